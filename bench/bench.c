@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "bench.h"
+
+#define BENCH_MAX_REPETITIONS 1001
+
+static int cycles_counted = -1; // 1 with the kernel's cycles, 0 user space only, -1 no counter
+static volatile uint64_t bench_sink;
+
+/**
+ * @brief Opens a CPU cycle counter for this thread.
+ *
+ * @param exclude_kernel Whether to leave out the cycles spent in the kernel (system calls).
+ * @return Returns the counter, or -1 where there are no hardware counters (VMs, containers).
+ */
+static int open_cycles(int exclude_kernel)
+{
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+    attributes.disabled = 1;
+    attributes.exclude_kernel = exclude_kernel;
+    attributes.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+/**
+ * @brief Parses the options common to the benchmarks, pins the process to the CPU it is on
+ * and finds out which cycles can be counted.
+ *
+ * usage: [-r repetitions] [-o operations] [-f filter] [-q]
+ *
+ * @param config Where to store the options.
+ * @return Returns 0 on success, -1 (after printing the usage) for bad options.
+ */
+int bench_configure(struct bench_Config *config, int argc, char **argv)
+{
+    int option;
+    memset(config, 0, sizeof(*config));
+    config->repetitions = BENCH_DEFAULT_REPETITIONS;
+    while ((option = getopt(argc, argv, "r:o:f:q")) != -1)
+    {
+        switch (option)
+        {
+            case 'r':
+                config->repetitions = strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                config->operations = strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                config->filter = optarg;
+                break;
+            case 'q':
+                config->quiet = 1;
+                break;
+            default:
+                config->repetitions = 0;
+        }
+    }
+    if ((config->repetitions == 0) || (config->repetitions > BENCH_MAX_REPETITIONS) || (optind != argc))
+    {
+        fprintf(stderr, "usage: %s [-r repetitions] [-o operations_per_repetition] [-f name_filter] [-q]\n", argv[0]);
+        return -1;
+    }
+
+    /* Migrating in the middle of a repetition costs more than most of the tests */
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+
+    for (int exclude_kernel = 0; (exclude_kernel <= 1) && (cycles_counted < 0); exclude_kernel++)
+    {
+        int counter = open_cycles(exclude_kernel);
+        if (counter >= 0)
+        {
+            cycles_counted = !exclude_kernel;
+            close(counter);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints the comment line describing the run and the CSV header, unless quiet.
+ */
+void bench_print_header(const struct bench_Config *config)
+{
+    if (config->quiet)
+    {
+        return;
+    }
+    printf("# %u repetitions after %u warmup, cycles: %s\n", config->repetitions, BENCH_WARMUP_REPETITIONS,
+           (cycles_counted > 0) ? "user+kernel" : (cycles_counted == 0) ? "user only" : "n/a");
+    printf("suite,test,ns_per_op_median,ns_per_op_min,ns_per_op_max,cycles_per_op,ns_per_byte\n");
+}
+
+/**
+ * @brief Runs one repetition of a test.
+ *
+ * @return Returns how long it took, in nanoseconds.
+ */
+static uint64_t run_repetition(bench_Test test, void *state, uint64_t operations)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bench_sink += test(state, operations);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double difference = *(const double *)a - *(const double *)b;
+    return (difference > 0) - (difference < 0);
+}
+
+/**
+ * @brief Warms up, calibrates and times one test, and prints its line of results.
+ *
+ * @param config The options.
+ * @param suite The program the functions under test come from ("rsend" or "rrecv").
+ * @param name The name of the test.
+ * @param test The test.
+ * @param state Passed to the test.
+ * @param bytes_per_operation The bytes each operation moves, or 0 when that means nothing.
+ */
+void bench_run(const struct bench_Config *config, const char *suite, const char *name,
+               bench_Test test, void *state, uint32_t bytes_per_operation)
+{
+    if ((config->filter != NULL) && (strstr(name, config->filter) == NULL))
+    {
+        return;
+    }
+
+    uint64_t operations = (config->operations > 0) ? config->operations : 1;
+    for (unsigned int i = 0; i < BENCH_WARMUP_REPETITIONS; i++)
+    {
+        run_repetition(test, state, operations);
+    }
+    while ((config->operations == 0) && (run_repetition(test, state, operations) < BENCH_MIN_REP_NS))
+    {
+        operations *= 2;
+    }
+
+    double ns_per_operation[BENCH_MAX_REPETITIONS];
+    int counter = (cycles_counted >= 0) ? open_cycles(!cycles_counted) : -1;
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    for (unsigned int i = 0; i < config->repetitions; i++)
+    {
+        ns_per_operation[i] = (double)run_repetition(test, state, operations) / operations;
+    }
+    long long int cycles = -1;
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &cycles, sizeof(cycles)) != sizeof(cycles))
+        {
+            cycles = -1;
+        }
+        close(counter);
+    }
+    qsort(ns_per_operation, config->repetitions, sizeof(double), compare_doubles);
+
+    double median = ns_per_operation[config->repetitions / 2];
+    printf("%s,%s,%.2f,%.2f,%.2f,", suite, name, median, ns_per_operation[0], ns_per_operation[config->repetitions - 1]);
+    if (cycles >= 0)
+    {
+        printf("%.1f,", (double)cycles / ((double)operations * config->repetitions));
+    }
+    else
+    {
+        printf("n/a,");
+    }
+    if (bytes_per_operation > 0)
+    {
+        printf("%.4f\n", median / bytes_per_operation);
+    }
+    else
+    {
+        printf("n/a\n");
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,43 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+/*
+ * A small harness for microbenchmarks of the per-packet code (bench/hotpath_*.c).
+ *
+ * A test is a function that does a given number of operations, one operation being a call
+ * of the function under test with realistic arguments (a segment built, an ACK number
+ * checked, a segment stored). Each test is warmed up, the operations per repetition are
+ * doubled until a repetition takes BENCH_MIN_REP_NS, and then it is timed over the
+ * repetitions. Every test prints one CSV line: the median, fastest and slowest nanoseconds
+ * per operation, CPU cycles per operation where hardware counters are available, and
+ * nanoseconds per byte for tests that move data. The lines hold no times of day or counts
+ * that change from run to run, so results of two commits can be diffed line by line
+ * (bench/compare.sh).
+ */
+
+#define BENCH_DEFAULT_REPETITIONS 11
+#define BENCH_WARMUP_REPETITIONS 2
+#define BENCH_MIN_REP_NS 20000000ULL // Operations per repetition are doubled until one takes this long
+
+/*
+ * Does operations operations of a test and returns something computed from their results,
+ * so the compiler cannot leave the work out.
+ */
+typedef uint64_t (*bench_Test)(void *state, uint64_t operations);
+
+struct bench_Config
+{
+    unsigned int repetitions;
+    uint64_t operations; // Per repetition; 0 to calibrate each test
+    const char *filter;  // Runs only tests whose name contains it, if not NULL
+    uint8_t quiet;       // Leaves out the header lines
+};
+
+int bench_configure(struct bench_Config *config, int argc, char **argv);
+void bench_print_header(const struct bench_Config *config);
+void bench_run(const struct bench_Config *config, const char *suite, const char *name,
+               bench_Test test, void *state, uint32_t bytes_per_operation);
+
+#endif
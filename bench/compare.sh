@@ -0,0 +1,26 @@
+#!/bin/sh
+# Compares two runs of make bench, test by test.
+# usage: bench/compare.sh before.csv after.csv   (each saved with make bench > file)
+#
+# Prints each test's median ns per operation in both runs and the change. Tests only in one
+# of the runs are listed with the other side empty.
+
+if [ $# -ne 2 ]; then
+    echo "usage: $0 before.csv after.csv" >&2
+    exit 1
+fi
+
+awk -F, '
+    /^#/ || $1 == "suite" || NF < 7 { next }
+    FNR == NR { before[$1 "," $2] = $3; order[++count] = $1 "," $2; next }
+    { after[$1 "," $2] = $3; if (!($1 "," $2 in before)) order[++count] = $1 "," $2 }
+    END {
+        print "suite,test,before_ns_per_op,after_ns_per_op,change_percent"
+        for (i = 1; i <= count; i++) {
+            test = order[i]
+            if ((test in before) && (test in after) && (before[test] > 0))
+                printf "%s,%s,%s,%+.1f\n", test, before[test], after[test], (after[test] - before[test]) * 100 / before[test]
+            else
+                printf "%s,%s,%s,\n", test, before[test], after[test]
+        }
+    }' "$1" "$2"
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Goodput vs. simulated loss with FEC off and on, over loopback.
+# usage: bench/fec_goodput.sh [bytes] [port]   (run from the repo root after make)
+
+BYTES=${1:-4000000}
+PORT=${2:-9400}
+INPUT=$(mktemp)
+OUTPUT=$(mktemp)
+trap 'rm -f "$INPUT" "$OUTPUT"' EXIT
+
+head -c "$BYTES" /dev/urandom > "$INPUT"
+
+echo "loss_percent,fec,goodput_mbit_s,intact"
+for LOSS in 0 1 2 5 10; do
+    for FEC in off on; do
+        FLAG=""
+        [ "$FEC" = on ] && FLAG="-f"
+
+        ./rrecv "$PORT" "$OUTPUT" > /dev/null &
+        RECEIVER=$!
+        sleep 0.2
+        GOODPUT=$(./rsend $FLAG -L "$LOSS" 127.0.0.1 "$PORT" "$INPUT" "$BYTES" | sed -n 's/.*goodput \([0-9.]*\).*/\1/p')
+        wait "$RECEIVER"
+
+        INTACT=yes
+        cmp -s "$INPUT" "$OUTPUT" || INTACT=no
+        echo "$LOSS,$FEC,$GOODPUT,$INTACT"
+        PORT=$((PORT + 1))
+    done
+done
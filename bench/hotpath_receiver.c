@@ -0,0 +1,269 @@
+/*
+ * Microbenchmarks of rrecv's per-packet code.
+ * usage: bench/hotpath_receiver [-r repetitions] [-o operations] [-f filter] [-q]   (built and run by make bench)
+ *
+ * receiver.c is compiled into this program, so the tests call the very functions rrecv runs,
+ * static state and all. Each test sets up that state the way a transfer in progress would
+ * have it, then calls one function over and over:
+ *   is_duplicate                on a mix of numbers in and around the window, with the window
+ *                               in the middle of the sequence space and across its wrap
+ *   add_data_to_buffer_*        one operation per segment stored at its place in the window:
+ *                               the reassembly buffer, the sink (sparse writes, extents and
+ *                               the stream digest), and the sink checking every byte (-v)
+ *   receive_data_*              one operation per in-order segment going through everything
+ *                               Wait_for_Pipeline does with it: storing it and, every
+ *                               ack_frequency segments, send_ack() with its flush of the
+ *                               in-order bytes and the send() of the ACK to a local socket
+ *                               that is never read
+ *   process_batch_*             the same, one operation per segment of batches of in-order
+ *                               segments as recvmmsg() leaves them (see batch.h): classifying
+ *                               the headers, then storing each run of segments up to the next
+ *                               ACK with one copy
+ */
+#define _GNU_SOURCE
+#define main rrecv_main
+#include "receiver.c"
+#undef main
+#include "bench.h"
+
+#define BENCH_INPUTS 4096 // Arguments cycled through, a power of two
+#define BENCH_SEGMENTS (MAX_SPARSE_WINDOW_SIZE / PACKET_SIZE)
+#define BENCH_ACK_FREQUENCY 4 // What rsend asks for unless told otherwise
+#define BENCH_BATCH BATCH_DEFAULT_DATAGRAMS
+
+struct receiver_bench
+{
+    uint32_t inputs[BENCH_INPUTS];
+    struct protocol_Packet packets[BENCH_SEGMENTS];
+    uint32_t segments; // In the window
+};
+
+/**
+ * @brief Sets up the window at a sequence number, with nothing received yet.
+ *
+ * @param front The sequence number and stream offset of the first byte needed.
+ * @param size The window size.
+ * @param sparse Whether segments go to the sink rather than the reassembly buffer.
+ */
+static void set_window(struct receiver_bench *bench, uint32_t front, uint32_t size, uint8_t sparse)
+{
+    committed_offset = front;
+    digest_offset = front;
+    stream_digest = 0;
+    receive_window_size = size;
+    sparse_writes = sparse;
+    sink_enabled = sparse;
+    extent_count = 0;
+    memset(buffered_valid, 0, MAX_WINDOW_SIZE);
+    setup_recv_window();
+    receiver_current_state = Wait_for_Packet;
+    bench->segments = size / PROTOCOL_DATA_SIZE;
+    for (uint32_t i = 0; i < bench->segments; i++)
+    {
+        bench->packets[i].header.seq_ack_num = front + i * PROTOCOL_DATA_SIZE;
+        bench->packets[i].header.bytes_of_data = PROTOCOL_DATA_SIZE;
+        bench->packets[i].header.management_byte = 0;
+        synthetic_fill(Synthetic_Pattern, bench->packets[i].data, PROTOCOL_DATA_SIZE, front + i * PROTOCOL_DATA_SIZE);
+    }
+}
+
+/**
+ * @brief Fills the inputs with sequence numbers spread from half a window before the
+ * window to half a window past it.
+ */
+static void fill_inputs(struct receiver_bench *bench)
+{
+    uint64_t seed = 1;
+    for (unsigned int i = 0; i < BENCH_INPUTS; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        bench->inputs[i] = next_needed_seq_num - receive_window_size / 2 + (uint32_t)((seed >> 33) % (2 * receive_window_size));
+    }
+}
+
+static uint64_t test_is_duplicate(void *state, uint64_t operations)
+{
+    struct receiver_bench *bench = state;
+    uint64_t duplicates = 0;
+    for (uint64_t i = 0; i < operations; i++)
+    {
+        duplicates += is_duplicate(bench->inputs[i % BENCH_INPUTS]);
+    }
+    return duplicates;
+}
+
+/**
+ * @brief Stores the segments of the window in order, over and over. In the sink the
+ * extents and the digest start again with each pass, so each pass costs what the first did.
+ */
+static uint64_t test_add_data_to_buffer(void *state, uint64_t operations)
+{
+    struct receiver_bench *bench = state;
+    for (uint64_t i = 0; i < operations; i++)
+    {
+        uint32_t segment = i % bench->segments;
+        if (sparse_writes && (segment == 0))
+        {
+            extent_count = 0;
+            digest_offset = committed_offset;
+        }
+        add_data_to_buffer(bench->packets[segment].header.seq_ack_num, bench->packets[segment].data, PROTOCOL_DATA_SIZE);
+    }
+    return stream_digest + extent_count + buffered_valid[0];
+}
+
+/**
+ * @brief Receives the stream in order, one segment after another.
+ */
+static uint64_t test_receive_data(void *state, uint64_t operations)
+{
+    struct receiver_bench *bench = state;
+    for (uint64_t i = 0; i < operations; i++)
+    {
+        struct protocol_Packet *packet = &bench->packets[i % bench->segments];
+        packet->header.seq_ack_num = next_needed_seq_num + contiguous_length;
+        receive_data(packet, sizeof(struct protocol_Header) + PROTOCOL_DATA_SIZE);
+        if (receiver_current_state == Finished)
+        {
+            fprintf(stderr, "Receiving failed\n");
+            exit(1);
+        }
+    }
+    return stream_digest + acks_sent;
+}
+
+/**
+ * @brief Receives the stream in order, a batch of segments at a time.
+ */
+static uint64_t test_process_batch(void *state, uint64_t operations)
+{
+    (void)state;
+    while (operations > 0)
+    {
+        batch.count = (operations < BENCH_BATCH) ? operations : BENCH_BATCH;
+        uint32_t seq_num = next_needed_seq_num + contiguous_length;
+        for (unsigned int i = 0; i < batch.count; i++)
+        {
+            batch.headers[i].seq_ack_num = seq_num + i * PROTOCOL_DATA_SIZE;
+            batch.lengths[i] = sizeof(struct protocol_Header) + PROTOCOL_DATA_SIZE;
+        }
+        process_batch();
+        if (receiver_current_state == Finished)
+        {
+            fprintf(stderr, "Receiving failed\n");
+            exit(1);
+        }
+        operations -= batch.count;
+    }
+    return stream_digest + acks_sent;
+}
+
+/**
+ * @brief Fills a batch with full data segments, as recvmmsg() would leave them.
+ */
+static void fill_batch(void)
+{
+    for (unsigned int i = 0; i < batch.capacity; i++)
+    {
+        memset(&batch.headers[i], 0, sizeof(batch.headers[i]));
+        batch.headers[i].bytes_of_data = PROTOCOL_DATA_SIZE;
+        synthetic_fill(Synthetic_Pattern, batch_payload(&batch, i), PROTOCOL_DATA_SIZE, i * PROTOCOL_DATA_SIZE);
+    }
+}
+
+/**
+ * @brief Opens a socket on loopback that nobody reads, and connects rrecv's socket to it.
+ *
+ * Once its receive buffer is full the kernel drops what arrives, so ACKs never block.
+ *
+ * @return Returns the unread socket, or -1 on failure.
+ */
+static int setup_bench_socket(void)
+{
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int unread = socket(AF_INET, SOCK_DGRAM, 0);
+    receiver_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((unread < 0) || (receiver_socket < 0) || (bind(unread, (struct sockaddr *)&address, sizeof(address)) < 0) ||
+        (getsockname(unread, (struct sockaddr *)&address, &address_length) < 0) ||
+        (connect(receiver_socket, (struct sockaddr *)&address, sizeof(address)) < 0))
+    {
+        perror("Error setting up the benchmark socket");
+        return -1;
+    }
+    return unread;
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_Config config;
+    if (bench_configure(&config, argc, argv) < 0)
+    {
+        return 1;
+    }
+    struct receiver_bench *bench = calloc(1, sizeof(*bench));
+    int unread = setup_bench_socket();
+    buffered_bytes = malloc(MAX_WINDOW_SIZE);
+    buffered_valid = calloc(MAX_WINDOW_SIZE, sizeof(uint8_t));
+    parity_slots = calloc(MAX_SPARSE_WINDOW_SIZE / PACKET_SIZE, sizeof(struct parity_slot));
+    sink_bytes = malloc(MAX_SPARSE_WINDOW_SIZE);
+    receiver_file = fopen("/dev/null", "wb");
+    if ((bench == NULL) || (unread < 0) || (buffered_bytes == NULL) || (buffered_valid == NULL) ||
+        (parity_slots == NULL) || (sink_bytes == NULL) || (receiver_file == NULL) || (batch_init(&batch, BENCH_BATCH) < 0))
+    {
+        perror("Error setting up the benchmark");
+        return 1;
+    }
+    bench_print_header(&config);
+
+    /* A transfer in progress, with no end in sight */
+    ack_frequency = BENCH_ACK_FREQUENCY;
+    socket_window_size = MAX_SPARSE_WINDOW_SIZE;
+
+    set_window(bench, 0x40000000, MAX_WINDOW_SIZE, 0);
+    fill_inputs(bench);
+    bench_run(&config, "rrecv", "is_duplicate", test_is_duplicate, bench, 0);
+    set_window(bench, UINT32_MAX - MAX_WINDOW_SIZE / 2, MAX_WINDOW_SIZE, 0);
+    fill_inputs(bench);
+    bench_run(&config, "rrecv", "is_duplicate_wrapped", test_is_duplicate, bench, 0);
+
+    set_window(bench, 0, MAX_WINDOW_SIZE, 0);
+    bench_run(&config, "rrecv", "add_data_to_buffer_reassembly", test_add_data_to_buffer, bench, PROTOCOL_DATA_SIZE);
+    set_window(bench, 0, MAX_SPARSE_WINDOW_SIZE, 1);
+    bench_run(&config, "rrecv", "add_data_to_buffer_sink", test_add_data_to_buffer, bench, PROTOCOL_DATA_SIZE);
+    set_window(bench, 0, MAX_SPARSE_WINDOW_SIZE, 1);
+    verify_enabled = 1;
+    generated_kind = Synthetic_Pattern;
+    bench_run(&config, "rrecv", "add_data_to_buffer_verify", test_add_data_to_buffer, bench, PROTOCOL_DATA_SIZE);
+    if (mismatched_bytes > 0)
+    {
+        fprintf(stderr, "The verify sink found %llu bytes that differ\n", mismatched_bytes);
+        return 1;
+    }
+    verify_enabled = 0;
+
+    set_window(bench, 0, MAX_WINDOW_SIZE, 0);
+    bench_run(&config, "rrecv", "receive_data_reassembly", test_receive_data, bench, PROTOCOL_DATA_SIZE);
+    set_window(bench, 0, MAX_SPARSE_WINDOW_SIZE, 1);
+    bench_run(&config, "rrecv", "receive_data_sink", test_receive_data, bench, PROTOCOL_DATA_SIZE);
+
+    fill_batch();
+    set_window(bench, 0, MAX_WINDOW_SIZE, 0);
+    bench_run(&config, "rrecv", "process_batch_reassembly", test_process_batch, bench, PROTOCOL_DATA_SIZE);
+    set_window(bench, 0, MAX_SPARSE_WINDOW_SIZE, 1);
+    bench_run(&config, "rrecv", "process_batch_sink", test_process_batch, bench, PROTOCOL_DATA_SIZE);
+
+    batch_free(&batch);
+    fclose(receiver_file);
+    close(receiver_socket);
+    close(unread);
+    free(sink_bytes);
+    free(parity_slots);
+    free(buffered_valid);
+    free(buffered_bytes);
+    free(bench);
+    return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * Microbenchmarks of rsend's per-packet code.
+ * usage: bench/hotpath_sender [-r repetitions] [-o operations] [-f filter] [-q]   (built and run by make bench)
+ *
+ * sender.c is compiled into this program, so the tests call the very functions rsend runs,
+ * static state and all. Each test sets up that state the way a transfer in progress would
+ * have it, then calls one function over and over:
+ *   valid_ack_num, sending_index_in_range  on a mix of numbers in and around the window,
+ *                                          with the window in the middle of the sequence
+ *                                          space and across its wrap
+ *   send_segment_*                         one operation per segment: header, read (generated
+ *                                          data or a file in the page cache), stream digest,
+ *                                          checksum; simulated loss drops it before send()
+ *   send_n_packets_syscall                 one operation per segment of whole windows sent
+ *                                          by sender_action_Send_N_Packets() to a local socket
+ *                                          that is never read
+ *   send_n_packets_zerocopy                the same with rsend -z: runs of up to 32 segments
+ *                                          per sendmsg() with UDP segmentation, zero-copy
+ *                                          (the kernel copies anyway on loopback); skipped
+ *                                          where the kernel has neither
+ */
+#define _GNU_SOURCE
+#define main rsend_main
+#include "sender.c"
+#undef main
+#include "bench.h"
+
+#define BENCH_INPUTS 4096 // Arguments cycled through, a power of two
+#define BENCH_FILE_BYTES (16 * 1024 * 1024)
+
+struct sender_bench
+{
+    uint32_t inputs[BENCH_INPUTS];
+    struct protocol_Packet packet;
+    unsigned long long int stream_bytes;
+};
+
+/**
+ * @brief Puts the window at a sequence number, with all of it sent and nothing acknowledged.
+ */
+static void set_window(uint32_t front, uint32_t size)
+{
+    current_window_size = size;
+    in_Flight[0] = front;
+    in_Flight[1] = front + (size - 1);
+    next_to_send = front;
+    highest_sent = front + size;
+    file_offset_for_sending = 0;
+}
+
+/**
+ * @brief Fills the inputs with sequence numbers spread from half a window before the
+ * window to half a window past it, so about half of them are in it.
+ */
+static void fill_inputs(struct sender_bench *bench)
+{
+    uint64_t seed = 1;
+    for (unsigned int i = 0; i < BENCH_INPUTS; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        bench->inputs[i] = in_Flight[0] - current_window_size / 2 + (uint32_t)((seed >> 33) % (2 * current_window_size));
+    }
+}
+
+static uint64_t test_valid_ack_num(void *state, uint64_t operations)
+{
+    struct sender_bench *bench = state;
+    uint64_t valid = 0;
+    for (uint64_t i = 0; i < operations; i++)
+    {
+        valid += valid_ack_num(bench->inputs[i % BENCH_INPUTS]);
+    }
+    return valid;
+}
+
+static uint64_t test_sending_index_in_range(void *state, uint64_t operations)
+{
+    struct sender_bench *bench = state;
+    uint64_t in_range = 0;
+    for (uint64_t i = 0; i < operations; i++)
+    {
+        in_range += sending_index_in_range(bench->inputs[i % BENCH_INPUTS]);
+    }
+    return in_range;
+}
+
+/**
+ * @brief Builds segments one after another, each window of them from the next part of
+ * the stream, so every byte read is also new to the stream digest.
+ */
+static uint64_t test_send_segment(void *state, uint64_t operations)
+{
+    struct sender_bench *bench = state;
+    uint32_t segments = current_window_size / PROTOCOL_DATA_SIZE;
+    uint64_t sent = 0;
+    for (uint64_t i = 0; i < operations; i++)
+    {
+        uint32_t segment = i % segments;
+        if (segment == 0)
+        {
+            file_offset_for_sending = (file_offset_for_sending + current_window_size) % (bench->stream_bytes - current_window_size);
+            digest_offset = file_offset_for_sending;
+        }
+        sent += send_segment(&bench->packet, in_Flight[0] + segment * PROTOCOL_DATA_SIZE, segment == segments - 1);
+    }
+    return sent + stream_digest;
+}
+
+/**
+ * @brief Sends whole windows with sender_action_Send_N_Packets(), the last one cut short
+ * so exactly the given number of segments is sent.
+ */
+static uint64_t test_send_n_packets(void *state, uint64_t operations)
+{
+    struct sender_bench *bench = state;
+    uint32_t front = in_Flight[0];
+    while (operations > 0)
+    {
+        uint64_t segments = (operations < MAX_WINDOW_SIZE / PROTOCOL_DATA_SIZE) ? operations : MAX_WINDOW_SIZE / PROTOCOL_DATA_SIZE;
+        file_offset_for_sending = (file_offset_for_sending + MAX_WINDOW_SIZE) % (bench->stream_bytes - MAX_WINDOW_SIZE);
+        digest_offset = file_offset_for_sending;
+        in_Flight[1] = front + segments * PROTOCOL_DATA_SIZE - 1;
+        next_to_send = front;
+        sender_current_state = Send_N_Packets;
+        sender_action_Send_N_Packets();
+        if (sender_current_state == sender_Done)
+        {
+            fprintf(stderr, "Sending failed\n");
+            exit(1);
+        }
+        operations -= segments;
+    }
+    in_Flight[1] = front + MAX_WINDOW_SIZE - 1;
+    return packets_sent + stream_digest;
+}
+
+/**
+ * @brief Opens a socket on loopback that nobody reads, and connects rsend's socket to it.
+ *
+ * Once its receive buffer is full the kernel drops what arrives, so sends never block.
+ *
+ * @return Returns the unread socket, or -1 on failure.
+ */
+static int setup_bench_socket(void)
+{
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int unread = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((unread < 0) || (bind(unread, (struct sockaddr *)&address, sizeof(address)) < 0) ||
+        (getsockname(unread, (struct sockaddr *)&address, &address_length) < 0))
+    {
+        perror("Error setting up the benchmark socket");
+        return -1;
+    }
+    return (setup_socket("127.0.0.1", ntohs(address.sin_port)) < 0) ? -1 : unread;
+}
+
+/**
+ * @brief Makes a file of generated data to read segments from, left in the page cache.
+ *
+ * @return Returns the file, unlinked already, or NULL on failure.
+ */
+static FILE *make_bench_file(void)
+{
+    char path[] = "/tmp/hotpath_sender.XXXXXX";
+    char chunk[64 * 1024];
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror("Error creating the benchmark file");
+        return NULL;
+    }
+    unlink(path);
+    for (unsigned long long int offset = 0; offset < BENCH_FILE_BYTES; offset += sizeof(chunk))
+    {
+        synthetic_fill(Synthetic_Random, chunk, sizeof(chunk), offset);
+        if (write(fd, chunk, sizeof(chunk)) != (ssize_t)sizeof(chunk))
+        {
+            perror("Error writing the benchmark file");
+            close(fd);
+            return NULL;
+        }
+    }
+    return fdopen(fd, "rb");
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_Config config;
+    if (bench_configure(&config, argc, argv) < 0)
+    {
+        return 1;
+    }
+    struct sender_bench *bench = calloc(1, sizeof(*bench));
+    int unread = setup_bench_socket();
+    FILE *file = make_bench_file();
+    if ((bench == NULL) || (unread < 0) || (file == NULL))
+    {
+        return 1;
+    }
+    bench_print_header(&config);
+
+    /* A transfer in progress: plenty left to send, an RTT sample already running */
+    max_window_size = MAX_WINDOW_SIZE;
+    bytes_left_to_send = 1ULL << 40;
+    timer_valid = 1;
+    ack_frequency = ACK_FREQUENCY_DEFAULT;
+    srand48(1);
+
+    set_window(0x40000000, MAX_WINDOW_SIZE);
+    fill_inputs(bench);
+    bench_run(&config, "rsend", "valid_ack_num", test_valid_ack_num, bench, 0);
+    bench_run(&config, "rsend", "sending_index_in_range", test_sending_index_in_range, bench, 0);
+    set_window(UINT32_MAX - MAX_WINDOW_SIZE / 2, MAX_WINDOW_SIZE);
+    fill_inputs(bench);
+    bench_run(&config, "rsend", "valid_ack_num_wrapped", test_valid_ack_num, bench, 0);
+    bench_run(&config, "rsend", "sending_index_in_range_wrapped", test_sending_index_in_range, bench, 0);
+
+    /* Segments dropped by simulated loss, so everything but the send() is measured */
+    set_window(0x40000000, MAX_WINDOW_SIZE);
+    simulated_loss_percent = 100;
+    generated_kind = Synthetic_Pattern;
+    bench->stream_bytes = BENCH_FILE_BYTES;
+    bench_run(&config, "rsend", "send_segment_generated", test_send_segment, bench, PROTOCOL_DATA_SIZE);
+    generated_kind = Synthetic_None;
+    file_pointer = file;
+    bench_run(&config, "rsend", "send_segment_file", test_send_segment, bench, PROTOCOL_DATA_SIZE);
+
+    simulated_loss_percent = 0;
+    bench_run(&config, "rsend", "send_n_packets_syscall", test_send_n_packets, bench, PROTOCOL_DATA_SIZE);
+    zerocopy_active = (zerocopy_init(&zerocopy, sockfd) == 0);
+    if (zerocopy_active)
+    {
+        bench_run(&config, "rsend", "send_n_packets_zerocopy", test_send_n_packets, bench, PROTOCOL_DATA_SIZE);
+        zerocopy_close(&zerocopy);
+        zerocopy_active = 0;
+    }
+
+    fclose(file);
+    close(unread);
+    close(sockfd);
+    free(bench);
+    return 0;
+}
@@ -0,0 +1,379 @@
+/*
+ * Throughput and cache misses of the handoff rings and the buffer pool.
+ * usage: bench/ring_bench [operations]   (built and run by make bench-ring)
+ *
+ * Every test passes descriptors from producer threads to one consumer thread and reports
+ * operations per second and, where the kernel exposes hardware counters, cache misses and
+ * references per operation (user space only). Two baselines put the numbers in context:
+ * a ring whose indexes share a cache line and are re-read on every operation, and a queue
+ * behind a mutex. The pool tests move packet-sized buffers through a ring the way rsend -T
+ * and rrecv -T do, against malloc() and free().
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "our_protocol.h"
+#include "ring.h"
+#include "pool.h"
+
+#define DEFAULT_OPERATIONS 4000000
+#define RING_SLOTS 1024
+#define POOL_BUFFERS (4 * MAX_SPARSE_WINDOW_SIZE / PACKET_SIZE)
+#define MAX_PRODUCERS 4
+
+/* Ring with both indexes on one cache line and no cached copies, to show what padding saves */
+struct shared_line_ring
+{
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    struct ring_Descriptor slots[RING_SLOTS];
+};
+
+/* Ring behind a mutex */
+struct locked_ring
+{
+    pthread_mutex_t lock;
+    uint64_t head;
+    uint64_t tail;
+    struct ring_Descriptor slots[RING_SLOTS];
+};
+
+enum bench_kind
+{
+    Bench_Spsc,
+    Bench_Shared_Line,
+    Bench_Locked,
+    Bench_Mpsc,
+    Bench_Pool,
+    Bench_Malloc
+};
+
+struct bench_run
+{
+    enum bench_kind kind;
+    unsigned int producers;
+    uint64_t operations;
+    struct ring_Spsc spsc;
+    struct ring_Mpsc mpsc;
+    struct shared_line_ring *shared_line;
+    struct locked_ring *locked;
+    struct pool_Pool pool;
+};
+
+struct producer_argument
+{
+    struct bench_run *run;
+    uint64_t operations;
+};
+
+/**
+ * @brief Adds a descriptor to the ring under test, waiting while it is full.
+ */
+static void bench_push(struct bench_run *run, const struct ring_Descriptor *descriptor)
+{
+    while (1)
+    {
+        switch (run->kind)
+        {
+            case Bench_Mpsc:
+                if (ring_mpsc_push(&run->mpsc, descriptor))
+                {
+                    return;
+                }
+                break;
+            case Bench_Shared_Line:
+            {
+                uint64_t tail = atomic_load(&run->shared_line->tail);
+                if (tail - atomic_load(&run->shared_line->head) < RING_SLOTS)
+                {
+                    run->shared_line->slots[tail % RING_SLOTS] = *descriptor;
+                    atomic_store(&run->shared_line->tail, tail + 1);
+                    return;
+                }
+                break;
+            }
+            case Bench_Locked:
+            {
+                int pushed = 0;
+                pthread_mutex_lock(&run->locked->lock);
+                if (run->locked->tail - run->locked->head < RING_SLOTS)
+                {
+                    run->locked->slots[run->locked->tail++ % RING_SLOTS] = *descriptor;
+                    pushed = 1;
+                }
+                pthread_mutex_unlock(&run->locked->lock);
+                if (pushed)
+                {
+                    return;
+                }
+                break;
+            }
+            default:
+                if (ring_spsc_push(&run->spsc, descriptor))
+                {
+                    return;
+                }
+        }
+        sched_yield();
+    }
+}
+
+/**
+ * @brief Takes a descriptor from the ring under test, waiting while it is empty.
+ */
+static void bench_pop(struct bench_run *run, struct ring_Descriptor *descriptor)
+{
+    while (1)
+    {
+        switch (run->kind)
+        {
+            case Bench_Mpsc:
+                if (ring_mpsc_pop(&run->mpsc, descriptor))
+                {
+                    return;
+                }
+                break;
+            case Bench_Shared_Line:
+            {
+                uint64_t head = atomic_load(&run->shared_line->head);
+                if (head != atomic_load(&run->shared_line->tail))
+                {
+                    *descriptor = run->shared_line->slots[head % RING_SLOTS];
+                    atomic_store(&run->shared_line->head, head + 1);
+                    return;
+                }
+                break;
+            }
+            case Bench_Locked:
+            {
+                int popped = 0;
+                pthread_mutex_lock(&run->locked->lock);
+                if (run->locked->head != run->locked->tail)
+                {
+                    *descriptor = run->locked->slots[run->locked->head++ % RING_SLOTS];
+                    popped = 1;
+                }
+                pthread_mutex_unlock(&run->locked->lock);
+                if (popped)
+                {
+                    return;
+                }
+                break;
+            }
+            default:
+                if (ring_spsc_pop(&run->spsc, descriptor))
+                {
+                    return;
+                }
+        }
+        sched_yield();
+    }
+}
+
+/**
+ * @brief Producer thread: queues its share of the operations, with a buffer for the pool tests.
+ */
+static void *producer_main(void *argument)
+{
+    struct producer_argument *producer = argument;
+    struct bench_run *run = producer->run;
+    struct pool_Cache cache;
+    pool_cache_init(&cache, &run->pool);
+    unsigned int idle_rounds = 0;
+
+    for (uint64_t i = 0; i < producer->operations; i++)
+    {
+        struct ring_Descriptor descriptor = {NULL, i * PACKET_SIZE, PACKET_SIZE, 0};
+        if (run->kind == Bench_Pool)
+        {
+            while ((descriptor.data = pool_alloc(&cache)) == NULL)
+            {
+                ring_backoff(&idle_rounds);
+            }
+            idle_rounds = 0;
+            descriptor.data[0] = (char)i;
+        }
+        else if (run->kind == Bench_Malloc)
+        {
+            descriptor.data = malloc(PACKET_SIZE);
+            descriptor.data[0] = (char)i;
+        }
+        bench_push(run, &descriptor);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Consumer thread: takes every operation and gives back the buffers.
+ */
+static void *consumer_main(void *argument)
+{
+    struct bench_run *run = argument;
+    struct pool_Cache cache;
+    pool_cache_init(&cache, &run->pool);
+    uint64_t checksum = 0;
+
+    for (uint64_t i = 0; i < run->operations; i++)
+    {
+        struct ring_Descriptor descriptor;
+        bench_pop(run, &descriptor);
+        checksum += descriptor.stream_offset;
+        if (run->kind == Bench_Pool)
+        {
+            checksum += (unsigned char)descriptor.data[0];
+            pool_free(&cache, descriptor.data);
+        }
+        else if (run->kind == Bench_Malloc)
+        {
+            checksum += (unsigned char)descriptor.data[0];
+            free(descriptor.data);
+        }
+    }
+    pool_cache_flush(&cache);
+    return (void *)(uintptr_t)checksum;
+}
+
+/**
+ * @brief Opens a hardware cache counter for this process and the threads it starts.
+ *
+ * @param config PERF_COUNT_HW_CACHE_MISSES or PERF_COUNT_HW_CACHE_REFERENCES.
+ * @return Returns the counter, or -1 where there are no hardware counters (VMs, containers).
+ */
+static int open_counter(uint64_t config)
+{
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = config;
+    attributes.disabled = 1;
+    attributes.inherit = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+/**
+ * @brief Reads and closes a counter.
+ *
+ * @return Returns the count, or -1 if there is none.
+ */
+static long long int close_counter(int counter)
+{
+    long long int count = -1;
+    if (counter < 0)
+    {
+        return -1;
+    }
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter, &count, sizeof(count)) != sizeof(count))
+    {
+        count = -1;
+    }
+    close(counter);
+    return count;
+}
+
+/**
+ * @brief Runs one test and prints its line of results.
+ */
+static void run_bench(const char *name, enum bench_kind kind, unsigned int producers, uint64_t operations)
+{
+    struct bench_run *run = calloc(1, sizeof(*run));
+    run->kind = kind;
+    run->producers = producers;
+    run->operations = operations - operations % producers;
+    if ((ring_spsc_init(&run->spsc, RING_SLOTS) < 0) || (ring_mpsc_init(&run->mpsc, RING_SLOTS) < 0) ||
+        (pool_init(&run->pool, PACKET_SIZE, POOL_BUFFERS) < 0))
+    {
+        exit(1);
+    }
+    run->shared_line = calloc(1, sizeof(struct shared_line_ring));
+    run->locked = calloc(1, sizeof(struct locked_ring));
+    pthread_mutex_init(&run->locked->lock, NULL);
+
+    int misses = open_counter(PERF_COUNT_HW_CACHE_MISSES);
+    int references = open_counter(PERF_COUNT_HW_CACHE_REFERENCES);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (misses >= 0)
+    {
+        ioctl(misses, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    if (references >= 0)
+    {
+        ioctl(references, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    pthread_t consumer;
+    pthread_t producer_threads[MAX_PRODUCERS];
+    struct producer_argument arguments[MAX_PRODUCERS];
+    pthread_create(&consumer, NULL, consumer_main, run);
+    for (unsigned int i = 0; i < producers; i++)
+    {
+        arguments[i].run = run;
+        arguments[i].operations = run->operations / producers;
+        pthread_create(&producer_threads[i], NULL, producer_main, &arguments[i]);
+    }
+    for (unsigned int i = 0; i < producers; i++)
+    {
+        pthread_join(producer_threads[i], NULL);
+    }
+    pthread_join(consumer, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long int miss_count = close_counter(misses);
+    long long int reference_count = close_counter(references);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("%s,%u,%.0f,", name, producers, run->operations / seconds);
+    if (miss_count >= 0 && reference_count >= 0)
+    {
+        printf("%.3f,%.3f\n", (double)miss_count / run->operations, (double)reference_count / run->operations);
+    }
+    else
+    {
+        printf("n/a,n/a\n");
+    }
+
+    pthread_mutex_destroy(&run->locked->lock);
+    free(run->locked);
+    free(run->shared_line);
+    pool_destroy(&run->pool);
+    ring_mpsc_destroy(&run->mpsc);
+    ring_spsc_destroy(&run->spsc);
+    free(run);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t operations = (argc > 1) ? strtoull(argv[1], NULL, 10) : DEFAULT_OPERATIONS;
+    if (operations == 0)
+    {
+        fprintf(stderr, "usage: %s [operations]\n", argv[0]);
+        return 1;
+    }
+
+    printf("# %llu operations, %ld CPUs online\n", (unsigned long long int)operations, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("test,producers,ops_per_sec,cache_misses_per_op,cache_references_per_op\n");
+    run_bench("spsc", Bench_Spsc, 1, operations);
+    run_bench("spsc_shared_line", Bench_Shared_Line, 1, operations);
+    run_bench("mutex_queue", Bench_Locked, 1, operations);
+    for (unsigned int producers = 1; producers <= MAX_PRODUCERS; producers *= 2)
+    {
+        run_bench("mpsc", Bench_Mpsc, producers, operations);
+    }
+    run_bench("spsc_pool_buffers", Bench_Pool, 1, operations);
+    run_bench("spsc_malloc_buffers", Bench_Malloc, 1, operations);
+    return 0;
+}
@@ -0,0 +1,86 @@
+#!/bin/sh
+# Many concurrent sessions over loopback: aggregate goodput, fairness, completion times, CPU and memory.
+# usage: bench/scale_soak.sh [sessions] [bytes] [rounds] [port]   (run from the repo root after make)
+#
+# Every session is an rsend -g / rrecv -n pair on a port of its own, so no disk is involved.
+# RATE=100mbit puts one token bucket on lo that all sessions share (needs root and tc).
+# With rounds > 1 every receiver handles that many transfers in one process (rrecv -c), and
+# each round reports its CPU, peak RSS and open descriptors, so a leak in setting up or
+# tearing down a transfer shows as growth from round to round.
+
+SESSIONS=${1:-100}
+BYTES=${2:-1000000}
+ROUNDS=${3:-1}
+PORT=${4:-10000}
+WORK=$(mktemp -d)
+
+cleanup() {
+    [ -f "$WORK/receivers" ] && kill $(cat "$WORK/receivers") 2> /dev/null
+    [ -n "$RATE" ] && tc qdisc del dev lo root 2> /dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+if [ -n "$RATE" ] && ! tc qdisc replace dev lo root tbf rate "$RATE" burst 64kb limit 4mb; then
+    echo "Could not rate-limit lo" >&2
+    exit 1
+fi
+
+i=0
+while [ "$i" -lt "$SESSIONS" ]; do
+    ./rrecv -n -c "$ROUNDS" $((PORT + i)) > "$WORK/recv.$i" 2>&1 &
+    echo $! >> "$WORK/receivers"
+    i=$((i + 1))
+done
+sleep 1
+
+echo "round,sessions,completed,aggregate_mbit_s,jain_fairness,p50_s,p90_s,p99_s,max_s,send_cpu_s,recv_cpu_s,recv_peak_rss_kib,recv_rss_kib_total,recv_fds_total"
+ROUND=1
+while [ "$ROUND" -le "$ROUNDS" ]; do
+    START=$(date +%s%N)
+    SENDERS=""
+    i=0
+    while [ "$i" -lt "$SESSIONS" ]; do
+        ./rsend -g random 127.0.0.1 $((PORT + i)) "$BYTES" > "$WORK/send.$i" 2>&1 &
+        SENDERS="$SENDERS $!"
+        i=$((i + 1))
+    done
+    for SENDER in $SENDERS; do
+        wait "$SENDER"
+    done
+    END=$(date +%s%N)
+    sleep 0.2
+
+    # Resident memory and open descriptors of the receivers still running, summed; they exit
+    # after the last round.
+    RSS=0
+    FDS=0
+    for RECEIVER in $(cat "$WORK/receivers"); do
+        if [ -d "/proc/$RECEIVER/fd" ]; then
+            KIB=$(sed -n 's/^VmRSS:[[:space:]]*\([0-9]*\) kB/\1/p' "/proc/$RECEIVER/status" 2> /dev/null)
+            RSS=$((RSS + ${KIB:-0}))
+            FDS=$((FDS + $(ls "/proc/$RECEIVER/fd" 2> /dev/null | wc -l)))
+        fi
+    done
+
+    # Per session: completion time, goodput and CPU from rsend; this round's CPU and peak RSS from rrecv.
+    i=0
+    while [ "$i" -lt "$SESSIONS" ]; do
+        SEND=$(sed -n 's/^Transferred \([0-9]*\) bytes in \([0-9.]*\) s, goodput \([0-9.]*\).*/\1 \2 \3/p' "$WORK/send.$i")
+        SEND_CPU=$(sed -n 's/^Sent .* CPU \([0-9.]*\) s .*/\1/p' "$WORK/send.$i")
+        RECV=$(sed -n 's/^Received .* CPU \([0-9.]*\) s .*peak RSS \([0-9]*\) KiB.*/\1 \2/p' "$WORK/recv.$i" | sed -n "${ROUND}p")
+        grep -q "Integrity verified" "$WORK/send.$i" && echo "${SEND:-0 0 0} ${SEND_CPU:-0} ${RECV:-0 0}"
+        i=$((i + 1))
+    done | sort -n -k 2 | awk -v round="$ROUND" -v sessions="$SESSIONS" -v wall_ns=$((END - START)) -v rss_now="$RSS" -v fds="$FDS" '
+        { bytes += $1; time[NR] = $2; goodput += $3; squares += $3 * $3; send_cpu += $4; recv_cpu += $5; rss += $6 }
+        function percentile(p) { return time[int((NR - 1) * p) + 1] }
+        END {
+            if (NR == 0) { printf "%d,%d,0,,,,,,,,,,%d,%d\n", round, sessions, rss_now, fds; exit }
+            printf "%d,%d,%d,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.4f,%.4f,%.0f,%d,%d\n", round, sessions, NR,
+                   bytes * 8 / (wall_ns / 1e9) / 1e6, (squares > 0) ? goodput * goodput / (NR * squares) : 0,
+                   percentile(0.5), percentile(0.9), percentile(0.99), time[NR],
+                   send_cpu / NR, recv_cpu / NR, rss / NR, rss_now, fds
+        }'
+    ROUND=$((ROUND + 1))
+done
@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "batch.h"
+#include "checksum.h"
+#include "ecn.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define BATCH_SIMD "sse2"
+#elif defined(__ARM_NEON) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#include <arm_neon.h>
+#define BATCH_NEON
+#define BATCH_SIMD "neon"
+#else
+#define BATCH_SIMD "scalar"
+#endif
+
+#define BATCH_LANES 4 // Headers classified at a time, one per 32-bit lane of a 128-bit vector
+
+/* The vector code reads the fields straight out of four headers at a time, little-endian */
+_Static_assert(sizeof(struct protocol_Header) == 16, "protocol_Header must be 16 bytes");
+_Static_assert(offsetof(struct protocol_Header, seq_ack_num) == 4, "seq_ack_num must be the second word");
+_Static_assert(offsetof(struct protocol_Header, bytes_of_data) == 8, "bytes_of_data must start the third word");
+
+/**
+ * @brief Allocates a batch and points each datagram's iovecs at its header, data slot and tail.
+ *
+ * @param batch The batch.
+ * @param capacity Datagrams per recvmmsg(), rounded up to a multiple of 4, at most BATCH_MAX_DATAGRAMS.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int batch_init(struct batch_Receive *batch, unsigned int capacity)
+{
+    memset(batch, 0, sizeof(*batch));
+    capacity = (capacity + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES;
+    batch->capacity = (capacity > BATCH_MAX_DATAGRAMS) ? BATCH_MAX_DATAGRAMS : capacity;
+
+    batch->headers = aligned_alloc(16, batch->capacity * sizeof(struct protocol_Header));
+    batch->payloads = malloc((size_t)batch->capacity * PROTOCOL_DATA_SIZE);
+    batch->tails = malloc(batch->capacity * BATCH_TAIL_BYTES);
+    batch->lengths = aligned_alloc(16, batch->capacity * sizeof(uint32_t));
+    batch->offsets = calloc(batch->capacity, sizeof(uint32_t));
+    batch->order = calloc(batch->capacity, sizeof(uint16_t));
+    batch->fast = calloc(batch->capacity, sizeof(uint8_t));
+    batch->messages = calloc(batch->capacity, sizeof(struct mmsghdr));
+    batch->iovecs = calloc(3 * batch->capacity, sizeof(struct iovec));
+    if ((batch->headers == NULL) || (batch->payloads == NULL) || (batch->tails == NULL) || (batch->lengths == NULL) || (batch->offsets == NULL) ||
+        (batch->order == NULL) || (batch->fast == NULL) || (batch->messages == NULL) || (batch->iovecs == NULL))
+    {
+        perror("Failed to malloc for the receive batch");
+        batch_free(batch);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < batch->capacity; i++)
+    {
+        batch->iovecs[3 * i].iov_base = &batch->headers[i];
+        batch->iovecs[3 * i].iov_len = sizeof(struct protocol_Header);
+        batch->iovecs[3 * i + 1].iov_base = batch_payload(batch, i);
+        batch->iovecs[3 * i + 1].iov_len = PROTOCOL_DATA_SIZE;
+        batch->iovecs[3 * i + 2].iov_base = batch->tails + i * BATCH_TAIL_BYTES;
+        batch->iovecs[3 * i + 2].iov_len = BATCH_TAIL_BYTES;
+        batch->messages[i].msg_hdr.msg_iov = &batch->iovecs[3 * i];
+        batch->messages[i].msg_hdr.msg_iovlen = 3;
+    }
+    return 0;
+}
+
+/**
+ * @brief Gives each datagram of the batch room for its TOS byte, so its ECN field is read too.
+ *
+ * The socket needs ecn_enable_receive() as well.
+ *
+ * @param batch The batch.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int batch_enable_ecn(struct batch_Receive *batch)
+{
+    if (batch->controls != NULL)
+    {
+        return 0;
+    }
+    batch->controls = malloc(batch->capacity * ECN_CONTROL_SIZE); // Each one stays aligned for a cmsghdr
+    batch->codepoints = calloc(batch->capacity, sizeof(uint8_t));
+    if ((batch->controls == NULL) || (batch->codepoints == NULL))
+    {
+        perror("Failed to malloc for the receive batch");
+        free(batch->controls);
+        free(batch->codepoints);
+        batch->controls = NULL;
+        batch->codepoints = NULL;
+        return -1;
+    }
+    for (unsigned int i = 0; i < batch->capacity; i++)
+    {
+        batch->messages[i].msg_hdr.msg_control = batch->controls + i * ECN_CONTROL_SIZE;
+    }
+    return 0;
+}
+
+/**
+ * @brief Takes whatever datagrams are waiting, up to a batch, with one recvmmsg().
+ *
+ * @param batch The batch.
+ * @param fd The socket.
+ * @return Returns the number of datagrams, or -1 with errno set (EAGAIN if there are none).
+ */
+int batch_receive(struct batch_Receive *batch, int fd)
+{
+    batch->count = 0;
+    for (unsigned int i = 0; (batch->controls != NULL) && (i < batch->capacity); i++)
+    {
+        batch->messages[i].msg_hdr.msg_controllen = ECN_CONTROL_SIZE; // The kernel shrinks it to what it used
+    }
+    int received = recvmmsg(fd, batch->messages, batch->capacity, MSG_DONTWAIT, NULL);
+    if (received <= 0)
+    {
+        return received;
+    }
+    for (int i = 0; i < received; i++)
+    {
+        batch->lengths[i] = batch->messages[i].msg_len;
+        if (batch->controls != NULL)
+        {
+            batch->codepoints[i] = ecn_codepoint(&batch->messages[i].msg_hdr);
+        }
+    }
+    batch->count = received;
+    batch->calls++;
+    batch->datagrams += received;
+    return received;
+}
+
+/**
+ * @brief Marks the datagrams of the batch that are plain data segments inside the window,
+ * and puts each stretch of them that arrived one after another in stream order.
+ *
+ * A datagram is marked fast if it has no management bit set (so no SYNC, FIN, parity or
+ * ack-now), carries 1 to PROTOCOL_DATA_SIZE bytes and is long enough to hold them, and all of
+ * them lie inside the window. Datagrams of length 0 never are. order[] lists every datagram:
+ * the others keep their place in the arrival order, so they are still acted on between the
+ * same datagrams as they arrived between, and each stretch of fast ones between them is
+ * sorted by offset.
+ *
+ * @param batch The batch.
+ * @param window_start The sequence number at the front of the window.
+ * @param window_size The window size in bytes.
+ */
+void batch_classify(struct batch_Receive *batch, uint32_t window_start, uint32_t window_size)
+{
+    unsigned int groups = (batch->count + BATCH_LANES - 1) / BATCH_LANES;
+    for (unsigned int i = batch->count; i < groups * BATCH_LANES; i++)
+    {
+        batch->lengths[i] = 0; // The lanes past the last datagram never qualify
+    }
+
+    for (unsigned int group = 0; group < groups; group++)
+    {
+        unsigned int first = group * BATCH_LANES;
+        uint32_t offsets[BATCH_LANES];
+        unsigned int mask;
+#if defined(__SSE2__)
+        /* Transpose four headers into a vector per word: management byte, sequence number,
+         * data length. SSE2 only compares signed, so unsigned comparisons flip the sign bit. */
+        const __m128i *headers = (const __m128i *)&batch->headers[first];
+        __m128i h0 = _mm_load_si128(&headers[0]);
+        __m128i h1 = _mm_load_si128(&headers[1]);
+        __m128i h2 = _mm_load_si128(&headers[2]);
+        __m128i h3 = _mm_load_si128(&headers[3]);
+        __m128i low01 = _mm_unpacklo_epi32(h0, h1);
+        __m128i low23 = _mm_unpacklo_epi32(h2, h3);
+        __m128i high01 = _mm_unpackhi_epi32(h0, h1);
+        __m128i high23 = _mm_unpackhi_epi32(h2, h3);
+        __m128i management = _mm_and_si128(_mm_unpacklo_epi64(low01, low23), _mm_set1_epi32(0xff));
+        __m128i seqs = _mm_unpackhi_epi64(low01, low23);
+        __m128i bytes = _mm_and_si128(_mm_unpacklo_epi64(high01, high23), _mm_set1_epi32(0xffff));
+        __m128i lengths = _mm_load_si128((const __m128i *)&batch->lengths[first]);
+
+        const __m128i sign = _mm_set1_epi32((int)0x80000000);
+        const __m128i one = _mm_set1_epi32(1);
+        __m128i window = _mm_xor_si128(_mm_set1_epi32((int)window_size), sign);
+        __m128i offset = _mm_sub_epi32(seqs, _mm_set1_epi32((int)window_start));
+        __m128i plain = _mm_cmpeq_epi32(management, _mm_setzero_si128());
+        __m128i sized = _mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(bytes, one), sign),
+                                        _mm_set1_epi32((int)(PROTOCOL_DATA_SIZE ^ 0x80000000)));
+        __m128i fits = _mm_and_si128(_mm_cmplt_epi32(_mm_xor_si128(offset, sign), window),
+                                     _mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(_mm_add_epi32(offset, bytes), one), sign), window));
+        __m128i whole = _mm_cmpgt_epi32(_mm_xor_si128(lengths, sign),
+                                        _mm_xor_si128(_mm_add_epi32(bytes, _mm_set1_epi32(sizeof(struct protocol_Header) - 1)), sign));
+        __m128i qualifies = _mm_and_si128(_mm_and_si128(plain, sized), _mm_and_si128(fits, whole));
+        mask = _mm_movemask_ps(_mm_castsi128_ps(qualifies));
+        _mm_storeu_si128((__m128i *)offsets, offset);
+#elif defined(BATCH_NEON)
+        /* vld4q deinterleaves the four words of four headers into a vector per word */
+        uint32x4x4_t words = vld4q_u32((const uint32_t *)&batch->headers[first]);
+        uint32x4_t management = vandq_u32(words.val[0], vdupq_n_u32(0xff));
+        uint32x4_t bytes = vandq_u32(words.val[2], vdupq_n_u32(0xffff));
+        uint32x4_t lengths = vld1q_u32(&batch->lengths[first]);
+        uint32x4_t window = vdupq_n_u32(window_size);
+        uint32x4_t one = vdupq_n_u32(1);
+        uint32x4_t offset = vsubq_u32(words.val[1], vdupq_n_u32(window_start));
+        uint32x4_t plain = vceqq_u32(management, vdupq_n_u32(0));
+        uint32x4_t sized = vcltq_u32(vsubq_u32(bytes, one), vdupq_n_u32(PROTOCOL_DATA_SIZE));
+        uint32x4_t fits = vandq_u32(vcltq_u32(offset, window), vcltq_u32(vsubq_u32(vaddq_u32(offset, bytes), one), window));
+        uint32x4_t whole = vcgeq_u32(lengths, vaddq_u32(bytes, vdupq_n_u32(sizeof(struct protocol_Header))));
+        uint32x4_t qualifies = vandq_u32(vandq_u32(plain, sized), vandq_u32(fits, whole));
+        mask = (vgetq_lane_u32(qualifies, 0) & 1) | (vgetq_lane_u32(qualifies, 1) & 2) |
+               (vgetq_lane_u32(qualifies, 2) & 4) | (vgetq_lane_u32(qualifies, 3) & 8);
+        vst1q_u32(offsets, offset);
+#else
+        mask = 0;
+        for (unsigned int lane = 0; lane < BATCH_LANES; lane++)
+        {
+            const struct protocol_Header *header = &batch->headers[first + lane];
+            uint32_t bytes = header->bytes_of_data;
+            offsets[lane] = header->seq_ack_num - window_start;
+            if ((header->management_byte == 0) && (bytes >= 1) && (bytes <= PROTOCOL_DATA_SIZE) &&
+                (offsets[lane] < window_size) && (offsets[lane] + bytes - 1 < window_size) &&
+                (batch->lengths[first + lane] >= sizeof(struct protocol_Header) + bytes))
+            {
+                mask |= 1u << lane;
+            }
+        }
+#endif
+        for (unsigned int lane = 0; lane < BATCH_LANES; lane++)
+        {
+            batch->fast[first + lane] = (mask >> lane) & 1;
+            batch->offsets[first + lane] = offsets[lane];
+        }
+    }
+
+    /* Insertion sort within each stretch: segments mostly arrive in order already, so this is
+     * close to one pass */
+    unsigned int stretch = 0;
+    for (unsigned int i = 0; i < batch->count; i++)
+    {
+        batch->order[i] = i;
+        if (!batch->fast[i])
+        {
+            stretch = i + 1;
+            continue;
+        }
+        unsigned int j = i;
+        while ((j > stretch) && (batch->offsets[batch->order[j - 1]] > batch->offsets[i]))
+        {
+            batch->order[j] = batch->order[j - 1];
+            j--;
+        }
+        batch->order[j] = i;
+    }
+}
+
+/**
+ * @brief Copies a datagram of the batch back into one packet, for the per-packet path.
+ *
+ * @param batch The batch.
+ * @param index The datagram.
+ * @param packet Where to put it.
+ */
+void batch_packet(const struct batch_Receive *batch, unsigned int index, struct protocol_Packet *packet)
+{
+    packet->header = batch->headers[index];
+    size_t data_length = (batch->lengths[index] > sizeof(struct protocol_Header)) ? batch->lengths[index] - sizeof(struct protocol_Header) : 0;
+    size_t in_slot = (data_length > PROTOCOL_DATA_SIZE) ? PROTOCOL_DATA_SIZE : data_length;
+    memcpy(packet->data, batch_payload(batch, index), in_slot);
+    memcpy((char *)packet + sizeof(struct protocol_Header) + in_slot, batch->tails + index * BATCH_TAIL_BYTES, data_length - in_slot);
+}
+
+/**
+ * @brief Checks the checksum of a datagram of the batch.
+ *
+ * @param batch The batch.
+ * @param index The datagram.
+ * @return Returns 1 if it is intact, 0 if it is corrupted or truncated.
+ */
+int batch_checksum_valid(const struct batch_Receive *batch, unsigned int index)
+{
+    if (batch->lengths[index] <= sizeof(struct protocol_Header) + PROTOCOL_DATA_SIZE)
+    {
+        return packet_checksum_valid_split(&batch->headers[index], batch_payload(batch, index), batch->lengths[index]);
+    }
+    /* A whole packet (parity, or a padded segment from rsend -z) runs on into the tail */
+    uint32_t crc = crc32c_extend(packet_header_crc(&batch->headers[index]), batch_payload(batch, index), PROTOCOL_DATA_SIZE);
+    crc = crc32c_extend(crc, batch->tails + index * BATCH_TAIL_BYTES,
+                        batch->lengths[index] - sizeof(struct protocol_Header) - PROTOCOL_DATA_SIZE);
+    return crc == batch->headers[index].checksum;
+}
+
+/**
+ * @brief Names the vector instructions batch_classify() uses.
+ *
+ * @return Returns "sse2", "neon" or "scalar".
+ */
+const char *batch_implementation(void)
+{
+    return BATCH_SIMD;
+}
+
+/**
+ * @brief Frees a batch.
+ */
+void batch_free(struct batch_Receive *batch)
+{
+    free(batch->headers);
+    free(batch->payloads);
+    free(batch->tails);
+    free(batch->lengths);
+    free(batch->offsets);
+    free(batch->order);
+    free(batch->fast);
+    free(batch->messages);
+    free(batch->iovecs);
+    free(batch->controls);
+    free(batch->codepoints);
+    memset(batch, 0, sizeof(*batch));
+}
@@ -0,0 +1,71 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "our_protocol.h"
+
+/*
+ * Batched receive for rrecv (on unless -b 1).
+ *
+ * One recvmmsg() takes up to a batch of datagrams off the socket. Each datagram is scattered
+ * as it is received: its header goes to an array of headers and its data to a slot of a slab
+ * of PROTOCOL_DATA_SIZE slots, so segments that arrive one after another in stream order lie
+ * one after another in the slab too.
+ *
+ * batch_classify() then checks the headers of four datagrams at a time with SSE2 or NEON
+ * (plain C elsewhere): whether each is a plain data segment with no management bit set,
+ * whether its length matches, and whether it falls inside the receive window. Each stretch
+ * of such fast datagrams is sorted by place in the window, so the receiver can store each run
+ * of consecutive segments, which are also consecutive in the slab, with a single copy.
+ * Everything else (SYNC, FIN, parity, ack-now, segments past the window) goes through the
+ * per-packet path, in the order it arrived among the stretches.
+ *
+ * With batch_enable_ecn() each datagram also gets room for its TOS byte, and batch_receive()
+ * leaves its ECN field in codepoints[].
+ *
+ * A datagram as long as a whole protocol_Packet (parity is sent that way) has a few bytes
+ * more than a slot holds; they go to a small tail of its own, so the slots stay back to back.
+ */
+
+#define BATCH_DEFAULT_DATAGRAMS 32
+#define BATCH_MAX_DATAGRAMS 256
+#define BATCH_TAIL_BYTES (sizeof(struct protocol_Packet) - sizeof(struct protocol_Header) - PROTOCOL_DATA_SIZE)
+
+struct batch_Receive
+{
+    unsigned int capacity;             // Datagrams per recvmmsg(), a multiple of 4
+    unsigned int count;                // Datagrams in the batch
+    struct protocol_Header *headers;   // capacity of them, 16-byte aligned
+    char *payloads;                    // capacity slots of PROTOCOL_DATA_SIZE bytes
+    char *tails;                       // capacity tails of BATCH_TAIL_BYTES
+    uint32_t *lengths;                 // Datagram lengths, 0 for one that is to be ignored
+    uint8_t *fast;                     // Whether each is a plain data segment inside the window
+    uint32_t *offsets;                 // Offsets in the window, for the fast ones
+    uint16_t *order;                   // Every datagram, each stretch of fast ones sorted by offset
+    struct mmsghdr *messages;
+    struct iovec *iovecs;
+    char *controls;                    // capacity of ECN_CONTROL_SIZE, with batch_enable_ecn()
+    uint8_t *codepoints;               // The ECN field of each datagram
+    unsigned long long int calls;      // recvmmsg() calls that returned datagrams
+    unsigned long long int datagrams;
+};
+
+int batch_init(struct batch_Receive *batch, unsigned int capacity);
+int batch_enable_ecn(struct batch_Receive *batch);
+int batch_receive(struct batch_Receive *batch, int fd);
+void batch_classify(struct batch_Receive *batch, uint32_t window_start, uint32_t window_size);
+void batch_packet(const struct batch_Receive *batch, unsigned int index, struct protocol_Packet *packet);
+int batch_checksum_valid(const struct batch_Receive *batch, unsigned int index);
+const char *batch_implementation(void);
+void batch_free(struct batch_Receive *batch);
+
+/**
+ * @brief Returns the data of a datagram of the batch.
+ */
+static inline char *batch_payload(const struct batch_Receive *batch, unsigned int index)
+{
+    return batch->payloads + (size_t)index * PROTOCOL_DATA_SIZE;
+}
+
+#endif
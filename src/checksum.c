@@ -0,0 +1,340 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "checksum.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE "sse4.2"
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC32C_HARDWARE "armv8-crc"
+#endif
+
+#define CRC32C_POLY 0x82f63b78 /* Reflected Castagnoli polynomial */
+#define CRC32C_LONG 8192       /* Lane lengths for the three-lane hardware CRC */
+#define CRC32C_SHORT 256
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_long_shift[4][256];
+static uint32_t crc32c_short_shift[4][256];
+static uint32_t (*crc32c_function)(uint32_t crc, const uint8_t *data, size_t length);
+static const char *crc32c_name;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void);
+static uint32_t crc32c_software(uint32_t crc, const uint8_t *data, size_t length);
+
+/**
+ * @brief Extends a CRC32C over more bytes.
+ *
+ * Start with crc = 0; crc32c_extend(crc32c_extend(0, a), b) is the CRC of a followed by b.
+ *
+ * @param crc The CRC of the bytes so far.
+ * @param data The next bytes.
+ * @param length The number of bytes.
+ * @return Returns the CRC of all the bytes.
+ */
+uint32_t crc32c_extend(uint32_t crc, const void *data, size_t length)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_function(crc, data, length);
+}
+
+/**
+ * @brief Names the CRC32C implementation picked for this CPU.
+ *
+ * @return Returns "sse4.2", "armv8-crc" or "table".
+ */
+const char *crc32c_implementation(void)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_name;
+}
+
+/**
+ * @brief Stores the checksum of a packet in its header.
+ *
+ * @param packet The packet, starting with a protocol_Header.
+ * @param length The number of bytes that will be sent.
+ */
+void packet_set_checksum(void *packet, size_t length)
+{
+    struct protocol_Header *header = packet;
+    header->checksum = 0;
+    header->checksum = crc32c_extend(0, packet, length);
+}
+
+/**
+ * @brief Checks the checksum of a received packet.
+ *
+ * @param packet The received packet, starting with a protocol_Header.
+ * @param length The number of bytes received.
+ * @return Returns 1 if the packet is intact, 0 if it is corrupted or truncated.
+ */
+int packet_checksum_valid(const void *packet, size_t length)
+{
+    struct protocol_Header header;
+    if (length < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, packet, sizeof(header));
+    return packet_checksum_valid_split(&header, (const uint8_t *)packet + sizeof(header), length);
+}
+
+/**
+ * @brief Checks the checksum of a received packet whose header and data were received
+ * into different places (batch.h).
+ *
+ * @param header The header.
+ * @param data The data that followed it.
+ * @param length The number of bytes received, header included.
+ * @return Returns 1 if the packet is intact, 0 if it is corrupted or truncated.
+ */
+int packet_checksum_valid_split(const struct protocol_Header *header, const void *data, size_t length)
+{
+    if (length < sizeof(*header)) {
+        return 0;
+    }
+    uint32_t crc = crc32c_extend(packet_header_crc(header), data, length - sizeof(*header));
+    return crc == header->checksum;
+}
+
+/**
+ * @brief Starts the checksum of a packet whose data is checked piece by piece.
+ *
+ * @param header The header.
+ * @return Returns the CRC32C of the header with its checksum field zeroed, to be extended
+ * over the data with crc32c_extend() and compared with header->checksum.
+ */
+uint32_t packet_header_crc(const struct protocol_Header *header)
+{
+    struct protocol_Header zeroed;
+    memcpy(&zeroed, header, sizeof(zeroed)); // Padding and all, as the CRC covers it
+    zeroed.checksum = 0;
+    return crc32c_extend(0, &zeroed, sizeof(zeroed));
+}
+
+/**
+ * @brief Multiplies a GF(2) 32x32 matrix by a vector.
+ */
+static uint32_t gf2_matrix_times(const uint32_t *matrix, uint32_t vector)
+{
+    uint32_t sum = 0;
+    while (vector) {
+        if (vector & 1) {
+            sum ^= *matrix;
+        }
+        vector >>= 1;
+        matrix++;
+    }
+    return sum;
+}
+
+/**
+ * @brief Squares a GF(2) 32x32 matrix.
+ */
+static void gf2_matrix_square(uint32_t *square, const uint32_t *matrix)
+{
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(matrix, matrix[n]);
+    }
+}
+
+/**
+ * @brief Builds tables that advance a CRC over length zero bytes.
+ *
+ * Used to join the CRCs of the three hardware lanes: the CRC of a followed by b is the
+ * CRC of a advanced over len(b) zeros, XORed with the CRC of b started from zero.
+ *
+ * @param shift The four byte-indexed tables to fill in.
+ * @param length The number of zero bytes, a power of two.
+ */
+static void crc32c_build_shift(uint32_t shift[4][256], size_t length)
+{
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    /* Operator for one zero bit, then square up to one zero byte and beyond */
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = 1u << (n - 1);
+    }
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+    const uint32_t *op = NULL;
+    do {
+        gf2_matrix_square(even, odd);
+        length >>= 1;
+        op = even;
+        if (length == 0) {
+            break;
+        }
+        gf2_matrix_square(odd, even);
+        length >>= 1;
+        op = odd;
+    } while (length);
+
+    for (uint32_t n = 0; n < 256; n++) {
+        shift[0][n] = gf2_matrix_times(op, n);
+        shift[1][n] = gf2_matrix_times(op, n << 8);
+        shift[2][n] = gf2_matrix_times(op, n << 16);
+        shift[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static inline uint32_t crc32c_shift(uint32_t shift[4][256], uint32_t crc)
+{
+    return shift[0][crc & 0xff] ^ shift[1][(crc >> 8) & 0xff] ^ shift[2][(crc >> 16) & 0xff] ^ shift[3][crc >> 24];
+}
+
+/**
+ * @brief Software CRC32C, eight bytes per step (slicing-by-8).
+ */
+static uint32_t crc32c_software(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xff] ^ crc32c_table[6][(word >> 8) & 0xff]
+              ^ crc32c_table[5][(word >> 16) & 0xff] ^ crc32c_table[4][(word >> 24) & 0xff]
+              ^ crc32c_table[3][(word >> 32) & 0xff] ^ crc32c_table[2][(word >> 40) & 0xff]
+              ^ crc32c_table[1][(word >> 48) & 0xff] ^ crc32c_table[0][word >> 56];
+        data += 8;
+        length -= 8;
+    }
+#endif
+    while (length--) {
+        crc = crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#ifdef CRC32C_HARDWARE
+
+#if defined(__x86_64__)
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#define crc32c_u8(crc, value) _mm_crc32_u8((crc), (value))
+#define crc32c_u64(crc, value) ((uint32_t)_mm_crc32_u64((crc), (value)))
+#else
+#define CRC32C_TARGET __attribute__((target("+crc")))
+#define crc32c_u8(crc, value) __crc32cb((crc), (value))
+#define crc32c_u64(crc, value) __crc32cd((crc), (value))
+#endif
+
+static inline uint64_t load64(const uint8_t *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Hardware CRC32C, three independent lanes at a time.
+ *
+ * The CRC instruction has a latency of about three cycles but can start one per cycle,
+ * so three lanes keep it busy; the lane CRCs are joined with the shift tables.
+ */
+CRC32C_TARGET
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t *data, size_t length)
+{
+    uint32_t crc0 = ~crc;
+
+    while (length && ((uintptr_t)data & 7)) {
+        crc0 = crc32c_u8(crc0, *data++);
+        length--;
+    }
+
+    while (length >= 3 * CRC32C_LONG) {
+        uint32_t crc1 = 0, crc2 = 0;
+        const uint8_t *end = data + CRC32C_LONG;
+        do {
+            crc0 = crc32c_u64(crc0, load64(data));
+            crc1 = crc32c_u64(crc1, load64(data + CRC32C_LONG));
+            crc2 = crc32c_u64(crc2, load64(data + 2 * CRC32C_LONG));
+            data += 8;
+        } while (data < end);
+        crc0 = crc32c_shift(crc32c_long_shift, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_long_shift, crc0) ^ crc2;
+        data += 2 * CRC32C_LONG;
+        length -= 3 * CRC32C_LONG;
+    }
+
+    while (length >= 3 * CRC32C_SHORT) {
+        uint32_t crc1 = 0, crc2 = 0;
+        const uint8_t *end = data + CRC32C_SHORT;
+        do {
+            crc0 = crc32c_u64(crc0, load64(data));
+            crc1 = crc32c_u64(crc1, load64(data + CRC32C_SHORT));
+            crc2 = crc32c_u64(crc2, load64(data + 2 * CRC32C_SHORT));
+            data += 8;
+        } while (data < end);
+        crc0 = crc32c_shift(crc32c_short_shift, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short_shift, crc0) ^ crc2;
+        data += 2 * CRC32C_SHORT;
+        length -= 3 * CRC32C_SHORT;
+    }
+
+    while (length >= 8) {
+        crc0 = crc32c_u64(crc0, load64(data));
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc0 = crc32c_u8(crc0, *data++);
+    }
+    return ~crc0;
+}
+
+/**
+ * @brief Checks whether the CPU has CRC32C instructions.
+ */
+static int crc32c_hardware_available(void)
+{
+#if defined(__x86_64__)
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+
+#endif
+
+/**
+ * @brief Builds the tables and picks the fastest implementation for this CPU.
+ */
+static void crc32c_init(void)
+{
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = crc32c_table[0][n];
+        for (int k = 1; k < 8; k++) {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            crc32c_table[k][n] = crc;
+        }
+    }
+
+    crc32c_function = crc32c_software;
+    crc32c_name = "table";
+#ifdef CRC32C_HARDWARE
+    if (crc32c_hardware_available()) {
+        crc32c_build_shift(crc32c_long_shift, CRC32C_LONG);
+        crc32c_build_shift(crc32c_short_shift, CRC32C_SHORT);
+        crc32c_function = crc32c_hardware;
+        crc32c_name = CRC32C_HARDWARE;
+    }
+#endif
+}
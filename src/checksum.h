@@ -0,0 +1,28 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "our_protocol.h"
+
+/*
+ * CRC32C (Castagnoli) checksums.
+ *
+ * Every packet carries the CRC32C of the whole datagram, computed with the checksum
+ * field zeroed, so corrupted packets are dropped before they reach the window. Both
+ * ends also keep a running CRC32C of the data stream as a digest and compare it at FIN.
+ *
+ * The CRC uses the SSE4.2 or ARMv8 CRC instructions when the CPU has them, running three
+ * independent lanes and joining them with precomputed shift tables so the instruction
+ * latency is hidden; otherwise it falls back to slicing-by-8 tables.
+ */
+
+uint32_t crc32c_extend(uint32_t crc, const void *data, size_t length);
+const char *crc32c_implementation(void);
+
+void packet_set_checksum(void *packet, size_t length);
+int packet_checksum_valid(const void *packet, size_t length);
+int packet_checksum_valid_split(const struct protocol_Header *header, const void *data, size_t length);
+uint32_t packet_header_crc(const struct protocol_Header *header);
+
+#endif
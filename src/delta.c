@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "delta.h"
+
+#define PRIME64_1 11400714785074694791ULL
+#define PRIME64_2 14029467366897019727ULL
+#define PRIME64_3 1609587929392839161ULL
+#define PRIME64_4 9650029242287828579ULL
+#define PRIME64_5 2870177450012600261ULL
+
+/* A share of the blocks hashed by one thread: either a contiguous range of the file
+ * (signatures), or a range of a list of candidate blocks to confirm (confirmations). */
+struct delta_Job
+{
+    int fd;
+    uint64_t file_size;
+    struct delta_Signature *signatures;
+    int with_strong_hash;
+    const uint64_t *candidates;
+    const struct delta_Signature *remote;
+    uint8_t *unchanged;
+    uint64_t first;
+    uint64_t end;
+    int failed;
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static int delta_run_jobs(struct delta_Job *job_template, uint64_t count, void *(*worker)(void *));
+static void *delta_hash_blocks(void *arg);
+static void *delta_confirm_candidates(void *arg);
+static void sha256_compress(uint32_t state[8], const uint8_t block[64]);
+
+/**
+ * @brief Returns how many blocks a file of the given size is split into.
+ *
+ * @param file_size The file size in bytes.
+ * @return Returns the number of DELTA_BLOCK_SIZE blocks, counting a partial last block.
+ */
+uint64_t delta_block_count(uint64_t file_size)
+{
+    return (file_size + DELTA_BLOCK_SIZE - 1) / DELTA_BLOCK_SIZE;
+}
+
+/**
+ * @brief Returns the length of one block of a file.
+ *
+ * @param file_size The file size in bytes.
+ * @param block The index of the block.
+ * @return Returns DELTA_BLOCK_SIZE, or the remainder for the last block.
+ */
+uint32_t delta_block_length(uint64_t file_size, uint64_t block)
+{
+    uint64_t remaining = file_size - block * DELTA_BLOCK_SIZE;
+    return (remaining < DELTA_BLOCK_SIZE) ? (uint32_t)remaining : DELTA_BLOCK_SIZE;
+}
+
+/**
+ * @brief Computes the signature of every block of a file.
+ *
+ * The blocks are split into contiguous ranges hashed by one thread per online CPU
+ * (up to DELTA_MAX_THREADS), each reading its range with pread.
+ *
+ * @param fd The file to hash.
+ * @param file_size The number of bytes of the file to hash.
+ * @param signatures Array of delta_block_count(file_size) signatures to fill in.
+ * @param with_strong_hash Whether to compute the strong hash as well as the weak one.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int delta_compute_signatures(int fd, uint64_t file_size, struct delta_Signature *signatures, int with_strong_hash)
+{
+    struct delta_Job job_template;
+    memset(&job_template, 0, sizeof(job_template));
+    job_template.fd = fd;
+    job_template.file_size = file_size;
+    job_template.signatures = signatures;
+    job_template.with_strong_hash = with_strong_hash;
+    return delta_run_jobs(&job_template, delta_block_count(file_size), delta_hash_blocks);
+}
+
+/**
+ * @brief Confirms weak hash matches by comparing strong hashes.
+ *
+ * The candidate blocks are split between threads the same way as when computing
+ * signatures, so only blocks whose weak hash matched pay for the strong hash.
+ *
+ * @param fd The local file.
+ * @param file_size The size of the local file.
+ * @param candidates The indices of the blocks whose weak hash matched.
+ * @param remote The remote signature of each candidate.
+ * @param unchanged Set to 1 for each candidate whose strong hash also matches, 0 otherwise.
+ * @param count The number of candidates.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int delta_confirm_blocks(int fd, uint64_t file_size, const uint64_t *candidates, 
+                         const struct delta_Signature *remote, uint8_t *unchanged, uint64_t count)
+{
+    struct delta_Job job_template;
+    memset(&job_template, 0, sizeof(job_template));
+    job_template.fd = fd;
+    job_template.file_size = file_size;
+    job_template.candidates = candidates;
+    job_template.remote = remote;
+    job_template.unchanged = unchanged;
+    return delta_run_jobs(&job_template, count, delta_confirm_candidates);
+}
+
+/**
+ * @brief Splits count items into contiguous ranges and runs a worker thread on each.
+ *
+ * Uses one thread per online CPU, up to DELTA_MAX_THREADS. A range whose thread
+ * cannot be created is run on the calling thread instead.
+ *
+ * @param job_template The job fields shared by every thread.
+ * @param count The number of items to split.
+ * @param worker The function each thread runs on its delta_Job.
+ * @return Returns 0 on success, -1 if any worker failed.
+ */
+static int delta_run_jobs(struct delta_Job *job_template, uint64_t count, void *(*worker)(void *))
+{
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > DELTA_MAX_THREADS) {
+        threads = DELTA_MAX_THREADS;
+    }
+    if ((uint64_t)threads > count) {
+        threads = (count > 0) ? (long)count : 1;
+    }
+
+    pthread_t thread_ids[DELTA_MAX_THREADS];
+    uint8_t thread_started[DELTA_MAX_THREADS];
+    struct delta_Job jobs[DELTA_MAX_THREADS];
+    int failed = 0;
+
+    for (long t = 0; t < threads; t++) {
+        jobs[t] = *job_template;
+        jobs[t].first = count * t / threads;
+        jobs[t].end = count * (t + 1) / threads;
+        jobs[t].failed = 0;
+        thread_started[t] = (pthread_create(&thread_ids[t], NULL, worker, &jobs[t]) == 0);
+        if (!thread_started[t]) {
+            worker(&jobs[t]);
+        }
+    }
+    for (long t = 0; t < threads; t++) {
+        if (thread_started[t]) {
+            pthread_join(thread_ids[t], NULL);
+        }
+        failed |= jobs[t].failed;
+    }
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief Hashes one thread's range of blocks.
+ *
+ * @param arg Pointer to the delta_Job describing the range.
+ * @return Returns NULL; failures are reported through the job.
+ */
+static void *delta_hash_blocks(void *arg)
+{
+    struct delta_Job *job = arg;
+    uint8_t *buffer = malloc(DELTA_BLOCK_SIZE);
+    if (buffer == NULL) {
+        job->failed = 1;
+        return NULL;
+    }
+
+    for (uint64_t block = job->first; block < job->end; block++) {
+        uint32_t length = delta_block_length(job->file_size, block);
+        if (pread(job->fd, buffer, length, block * DELTA_BLOCK_SIZE) != (ssize_t)length) {
+            job->failed = 1;
+            break;
+        }
+        job->signatures[block].weak_hash = delta_weak_hash(buffer, length);
+        if (job->with_strong_hash) {
+            delta_strong_hash(buffer, length, job->signatures[block].strong_hash);
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * @brief Confirms one thread's range of candidate blocks.
+ *
+ * @param arg Pointer to the delta_Job describing the range.
+ * @return Returns NULL; failures are reported through the job.
+ */
+static void *delta_confirm_candidates(void *arg)
+{
+    struct delta_Job *job = arg;
+    uint8_t *buffer = malloc(DELTA_BLOCK_SIZE);
+    if (buffer == NULL) {
+        job->failed = 1;
+        return NULL;
+    }
+
+    uint8_t digest[DELTA_STRONG_HASH_SIZE];
+    for (uint64_t i = job->first; i < job->end; i++) {
+        uint64_t block = job->candidates[i];
+        uint32_t length = delta_block_length(job->file_size, block);
+        job->unchanged[i] = 0;
+        if (pread(job->fd, buffer, length, block * DELTA_BLOCK_SIZE) != (ssize_t)length) {
+            job->failed = 1;
+            break;
+        }
+        delta_strong_hash(buffer, length, digest);
+        job->unchanged[i] = (memcmp(digest, job->remote[i].strong_hash, DELTA_STRONG_HASH_SIZE) == 0);
+    }
+    free(buffer);
+    return NULL;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= xxh64_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * @brief Fast non-cryptographic 64-bit hash of a block (xxHash64, seed 0).
+ *
+ * Four independent multiply-rotate lanes over 32-byte stripes keep this several
+ * times faster than the strong hash.
+ *
+ * @param data The bytes to hash.
+ * @param length The number of bytes.
+ * @return Returns the 64-bit hash.
+ */
+uint64_t delta_weak_hash(const uint8_t *data, size_t length)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = data + length;
+    uint64_t hash;
+
+    if (length >= 32) {
+        uint64_t v1 = PRIME64_1 + PRIME64_2;
+        uint64_t v2 = PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = -PRIME64_1;
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh64_merge_round(hash, v1);
+        hash = xxh64_merge_round(hash, v2);
+        hash = xxh64_merge_round(hash, v3);
+        hash = xxh64_merge_round(hash, v4);
+    } else {
+        hash = PRIME64_5;
+    }
+    hash += length;
+
+    while (p + 8 <= end) {
+        hash ^= xxh64_round(0, read64(p));
+        hash = rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        hash ^= (uint64_t)word * PRIME64_1;
+        hash = rotl64(hash, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        hash ^= (*p) * PRIME64_5;
+        hash = rotl64(hash, 11) * PRIME64_1;
+        p++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * @brief Strong hash of a block used to confirm weak hash matches.
+ *
+ * SHA-256, truncated to DELTA_STRONG_HASH_SIZE bytes.
+ *
+ * @param data The bytes to hash.
+ * @param length The number of bytes.
+ * @param digest Where to store the truncated digest.
+ */
+void delta_strong_hash(const uint8_t *data, size_t length, uint8_t digest[DELTA_STRONG_HASH_SIZE])
+{
+    uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    size_t offset = 0;
+    for (; offset + 64 <= length; offset += 64) {
+        sha256_compress(state, data + offset);
+    }
+
+    /* Pad the tail with 0x80, zeros and the length in bits */
+    uint8_t tail[128] = {0};
+    size_t tail_length = length - offset;
+    memcpy(tail, data + offset, tail_length);
+    tail[tail_length] = 0x80;
+    size_t padded_length = (tail_length < 56) ? 64 : 128;
+    uint64_t bit_length = (uint64_t)length * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[padded_length - 1 - i] = (uint8_t)(bit_length >> (8 * i));
+    }
+    sha256_compress(state, tail);
+    if (padded_length == 128) {
+        sha256_compress(state, tail + 64);
+    }
+
+    for (int i = 0; i < DELTA_STRONG_HASH_SIZE; i++) {
+        digest[i] = (uint8_t)(state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+static inline uint32_t rotr32(uint32_t x, int r)
+{
+    return (x >> r) | (x << (32 - r));
+}
+
+/**
+ * @brief Runs the SHA-256 compression function over one 64-byte block.
+ *
+ * @param state The eight-word hash state to update.
+ * @param block The 64-byte message block.
+ */
+static void sha256_compress(uint32_t state[8], const uint8_t block[64])
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16)
+               | ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t temp1 = h + s1 + choice + sha256_k[i] + w[i];
+        uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t temp2 = s0 + majority;
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
@@ -0,0 +1,39 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "our_protocol.h"
+
+/*
+ * Block-hash delta sync.
+ *
+ * The receiver hashes fixed-size blocks of the file it already has and the sender fetches
+ * that signature list during the handshake, DELTA_SIGNATURES_PER_PACKET entries per
+ * SIGNATURE packet. A block is unchanged if the fast weak hash matches and the strong
+ * hash confirms it. The data stream is then a bitmap of changed blocks (one bit per block
+ * of the sender's file) followed by the contents of the changed blocks in order, which the
+ * receiver patches into its file in place.
+ */
+
+#define DELTA_BLOCK_SIZE (64 * 1024)
+#define DELTA_STRONG_HASH_SIZE 16
+#define DELTA_MAX_THREADS 16
+
+struct delta_Signature
+{
+    uint64_t weak_hash;
+    uint8_t strong_hash[DELTA_STRONG_HASH_SIZE];
+};
+
+#define DELTA_SIGNATURES_PER_PACKET (PROTOCOL_DATA_SIZE / sizeof(struct delta_Signature))
+
+uint64_t delta_block_count(uint64_t file_size);
+uint32_t delta_block_length(uint64_t file_size, uint64_t block);
+int delta_compute_signatures(int fd, uint64_t file_size, struct delta_Signature *signatures, int with_strong_hash);
+int delta_confirm_blocks(int fd, uint64_t file_size, const uint64_t *candidates, 
+                         const struct delta_Signature *remote, uint8_t *unchanged, uint64_t count);
+uint64_t delta_weak_hash(const uint8_t *data, size_t length);
+void delta_strong_hash(const uint8_t *data, size_t length, uint8_t digest[DELTA_STRONG_HASH_SIZE]);
+
+#endif
@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include "direct_io.h"
+
+static int direct_allocate(struct direct_Block *blocks);
+static void direct_free(struct direct_Block *blocks);
+static ssize_t direct_transfer(int fd, int *direct, char *data, size_t length, uint64_t offset, int writing);
+static struct direct_Block *direct_reader_block(struct direct_Reader *reader, uint64_t index);
+static struct direct_Block *direct_writer_block(struct direct_Writer *writer, uint64_t index);
+static int direct_write_block(struct direct_Writer *writer, uint64_t index, uint32_t length);
+static void direct_writeback(int fd, uint64_t offset, uint32_t length);
+
+/**
+ * @brief Opens a file for reading through the block pool.
+ *
+ * Falls back to the page cache, with sequential readahead, where O_DIRECT is not supported.
+ *
+ * @param reader The reader to set up.
+ * @param path The file to read.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int direct_reader_open(struct direct_Reader *reader, const char *path)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = open(path, O_RDONLY | O_DIRECT);
+    reader->direct = (reader->fd >= 0);
+    if (!reader->direct)
+    {
+        reader->fd = open(path, O_RDONLY);
+        if (reader->fd < 0)
+        {
+            perror("Error opening file for direct I/O");
+            return -1;
+        }
+        posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    return direct_allocate(reader->blocks);
+}
+
+/**
+ * @brief Reads bytes of the file through the block pool.
+ *
+ * Blocks are read whole, and the least recently used one is replaced when the pool is full.
+ *
+ * @param reader The reader.
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes to read.
+ * @param offset The file offset to read from.
+ * @return Returns 0 on success, -1 on failure or when reading past the end of the file.
+ */
+int direct_read(struct direct_Reader *reader, char *buffer, uint32_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        struct direct_Block *block = direct_reader_block(reader, offset / DIRECT_IO_BLOCK_SIZE);
+        uint32_t within_block = offset % DIRECT_IO_BLOCK_SIZE;
+        if (block == NULL)
+        {
+            return -1;
+        }
+        if (within_block >= block->length)
+        {
+            fprintf(stderr, "Error: Read past the end of the file at %llu\n", (unsigned long long int)offset);
+            return -1;
+        }
+
+        uint32_t bytes_read = ((block->length - within_block) < length) ? (block->length - within_block) : length;
+        memcpy(buffer, block->data + within_block, bytes_read);
+        buffer += bytes_read;
+        offset += bytes_read;
+        length -= bytes_read;
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes the file and frees the block pool.
+ *
+ * @param reader The reader.
+ */
+void direct_reader_close(struct direct_Reader *reader)
+{
+    if (reader->fd >= 0)
+    {
+        close(reader->fd);
+        reader->fd = -1;
+    }
+    direct_free(reader->blocks);
+}
+
+/**
+ * @brief Opens a file for writing through the block pool.
+ *
+ * The block the transfer starts in is written whole later on, so whatever is already in the
+ * file before the start offset (when resuming) is read into it first.
+ *
+ * @param writer The writer to set up.
+ * @param path The file to write.
+ * @param start_offset The file offset the transfer starts from.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int direct_writer_open(struct direct_Writer *writer, const char *path, uint64_t start_offset)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = open(path, O_RDWR | O_DIRECT);
+    writer->direct = (writer->fd >= 0);
+    if (!writer->direct)
+    {
+        writer->fd = open(path, O_RDWR);
+        if (writer->fd < 0)
+        {
+            perror("Error opening file for direct I/O");
+            return -1;
+        }
+    }
+    if (direct_allocate(writer->blocks) < 0)
+    {
+        return -1;
+    }
+
+    writer->durable_offset = start_offset;
+    uint32_t head = start_offset % DIRECT_IO_BLOCK_SIZE;
+    if (head > 0)
+    {
+        struct direct_Block *block = direct_writer_block(writer, start_offset / DIRECT_IO_BLOCK_SIZE);
+        size_t aligned_head = (head + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        if (direct_transfer(writer->fd, &writer->direct, block->data, aligned_head, start_offset - head, 0) < (ssize_t)head)
+        {
+            perror("Error reading the start of the block being resumed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Stores bytes in the block pool, at their file offset.
+ *
+ * The bytes must lie within a few blocks of the durable offset: the pool holds
+ * DIRECT_IO_POOL_BLOCKS blocks, and a block's slot is only reused once it has been written.
+ *
+ * @param writer The writer.
+ * @param bytes The bytes.
+ * @param length The number of bytes.
+ * @param offset The file offset of the first byte.
+ */
+void direct_store(struct direct_Writer *writer, const char *bytes, uint32_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        struct direct_Block *block = direct_writer_block(writer, offset / DIRECT_IO_BLOCK_SIZE);
+        uint32_t within_block = offset % DIRECT_IO_BLOCK_SIZE;
+        uint32_t bytes_stored = ((DIRECT_IO_BLOCK_SIZE - within_block) < length) ? (DIRECT_IO_BLOCK_SIZE - within_block) : length;
+        memcpy(block->data + within_block, bytes, bytes_stored);
+        bytes += bytes_stored;
+        offset += bytes_stored;
+        length -= bytes_stored;
+    }
+}
+
+/**
+ * @brief Reads back bytes stored in the block pool that are not written yet.
+ *
+ * @param writer The writer.
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes.
+ * @param offset The file offset of the first byte.
+ */
+void direct_load(struct direct_Writer *writer, char *buffer, uint32_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        struct direct_Block *block = direct_writer_block(writer, offset / DIRECT_IO_BLOCK_SIZE);
+        uint32_t within_block = offset % DIRECT_IO_BLOCK_SIZE;
+        uint32_t bytes_loaded = ((DIRECT_IO_BLOCK_SIZE - within_block) < length) ? (DIRECT_IO_BLOCK_SIZE - within_block) : length;
+        memcpy(buffer, block->data + within_block, bytes_loaded);
+        buffer += bytes_loaded;
+        offset += bytes_loaded;
+        length -= bytes_loaded;
+    }
+}
+
+/**
+ * @brief Writes every block that the committed offset has moved past.
+ *
+ * @param writer The writer.
+ * @param committed_offset The file offset everything before which has been received.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int direct_commit(struct direct_Writer *writer, uint64_t committed_offset)
+{
+    while (1)
+    {
+        uint64_t index = writer->durable_offset / DIRECT_IO_BLOCK_SIZE;
+        uint64_t block_end = (index + 1) * DIRECT_IO_BLOCK_SIZE;
+        if (block_end > committed_offset)
+        {
+            return 0;
+        }
+        if (direct_write_block(writer, index, DIRECT_IO_BLOCK_SIZE) < 0)
+        {
+            return -1;
+        }
+        writer->durable_offset = block_end;
+    }
+}
+
+/**
+ * @brief Writes the last, partial block and flushes the file to disk.
+ *
+ * O_DIRECT only writes whole multiples of DIRECT_IO_ALIGNMENT, so the block is padded and
+ * the file is truncated back to its real end afterwards.
+ *
+ * @param writer The writer.
+ * @param end_offset The end of the file; everything before it has been received.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int direct_writer_finish(struct direct_Writer *writer, uint64_t end_offset)
+{
+    if (direct_commit(writer, end_offset) < 0)
+    {
+        return -1;
+    }
+    if (writer->durable_offset < end_offset)
+    {
+        uint64_t index = writer->durable_offset / DIRECT_IO_BLOCK_SIZE;
+        struct direct_Block *block = direct_writer_block(writer, index);
+        uint32_t length = end_offset - index * DIRECT_IO_BLOCK_SIZE;
+        uint32_t padded_length = (length + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        memset(block->data + length, 0, padded_length - length);
+
+        if ((direct_write_block(writer, index, padded_length) < 0) || (ftruncate(writer->fd, end_offset) < 0))
+        {
+            perror("Error writing the end of the file");
+            return -1;
+        }
+        writer->durable_offset = end_offset;
+    }
+    if (fdatasync(writer->fd) < 0)
+    {
+        perror("Error flushing file");
+        return -1;
+    }
+    if (!writer->direct)
+    {
+        posix_fadvise(writer->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes the file and frees the block pool.
+ *
+ * Blocks that were not written yet are lost; durable_offset says how far the file is complete.
+ *
+ * @param writer The writer.
+ */
+void direct_writer_close(struct direct_Writer *writer)
+{
+    if (writer->fd >= 0)
+    {
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    direct_free(writer->blocks);
+}
+
+/**
+ * @brief Allocates the aligned memory of a block pool.
+ */
+static int direct_allocate(struct direct_Block *blocks)
+{
+    for (int i = 0; i < DIRECT_IO_POOL_BLOCKS; i++)
+    {
+        if (posix_memalign((void **)&blocks[i].data, DIRECT_IO_ALIGNMENT, DIRECT_IO_BLOCK_SIZE) != 0)
+        {
+            blocks[i].data = NULL;
+            fprintf(stderr, "Error allocating direct I/O blocks\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees the memory of a block pool.
+ */
+static void direct_free(struct direct_Block *blocks)
+{
+    for (int i = 0; i < DIRECT_IO_POOL_BLOCKS; i++)
+    {
+        free(blocks[i].data);
+        blocks[i].data = NULL;
+        blocks[i].valid = 0;
+    }
+}
+
+/**
+ * @brief Reads or writes at an offset, giving up O_DIRECT if this I/O is refused.
+ *
+ * Some file systems accept O_DIRECT when the file is opened but fail the I/O itself with
+ * EINVAL; the file then carries on through the page cache.
+ */
+static ssize_t direct_transfer(int fd, int *direct, char *data, size_t length, uint64_t offset, int writing)
+{
+    ssize_t result = writing ? pwrite(fd, data, length, offset) : pread(fd, data, length, offset);
+    if ((result < 0) && (errno == EINVAL) && *direct)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        *direct = 0;
+        result = writing ? pwrite(fd, data, length, offset) : pread(fd, data, length, offset);
+    }
+    return result;
+}
+
+/**
+ * @brief Finds the pool block holding a block of the file, reading it in if needed.
+ *
+ * Through the page cache, the block read in hints readahead of the next one, and the
+ * block it replaces is dropped from the cache.
+ */
+static struct direct_Block *direct_reader_block(struct direct_Reader *reader, uint64_t index)
+{
+    struct direct_Block *victim = NULL;
+    reader->clock++;
+    for (int i = 0; i < DIRECT_IO_POOL_BLOCKS; i++)
+    {
+        struct direct_Block *block = &reader->blocks[i];
+        if (block->valid && (block->index == index))
+        {
+            block->last_used = reader->clock;
+            return block;
+        }
+        if ((victim == NULL) || !block->valid || (victim->valid && (block->last_used < victim->last_used)))
+        {
+            victim = block;
+        }
+    }
+
+    if (victim->valid && !reader->direct)
+    {
+        posix_fadvise(reader->fd, victim->index * DIRECT_IO_BLOCK_SIZE, victim->length, POSIX_FADV_DONTNEED);
+    }
+    victim->valid = 0;
+    ssize_t bytes_read = direct_transfer(reader->fd, &reader->direct, victim->data, DIRECT_IO_BLOCK_SIZE,
+                                         index * DIRECT_IO_BLOCK_SIZE, 0);
+    if (bytes_read < 0)
+    {
+        perror("Error reading file");
+        return NULL;
+    }
+    victim->index = index;
+    victim->length = bytes_read;
+    victim->valid = 1;
+    victim->last_used = reader->clock;
+
+    if (!reader->direct)
+    {
+        readahead(reader->fd, (index + 1) * DIRECT_IO_BLOCK_SIZE, DIRECT_IO_BLOCK_SIZE);
+    }
+    return victim;
+}
+
+/**
+ * @brief Finds the pool slot for a block of the file being written.
+ *
+ * Blocks map onto slots by index, so a slot is only taken over by a block
+ * DIRECT_IO_POOL_BLOCKS further on, long after the earlier block was written.
+ */
+static struct direct_Block *direct_writer_block(struct direct_Writer *writer, uint64_t index)
+{
+    struct direct_Block *block = &writer->blocks[index % DIRECT_IO_POOL_BLOCKS];
+    if (!block->valid || (block->index != index))
+    {
+        block->index = index;
+        block->valid = 1;
+    }
+    return block;
+}
+
+/**
+ * @brief Writes a pool block to its place in the file and frees its slot.
+ */
+static int direct_write_block(struct direct_Writer *writer, uint64_t index, uint32_t length)
+{
+    struct direct_Block *block = direct_writer_block(writer, index);
+    uint64_t offset = index * DIRECT_IO_BLOCK_SIZE;
+    if (direct_transfer(writer->fd, &writer->direct, block->data, length, offset, 1) != (ssize_t)length)
+    {
+        perror("Error writing file");
+        return -1;
+    }
+    block->valid = 0;
+    if (!writer->direct)
+    {
+        direct_writeback(writer->fd, offset, length);
+    }
+    return 0;
+}
+
+/**
+ * @brief Keeps dirty pages from piling up when writing through the page cache.
+ *
+ * Starts writeback of the block just written, then waits for the block before it
+ * and drops it from the cache.
+ */
+static void direct_writeback(int fd, uint64_t offset, uint32_t length)
+{
+    sync_file_range(fd, offset, length, SYNC_FILE_RANGE_WRITE);
+    if (offset >= DIRECT_IO_BLOCK_SIZE)
+    {
+        sync_file_range(fd, offset - DIRECT_IO_BLOCK_SIZE, DIRECT_IO_BLOCK_SIZE,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, offset - DIRECT_IO_BLOCK_SIZE, DIRECT_IO_BLOCK_SIZE, POSIX_FADV_DONTNEED);
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef DIRECT_IO_H
+#define DIRECT_IO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Direct I/O for very large transfers (rsend -D, rrecv -D).
+ *
+ * File data goes through a small pool of aligned blocks of DIRECT_IO_BLOCK_SIZE bytes and
+ * reaches the disk with O_DIRECT, one whole block at a time, so a transfer of any size leaves
+ * nothing behind in the page cache. Where the file system refuses O_DIRECT the same blocks go
+ * through the page cache instead: reads hint readahead for the next block and drop each block
+ * once it leaves the pool, and writes start writeback of each block with sync_file_range, wait
+ * for the one before and drop it, so dirty pages never pile up.
+ */
+
+#define DIRECT_IO_ALIGNMENT 4096
+#define DIRECT_IO_BLOCK_SIZE (1024 * 1024)
+#define DIRECT_IO_POOL_BLOCKS 4
+
+struct direct_Block
+{
+    char *data;
+
+    /* Which DIRECT_IO_BLOCK_SIZE block of the file this holds */
+    uint64_t index;
+
+    /* Bytes of the block read from the file (reader) */
+    uint32_t length;
+    uint8_t valid;
+    uint64_t last_used;
+};
+
+/* Sender side: reads the file being sent */
+struct direct_Reader
+{
+    int fd;
+
+    /* O_DIRECT is in effect; otherwise the page cache is used and cleaned up after */
+    int direct;
+    struct direct_Block blocks[DIRECT_IO_POOL_BLOCKS];
+    uint64_t clock;
+};
+
+/* Receiver side: writes the destination file as the committed offset moves forward */
+struct direct_Writer
+{
+    int fd;
+    int direct;
+    struct direct_Block blocks[DIRECT_IO_POOL_BLOCKS];
+
+    /* Every byte before this is in the file */
+    uint64_t durable_offset;
+};
+
+int direct_reader_open(struct direct_Reader *reader, const char *path);
+int direct_read(struct direct_Reader *reader, char *buffer, uint32_t length, uint64_t offset);
+void direct_reader_close(struct direct_Reader *reader);
+
+int direct_writer_open(struct direct_Writer *writer, const char *path, uint64_t start_offset);
+void direct_store(struct direct_Writer *writer, const char *bytes, uint32_t length, uint64_t offset);
+void direct_load(struct direct_Writer *writer, char *buffer, uint32_t length, uint64_t offset);
+int direct_commit(struct direct_Writer *writer, uint64_t committed_offset);
+int direct_writer_finish(struct direct_Writer *writer, uint64_t end_offset);
+void direct_writer_close(struct direct_Writer *writer);
+
+#endif
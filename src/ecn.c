@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include "ecn.h"
+
+/**
+ * @brief Marks everything sent on a socket from now on ECN-capable, ECT(0).
+ *
+ * The DSCP bits of the TOS byte are kept as they are.
+ *
+ * @param fd An IPv4 socket.
+ * @return Returns 0 on success, -1 with errno set on failure.
+ */
+int ecn_mark_outgoing(int fd)
+{
+    int tos = 0;
+    socklen_t length = sizeof(tos);
+    if (getsockopt(fd, IPPROTO_IP, IP_TOS, &tos, &length) < 0)
+    {
+        return -1;
+    }
+    tos = (tos & ~ECN_MASK) | ECN_ECT_0;
+    return setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+}
+
+/**
+ * @brief Asks for the TOS byte of every datagram received on a socket.
+ *
+ * @param fd An IPv4 socket.
+ * @return Returns 0 on success, -1 with errno set on failure.
+ */
+int ecn_enable_receive(int fd)
+{
+    int on = 1;
+    return setsockopt(fd, IPPROTO_IP, IP_RECVTOS, &on, sizeof(on));
+}
+
+/**
+ * @brief Finds the ECN field of a received datagram in its control messages.
+ *
+ * @param message The message recvmsg() or recvmmsg() filled in.
+ * @return Returns ECN_NOT_ECT, ECN_ECT_1, ECN_ECT_0 or ECN_CE; ECN_NOT_ECT if it is not there.
+ */
+uint8_t ecn_codepoint(struct msghdr *message)
+{
+    for (struct cmsghdr *entry = CMSG_FIRSTHDR(message); entry != NULL; entry = CMSG_NXTHDR(message, entry))
+    {
+        if ((entry->cmsg_level == IPPROTO_IP) && (entry->cmsg_type == IP_TOS) && (entry->cmsg_len >= CMSG_LEN(1)))
+        {
+            return *CMSG_DATA(entry) & ECN_MASK; // A single byte
+        }
+    }
+    return ECN_NOT_ECT;
+}
+
+/**
+ * @brief Receives a datagram without blocking, along with its ECN field.
+ *
+ * @param fd A socket with ecn_enable_receive() on.
+ * @param buffer Where to store the datagram.
+ * @param length The size of the buffer.
+ * @param codepoint Set to the datagram's ECN field.
+ * @return Returns the result of recvmsg().
+ */
+ssize_t ecn_recv(int fd, void *buffer, size_t length, uint8_t *codepoint)
+{
+    union
+    {
+        char bytes[ECN_CONTROL_SIZE];
+        struct cmsghdr align;
+    } control;
+    struct iovec data = {buffer, length};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control.bytes;
+    message.msg_controllen = sizeof(control.bytes);
+
+    ssize_t bytes_received = recvmsg(fd, &message, MSG_DONTWAIT);
+    *codepoint = (bytes_received >= 0) ? ecn_codepoint(&message) : ECN_NOT_ECT;
+    return bytes_received;
+}
@@ -0,0 +1,35 @@
+#ifndef ECN_H
+#define ECN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * Explicit Congestion Notification (rsend -e), through the ECN field of the IP header.
+ *
+ * The sender marks its packets ECN-capable (ECT(0)) once the receiver has agreed to echo
+ * marks. A router whose queue is building marks such a packet Congestion Experienced (CE)
+ * instead of dropping it. The receiver reads the field of every datagram from the control
+ * message IP_RECVTOS attaches, and sets ECN_ECHO_BIT on its next ACK after a CE mark. The
+ * sender halves its window on an echo, at most once per round trip, and retransmits nothing,
+ * since nothing was lost.
+ */
+
+/* The two low bits of the IP TOS byte (RFC 3168) */
+#define ECN_NOT_ECT 0x0
+#define ECN_ECT_1 0x1
+#define ECN_ECT_0 0x2
+#define ECN_CE 0x3
+#define ECN_MASK 0x3
+
+/* Room for the IP_TOS control message of one datagram */
+#define ECN_CONTROL_SIZE CMSG_SPACE(sizeof(int))
+
+int ecn_mark_outgoing(int fd);
+int ecn_enable_receive(int fd);
+uint8_t ecn_codepoint(struct msghdr *message);
+ssize_t ecn_recv(int fd, void *buffer, size_t length, uint8_t *codepoint);
+
+#endif
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fec.h"
+
+/**
+ * @brief Picks the number of data segments protected by one parity packet.
+ *
+ * One XOR parity packet repairs one loss per block, so the block is sized to keep the
+ * expected number of losses in it around FEC_TARGET_LOSSES_PER_BLOCK. Heavier loss gives
+ * smaller blocks (more redundancy), and a clean path turns parity off altogether.
+ *
+ * @param loss_rate The measured fraction of segments lost on the path (0 to 1).
+ * @return Returns the block size in segments, or 0 if no parity should be sent.
+ */
+unsigned int fec_block_segments(double loss_rate)
+{
+    if (loss_rate < FEC_LOSS_OFF_THRESHOLD) {
+        return 0;
+    }
+
+    double segments = FEC_TARGET_LOSSES_PER_BLOCK / loss_rate;
+    if (segments > FEC_MAX_BLOCK_SEGMENTS) {
+        return FEC_MAX_BLOCK_SEGMENTS;
+    }
+    if (segments < FEC_MIN_BLOCK_SEGMENTS) {
+        return FEC_MIN_BLOCK_SEGMENTS;
+    }
+    return (unsigned int)segments;
+}
+
+/**
+ * @brief Returns how many segments make up a block of the given length.
+ *
+ * @param block_length The block length in bytes, as carried in a parity header.
+ * @return Returns the number of segments in the block.
+ */
+unsigned int fec_segment_count(uint16_t block_length)
+{
+    return (block_length + PROTOCOL_DATA_SIZE - 1) / PROTOCOL_DATA_SIZE;
+}
+
+/**
+ * @brief Returns the length of one segment of a block.
+ *
+ * Every segment is PROTOCOL_DATA_SIZE long except the last, which holds the remainder.
+ *
+ * @param block_length The block length in bytes.
+ * @param segment The index of the segment within the block.
+ * @return Returns the segment length in bytes.
+ */
+uint16_t fec_segment_length(uint16_t block_length, unsigned int segment)
+{
+    uint32_t segment_start = segment * PROTOCOL_DATA_SIZE;
+    uint32_t remaining = block_length - segment_start;
+    return (remaining < PROTOCOL_DATA_SIZE) ? remaining : PROTOCOL_DATA_SIZE;
+}
+
+/**
+ * @brief XORs a segment into a parity buffer.
+ *
+ * Bytes past length are treated as zero, so short segments leave the tail of the
+ * parity untouched.
+ *
+ * @param parity The PROTOCOL_DATA_SIZE parity buffer to accumulate into.
+ * @param data The segment data.
+ * @param length The number of bytes of data.
+ */
+void fec_xor_into(char *parity, const char *data, uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++) {
+        parity[i] ^= data[i];
+    }
+}
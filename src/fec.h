@@ -0,0 +1,28 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include "our_protocol.h"
+
+/*
+ * XOR forward error correction.
+ *
+ * The sender groups up to K consecutive data segments of a window into a block and
+ * follows them with one parity packet (PARITY_BIT set). The parity header carries the
+ * seq num of the first segment and the block length in bytes; its data is the XOR of
+ * every segment in the block, zero padded to PROTOCOL_DATA_SIZE. Segments in a block
+ * are all PROTOCOL_DATA_SIZE long except the last one, so the receiver can rebuild any
+ * single missing segment of a block from the parity and the segments it already has.
+ */
+
+#define FEC_MIN_BLOCK_SEGMENTS 2
+#define FEC_MAX_BLOCK_SEGMENTS 16
+#define FEC_LOSS_OFF_THRESHOLD 0.002 /* Below this loss rate parity is not worth sending */
+#define FEC_TARGET_LOSSES_PER_BLOCK 0.25
+
+unsigned int fec_block_segments(double loss_rate);
+unsigned int fec_segment_count(uint16_t block_length);
+uint16_t fec_segment_length(uint16_t block_length, unsigned int segment);
+void fec_xor_into(char *parity, const char *data, uint16_t length);
+
+#endif
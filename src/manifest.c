@@ -0,0 +1,504 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "manifest.h"
+
+static int manifest_add_path(struct manifest_List *list, const char *path);
+static int manifest_add_entry(struct manifest_List *list, const char *path, const struct stat *info);
+static size_t manifest_find(struct manifest_List *list, uint64_t stream_offset);
+static int manifest_make_parents(char *full_path);
+static int manifest_open_entry(struct manifest_Writer *writer);
+static void manifest_close_entry(struct manifest_Writer *writer);
+
+/**
+ * @brief Reads a manifest and lists every file and directory it names.
+ *
+ * Each line is a path relative to the current directory; directories are walked
+ * recursively. Blank lines are skipped.
+ *
+ * @param list The list to fill in.
+ * @param manifest_path The manifest file.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int manifest_load(struct manifest_List *list, const char *manifest_path)
+{
+    memset(list, 0, sizeof(*list));
+    list->open_fd = -1;
+
+    FILE *manifest = fopen(manifest_path, "r");
+    if (manifest == NULL)
+    {
+        perror("Error opening manifest");
+        return -1;
+    }
+
+    char line[MANIFEST_MAX_PATH + 2];
+    int result = 0;
+    while ((result == 0) && (fgets(line, sizeof(line), manifest) != NULL))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *path = line;
+        while (strncmp(path, "./", 2) == 0)
+        {
+            path += 2;
+        }
+        if (*path == '\0')
+        {
+            continue;
+        }
+        result = manifest_add_path(list, path);
+    }
+    fclose(manifest);
+
+    if ((result == 0) && (list->count == 0))
+    {
+        fprintf(stderr, "Error: Manifest lists no files.\n");
+        result = -1;
+    }
+    return result;
+}
+
+/**
+ * @brief Reads bytes of the multi-file data stream.
+ *
+ * Frame headers are built from the entry list and file contents are read with pread.
+ * The last file read from stays open, since reads mostly move forward through the stream.
+ *
+ * @param list The entries being sent.
+ * @param stream_offset The offset in the stream to read from.
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes to read.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int manifest_read(struct manifest_List *list, uint64_t stream_offset, char *buffer, uint32_t length)
+{
+    size_t index = manifest_find(list, stream_offset);
+    while (length > 0)
+    {
+        if (index >= list->count)
+        {
+            return -1;
+        }
+        struct manifest_Entry *entry = &list->entries[index];
+        uint64_t within = stream_offset - entry->stream_offset;
+        uint64_t header_length = sizeof(struct manifest_Frame) + strlen(entry->path);
+        uint32_t bytes_read;
+
+        if (within < header_length)
+        {
+            char header[sizeof(struct manifest_Frame) + MANIFEST_MAX_PATH];
+            struct manifest_Frame frame;
+            memset(&frame, 0, sizeof(frame));
+            frame.size = entry->size;
+            frame.mode = entry->mode;
+            frame.path_length = header_length - sizeof(frame);
+            memcpy(header, &frame, sizeof(frame));
+            memcpy(header + sizeof(frame), entry->path, frame.path_length);
+
+            bytes_read = ((header_length - within) < length) ? (header_length - within) : length;
+            memcpy(buffer, header + within, bytes_read);
+        }
+        else if (within < header_length + entry->size)
+        {
+            uint64_t file_offset = within - header_length;
+            bytes_read = ((entry->size - file_offset) < length) ? (entry->size - file_offset) : length;
+
+            if ((list->open_fd < 0) || (list->open_entry != index))
+            {
+                if (list->open_fd >= 0)
+                {
+                    close(list->open_fd);
+                }
+                list->open_fd = open(entry->path, O_RDONLY);
+                list->open_entry = index;
+                if (list->open_fd < 0)
+                {
+                    perror(entry->path);
+                    return -1;
+                }
+            }
+            ssize_t got = pread(list->open_fd, buffer, bytes_read, file_offset);
+            if (got < 0)
+            {
+                perror(entry->path);
+                return -1;
+            }
+            /* A file that shrank since the manifest was read is padded with zeros */
+            memset(buffer + got, 0, bytes_read - got);
+        }
+        else
+        {
+            index++;
+            continue;
+        }
+        buffer += bytes_read;
+        stream_offset += bytes_read;
+        length -= bytes_read;
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees the entry list and closes any open file.
+ *
+ * @param list The entries that were sent.
+ */
+void manifest_free(struct manifest_List *list)
+{
+    for (size_t index = 0; index < list->count; index++)
+    {
+        free(list->entries[index].path);
+    }
+    free(list->entries);
+    if (list->open_fd >= 0)
+    {
+        close(list->open_fd);
+    }
+    memset(list, 0, sizeof(*list));
+    list->open_fd = -1;
+}
+
+/**
+ * @brief Prepares to write a multi-file stream under a destination directory.
+ *
+ * @param writer The parsing state to set up.
+ * @param root The destination directory, created if it does not exist.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int manifest_writer_init(struct manifest_Writer *writer, const char *root)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+    if ((mkdir(root, 0755) < 0) && (errno != EEXIST))
+    {
+        perror("Error creating destination directory");
+        return -1;
+    }
+    writer->root = strdup(root);
+    return (writer->root == NULL) ? -1 : 0;
+}
+
+/**
+ * @brief Writes in-order bytes of a multi-file stream.
+ *
+ * Collects each frame and path, then creates the directory or file it describes and
+ * writes the contents that follow. After an error the rest of the stream is ignored.
+ *
+ * @param writer The parsing state.
+ * @param bytes The next bytes of the stream.
+ * @param length The number of bytes.
+ * @return Returns 0 on success, -1 once anything failed.
+ */
+int manifest_write(struct manifest_Writer *writer, const char *bytes, uint32_t length)
+{
+    while ((length > 0) && !writer->failed)
+    {
+        /* Contents of the current file */
+        if (writer->fd >= 0)
+        {
+            uint32_t chunk = (writer->remaining < length) ? (uint32_t)writer->remaining : length;
+            ssize_t written = write(writer->fd, bytes, chunk);
+            if (written <= 0)
+            {
+                perror("Error writing file");
+                writer->failed = 1;
+                break;
+            }
+            bytes += written;
+            length -= written;
+            writer->remaining -= written;
+            if (writer->remaining == 0)
+            {
+                manifest_close_entry(writer);
+            }
+            continue;
+        }
+
+        /* Frame, then path */
+        uint32_t wanted = sizeof(struct manifest_Frame);
+        if (writer->header_filled >= sizeof(struct manifest_Frame))
+        {
+            wanted += writer->frame.path_length;
+        }
+        uint32_t chunk = ((wanted - writer->header_filled) < length) ? (wanted - writer->header_filled) : length;
+        memcpy(writer->header + writer->header_filled, bytes, chunk);
+        writer->header_filled += chunk;
+        bytes += chunk;
+        length -= chunk;
+
+        if (writer->header_filled == sizeof(struct manifest_Frame))
+        {
+            memcpy(&writer->frame, writer->header, sizeof(writer->frame));
+            if ((writer->frame.path_length == 0) || (writer->frame.path_length >= MANIFEST_MAX_PATH))
+            {
+                fprintf(stderr, "Error: Bad frame in multi-file stream.\n");
+                writer->failed = 1;
+            }
+        }
+        else if (writer->header_filled == sizeof(struct manifest_Frame) + writer->frame.path_length)
+        {
+            writer->header[writer->header_filled] = '\0';
+            if (manifest_open_entry(writer) < 0)
+            {
+                writer->failed = 1;
+            }
+        }
+    }
+    return writer->failed ? -1 : 0;
+}
+
+/**
+ * @brief Closes any partly written file and frees the parsing state.
+ *
+ * @param writer The parsing state.
+ */
+void manifest_writer_finish(struct manifest_Writer *writer)
+{
+    if (writer->fd >= 0)
+    {
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    free(writer->root);
+    writer->root = NULL;
+}
+
+/**
+ * @brief Checks that a path stays inside the destination directory.
+ *
+ * @param path The relative path of an entry.
+ * @return Returns 1 if the path is relative and has no ".." components, 0 otherwise.
+ */
+int manifest_path_valid(const char *path)
+{
+    if ((path[0] == '\0') || (path[0] == '/'))
+    {
+        return 0;
+    }
+    for (const char *component = path; component != NULL; )
+    {
+        if ((strncmp(component, "..", 2) == 0) && ((component[2] == '/') || (component[2] == '\0')))
+        {
+            return 0;
+        }
+        component = strchr(component, '/');
+        if (component != NULL)
+        {
+            component++;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Adds a path from the manifest, walking it if it is a directory.
+ */
+static int manifest_add_path(struct manifest_List *list, const char *path)
+{
+    struct stat info;
+    if (lstat(path, &info) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    if (!S_ISREG(info.st_mode) && !S_ISDIR(info.st_mode))
+    {
+        fprintf(stderr, "Skipping %s: not a regular file or directory\n", path);
+        return 0;
+    }
+    if (manifest_add_entry(list, path, &info) < 0)
+    {
+        return -1;
+    }
+    if (!S_ISDIR(info.st_mode))
+    {
+        return 0;
+    }
+
+    DIR *directory = opendir(path);
+    if (directory == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    int result = 0;
+    struct dirent *child;
+    while ((result == 0) && ((child = readdir(directory)) != NULL))
+    {
+        if ((strcmp(child->d_name, ".") == 0) || (strcmp(child->d_name, "..") == 0))
+        {
+            continue;
+        }
+        char child_path[MANIFEST_MAX_PATH];
+        if (snprintf(child_path, sizeof(child_path), "%s/%s", path, child->d_name) >= (int)sizeof(child_path))
+        {
+            fprintf(stderr, "Error: Path too long under %s\n", path);
+            result = -1;
+            break;
+        }
+        result = manifest_add_path(list, child_path);
+    }
+    closedir(directory);
+    return result;
+}
+
+/**
+ * @brief Appends one entry and places its frame at the end of the stream.
+ */
+static int manifest_add_entry(struct manifest_List *list, const char *path, const struct stat *info)
+{
+    size_t path_length = strlen(path);
+    while ((path_length > 1) && (path[path_length - 1] == '/'))
+    {
+        path_length--;
+    }
+    if (!manifest_path_valid(path) || (path_length >= MANIFEST_MAX_PATH))
+    {
+        fprintf(stderr, "Error: %s must be a relative path without \"..\"\n", path);
+        return -1;
+    }
+
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        struct manifest_Entry *entries = realloc(list->entries, capacity * sizeof(struct manifest_Entry));
+        if (entries == NULL)
+        {
+            perror("Error allocating manifest");
+            return -1;
+        }
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+
+    struct manifest_Entry *entry = &list->entries[list->count];
+    entry->path = strndup(path, path_length);
+    if (entry->path == NULL)
+    {
+        perror("Error allocating manifest");
+        return -1;
+    }
+    entry->size = S_ISDIR(info->st_mode) ? 0 : (uint64_t)info->st_size;
+    entry->mode = info->st_mode;
+    entry->stream_offset = list->stream_length;
+    list->stream_length += sizeof(struct manifest_Frame) + path_length + entry->size;
+    list->count++;
+    return 0;
+}
+
+/**
+ * @brief Finds the entry whose frame covers a stream offset.
+ *
+ * @return Returns the entry index, or list->count past the end of the stream.
+ */
+static size_t manifest_find(struct manifest_List *list, uint64_t stream_offset)
+{
+    if (stream_offset >= list->stream_length)
+    {
+        return list->count;
+    }
+    size_t low = 0;
+    size_t high = list->count - 1;
+    while (low < high)
+    {
+        size_t middle = low + (high - low + 1) / 2;
+        if (list->entries[middle].stream_offset <= stream_offset)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Creates every missing parent directory of a path.
+ */
+static int manifest_make_parents(char *full_path)
+{
+    for (char *slash = strchr(full_path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        int result = mkdir(full_path, 0755);
+        *slash = '/';
+        if ((result < 0) && (errno != EEXIST))
+        {
+            perror(full_path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates the directory or file described by a complete frame and path.
+ */
+static int manifest_open_entry(struct manifest_Writer *writer)
+{
+    const char *path = writer->header + sizeof(struct manifest_Frame);
+    if (!manifest_path_valid(path))
+    {
+        fprintf(stderr, "Error: Refusing to write outside the destination: %s\n", path);
+        return -1;
+    }
+
+    char full_path[strlen(writer->root) + MANIFEST_MAX_PATH + 2];
+    sprintf(full_path, "%s/%s", writer->root, path);
+    if (manifest_make_parents(full_path) < 0)
+    {
+        return -1;
+    }
+    mode_t permissions = writer->frame.mode & 07777;
+    writer->header_filled = 0;
+
+    if (S_ISDIR(writer->frame.mode))
+    {
+        if ((mkdir(full_path, permissions) < 0) && (errno != EEXIST))
+        {
+            perror(full_path);
+            return -1;
+        }
+        writer->files_written++;
+        return 0;
+    }
+
+    writer->fd = open(full_path, O_WRONLY | O_CREAT | O_TRUNC, permissions);
+    if (writer->fd < 0)
+    {
+        perror(full_path);
+        return -1;
+    }
+    if (fchmod(writer->fd, permissions) < 0)
+    {
+        perror(full_path);
+    }
+    writer->remaining = writer->frame.size;
+    if (writer->remaining == 0)
+    {
+        manifest_close_entry(writer);
+    }
+    return 0;
+}
+
+/**
+ * @brief Closes a file once all of its contents have been written.
+ */
+static void manifest_close_entry(struct manifest_Writer *writer)
+{
+    if (close(writer->fd) < 0)
+    {
+        perror("Error closing file");
+        writer->failed = 1;
+    }
+    writer->fd = -1;
+    writer->files_written++;
+}
@@ -0,0 +1,78 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "our_protocol.h"
+
+/*
+ * Multi-file transfers.
+ *
+ * The sender reads a manifest (one path per line, directories are walked recursively) and
+ * sends every entry over a single connection. The data stream is a sequence of frames:
+ * a manifest_Frame, the entry's relative path, then the contents of the file. The receiver
+ * parses the frames as bytes are committed and recreates the tree under its destination
+ * directory, so the window stays open across files and there is one handshake in total.
+ */
+
+#define MANIFEST_MAX_PATH 4096
+
+struct manifest_Frame
+{
+    /* Bytes of file contents that follow the path */
+    uint64_t size;
+
+    /* st_mode of the entry; directories carry no contents */
+    uint32_t mode;
+
+    /* Bytes of path that follow the frame, without a terminator */
+    uint16_t path_length;
+    uint16_t reserved;
+};
+
+struct manifest_Entry
+{
+    char *path;
+    uint64_t size;
+    uint32_t mode;
+
+    /* Where the entry's frame starts in the data stream */
+    uint64_t stream_offset;
+};
+
+/* Sender side: the entries being sent */
+struct manifest_List
+{
+    struct manifest_Entry *entries;
+    size_t count;
+    size_t capacity;
+    uint64_t stream_length;
+
+    /* The file most recently read from, kept open for the next read */
+    size_t open_entry;
+    int open_fd;
+};
+
+/* Receiver side: parsing state of the frames being written */
+struct manifest_Writer
+{
+    char *root;
+    char header[sizeof(struct manifest_Frame) + MANIFEST_MAX_PATH];
+    uint32_t header_filled;
+    struct manifest_Frame frame;
+    uint64_t remaining;
+    int fd;
+    int failed;
+    uint64_t files_written;
+};
+
+int manifest_load(struct manifest_List *list, const char *manifest_path);
+int manifest_read(struct manifest_List *list, uint64_t stream_offset, char *buffer, uint32_t length);
+void manifest_free(struct manifest_List *list);
+
+int manifest_writer_init(struct manifest_Writer *writer, const char *root);
+int manifest_write(struct manifest_Writer *writer, const char *bytes, uint32_t length);
+void manifest_writer_finish(struct manifest_Writer *writer);
+int manifest_path_valid(const char *path);
+
+#endif
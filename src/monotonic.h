@@ -0,0 +1,21 @@
+#ifndef MONOTONIC_H
+#define MONOTONIC_H
+
+#include <time.h>
+
+/**
+ * @brief Returns the current time on the monotonic clock, in milliseconds.
+ *
+ * Unlike clock(), which counts the CPU time of the process, this keeps running while
+ * the process blocks or shares its CPU, so timeouts measure real elapsed time.
+ *
+ * @return Returns milliseconds since an arbitrary fixed point.
+ */
+static inline double monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+#endif
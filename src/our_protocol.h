@@ -1,3 +1,6 @@
+#ifndef OUR_PROTOCOL_H
+#define OUR_PROTOCOL_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,20 +21,101 @@
 //#define MAX_WINDOW_SIZE 21750  /* Set as (uint16_t / 3) */ 
 #define PACKET_SIZE 1450 // Just data.
 
+/* Largest window when the receiver writes each segment straight to its place in the file,
+ * so the window is not limited by its reassembly buffer */
+#define MAX_SPARSE_WINDOW_SIZE (256 * PACKET_SIZE)
+
+/* Parity bit (bit 5 of the management byte) marks an FEC parity packet, see fec.h */
+#define PARITY_BIT 0x20
+
+/* Signature bit (bit 4) marks a delta-sync signature request (sender) or reply (receiver), see delta.h */
+#define SIGNATURE_BIT 0x10
+
+/* Ack-now bit (bit 3) marks the last data segment the sender sends before it waits for ACKs */
+#define ACK_NOW_BIT 0x08
+
+/* ECN-echo bit (bit 2) on an ACK says data since the previous ACK arrived marked Congestion Experienced, see ecn.h */
+#define ECN_ECHO_BIT 0x04
+
+/* Options negotiated in protocol_Sync */
+#define SYNC_OPTION_DELTA 0x1
+#define SYNC_OPTION_MANIFEST 0x2  /* Multi-file stream, see manifest.h */
+#define SYNC_OPTION_TIMESTAMPS 0x4  /* ACKs echo kernel arrival times, see timestamp.h */
+#define SYNC_OPTION_GENERATED_PATTERN 0x8  /* The stream is generated, see synthetic.h */
+#define SYNC_OPTION_GENERATED_RANDOM 0x10
+#define SYNC_OPTION_ECN 0x20  /* Data is sent ECN-capable and ACKs echo CE marks, see ecn.h */
+
 //987348
 struct protocol_Header
 {
-    /* Sync bit:7, Sync Ack bit:6, 0:5, 0:4, 0:3, 0:2, Fin bit:1, Fin ack bit:0 */
+    /* Sync bit:7, Sync Ack bit:6, Parity bit:5, Signature bit:4, Ack-now bit:3, ECN-echo bit:2, Fin bit:1, Fin ack bit:0 */
     uint8_t management_byte;
 
-    /* Servers as Seq num for sender, and Ack num for Receiver */
+    /* Servers as Seq num for sender, and Ack num for Receiver (byte offset in the data stream, mod 2^32) */
     uint32_t seq_ack_num;
+
+    /* Data bytes for data packets, block length for parity packets, 
+     * and the number of segments repaired by FEC since the last ACK for ACKs */
     uint16_t bytes_of_data;
 
+    /* CRC32C of the whole datagram with this field zeroed, see checksum.h */
+    uint32_t checksum;
+
+};
+
+/* Carried in the data of SYNC and SYNC_ACK packets */
+struct protocol_Sync
+{
+    /* Bytes the sender will transfer in total */
+    uint64_t total_bytes;
+
+    /* Byte offset the transfer starts from; chosen by the receiver when resuming */
+    uint64_t start_offset;
+
+    /* SYNC_OPTION_* bits; the SYNC_ACK echoes the ones the receiver accepted */
+    uint32_t options;
+
+    /* Number of block signatures the receiver has for delta sync */
+    uint32_t signature_count;
+
+    /* Largest window in bytes the sender will use (SYNC) or the receiver accepts (SYNC_ACK) */
+    uint32_t window_size;
+
+    /* Data bytes per packet */
+    uint16_t segment_size;
+
+    /* Data segments per ACK the sender asks for (SYNC) or the receiver will use (SYNC_ACK) */
+    uint16_t ack_frequency;
+};
+
+/* Carried after the data of FIN packets (a FIN may ride on the last data segment) 
+ * and in the data of FIN_ACK packets */
+struct protocol_Fin
+{
+    /* CRC32C of every byte of the data stream, as sent (FIN) or as written (FIN_ACK) */
+    uint32_t stream_digest;
+
+    /* Sender's retransmission timeout; the receiver lingers a few of these after FIN_ACK */
+    uint32_t rto_ms;
+};
+
+/* Carried in the data of the ACK an ack-now segment triggers, with SYNC_OPTION_TIMESTAMPS */
+struct protocol_Ack_Timestamp
+{
+    /* Sequence number of the ack-now segment */
+    uint32_t seq;
+
+    /* 1 if arrival_ns is from the receiver's NIC clock, 0 if from its system clock */
+    uint32_t hardware;
+
+    /* When the kernel received it, in nanoseconds on the receiver's clock */
+    uint64_t arrival_ns;
 };
 
 struct protocol_Packet
 {
     struct protocol_Header header;
     char data[PROTOCOL_DATA_SIZE];
-};
\ No newline at end of file
+};
+
+#endif
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf.h"
+#include "monotonic.h"
+
+/* Where tracefs may be mounted, for the id of the tracepoint hit on every system call */
+static const char *syscall_tracepoint_ids[] = {
+    "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+    "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"
+};
+
+static const char *phase_names[PERF_PHASES] = {"handshake", "data", "teardown"};
+
+/**
+ * @brief Opens one counter for the calling thread, counting from now.
+ *
+ * @param type PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE or PERF_TYPE_TRACEPOINT.
+ * @param config The event.
+ * @param exclude_kernel Whether to leave out what happens in the kernel.
+ * @return Returns the counter, or -1 if it cannot be counted.
+ */
+static int open_counter(uint32_t type, uint64_t config, int exclude_kernel)
+{
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = type;
+    attributes.config = config;
+    attributes.exclude_kernel = exclude_kernel;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+/**
+ * @brief Looks up the id of the raw_syscalls:sys_enter tracepoint.
+ *
+ * @return Returns the id, or -1 if tracefs is not there or not readable.
+ */
+static long long int syscall_tracepoint_id(void)
+{
+    for (size_t i = 0; i < sizeof(syscall_tracepoint_ids) / sizeof(syscall_tracepoint_ids[0]); i++)
+    {
+        long long int id = -1;
+        FILE *file = fopen(syscall_tracepoint_ids[i], "r");
+        if (file == NULL)
+        {
+            continue;
+        }
+        if (fscanf(file, "%lld", &id) != 1)
+        {
+            id = -1;
+        }
+        fclose(file);
+        if (id >= 0)
+        {
+            return id;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Reads a counter, scaled up for the time it was not on the PMU.
+ *
+ * @return Returns the count, or 0 for a counter that is not open.
+ */
+static double read_counter(int fd)
+{
+    uint64_t values[3]; // Count, time enabled, time running
+    if ((fd < 0) || (read(fd, values, sizeof(values)) != sizeof(values)) || (values[2] == 0))
+    {
+        return 0;
+    }
+    return (double)values[0] * values[1] / values[2];
+}
+
+/**
+ * @brief Opens the counters for the calling thread.
+ *
+ * Cycles, instructions and cache misses are counted in the kernel too if perf_event_paranoid
+ * allows it, in user space only otherwise.
+ *
+ * @param perf The counters.
+ * @return Returns the number of events that can be counted, 0 if none (a message says so).
+ */
+int perf_open(struct perf_Counters *perf)
+{
+    static const uint64_t hardware[] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+    memset(perf, 0, sizeof(*perf));
+    perf->phase = -1;
+    for (int i = 0; i < PERF_EVENTS; i++)
+    {
+        perf->fds[i] = -1;
+    }
+
+    perf->kernel_counted = 1;
+    perf->fds[Perf_Cycles] = open_counter(PERF_TYPE_HARDWARE, hardware[Perf_Cycles], 0);
+    if (perf->fds[Perf_Cycles] < 0)
+    {
+        perf->kernel_counted = 0;
+        perf->fds[Perf_Cycles] = open_counter(PERF_TYPE_HARDWARE, hardware[Perf_Cycles], 1);
+    }
+    for (int i = Perf_Instructions; i <= Perf_Cache_Misses; i++)
+    {
+        perf->fds[i] = open_counter(PERF_TYPE_HARDWARE, hardware[i], !perf->kernel_counted);
+    }
+    perf->fds[Perf_Context_Switches] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 0);
+    long long int tracepoint = syscall_tracepoint_id();
+    if (tracepoint >= 0)
+    {
+        perf->fds[Perf_Syscalls] = open_counter(PERF_TYPE_TRACEPOINT, tracepoint, 0);
+    }
+
+    int events = 0;
+    for (int i = 0; i < PERF_EVENTS; i++)
+    {
+        events += (perf->fds[i] >= 0);
+    }
+    if (events == 0)
+    {
+        printf("Performance counters unavailable\n");
+    }
+    return events;
+}
+
+/**
+ * @brief Moves to a phase of the transfer, ending the one before.
+ *
+ * Called for every state the state machine runs, so staying in the same phase costs no
+ * more than a comparison.
+ *
+ * @param perf The counters.
+ * @param phase One of enum perf_phase.
+ * @param packets The packets sent or received so far.
+ */
+void perf_enter(struct perf_Counters *perf, int phase, unsigned long long int packets)
+{
+    if (phase == perf->phase)
+    {
+        return;
+    }
+    double now = monotonic_ms();
+    for (int i = 0; i < PERF_EVENTS; i++)
+    {
+        double count = read_counter(perf->fds[i]);
+        if (perf->phase >= 0)
+        {
+            perf->counts[perf->phase][i] += count - perf->phase_start_counts[i];
+        }
+        perf->phase_start_counts[i] = count;
+    }
+    if (perf->phase >= 0)
+    {
+        perf->packets[perf->phase] += packets - perf->phase_start_packets;
+        perf->ms[perf->phase] += now - perf->phase_start_ms;
+    }
+    perf->phase = phase;
+    perf->phase_start_ms = now;
+    perf->phase_start_packets = packets;
+}
+
+/**
+ * @brief Prints one line of the report: a phase's counts divided by its packets or by the GB.
+ */
+static void print_normalized(const struct perf_Counters *perf, const char *phase, const char *per,
+                             unsigned long long int packets, double ms, const double *counts, double divisor)
+{
+    printf("%-10s %-6s %10llu %12.3f", phase, per, packets, ms);
+    for (int i = 0; i < PERF_EVENTS; i++)
+    {
+        if ((perf->fds[i] < 0) || (divisor == 0))
+        {
+            printf(" %13s", "n/a");
+        }
+        else
+        {
+            printf(" %13.4g", counts[i] / divisor);
+        }
+    }
+    if ((perf->fds[Perf_Cycles] >= 0) && (perf->fds[Perf_Instructions] >= 0) && (counts[Perf_Cycles] > 0))
+    {
+        printf(" %6.2f\n", counts[Perf_Instructions] / counts[Perf_Cycles]);
+    }
+    else
+    {
+        printf(" %6s\n", "n/a");
+    }
+}
+
+/**
+ * @brief Ends the current phase and prints the counts of every phase and of the whole
+ * transfer, per packet and per GB.
+ *
+ * @param perf The counters.
+ * @param packets The packets sent or received in all.
+ * @param bytes The bytes transferred, for the per-GB figures.
+ */
+void perf_report(struct perf_Counters *perf, unsigned long long int packets, unsigned long long int bytes)
+{
+    perf_enter(perf, -1, packets);
+    printf("Performance counters, state machine thread only (cycles, instructions, cache misses: %s):\n",
+           perf->kernel_counted ? "user and kernel" : "user only");
+    printf("%-10s %-6s %10s %12s %13s %13s %13s %13s %13s %6s\n", "phase", "per", "packets", "time_ms",
+           "cycles", "instructions", "cache_misses", "ctx_switches", "syscalls", "IPC");
+
+    double total_counts[PERF_EVENTS] = {0};
+    unsigned long long int total_packets = 0;
+    double total_ms = 0;
+    for (int phase = 0; phase < PERF_PHASES; phase++)
+    {
+        print_normalized(perf, phase_names[phase], "packet", perf->packets[phase], perf->ms[phase], perf->counts[phase], perf->packets[phase]);
+        print_normalized(perf, phase_names[phase], "GB", perf->packets[phase], perf->ms[phase], perf->counts[phase], bytes / 1e9);
+        for (int i = 0; i < PERF_EVENTS; i++)
+        {
+            total_counts[i] += perf->counts[phase][i];
+        }
+        total_packets += perf->packets[phase];
+        total_ms += perf->ms[phase];
+    }
+    print_normalized(perf, "total", "packet", total_packets, total_ms, total_counts, total_packets);
+    print_normalized(perf, "total", "GB", total_packets, total_ms, total_counts, bytes / 1e9);
+}
+
+/**
+ * @brief Closes the counters.
+ */
+void perf_close(struct perf_Counters *perf)
+{
+    for (int i = 0; i < PERF_EVENTS; i++)
+    {
+        if (perf->fds[i] >= 0)
+        {
+            close(perf->fds[i]);
+        }
+        perf->fds[i] = -1;
+    }
+}
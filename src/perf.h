@@ -0,0 +1,61 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+
+/*
+ * Hardware and software performance counters per phase of a transfer (rsend -p, rrecv -p),
+ * through perf_event_open.
+ *
+ * The counters follow the thread that runs the state machine: CPU cycles, instructions,
+ * last-level cache misses, context switches and system calls. Each state of the state
+ * machine belongs to one phase, and the counts are split at every change of phase, so the
+ * report shows what the handshake, the data exchange and the teardown each cost, per packet
+ * and per GB transferred. A syscall-bound run shows many cycles and system calls per packet
+ * with a high share of kernel cycles, a cache-bound one many cache misses and few
+ * instructions per cycle.
+ *
+ * Whatever cannot be counted (no PMU in a VM, perf_event_paranoid, no tracefs for the
+ * system call tracepoint) reports n/a. Cycles, instructions and cache misses include the
+ * kernel where allowed, user space only otherwise. Helper threads (-T, the trace flusher)
+ * are not counted. Counters multiplexed onto too few hardware counters are scaled by the
+ * time they ran.
+ */
+
+enum perf_phase
+{
+    Perf_Handshake,
+    Perf_Data,
+    Perf_Teardown,
+    PERF_PHASES
+};
+
+enum perf_event
+{
+    Perf_Cycles,
+    Perf_Instructions,
+    Perf_Cache_Misses,
+    Perf_Context_Switches,
+    Perf_Syscalls,
+    PERF_EVENTS
+};
+
+struct perf_Counters
+{
+    int fds[PERF_EVENTS];            // -1 where the event cannot be counted
+    uint8_t kernel_counted;          // Cycles, instructions and cache misses include the kernel
+    int phase;                       // -1 before the first phase
+    double phase_start_ms;
+    unsigned long long int phase_start_packets;
+    double phase_start_counts[PERF_EVENTS];
+    double counts[PERF_PHASES][PERF_EVENTS];
+    unsigned long long int packets[PERF_PHASES];
+    double ms[PERF_PHASES];
+};
+
+int perf_open(struct perf_Counters *perf);
+void perf_enter(struct perf_Counters *perf, int phase, unsigned long long int packets);
+void perf_report(struct perf_Counters *perf, unsigned long long int packets, unsigned long long int bytes);
+void perf_close(struct perf_Counters *perf);
+
+#endif
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+static void pool_cache_return(struct pool_Cache *cache, uint32_t count);
+
+/**
+ * @brief Allocates the buffers of a pool, all free.
+ *
+ * @param pool The pool.
+ * @param buffer_size Bytes per buffer, rounded up to whole cache lines.
+ * @param count The number of buffers.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int pool_init(struct pool_Pool *pool, uint32_t buffer_size, uint32_t count)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->buffer_size = (buffer_size + RING_CACHE_LINE - 1) / RING_CACHE_LINE * RING_CACHE_LINE;
+    pool->count = count;
+    pool->memory = aligned_alloc(RING_CACHE_LINE, (size_t)pool->buffer_size * count);
+    if (pool->memory == NULL)
+    {
+        fprintf(stderr, "Error allocating buffer pool\n");
+        return -1;
+    }
+    if (ring_mpsc_init(&pool->free_buffers, count) < 0)
+    {
+        free(pool->memory);
+        pool->memory = NULL;
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        struct ring_Descriptor descriptor = {pool->memory + (size_t)i * pool->buffer_size, 0, 0, 0};
+        ring_mpsc_push(&pool->free_buffers, &descriptor);
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees a pool. Every thread using it must be done with it.
+ *
+ * @param pool The pool.
+ */
+void pool_destroy(struct pool_Pool *pool)
+{
+    ring_mpsc_destroy(&pool->free_buffers);
+    free(pool->memory);
+    pool->memory = NULL;
+}
+
+/**
+ * @brief Sets up a thread's cache of a pool, empty.
+ *
+ * @param cache The cache, used by one thread only.
+ * @param pool The pool.
+ */
+void pool_cache_init(struct pool_Cache *cache, struct pool_Pool *pool)
+{
+    cache->pool = pool;
+    cache->count = 0;
+}
+
+/**
+ * @brief Takes a buffer; only one thread per pool may allocate.
+ *
+ * @param cache The calling thread's cache.
+ * @return Returns the buffer, or NULL if every buffer is in use.
+ */
+char *pool_alloc(struct pool_Cache *cache)
+{
+    if (cache->count == 0)
+    {
+        struct ring_Descriptor descriptor;
+        while (cache->count < POOL_CACHE_SIZE / 2 && ring_mpsc_pop(&cache->pool->free_buffers, &descriptor))
+        {
+            cache->buffers[cache->count++] = descriptor.data;
+        }
+        if (cache->count == 0)
+        {
+            return NULL;
+        }
+    }
+    return cache->buffers[--cache->count];
+}
+
+/**
+ * @brief Gives a buffer back; any thread.
+ *
+ * @param cache The calling thread's cache.
+ * @param buffer The buffer, from pool_alloc().
+ */
+void pool_free(struct pool_Cache *cache, char *buffer)
+{
+    if (cache->count == POOL_CACHE_SIZE)
+    {
+        pool_cache_return(cache, POOL_CACHE_SIZE / 2);
+    }
+    cache->buffers[cache->count++] = buffer;
+}
+
+/**
+ * @brief Gives every buffer in a cache back to the pool, so other threads can have them.
+ *
+ * @param cache The calling thread's cache.
+ */
+void pool_cache_flush(struct pool_Cache *cache)
+{
+    pool_cache_return(cache, cache->count);
+}
+
+/**
+ * @brief Moves the newest buffers of a cache to the pool's free ring.
+ *
+ * The free ring holds every buffer of the pool, so a push cannot fail.
+ */
+static void pool_cache_return(struct pool_Cache *cache, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        struct ring_Descriptor descriptor = {cache->buffers[--cache->count], 0, 0, 0};
+        ring_mpsc_push(&cache->pool->free_buffers, &descriptor);
+    }
+}
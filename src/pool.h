@@ -0,0 +1,45 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include "ring.h"
+
+/*
+ * Fixed-size buffer pool for packets handed between threads.
+ *
+ * One thread allocates and any thread frees, which is the shape of every handoff in rsend
+ * and rrecv: the thread that fills a buffer passes it down a ring, and the thread at the
+ * other end gives it back. Each thread goes through its own pool_Cache, a plain array it
+ * alone touches. A cache trades buffers with the pool only in batches of half its size, by
+ * way of a ring_Mpsc of free buffers, so the shared ring is touched once per batch instead
+ * of once per packet. Buffers are rounded up to whole cache lines.
+ */
+
+#define POOL_CACHE_SIZE 64
+
+struct pool_Pool
+{
+    char *memory;
+    uint32_t buffer_size;
+    uint32_t count;
+
+    /* Free buffers; any thread pushes, only the allocating thread pops */
+    struct ring_Mpsc free_buffers;
+};
+
+struct pool_Cache
+{
+    struct pool_Pool *pool;
+    char *buffers[POOL_CACHE_SIZE];
+    uint32_t count;
+};
+
+int pool_init(struct pool_Pool *pool, uint32_t buffer_size, uint32_t count);
+void pool_destroy(struct pool_Pool *pool);
+
+void pool_cache_init(struct pool_Cache *cache, struct pool_Pool *pool);
+char *pool_alloc(struct pool_Cache *cache);
+void pool_free(struct pool_Cache *cache, char *buffer);
+void pool_cache_flush(struct pool_Cache *cache);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,28 +6,188 @@
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
 #include "our_protocol.h"
+#include "fec.h"
+#include "delta.h"
+#include "checksum.h"
+#include "manifest.h"
+#include "monotonic.h"
+#include "direct_io.h"
+#include "uring.h"
+#include "ring.h"
+#include "pool.h"
+#include "trace.h"
+#include "timestamp.h"
+#include "synthetic.h"
+#include "perf.h"
+#include "batch.h"
+#include "ecn.h"
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <stdatomic.h>
 
-#define LONG_TIMER_MS 5000 // 2.5s
-#define SHORT_TIMER_MS 3
+#define LONG_TIMER_MS 5000 // Longest linger after FIN_ACK, when the sender's RTO is unknown
+#define FIN_LINGER_RTOS 3
+#define FIN_LINGER_MIN_MS 20
+#define ACK_DELAY_MAX_MS 3.0 // Longest an ACK is held back waiting for more segments
+#define ACK_DELAY_MIN_MS 0.25
+#define ACK_DELAY_RTT_FRACTION 4
+#define RTT_ALPHA 0.125
+#define CHECKPOINT_INTERVAL_BYTES (16 * 1024 * 1024)
 #define BUFFER_SIZE (sizeof(struct protocol_Packet) + 16) 
 #define MAX_PACKETS_IN_WINDOW (MAX_WINDOW_SIZE / PACKET_SIZE)
+#define ACK_FREQUENCY_MAX (MAX_PACKETS_IN_WINDOW / 2)
+#define URING_ENTRIES 16
+#define URING_BUFFERS 1024 // Four windows of the largest size, a power of two
+#define URING_BUFFER_SIZE 2048
+#define URING_BUFFER_GROUP 0
+#define URING_SOCKET_INDEX 0
+#define BIND_MAX_ATTEMPTS 100
+#define BIND_RETRY_US 10000
+#define WRITER_BUFFERS (4 * MAX_SPARSE_WINDOW_SIZE / PACKET_SIZE) // Four windows of the largest size
 
 static unsigned int receiver_current_state;
 static unsigned long long int receiver_write_rate;
 static FILE *receiver_file;
 static int receiver_socket;
-static time_t timer_start;
+static double ack_timer_start_ms;
 static char *buffered_bytes;
-static int64_t last_valid_buffer_index;  
-static int64_t first_valid_buffer_index;
+static uint8_t *buffered_valid;
+static struct parity_slot *parity_slots;
+static uint16_t repaired_segments;
 static uint32_t next_needed_seq_num;
 static uint32_t received[2];
 static uint32_t anticipate_next[2];
+static uint32_t contiguous_length;
+static uint32_t receive_window_size;
+static unsigned int parity_slot_count;
+static uint32_t socket_window_size;
+
+static uint8_t sparse_writes;
+static struct received_extent *received_extents;
+static size_t extent_count;
+static size_t extent_capacity;
+static uint64_t digest_offset;
+
+static uint8_t direct_enabled;
+static uint8_t direct_active;
+static struct direct_Writer direct_writer;
+static char *destination_path;
+
+static unsigned int worker_count = 1;
+static unsigned int transfer_count = 1;
+static int socket_receive_buffer;
+static int socket_send_buffer;
+
+static char *trace_path;
+
+static uint8_t writer_requested;
+static uint8_t writer_running;
+static pthread_t writer_thread;
+static struct ring_Spsc write_queue;
+static struct pool_Pool write_pool;
+static struct pool_Cache receive_cache;
+static unsigned long long int writes_queued;
+static _Atomic unsigned long long int writes_done;
+static _Atomic uint8_t writer_stopping;
+static _Atomic uint8_t writer_failed;
+
+static uint8_t uring_requested;
+static uint8_t uring_active;
+static struct uring_Ring uring;
+static unsigned long long int uring_packets;
+
+static uint16_t ack_frequency;
+static unsigned int segments_since_ack;
+static unsigned long long int acks_sent;
+static double receiver_rtt_ms;
+static uint8_t rtt_probe_valid;
+static uint32_t rtt_probe_seq;
+static double rtt_probe_start_ms;
+static struct timestamp_Stamp rtt_probe_stamp;
+
+static uint8_t timestamps_requested;
+static uint8_t timestamps_active;
+static uint8_t timestamps_echoed;
+static struct timestamp_Stamp arrival_stamp;
+static struct protocol_Ack_Timestamp ack_echo;
+static uint8_t ack_echo_valid;
+
+static uint8_t resume_enabled;
+static uint8_t transfer_complete;
+static char *checkpoint_path;
+static uint64_t transfer_total_bytes;
+static uint64_t transfer_start_offset;
+static uint64_t committed_offset;
+static uint64_t bytes_since_checkpoint;
+
+static uint8_t delta_enabled;
+static uint8_t delta_active;
+static struct delta_Signature *receiver_signatures;
+static uint32_t receiver_signature_count;
+static uint8_t *delta_changed_bitmap;
+static uint64_t delta_bitmap_length;
+static uint64_t *delta_changed_blocks;
+static uint64_t delta_changed_count;
+static uint64_t delta_stream_offset;
+
+static uint8_t manifest_enabled;
+static struct manifest_Writer manifest_writer;
+
+static uint32_t stream_digest;
+static uint32_t sender_stream_digest;
+static uint8_t sender_digest_received;
+static uint8_t fin_received;
+static uint32_t fin_seq_num;
+static uint32_t sender_rto_ms;
+static double linger_start_ms;
+static uint8_t transfer_failed;
+static unsigned long long int corrupted_packets;
+static unsigned long long int packets_received;
+static double transfer_start_ms;
+static struct rusage transfer_start_usage;
+
+static uint8_t sink_enabled;
+static uint8_t verify_enabled;
+static int generated_kind;
+static char *sink_bytes;
+static unsigned long long int mismatched_bytes;
+static uint64_t first_mismatch;
+
+static uint8_t perf_requested;
+static struct perf_Counters perf_counters;
+
+static unsigned int batch_size = BATCH_DEFAULT_DATAGRAMS;
+static uint8_t batch_active;
+static struct batch_Receive batch;
+
+static uint8_t ecn_echoed;
+static uint8_t ce_pending;
+static unsigned long long int ce_marked;
+static unsigned long long int ecn_echoes;
+
+/* A parity packet held until the block it protects can be checked for losses. */
+struct parity_slot
+{
+    uint8_t valid;
+    uint32_t base_seq_num;
+    uint16_t block_length;
+    char data[PROTOCOL_DATA_SIZE];
+};
+
+/* A run of stream bytes past the committed offset that is already in the file. */
+struct received_extent
+{
+    uint64_t start;
+    uint64_t end;
+};
 
 enum receiver_state
 {
@@ -46,9 +207,34 @@ enum receiver_state
 /* ================ Function Declarations Start ================ */
 /* Initialization */
 int receiver_init(unsigned short int myUDPport, char* destinationFile, unsigned long long int writeRate);
+void reset_transfer(void);
+int receive_transfers(unsigned short int udpPort, char *filename, unsigned long long int writeRate);
 int setup_socket(unsigned short int myUDPport);
+int set_socket_buffer(int option, int force_option, int bytes);
+int run_workers(unsigned short int udpPort, char *filename, unsigned long long int writeRate);
 int setup_file(char* destinationFile);
+int setup_uring(void);
+int arm_uring_recv(void);
 void setup_recv_window(void);
+int start_transfer(struct protocol_Packet *sync_packet);
+
+/* Resuming interrupted transfers */
+uint64_t load_checkpoint(uint64_t total_bytes);
+void save_checkpoint(void);
+void remove_checkpoint(void);
+
+/* Disk writer thread */
+int start_writer(void);
+void stop_writer(void);
+void *writer_main(void *argument);
+void queue_write(const char *bytes, uint32_t length, uint64_t offset);
+void drain_writes(void);
+
+/* Delta sync */
+int setup_signatures(void);
+int is_signature_request(struct protocol_Packet *receive_buffer);
+int send_signatures(uint32_t chunk);
+void write_delta(const char *bytes, uint32_t length);
 
 /* Closing file, socket, etc. */
 void receiver_finish(void);
@@ -57,19 +243,53 @@ void receiver_finish(void);
 int is_SYNC(struct protocol_Packet *receive_buffer);
 int is_data(struct protocol_Packet *receive_buffer);
 int is_FIN(struct protocol_Packet *receive_buffer);
+int is_parity(struct protocol_Packet *receive_buffer);
 int is_duplicate(uint32_t seq_num);
 
 /* Connection Setup */
 void receiver_action_Wait_Connection(void);
+int send_SYNC_ACK(void);
+int send_packet(void *packet, size_t length);
+ssize_t receive_packet(struct protocol_Packet *packet);
+ssize_t uring_receive_packet(struct protocol_Packet *packet);
+void note_codepoint(uint8_t codepoint);
+int socket_readable(double timeout_in_ms);
 
 /* Receive Data*/
 void receiver_action_Wait_for_Packet(void);
 void receiver_action_Wait_for_Pipeline(void);
-void add_data_to_buffer(struct protocol_Packet *receive_buffer);
+void handle_packet(struct protocol_Packet *receive_buffer, ssize_t length);
+void receive_batch(void);
+void process_batch(void);
+void receive_data(struct protocol_Packet *receive_buffer, ssize_t length);
+void accept_data(uint32_t seq_num, const char *bytes, uint32_t length, unsigned int segments, uint8_t ack_now);
+void receive_parity(struct protocol_Packet *receive_buffer);
+void send_ack(void);
+double ack_delay_ms(void);
+void add_data_to_buffer(uint32_t seq_num, const char *bytes, uint32_t length);
+void window_store(uint32_t index, const char *bytes, uint32_t length);
+int window_has(uint32_t index, uint32_t length);
+void window_read(uint32_t index, char *buffer, uint32_t length);
+void add_extent(uint64_t start, uint64_t end);
+void hash_from_file(uint64_t end);
+uint32_t advance_contiguous(void);
+void add_parity_to_buffer(struct protocol_Packet *receive_buffer);
+void recover_from_parity(void);
+void flush_buffer_to_file(void);
+void write_to_file(const char *bytes, uint32_t length);
+void sink_store(const char *bytes, uint32_t length, uint64_t offset);
+void sink_load(char *buffer, uint32_t length, uint64_t offset);
+void report_sink(void);
+
+/* Performance counters */
+int receiver_phase(void);
 
 /* Connection Teardown */
 void receiver_action_Send_Fin_Ack(void);
 void receiver_action_Wait_inCase(void);
+void record_fin(struct protocol_Packet *fin_packet, ssize_t length);
+int stream_complete(void);
+void check_stream_digest(void);
 /* ================ Function Declarations END ================ */
 
 /**
@@ -88,12 +308,16 @@ void rrecv(unsigned short int myUDPport, char* destinationFile, unsigned long lo
 
     // Initialize and handle if failed initialization.
     if (!receiver_init(myUDPport, destinationFile, writeRate)) {
+        transfer_failed = 1;
         receiver_finish();
         return;
     }
 
     // Main state machine loop.
     while(receiver_current_state != Finished) {
+        if (perf_requested) {
+            perf_enter(&perf_counters, receiver_phase(), packets_received);
+        }
         switch(receiver_current_state) {
             case Wait_Connection:
                 receiver_action_Wait_Connection();
@@ -113,10 +337,32 @@ void rrecv(unsigned short int myUDPport, char* destinationFile, unsigned long lo
         }
     }
 
+    if (perf_requested) {
+        perf_report(&perf_counters, packets_received, transfer_total_bytes - transfer_start_offset);
+    }
+
     // Clean up resources and exit once finished.
     receiver_finish();
 }
 
+/**
+ * @brief Returns the phase of the transfer the current state belongs to, for the
+ * performance counters. Waiting for the sender to connect counts as the handshake.
+ *
+ * @return Returns Perf_Handshake, Perf_Data or Perf_Teardown.
+ */
+int receiver_phase(void) {
+    switch (receiver_current_state) {
+        case Wait_Connection:
+            return Perf_Handshake;
+        case Wait_for_Packet:
+        case Wait_for_Pipeline:
+            return Perf_Data;
+        default:
+            return Perf_Teardown;
+    }
+}
+
 
 /**
  * @brief Initializes the receiver with the specified UDP port, destination file, and write rate.
@@ -132,29 +378,63 @@ void rrecv(unsigned short int myUDPport, char* destinationFile, unsigned long lo
 int receiver_init(unsigned short int myUDPport, 
                   char* destinationFile, 
                   unsigned long long int writeRate) {
+    reset_transfer();
+    if (perf_requested) {
+        perf_open(&perf_counters);
+    }
+    if ((trace_path != NULL) && (trace_open(trace_path, "rrecv") < 0)) {
+        return 0;
+    }
+
     // Set up UDP Socket
     if (!setup_socket(myUDPport)) {
         return 0;
     }
+    if ((batch_size > 1) && (batch_init(&batch, batch_size) < 0)) {
+        return 0;
+    }
 
-    // Setup File for Writing
-    if (!setup_file(destinationFile)) {
+    // Setup File for Writing, or the directory a multi-file transfer is written under.
+    // A sink (-n, -v) keeps nothing, so it has no file and nothing to resume.
+    if (manifest_enabled) {
+        if (manifest_writer_init(&manifest_writer, destinationFile) < 0) {
+            return 0;
+        }
+    } else if (!sink_enabled && !setup_file(destinationFile)) {
         return 0;
     }
     receiver_write_rate = writeRate;
+    destination_path = destinationFile;
+
+    // Checkpoint of the committed offset lives next to the destination file.
+    if (!sink_enabled) {
+        checkpoint_path = malloc(strlen(destinationFile) + sizeof(".ckpt"));
+        if (checkpoint_path == NULL) {
+            perror("Failed to malloc for checkpoint path.\n");
+            return 0;
+        }
+        sprintf(checkpoint_path, "%s.ckpt", destinationFile);
+    }
+    transfer_complete = 0;
+    committed_offset = 0;
+
+    // Hash the existing file so only changed blocks need to be sent.
+    if (delta_enabled && !setup_signatures()) {
+        return 0;
+    }
 
-    // Allocate memory for buffered bytes
+    // Allocate memory for buffered bytes, which bytes of it hold data, and FEC parity.
     buffered_bytes = malloc(MAX_WINDOW_SIZE);
-    if (buffered_bytes == NULL) {
+    buffered_valid = calloc(MAX_WINDOW_SIZE, sizeof(uint8_t));
+    parity_slots = calloc(MAX_SPARSE_WINDOW_SIZE / PACKET_SIZE, sizeof(struct parity_slot));
+    if (buffered_bytes == NULL || buffered_valid == NULL || parity_slots == NULL) {
         perror("Failed to malloc for buffered bytes.\n");
         return 0;
     }
-    // Initialize buffered bytes
-    for (int i = 0; i < MAX_WINDOW_SIZE; i++) {
-        buffered_bytes[i] = EOF;
-    }
+    repaired_segments = 0;
     
     // Setup receive window
+    receive_window_size = MAX_WINDOW_SIZE;
     setup_recv_window();
         
     // Set initial receiver state
@@ -162,6 +442,52 @@ int receiver_init(unsigned short int myUDPport,
     return 1;
 }
 
+/**
+ * @brief Clears what the last transfer left behind, for a receiver that runs several (-c).
+ *
+ * Everything a transfer allocates is freed, and set back to NULL, by receiver_finish();
+ * this puts the counters and flags back to how a new process starts.
+ */
+void reset_transfer(void) {
+    receiver_socket = -1;
+    extent_count = 0;
+    extent_capacity = 0;
+    sparse_writes = 0;
+    digest_offset = 0;
+    stream_digest = 0;
+    sender_stream_digest = 0;
+    sender_digest_received = 0;
+    fin_received = 0;
+    fin_seq_num = 0;
+    sender_rto_ms = 0;
+    transfer_total_bytes = 0;
+    transfer_start_offset = 0;
+    bytes_since_checkpoint = 0;
+    corrupted_packets = 0;
+    packets_received = 0;
+    acks_sent = 0;
+    receiver_rtt_ms = 0;
+    rtt_probe_valid = 0;
+    ack_echo_valid = 0;
+    timestamps_active = 0;
+    timestamps_echoed = 0;
+    uring_active = 0;
+    uring_packets = 0;
+    batch_active = 0;
+    ecn_echoed = 0;
+    ce_pending = 0;
+    ce_marked = 0;
+    ecn_echoes = 0;
+    writes_queued = 0;
+    atomic_store(&writes_done, 0);
+    atomic_store(&writer_stopping, 0);
+    atomic_store(&writer_failed, 0);
+    generated_kind = Synthetic_None;
+    mismatched_bytes = 0;
+    first_mismatch = 0;
+    getrusage(RUSAGE_SELF, &transfer_start_usage);
+}
+
 /**
  * @brief Sets up the UDP socket for the receiver.
  *
@@ -185,6 +511,38 @@ int setup_socket(unsigned short int myUDPport) {
         return 0;
     }
 
+    // Each worker binds its own socket to the port. The kernel spreads senders over them by a
+    // hash of the sender's address and port, and a connected socket gets all of its sender's
+    // packets, so a connection stays with one worker.
+    int reuse_port = 1;
+    if ((worker_count > 1) && 
+        (setsockopt(receiver_socket, SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port)) < 0)) {
+        perror("Error with setting SO_REUSEPORT.\n");
+        return 0;
+    }
+
+    // Room for a whole window of datagrams, with the kernel's per-packet overhead, so a burst 
+    // is not dropped while we are busy (or what -B asks for). The kernel caps this at 
+    // net.core.rmem_max, and the window we advertise is capped by what we got.
+    int receive_buffer_bytes = (socket_receive_buffer > 0) ? socket_receive_buffer : 4 * MAX_SPARSE_WINDOW_SIZE;
+    socklen_t option_length = sizeof(receive_buffer_bytes);
+    if (!set_socket_buffer(SO_RCVBUF, SO_RCVBUFFORCE, receive_buffer_bytes) ||
+        getsockopt(receiver_socket, SOL_SOCKET, SO_RCVBUF, &receive_buffer_bytes, &option_length) < 0) {
+        perror("Error with setting socket receive buffer.\n");
+    }
+    socket_window_size = receive_buffer_bytes / 4;
+    if ((socket_send_buffer > 0) && !set_socket_buffer(SO_SNDBUF, SO_SNDBUFFORCE, socket_send_buffer)) {
+        perror("Error with setting socket send buffer.\n");
+    }
+
+    // Kernel arrival times for the RTT probe, and for the sender's one-way delay when it asks.
+    if (timestamps_requested) {
+        timestamps_active = (timestamp_enable(receiver_socket) == 0);
+        if (!timestamps_active) {
+            printf("Kernel timestamps unavailable, timing in user space.\n");
+        }
+    }
+
     // Set socket address for receiving
     struct sockaddr_in receiver_socket_addr;
     memset(&receiver_socket_addr, 0, sizeof(struct sockaddr_in));
@@ -192,20 +550,81 @@ int setup_socket(unsigned short int myUDPport) {
     receiver_socket_addr.sin_port = htons(myUDPport);
     receiver_socket_addr.sin_addr.s_addr = htonl(INADDR_ANY); // Accept connections on any IP address.
 
-    // Bind the socket to the address and port
-    if (bind(receiver_socket, (struct sockaddr *)&receiver_socket_addr, sizeof(receiver_socket_addr)) < 0) {
-        perror("Error binding to the port.\n");
+    // Bind the socket to the address and port. The last transfer's socket can hold on to the
+    // port for a moment after it is closed, while io_uring releases it, so -c tries again.
+    int attempts = 0;
+    while (bind(receiver_socket, (struct sockaddr *)&receiver_socket_addr, sizeof(receiver_socket_addr)) < 0) {
+        if ((errno != EADDRINUSE) || (transfer_count == 1) || (++attempts >= BIND_MAX_ATTEMPTS)) {
+            perror("Error binding to the port.\n");
+            return 0;
+        }
+        usleep(BIND_RETRY_US);
+    }
+    return 1;
+}
+
+/**
+ * @brief Sizes one of the socket's buffers.
+ *
+ * A size given on the command line is forced past the net.core limits when we are
+ * privileged to (CAP_NET_ADMIN), and capped by them otherwise.
+ *
+ * @param option SO_RCVBUF or SO_SNDBUF.
+ * @param force_option SO_RCVBUFFORCE or SO_SNDBUFFORCE.
+ * @param bytes The size to ask for.
+ * @return Returns 1 on success, 0 on failure.
+ */
+int set_socket_buffer(int option, int force_option, int bytes) {
+    int configured = (option == SO_RCVBUF) ? (socket_receive_buffer > 0) : (socket_send_buffer > 0);
+    if (configured && (setsockopt(receiver_socket, SOL_SOCKET, force_option, &bytes, sizeof(bytes)) == 0)) {
+        return 1;
+    }
+    return setsockopt(receiver_socket, SOL_SOCKET, option, &bytes, sizeof(bytes)) == 0;
+}
+
+/**
+ * @brief Sets up the io_uring backend for receiving.
+ *
+ * The connected socket is registered with a new ring, together with a ring of provided
+ * buffers, and a multishot recv is armed on it. From then on datagrams land in those
+ * buffers as they arrive and are picked up from the completion ring without system calls.
+ *
+ * @return Returns 1 on success, 0 if io_uring is not available (plain system calls are used).
+ */
+int setup_uring(void) {
+    if ((uring_init(&uring, URING_ENTRIES) < 0) || 
+        (uring_register_files(&uring, &receiver_socket, 1) < 0) ||
+        (uring_setup_buffers(&uring, URING_BUFFER_GROUP, URING_BUFFERS, URING_BUFFER_SIZE) < 0) ||
+        !arm_uring_recv()) {
+        uring_close(&uring);
         return 0;
     }
+    uring_active = 1;
     return 1;
 }
 
+/**
+ * @brief Arms the multishot recv, which stays armed until the kernel runs out of buffers.
+ *
+ * @return Returns 1 on success, 0 on failure.
+ */
+int arm_uring_recv(void) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&uring);
+    if (sqe == NULL) {
+        return 0;
+    }
+    uring_prep_multishot_recv(sqe, URING_SOCKET_INDEX, URING_BUFFER_GROUP, 0);
+    return uring_submit(&uring, 0) >= 0;
+}
+
 /**
  * @brief Sets up the file for writing received data.
  * 
- * This function opens the specified file for writing. If the file cannot be opened,
- * an error message is displayed, and the function returns 0. On successful opening,
- * the file pointer is stored in a global variable for later use.
+ * This function opens the specified file for writing. When resuming or delta sync is enabled
+ * the existing contents are kept until the handshake decides how the transfer starts,
+ * otherwise the file is truncated. If the file cannot be opened, an error message is 
+ * displayed, and the function returns 0. On successful opening, the file pointer is 
+ * stored in a global variable for later use.
  *
  * @param destinationFile The path to the file where the received data will be written.
  * @return Returns 1 if the file is successfully opened, 0 otherwise.
@@ -213,8 +632,13 @@ int setup_socket(unsigned short int myUDPport) {
 int setup_file(char* destinationFile)
 {
     // Open file for writing
-    FILE *filePointer;
-    filePointer = fopen(destinationFile, "wb+");
+    FILE *filePointer = NULL;
+    if (resume_enabled || delta_enabled) {
+        filePointer = fopen(destinationFile, "rb+");
+    }
+    if (filePointer == NULL) {
+        filePointer = fopen(destinationFile, "wb+");
+    }
 
     if (filePointer == NULL) {
         perror("Error opening file.\n");
@@ -229,28 +653,419 @@ int setup_file(char* destinationFile)
  * 
  * This function sets up the initial state for the receiver's window, including the 
  * sequence number of the next needed packet and the anticipated range of packet sequence 
- * numbers.
+ * numbers, which spans receive_window_size bytes.
  */
 void setup_recv_window(void)
 {
-    next_needed_seq_num = 0;
+    next_needed_seq_num = (uint32_t)committed_offset;
     anticipate_next[0] = next_needed_seq_num;
-    anticipate_next[1] = anticipate_next[0] + (MAX_WINDOW_SIZE - 1);
+    anticipate_next[1] = anticipate_next[0] + (receive_window_size - 1);
     received[0] = anticipate_next[1] + 1;
     received[1] = anticipate_next[0] - 1;
+    contiguous_length = 0;
+    segments_since_ack = 0;
+    parity_slot_count = receive_window_size / PACKET_SIZE;
+}
+
+/**
+ * @brief Hashes the blocks of the existing destination file for delta sync.
+ *
+ * @return Returns 1 on success, 0 on failure.
+ */
+int setup_signatures(void)
+{
+    struct stat file_info;
+    if (fstat(fileno(receiver_file), &file_info) < 0) {
+        perror("Error reading file size.\n");
+        return 0;
+    }
+
+    uint64_t blocks = delta_block_count(file_info.st_size);
+    if (blocks > UINT32_MAX) {
+        fprintf(stderr, "File too large for delta sync.\n");
+        return 0;
+    }
+    receiver_signature_count = (uint32_t)blocks;
+    receiver_signatures = calloc(blocks + 1, sizeof(struct delta_Signature));
+    if (receiver_signatures == NULL) {
+        perror("Failed to malloc for signatures.\n");
+        return 0;
+    }
+    if (delta_compute_signatures(fileno(receiver_file), file_info.st_size, receiver_signatures, 1) < 0) {
+        perror("Error hashing file.\n");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Sets up the transfer described by a SYNC packet.
+ * 
+ * Segments larger than our packets are refused, and a multi-file transfer is only 
+ * accepted in multi-file mode (and the other way round).
+ * For delta sync the existing file is kept and patched in place. Otherwise decides the
+ * offset the transfer starts from (the last checkpoint when resuming a transfer of the 
+ * same size, otherwise 0), drops anything in the file past that offset and points
+ * the receive window at it. A plain file is preallocated and written sparsely, with a
+ * window as large as the sender asks for, up to MAX_SPARSE_WINDOW_SIZE. A sink (-n, -v)
+ * takes the same window without a file behind it, and -v only accepts generated data.
+ *
+ * @param sync_packet Pointer to the received SYNC packet.
+ * @return Returns 1 if the transfer was set up, 0 if it was refused or failed.
+ */
+int start_transfer(struct protocol_Packet *sync_packet)
+{
+    struct protocol_Sync sync_info;
+    memcpy(&sync_info, sync_packet->data, sizeof(sync_info));
+    transfer_total_bytes = sync_info.total_bytes;
+
+    // ACK as often as the sender asks, but at least twice per window.
+    ack_frequency = sync_info.ack_frequency;
+    if ((ack_frequency == 0) || (ack_frequency > ACK_FREQUENCY_MAX)) {
+        ack_frequency = ACK_FREQUENCY_MAX;
+    }
+    timestamps_echoed = timestamps_active && (sync_info.options & SYNC_OPTION_TIMESTAMPS);
+    // The ECN field comes with recv() and the batch; io_uring and kernel timestamps have no room for it.
+    ecn_echoed = (sync_info.options & SYNC_OPTION_ECN) && !uring_active && !timestamps_active &&
+                 (ecn_enable_receive(receiver_socket) == 0) && (!batch_active || (batch_enable_ecn(&batch) == 0));
+    generated_kind = (sync_info.options & SYNC_OPTION_GENERATED_PATTERN) ? Synthetic_Pattern :
+                     (sync_info.options & SYNC_OPTION_GENERATED_RANDOM) ? Synthetic_Random : Synthetic_None;
+    transfer_start_ms = monotonic_ms();
+
+    if (sync_info.segment_size > PROTOCOL_DATA_SIZE) {
+        fprintf(stderr, "Sender segments of %u bytes are larger than %u.\n", sync_info.segment_size, PROTOCOL_DATA_SIZE);
+        return 0;
+    }
+    if (((sync_info.options & SYNC_OPTION_MANIFEST) != 0) != manifest_enabled) {
+        fprintf(stderr, manifest_enabled ? "Sender is not sending multiple files (needs rsend -m).\n"
+                                         : "Sender is sending multiple files (needs rrecv -m).\n");
+        return 0;
+    }
+    if (manifest_enabled) {
+        transfer_start_offset = 0;
+        committed_offset = 0;
+        setup_recv_window();
+        return 1;
+    }
+    if (verify_enabled && (generated_kind == Synthetic_None)) {
+        fprintf(stderr, "Sender is not sending generated data (needs rsend -g).\n");
+        return 0;
+    }
+
+    if (delta_enabled && (sync_info.options & SYNC_OPTION_DELTA)) {
+        uint64_t blocks = delta_block_count(transfer_total_bytes);
+        delta_bitmap_length = (blocks + 7) / 8;
+        delta_changed_bitmap = calloc(delta_bitmap_length + 1, sizeof(uint8_t));
+        delta_changed_blocks = malloc((blocks + 1) * sizeof(uint64_t));
+        if (delta_changed_bitmap == NULL || delta_changed_blocks == NULL) {
+            perror("Failed to malloc for delta sync.\n");
+            return 0;
+        }
+        delta_active = 1;
+        delta_stream_offset = 0;
+        transfer_start_offset = 0;
+        committed_offset = 0;
+        setup_recv_window();
+        return 1;
+    }
+
+    transfer_start_offset = 0;
+    if (resume_enabled && transfer_total_bytes > 0) {
+        transfer_start_offset = load_checkpoint(transfer_total_bytes);
+    }
+
+    // Never resume past what actually made it to disk. A sink only keeps the window.
+    if (sink_enabled) {
+        sink_bytes = (sink_bytes == NULL) ? malloc(MAX_SPARSE_WINDOW_SIZE) : sink_bytes;
+        if (sink_bytes == NULL) {
+            perror("Failed to malloc for the sink.\n");
+            return 0;
+        }
+    } else {
+        struct stat file_info;
+        if (fstat(fileno(receiver_file), &file_info) < 0 || (uint64_t)file_info.st_size < transfer_start_offset) {
+            transfer_start_offset = 0;
+        }
+        if (ftruncate(fileno(receiver_file), transfer_start_offset) < 0) {
+            perror("Error truncating file.\n");
+        }
+        fseeko(receiver_file, transfer_start_offset, SEEK_SET);
+    }
+
+    if (transfer_start_offset > 0) {
+        printf("Resuming transfer at byte %llu\n", (unsigned long long int)transfer_start_offset);
+    }
+    committed_offset = transfer_start_offset;
+    bytes_since_checkpoint = 0;
+
+    // Each segment is written straight to its place in the file, so the window is not
+    // limited by the reassembly buffer; reserve the space up front to avoid fragmentation.
+    sparse_writes = 1;
+    digest_offset = transfer_start_offset;
+    receive_window_size = sync_info.window_size;
+    receive_window_size = (receive_window_size > MAX_SPARSE_WINDOW_SIZE) ? MAX_SPARSE_WINDOW_SIZE : receive_window_size;
+    receive_window_size = (receive_window_size > socket_window_size) ? socket_window_size : receive_window_size;
+    receive_window_size -= receive_window_size % PACKET_SIZE;
+    receive_window_size = (receive_window_size < MAX_WINDOW_SIZE) ? MAX_WINDOW_SIZE : receive_window_size;
+    if (!sink_enabled && (transfer_total_bytes > transfer_start_offset) && 
+        (fallocate(fileno(receiver_file), 0, transfer_start_offset, transfer_total_bytes - transfer_start_offset) < 0) &&
+        (errno != EOPNOTSUPP)) {
+        perror("Error preallocating file.\n");
+    }
+
+    // With -D the segments are gathered in aligned blocks and written with O_DIRECT instead.
+    if (direct_enabled) {
+        direct_active = (direct_writer_open(&direct_writer, destination_path, transfer_start_offset) == 0);
+        if (!direct_active) {
+            fprintf(stderr, "Direct I/O unavailable, writing through the page cache.\n");
+            direct_writer_close(&direct_writer);
+        }
+    }
+    if (writer_requested && !direct_active && (start_writer() < 0)) {
+        fprintf(stderr, "Writer thread unavailable, writing from the receive loop.\n");
+    }
+    setup_recv_window();
+    return 1;
+}
+
+/**
+ * @brief Reads the committed offset saved for an interrupted transfer.
+ * 
+ * The checkpoint is only trusted if it was written for a transfer of the same size.
+ *
+ * @param total_bytes The size of the transfer being set up.
+ * @return Returns the offset to resume from, or 0 if there is no usable checkpoint.
+ */
+uint64_t load_checkpoint(uint64_t total_bytes)
+{
+    FILE *checkpoint = fopen(checkpoint_path, "r");
+    if (checkpoint == NULL) {
+        return 0;
+    }
+
+    unsigned long long int saved_total_bytes, saved_offset;
+    int fields = fscanf(checkpoint, "%llu %llu", &saved_total_bytes, &saved_offset);
+    fclose(checkpoint);
+
+    if (fields != 2 || saved_total_bytes != total_bytes || saved_offset > total_bytes) {
+        return 0;
+    }
+    return saved_offset;
+}
+
+/**
+ * @brief Persists the committed offset so an interrupted transfer can resume.
+ * 
+ * The written data is flushed to disk first so the checkpoint never claims bytes that
+ * could still be lost, and the checkpoint is replaced atomically through a rename.
+ */
+void save_checkpoint(void)
+{
+    drain_writes();
+    fflush(receiver_file);
+    fdatasync(fileno(receiver_file));
+
+    char temporary_path[strlen(checkpoint_path) + sizeof(".tmp")];
+    sprintf(temporary_path, "%s.tmp", checkpoint_path);
+
+    FILE *checkpoint = fopen(temporary_path, "w");
+    if (checkpoint == NULL) {
+        perror("Error opening checkpoint.\n");
+        return;
+    }
+    // Direct I/O only writes whole blocks, so the file is complete up to the last block written.
+    uint64_t durable_offset = direct_active ? direct_writer.durable_offset : committed_offset;
+    fprintf(checkpoint, "%llu %llu\n", (unsigned long long int)transfer_total_bytes, 
+            (unsigned long long int)durable_offset);
+    fflush(checkpoint);
+    fsync(fileno(checkpoint));
+    fclose(checkpoint);
+
+    if (rename(temporary_path, checkpoint_path) < 0) {
+        perror("Error saving checkpoint.\n");
+    }
+    bytes_since_checkpoint = 0;
+}
+
+/**
+ * @brief Removes the checkpoint once the transfer has completed.
+ */
+void remove_checkpoint(void)
+{
+    if (unlink(checkpoint_path) < 0 && errno != ENOENT) {
+        perror("Error removing checkpoint.\n");
+    }
+}
+
+/**
+ * @brief Starts the thread that writes received segments to the file.
+ *
+ * The receive loop copies each verified segment into a buffer of write_pool and passes its
+ * descriptor down write_queue, so it can go back to the socket while the writer thread waits
+ * on the pwrite(). The writer gives each buffer back to the pool once it is written.
+ *
+ * @return Returns 0 on success, -1 on failure.
+ */
+int start_writer(void)
+{
+    if (pool_init(&write_pool, PACKET_SIZE, WRITER_BUFFERS) < 0) {
+        return -1;
+    }
+    if (ring_spsc_init(&write_queue, WRITER_BUFFERS) < 0) {
+        pool_destroy(&write_pool);
+        return -1;
+    }
+    pool_cache_init(&receive_cache, &write_pool);
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        fprintf(stderr, "Error starting writer thread\n");
+        ring_spsc_destroy(&write_queue);
+        pool_destroy(&write_pool);
+        return -1;
+    }
+    writer_running = 1;
+    return 0;
+}
+
+/**
+ * @brief Waits for every queued segment to be written, then stops the writer thread.
+ */
+void stop_writer(void)
+{
+    if (!writer_running) {
+        return;
+    }
+    drain_writes();
+    atomic_store_explicit(&writer_stopping, 1, memory_order_release);
+    pthread_join(writer_thread, NULL);
+    writer_running = 0;
+    if (atomic_load(&writer_failed)) {
+        transfer_failed = 1;
+    }
+    ring_spsc_destroy(&write_queue);
+    pool_destroy(&write_pool);
+}
+
+/**
+ * @brief The writer thread: writes each queued segment at its offset in the file.
+ *
+ * @param argument Unused.
+ * @return Returns NULL.
+ */
+void *writer_main(void *argument)
+{
+    (void)argument;
+    struct pool_Cache writer_cache;
+    pool_cache_init(&writer_cache, &write_pool);
+    struct ring_Descriptor segment;
+    unsigned int idle_rounds = 0;
+
+    while (!atomic_load_explicit(&writer_stopping, memory_order_acquire)) {
+        if (!ring_spsc_pop(&write_queue, &segment)) {
+            // Let the receive loop have back the buffers written so far before going idle.
+            if (idle_rounds == 0) {
+                pool_cache_flush(&writer_cache);
+            }
+            ring_backoff(&idle_rounds);
+            continue;
+        }
+        idle_rounds = 0;
+        if (pwrite(fileno(receiver_file), segment.data, segment.length, segment.stream_offset) != (ssize_t)segment.length) {
+            perror("Error writing to file.");
+            atomic_store(&writer_failed, 1);
+        }
+        pool_free(&writer_cache, segment.data);
+        atomic_fetch_add_explicit(&writes_done, 1, memory_order_release);
+    }
+    pool_cache_flush(&writer_cache);
+    return NULL;
+}
+
+/**
+ * @brief Hands a segment to the writer thread.
+ *
+ * @param bytes The bytes, copied into a pool buffer.
+ * @param length The number of bytes, at most PACKET_SIZE.
+ * @param offset The file offset to write them at.
+ */
+void queue_write(const char *bytes, uint32_t length, uint64_t offset)
+{
+    unsigned int idle_rounds = 0;
+    char *buffer;
+    while ((buffer = pool_alloc(&receive_cache)) == NULL) {
+        ring_backoff(&idle_rounds);
+    }
+    memcpy(buffer, bytes, length);
+
+    struct ring_Descriptor segment = {buffer, offset, length, 0};
+    while (!ring_spsc_push(&write_queue, &segment)) {
+        ring_backoff(&idle_rounds);
+    }
+    writes_queued++;
+}
+
+/**
+ * @brief Waits until the writer thread has written every queued segment.
+ *
+ * Called before the file is read back, synced or closed.
+ */
+void drain_writes(void)
+{
+    unsigned int idle_rounds = 0;
+    while (writer_running && (atomic_load_explicit(&writes_done, memory_order_acquire) != writes_queued)) {
+        ring_backoff(&idle_rounds);
+    }
 }
 
 /**
  * @brief Cleans up resources used by the receiver.
  * 
- * This function frees the allocated buffer for received bytes, closes the open file (if any),
- * and closes the socket. It is used to clean up resources before the receiver shuts down.
+ * This function saves a checkpoint for an unfinished resumable transfer, frees the allocated
+ * buffer for received bytes, closes the open file (if any), and closes the socket. It is used
+ * to clean up resources before the receiver shuts down.
  */
 void receiver_finish(void) {
+    stop_writer();
+    trace_close();
+    if (perf_requested) {
+        perf_close(&perf_counters);
+    }
+
+    // Leave a checkpoint behind if the transfer stopped part way.
+    if (resume_enabled && !delta_active && !transfer_complete && transfer_total_bytes > 0 && receiver_file != NULL) {
+        save_checkpoint();
+    }
+    if (checkpoint_path != NULL) {
+        free(checkpoint_path);
+        checkpoint_path = NULL;
+    }
+
     // Free the buffer if it exists
     if (buffered_bytes != NULL) {
         free(buffered_bytes);
+        buffered_bytes = NULL;
     }
+    if (buffered_valid != NULL) {
+        free(buffered_valid);
+        buffered_valid = NULL;
+    }
+    free(received_extents);
+    received_extents = NULL;
+    free(sink_bytes);
+    sink_bytes = NULL;
+    direct_writer_close(&direct_writer);
+    if (parity_slots != NULL) {
+        free(parity_slots);
+        parity_slots = NULL;
+    }
+    if (manifest_enabled) {
+        manifest_writer_finish(&manifest_writer);
+    }
+    free(receiver_signatures);
+    free(delta_changed_bitmap);
+    free(delta_changed_blocks);
+    receiver_signatures = NULL;
+    delta_changed_bitmap = NULL;
+    delta_changed_blocks = NULL;
 
     // Close the file if it's open
     if (receiver_file != NULL) {
@@ -258,9 +1073,15 @@ void receiver_finish(void) {
         receiver_file = NULL;
     }
 
+    if (uring_active) {
+        uring_close(&uring);
+    }
+    batch_free(&batch);
+
     // Close the socket if it's open
     if (receiver_socket >= 0) {
         close(receiver_socket);
+        receiver_socket = -1;
     }
 }
 
@@ -281,14 +1102,16 @@ int is_SYNC(struct protocol_Packet *receive_buffer) {
 /**
  * @brief Checks if the incoming packet is a data packet.
  * 
- * This function checks if the management_byte in the packet header is zero,
- * indicating a data packet.
+ * This function checks if the management_byte in the packet header is zero, or only
+ * has the FIN bit set on a packet that carries data (the last segment of the stream),
+ * indicating a data packet. The ack-now bit may be set on either.
  *
  * @param receive_buffer Pointer to the received protocol packet.
  * @return Returns 1 if it's a data packet, 0 otherwise.
  */
 int is_data(struct protocol_Packet *receive_buffer) {
-    return receive_buffer->header.management_byte == 0;
+    uint8_t management_byte = receive_buffer->header.management_byte & ~ACK_NOW_BIT;
+    return (management_byte == 0) || ((management_byte == 0x2) && (receive_buffer->header.bytes_of_data > 0));
 }
 
 /**
@@ -305,6 +1128,29 @@ int is_FIN(struct protocol_Packet *receive_buffer) {
     return FIN_bit == 0x2;
 }
 
+/**
+ * @brief Checks if the incoming packet is an FEC parity packet.
+ * 
+ * This function checks the management_byte in the packet header to determine
+ * if only the parity bit (bit 5) is set.
+ *
+ * @param receive_buffer Pointer to the received protocol packet.
+ * @return Returns 1 if it's a parity packet, 0 otherwise.
+ */
+int is_parity(struct protocol_Packet *receive_buffer) {
+    return receive_buffer->header.management_byte == PARITY_BIT;
+}
+
+/**
+ * @brief Checks if the incoming packet is a request for a chunk of block signatures.
+ *
+ * @param receive_buffer Pointer to the received protocol packet.
+ * @return Returns 1 if it's a signature request, 0 otherwise.
+ */
+int is_signature_request(struct protocol_Packet *receive_buffer) {
+    return receive_buffer->header.management_byte == SIGNATURE_BIT;
+}
+
 /**
  * @brief Checks if the incoming sequence number is a duplicate.
  *
@@ -335,17 +1181,24 @@ int is_duplicate(uint32_t seq_num) {
  *
  * Waits for a SYNC packet from the sender to establish a connection.
  * Upon receiving a SYNC packet, sends a SYNC ACK back to the sender.
+ * Nothing else is going on, so this blocks in poll() rather than spinning, which matters
+ * when many receivers sit idle on one host.
  */
 void receiver_action_Wait_Connection(void) 
 {
     char buffer[BUFFER_SIZE];
     struct sockaddr_in sender_addr;
     socklen_t addr_size = sizeof(sender_addr);
+    if (socket_readable(LONG_TIMER_MS) <= 0) {
+        return;
+    }
 
     // Check for any incoming packets
     ssize_t packet_size = recvfrom(receiver_socket, buffer, sizeof(buffer), 0, (struct sockaddr *)&sender_addr, &addr_size);
 
-    if (packet_size > 0) {
+    if ((packet_size > 0) && !packet_checksum_valid(buffer, packet_size)) {
+        corrupted_packets++;
+    } else if (packet_size > 0) {
         // Check if was a SYNC packet.
         if (is_SYNC((struct protocol_Packet *)buffer)) {
             
@@ -353,17 +1206,20 @@ void receiver_action_Wait_Connection(void)
             if (connect(receiver_socket, (struct sockaddr *)&sender_addr, addr_size) < 0) {
                 perror("Error connecting to sender.\n");
             }
-                // Send SYNC_ACK back to sender to complete handshaking.
-            struct protocol_Header SYNC_ACK_packet;
-            memset(&SYNC_ACK_packet, 0, sizeof(SYNC_ACK_packet));
-            
-            SYNC_ACK_packet.management_byte = 0x40; // set second-highest bit for SYNC ACK.
-            // Everything else should already be zero'd...
+            if (uring_requested && !uring_active && !setup_uring()) {
+                printf("io_uring unavailable, using plain system calls.\n");
+            }
+            // The batch takes the place of recv(); io_uring and kernel timestamps have their own.
+            batch_active = (batch.capacity > 0) && !uring_active && !timestamps_active;
 
-            if (send(receiver_socket, &SYNC_ACK_packet, sizeof(SYNC_ACK_packet), 0) < 0) {
+            // Decide where the transfer starts, then send SYNC_ACK back to sender to complete handshaking.
+            // A refused SYNC is still answered, so the sender learns what we expected.
+            int accepted = start_transfer((struct protocol_Packet *)buffer);
+            if (!send_SYNC_ACK()) {
                 perror("Error with sending SYNC_ACK.\n");
             }
-            receiver_current_state = Wait_for_Packet;
+            receiver_current_state = accepted ? Wait_for_Packet : Finished;
+            transfer_failed = !accepted;
         }
     } else if ((packet_size < 0)  && (errno != EAGAIN && errno != EWOULDBLOCK)) {
         perror("Error with recvfrom.\n");
@@ -373,68 +1229,214 @@ void receiver_action_Wait_Connection(void)
 }
 
 /**
- * @brief Handles the Wait for Packet state of the receiver.
+ * @brief Sends a SYNC_ACK packet to the sender.
  *
- * Waits for data packets from the sender. Processes received packets,
- * checks for duplicates, and handles SYNC and FIN packets.
+ * The SYNC_ACK carries the offset the transfer starts from, so a resuming sender
+ * can seek straight to it, the window and segment size we accept, and for delta sync 
+ * how many block signatures there are to fetch.
+ *
+ * @return Returns 1 if the SYNC_ACK was sent, 0 otherwise.
  */
-void receiver_action_Wait_for_Packet(void) {
-    // Check for any incoming packets...
-    struct protocol_Packet receive_buffer;
-    ssize_t bytes_received = recv(receiver_socket, &receive_buffer, sizeof(struct protocol_Packet), MSG_DONTWAIT);
+int send_SYNC_ACK(void)
+{
+    struct protocol_Packet SYNC_ACK_packet;
+    memset(&SYNC_ACK_packet, 0, sizeof(SYNC_ACK_packet));
+    
+    SYNC_ACK_packet.header.management_byte = 0x40; // set second-highest bit for SYNC ACK.
 
-    if (bytes_received > 0) 
-    {
-        // Handle checking if valid seq packet, duplicate, finish, etc.
-        if (is_SYNC(&receive_buffer)) 
-        {
-            // Send SYNC_ACK back to sender to complete handshaking.
-            struct protocol_Header SYNC_ACK_packet;
-            memset(&SYNC_ACK_packet, 0, sizeof(SYNC_ACK_packet));
-            
-            SYNC_ACK_packet.management_byte = 0x40; // set second-highest bit for SYNC ACK.
-            // Everything else should already be zero'd...
+    struct protocol_Sync sync_info;
+    memset(&sync_info, 0, sizeof(sync_info));
+    sync_info.total_bytes = transfer_total_bytes;
+    sync_info.start_offset = transfer_start_offset;
+    sync_info.window_size = receive_window_size;
+    sync_info.segment_size = PROTOCOL_DATA_SIZE;
+    sync_info.ack_frequency = ack_frequency;
+    if (delta_active) {
+        sync_info.options = SYNC_OPTION_DELTA;
+        sync_info.signature_count = receiver_signature_count;
+    }
+    if (manifest_enabled) {
+        sync_info.options |= SYNC_OPTION_MANIFEST;
+    }
+    if (timestamps_echoed) {
+        sync_info.options |= SYNC_OPTION_TIMESTAMPS;
+    }
+    if (ecn_echoed) {
+        sync_info.options |= SYNC_OPTION_ECN;
+    }
+    memcpy(SYNC_ACK_packet.data, &sync_info, sizeof(sync_info));
+    // Everything else should already be zero'd...
 
-            if (send(receiver_socket, &SYNC_ACK_packet, sizeof(SYNC_ACK_packet), 0) < 0) {
-                perror("Error with sending SYNC_ACK.\n");
-                receiver_current_state = Finished;
-            }
-        }
-        else if (is_data(&receive_buffer)) 
-        {
-            // Check if valid sequence packet or is a duplicate.
-            uint32_t sequence_num_received = receive_buffer.header.seq_ack_num;
-            uint32_t bytes_data_in_packet = receive_buffer.header.bytes_of_data;
-
-            if (is_duplicate(sequence_num_received))
-            {   
-                // Duplicate or invalid, send cumulative ACK right away.
-                struct protocol_Header ACK_packet;
-                memset(&ACK_packet, 0, sizeof(ACK_packet));
-                                
-                ACK_packet.seq_ack_num = sequence_num_received + bytes_data_in_packet;
-                // Everything else should already be zero'd...
-                
-                if (send(receiver_socket, &ACK_packet, sizeof(ACK_packet), 0) < 0) {
-                    perror("Error with sending ACK.");
-                    receiver_current_state = Finished;
-                }
-            } 
-            else {      
-                // ADD it to the buffered_bytes
-                last_valid_buffer_index = -1;  
-                first_valid_buffer_index = MAX_WINDOW_SIZE;
-
-                add_data_to_buffer(&receive_buffer);
-                // Start small countdown-timer and now wait for pipeline.
-                timer_start = clock();
-                receiver_current_state = Wait_for_Pipeline;
-            }
-        } 
-        else if (is_FIN(&receive_buffer)) 
-        {
-            receiver_current_state = Send_Fin_Ack;
+    size_t packet_size = sizeof(struct protocol_Header) + sizeof(sync_info);
+    return send_packet(&SYNC_ACK_packet, packet_size) >= 0;
+}
+
+/**
+ * @brief Checksums and sends a packet to the sender.
+ *
+ * @param packet The packet, starting with a protocol_Header.
+ * @param length The number of bytes of the packet to send, header included.
+ * @return Returns the result of send().
+ */
+int send_packet(void *packet, size_t length)
+{
+    packet_set_checksum(packet, length);
+    return send(receiver_socket, packet, length, 0);
+}
+
+/**
+ * @brief Polls the socket for a packet from the sender.
+ *
+ * Packets whose checksum does not match are counted and dropped before they can 
+ * reach the buffer, as if they were lost.
+ * With kernel timestamps on, the time it arrived is left in arrival_stamp.
+ * With ECN negotiated, a CE mark on it is noted for the next ACK.
+ *
+ * @param packet Where to store the packet.
+ * @return Returns the result of recv(), or -1 with errno set to EAGAIN for a corrupted packet.
+ */
+ssize_t receive_packet(struct protocol_Packet *packet)
+{
+    ssize_t bytes_received;
+    uint8_t codepoint = ECN_NOT_ECT;
+    if (uring_active) {
+        bytes_received = uring_receive_packet(packet);
+    } else if (timestamps_active) {
+        bytes_received = timestamp_recv(receiver_socket, packet, sizeof(struct protocol_Packet), &arrival_stamp);
+    } else if (ecn_echoed) {
+        bytes_received = ecn_recv(receiver_socket, packet, sizeof(struct protocol_Packet), &codepoint);
+    } else {
+        bytes_received = recv(receiver_socket, packet, sizeof(struct protocol_Packet), MSG_DONTWAIT);
+    }
+    if ((bytes_received > 0) && !packet_checksum_valid(packet, bytes_received)) {
+        corrupted_packets++;
+        trace_event(Trace_Corrupt, packet->header.seq_ack_num, bytes_received, 0);
+        errno = EAGAIN;
+        return -1;
+    }
+    packets_received += (bytes_received > 0);
+    note_codepoint(codepoint);
+    return bytes_received;
+}
+
+/**
+ * @brief Notes a Congestion Experienced mark, to be echoed on the next ACK.
+ *
+ * @param codepoint The ECN field of a packet that arrived intact.
+ */
+void note_codepoint(uint8_t codepoint) {
+    if (codepoint == ECN_CE) {
+        ce_marked++;
+        ce_pending = 1;
+    }
+}
+
+/**
+ * @brief Takes the next datagram the multishot recv completed, without a system call.
+ *
+ * The datagram is copied out and its buffer handed straight back. A completion without
+ * IORING_CQE_F_MORE means the recv is no longer armed (for instance the buffers ran out
+ * while we were busy, and the datagrams that did not fit were left in the socket), so it is
+ * armed again.
+ *
+ * @param packet Where to store the packet.
+ * @return Returns the number of bytes received, or -1 with errno set (EAGAIN if there are none).
+ */
+ssize_t uring_receive_packet(struct protocol_Packet *packet)
+{
+    struct io_uring_cqe *cqe = uring_peek_cqe(&uring);
+    if (cqe == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+    int32_t result = cqe->res;
+    uint32_t flags = cqe->flags;
+    uring_cqe_seen(&uring);
+
+    ssize_t bytes_received = result;
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned buffer_id = flags >> IORING_CQE_BUFFER_SHIFT;
+        bytes_received = (result > (int32_t)sizeof(struct protocol_Packet)) ? (ssize_t)sizeof(struct protocol_Packet) : result;
+        if (bytes_received > 0) {
+            memcpy(packet, uring_buffer(&uring, buffer_id), bytes_received);
         }
+        uring_recycle_buffer(&uring, buffer_id);
+        uring_packets++;
+    }
+    if (!(flags & IORING_CQE_F_MORE) && !arm_uring_recv()) {
+        perror("Error re-arming io_uring recv.");
+    }
+    if (result < 0) {
+        errno = (result == -ENOBUFS) ? EAGAIN : -result;
+        return -1;
+    }
+    return bytes_received;
+}
+
+/**
+ * @brief Waits for a packet from the sender, on the socket or the completion ring.
+ *
+ * @param timeout_in_ms How long to wait at most.
+ * @return Returns 1 if a packet is waiting, 0 on timeout, -1 on error.
+ */
+int socket_readable(double timeout_in_ms) {
+    if (uring_active) {
+        return uring_wait(&uring, timeout_in_ms);
+    }
+    struct pollfd socket_poll = { .fd = receiver_socket, .events = POLLIN };
+    return poll(&socket_poll, 1, (int)timeout_in_ms + 1);
+}
+
+/**
+ * @brief Sends one chunk of the block signature list to the sender.
+ *
+ * Requests outside the list, or when delta sync was not negotiated, are ignored.
+ *
+ * @param chunk The index of the chunk of DELTA_SIGNATURES_PER_PACKET signatures.
+ * @return Returns 1 unless sending failed.
+ */
+int send_signatures(uint32_t chunk)
+{
+    uint64_t first = (uint64_t)chunk * DELTA_SIGNATURES_PER_PACKET;
+    if (!delta_active || first >= receiver_signature_count) {
+        return 1;
+    }
+
+    uint64_t entries = receiver_signature_count - first;
+    if (entries > DELTA_SIGNATURES_PER_PACKET) {
+        entries = DELTA_SIGNATURES_PER_PACKET;
+    }
+
+    struct protocol_Packet signature_packet;
+    memset(&signature_packet.header, 0, sizeof(signature_packet.header));
+    signature_packet.header.management_byte = SIGNATURE_BIT;
+    signature_packet.header.seq_ack_num = chunk;
+    signature_packet.header.bytes_of_data = entries * sizeof(struct delta_Signature);
+    memcpy(signature_packet.data, &receiver_signatures[first], signature_packet.header.bytes_of_data);
+
+    size_t packet_size = sizeof(struct protocol_Header) + signature_packet.header.bytes_of_data;
+    return send_packet(&signature_packet, packet_size) >= 0;
+}
+
+/**
+ * @brief Handles the Wait for Packet state of the receiver.
+ *
+ * Waits for data packets from the sender while no ACK is pending. Processes received 
+ * packets, checks for duplicates, and handles SYNC and FIN packets.
+ */
+void receiver_action_Wait_for_Packet(void) {
+    if (batch_active) {
+        receive_batch();
+        return;
+    }
+
+    // Check for any incoming packets...
+    struct protocol_Packet receive_buffer;
+    ssize_t bytes_received = receive_packet(&receive_buffer);
+
+    if (bytes_received > 0) 
+    {
+        handle_packet(&receive_buffer, bytes_received);
     } 
     else if ((bytes_received == -1) && (errno != EAGAIN && errno != EWOULDBLOCK)) 
     {
@@ -447,139 +1449,871 @@ void receiver_action_Wait_for_Packet(void) {
 /**
  * @brief Handles the Wait for Pipeline state of the receiver.
  *
- * Waits for additional packets in the pipeline. Processes received data packets,
- * checks for duplicates, and handles writing data to the file after a short timer.
+ * Holds back the ACK for segments that arrived in order, waiting for more of the pipeline.
+ * Processes received data and parity packets, and once the ACK delay runs out sends the 
+ * cumulative ACK that is pending.
  */
 void receiver_action_Wait_for_Pipeline(void) 
 {
-    // Check for any incoming FINs (just in-case)...
-    struct protocol_Packet receive_buffer;
-    ssize_t bytes_received = recv(receiver_socket, &receive_buffer, 
-                                    sizeof(struct protocol_Packet), MSG_DONTWAIT);
-    
-    if (bytes_received > 0 && is_data(&receive_buffer)) 
+    if (batch_active) 
     {
-        uint32_t sequence_num_received = receive_buffer.header.seq_ack_num;
-        if (!is_duplicate(sequence_num_received))
-        {       
-            add_data_to_buffer(&receive_buffer);
-        }            
+        receive_batch();
     }
-    else if ((bytes_received == -1) && (errno != EAGAIN && errno != EWOULDBLOCK)) 
+    else
     {
-        perror("Error with recv while waiting for pipeline.");
-        receiver_current_state = Finished;
+        struct protocol_Packet receive_buffer;
+        ssize_t bytes_received = receive_packet(&receive_buffer);
+
+        if (bytes_received > 0)
+        {
+            handle_packet(&receive_buffer, bytes_received);
+        }
+        else if ((bytes_received == -1) && (errno != EAGAIN && errno != EWOULDBLOCK)) 
+        {
+            perror("Error with recv while waiting for pipeline.");
+            receiver_current_state = Finished;
+        }
     }
 
-    clock_t time_elapsed_ms = (clock() - timer_start) * 1000 / CLOCKS_PER_SEC;
-    
-    if (time_elapsed_ms > SHORT_TIMER_MS) 
+    if ((receiver_current_state == Wait_for_Pipeline) && 
+        (monotonic_ms() - ack_timer_start_ms > ack_delay_ms())) 
     {
-        if (first_valid_buffer_index == 0)
-        {
-            for (int i = 0; (i <= last_valid_buffer_index && i < MAX_WINDOW_SIZE); i++)
-            {   
-                fputc(buffered_bytes[i], receiver_file);
-                next_needed_seq_num++;
-                buffered_bytes[i] = EOF;
-            }
+        send_ack();
+    }
+}
+
+/**
+ * @brief Acts on one packet received while data is flowing.
+ *
+ * Data and parity are taken in either state. SYNC (our SYNC_ACK was lost), signature 
+ * requests and FIN are only acted on in Wait_for_Packet; with an ACK pending they are left 
+ * for the sender to send again.
+ *
+ * @param receive_buffer The packet.
+ * @param length The number of bytes received.
+ */
+void handle_packet(struct protocol_Packet *receive_buffer, ssize_t length) {
+    if (is_data(receive_buffer)) 
+    {
+        receive_data(receive_buffer, length);
+    } 
+    else if (is_parity(receive_buffer))
+    {
+        receive_parity(receive_buffer);
+    }
+    else if (receiver_current_state != Wait_for_Packet)
+    {
+        return;
+    }
+    else if (is_SYNC(receive_buffer)) 
+    {
+        // Send SYNC_ACK back to sender to complete handshaking.
+        if (!send_SYNC_ACK()) {
+            perror("Error with sending SYNC_ACK.\n");
+            receiver_current_state = Finished;
         }
-        
-        // Send Cumulative ACK
-        struct protocol_Header ACK_packet;
-        memset(&ACK_packet, 0, sizeof(ACK_packet));
+    }
+    else if (is_signature_request(receive_buffer))
+    {
+        if (!send_signatures(receive_buffer->header.seq_ack_num)) {
+            perror("Error with sending signatures.");
+            receiver_current_state = Finished;
+        }
+    }
+    else if (is_FIN(receive_buffer)) 
+    {
+        record_fin(receive_buffer, length);
+        receiver_current_state = Send_Fin_Ack;
+    }
+}
 
-        ACK_packet.seq_ack_num = next_needed_seq_num;
-        // Everything else should already be zero'd...
-        
-        if (send(receiver_socket, &ACK_packet, sizeof(ACK_packet), 0) < 0) {
-            perror("Error with sending ACK.");
+/**
+ * @brief Receives a batch of datagrams with one system call and acts on all of them.
+ *
+ * Packets whose checksum does not match are counted and dropped, as in receive_packet().
+ */
+void receive_batch(void) {
+    if (batch_receive(&batch, receiver_socket) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("Error with recvmmsg.");
             receiver_current_state = Finished;
         }
+        return;
+    }
+    for (unsigned int i = 0; i < batch.count; i++) {
+        if (!batch_checksum_valid(&batch, i)) {
+            corrupted_packets++;
+            trace_event(Trace_Corrupt, batch.headers[i].seq_ack_num, batch.lengths[i], 0);
+            batch.lengths[i] = 0;
+            continue;
+        }
+        packets_received++;
+        if (ecn_echoed) {
+            note_codepoint(batch.codepoints[i]);
+        }
+    }
+    process_batch();
+}
+
+/**
+ * @brief Acts on the datagrams of a batch, in the order batch_classify() put them in.
+ *
+ * Each run of in-window data segments that continues in the stream and lies in consecutive 
+ * slots of the batch is stored with one copy. A run stops where the ACK frequency says an ACK 
+ * is due, so the sender is ACKed as often as it would be one segment at a time, and a segment 
+ * that arrives out of order goes on its own, with the ACK that tells the sender about the hole.
+ * A segment the ACKs of this batch already moved the window past is handled as the duplicate 
+ * it now is. Everything else goes through handle_packet(). Once the transfer moves on to its
+ * teardown the rest of the batch is dropped, as if lost.
+ */
+void process_batch(void) {
+    batch_classify(&batch, next_needed_seq_num, receive_window_size);
+
+    struct protocol_Packet receive_buffer;
+    unsigned int next = 0;
+    while ((next < batch.count) && (receiver_current_state == Wait_for_Packet || receiver_current_state == Wait_for_Pipeline)) {
+        unsigned int first = batch.order[next];
+        uint32_t seq_num = batch.headers[first].seq_ack_num;
+        if (!batch.fast[first] || is_duplicate(seq_num) ||
+            (seq_num - next_needed_seq_num + batch.headers[first].bytes_of_data > receive_window_size)) {
+            if (batch.lengths[first] > 0) {
+                batch_packet(&batch, first, &receive_buffer);
+                handle_packet(&receive_buffer, batch.lengths[first]);
+            }
+            next++;
+            continue;
+        }
+
+        unsigned int limit = (segments_since_ack < ack_frequency) ? ack_frequency - segments_since_ack : 1;
+        limit = ((seq_num - next_needed_seq_num) == contiguous_length) ? limit : 1;
+        unsigned int segments = 1;
+        uint32_t length = batch.headers[first].bytes_of_data;
+        while ((segments < limit) && (next + segments < batch.count) && (batch.order[next + segments] == first + segments) &&
+               batch.fast[first + segments] && (length == (uint32_t)segments * PROTOCOL_DATA_SIZE) &&
+               (batch.headers[first + segments].seq_ack_num == seq_num + length) &&
+               (seq_num - next_needed_seq_num + length + batch.headers[first + segments].bytes_of_data <= receive_window_size)) {
+            length += batch.headers[first + segments].bytes_of_data;
+            segments++;
+        }
+        for (unsigned int i = 0; i < segments; i++) {
+            trace_event(Trace_Receive, batch.headers[first + i].seq_ack_num, batch.headers[first + i].bytes_of_data, 0);
+        }
+        accept_data(seq_num, batch_payload(&batch, first), length, segments, 0);
+        next += segments;
+    }
+}
+
+/**
+ * @brief Takes a data segment: a duplicate is ACKed right away, new data is buffered.
+ *
+ * @param receive_buffer The data packet.
+ * @param length The number of bytes received.
+ */
+void receive_data(struct protocol_Packet *receive_buffer, ssize_t length) {
+    uint32_t sequence_num_received = receive_buffer->header.seq_ack_num;
+    uint32_t bytes_data_in_packet = receive_buffer->header.bytes_of_data;
+    if (is_FIN(receive_buffer)) {
+        record_fin(receive_buffer, length);
+    }
 
-        anticipate_next[0] = next_needed_seq_num;
-        anticipate_next[1] = anticipate_next[0] + (MAX_WINDOW_SIZE - 1);
-        received[0] = anticipate_next[1] + 1;
-        received[1] = anticipate_next[0] - 1;
+    if (is_duplicate(sequence_num_received))
+    {   
+        // Duplicate or invalid, send cumulative ACK right away.
+        trace_event(Trace_Receive, sequence_num_received, bytes_data_in_packet, 1);
+        send_ack();
+        return;
+    }
+    trace_event(Trace_Receive, sequence_num_received, bytes_data_in_packet, 0);
 
-        receiver_current_state = Wait_for_Packet;
+    if (bytes_data_in_packet > PROTOCOL_DATA_SIZE) {
+        bytes_data_in_packet = PROTOCOL_DATA_SIZE;
     }
+    accept_data(sequence_num_received, receive_buffer->data, bytes_data_in_packet, 1,
+                (receive_buffer->header.management_byte & ACK_NOW_BIT) != 0);
 }
 
+/**
+ * @brief Buffers new data in the window, one segment or a run of them, and decides whether to ACK now.
+ *
+ * An ACK goes out right away when the data arrives out of order (so the sender learns of 
+ * the hole), fills a hole, completes the stream, carries the sender's ack-now bit, or brings
+ * the segments since the last ACK to the negotiated ACK frequency. Otherwise the ACK is 
+ * delayed, waiting for more segments in Wait_for_Pipeline.
+ *
+ * @param seq_num The sequence number of the first byte, inside the window.
+ * @param bytes The data.
+ * @param length The number of bytes.
+ * @param segments The number of segments they came in.
+ * @param ack_now Whether the (last) segment carried the ack-now bit.
+ */
+void accept_data(uint32_t seq_num, const char *bytes, uint32_t length, unsigned int segments, uint8_t ack_now) {
+    // The first new data after an ack-now was sent in response to our ACK.
+    if (rtt_probe_valid && ((int32_t)(seq_num - rtt_probe_seq) >= 0)) {
+        double sample = monotonic_ms() - rtt_probe_start_ms;
+        int64_t interval_ns;
+        if (timestamps_active && timestamp_interval(&rtt_probe_stamp, &arrival_stamp, &interval_ns)) {
+            sample = interval_ns / 1e6;
+        }
+        receiver_rtt_ms = (receiver_rtt_ms == 0) ? sample : (1 - RTT_ALPHA) * receiver_rtt_ms + RTT_ALPHA * sample;
+        rtt_probe_valid = 0;
+    }
+
+    uint32_t old_contiguous = contiguous_length;
+    uint8_t in_order = (seq_num - next_needed_seq_num) == old_contiguous;
+    add_data_to_buffer(seq_num, bytes, length);
+    segments_since_ack += segments;
+    uint8_t filled_hole = (advance_contiguous() - old_contiguous) > length;
+
+    if (!in_order || filled_hole || stream_complete() || ack_now || (segments_since_ack >= ack_frequency))
+    {
+        if (ack_now && in_order && !rtt_probe_valid) {
+            rtt_probe_seq = seq_num + length;
+            rtt_probe_start_ms = monotonic_ms();
+            rtt_probe_stamp = arrival_stamp;
+            rtt_probe_valid = 1;
+        }
+        // The ACK an ack-now segment triggers tells the sender when the segment got here.
+        if (ack_now && timestamps_echoed) {
+            ack_echo.seq = seq_num;
+            ack_echo.hardware = (arrival_stamp.hardware_ns != 0);
+            ack_echo.arrival_ns = ack_echo.hardware ? arrival_stamp.hardware_ns : arrival_stamp.software_ns;
+            ack_echo_valid = (ack_echo.arrival_ns != 0);
+        }
+        send_ack();
+    } 
+    else if (receiver_current_state == Wait_for_Packet)
+    {
+        // Start the ACK delay and now wait for pipeline.
+        ack_timer_start_ms = monotonic_ms();
+        receiver_current_state = Wait_for_Pipeline;
+    }
+}
 
 /**
- * @brief Adds data from a received packet to the buffer.
+ * @brief Buffers a parity packet and ACKs right away if it repaired a hole.
+ *
+ * @param receive_buffer The parity packet.
+ */
+void receive_parity(struct protocol_Packet *receive_buffer) {
+    add_parity_to_buffer(receive_buffer);
+
+    uint32_t old_contiguous = contiguous_length;
+    recover_from_parity();
+    if (advance_contiguous() != old_contiguous) {
+        send_ack();
+    }
+}
+
+/**
+ * @brief Writes out the in-order data and sends a cumulative ACK.
+ *
+ * Repairs what it can from parity first, and reports how many segments parity saved a 
+ * retransmit for. With timestamps negotiated, the ACK for an ack-now segment also carries
+ * when that segment arrived. With ECN negotiated, it echoes any CE mark since the last ACK. Once the stream is complete the FIN_ACK acknowledges everything instead.
+ * The receiver then waits for packets with no ACK pending.
+ */
+void send_ack(void) {
+    recover_from_parity();
+    flush_buffer_to_file();
+    receiver_current_state = Wait_for_Packet;
+
+    if (stream_complete()) {
+        repaired_segments = 0;
+        receiver_current_state = Send_Fin_Ack;
+        return;
+    }
+
+    struct protocol_Packet ACK_packet;
+    memset(&ACK_packet.header, 0, sizeof(ACK_packet.header));
+
+    ACK_packet.header.seq_ack_num = next_needed_seq_num;
+    ACK_packet.header.bytes_of_data = repaired_segments;
+    repaired_segments = 0;
+    if (ce_pending) {
+        ACK_packet.header.management_byte = ECN_ECHO_BIT;
+        ce_pending = 0;
+        ecn_echoes++;
+    }
+    // Everything else should already be zero'd...
+
+    size_t packet_size = sizeof(struct protocol_Header);
+    if (ack_echo_valid) {
+        memcpy(ACK_packet.data, &ack_echo, sizeof(ack_echo));
+        packet_size += sizeof(ack_echo);
+        ack_echo_valid = 0;
+    }
+    
+    if (send_packet(&ACK_packet, packet_size) < 0) {
+        perror("Error with sending ACK.");
+        receiver_current_state = Finished;
+    }
+    acks_sent++;
+    segments_since_ack = 0;
+    trace_event(Trace_Ack_Sent, next_needed_seq_num, 0, receive_window_size);
+
+    anticipate_next[0] = next_needed_seq_num;
+    anticipate_next[1] = anticipate_next[0] + (receive_window_size - 1);
+    received[0] = anticipate_next[1] + 1;
+    received[1] = anticipate_next[0] - 1;
+}
+
+/**
+ * @brief Works out how long an ACK may be held back.
  * 
- * This function processes the received packet and adds its data to the buffer. 
- * It calculates the buffer index based on the sequence number and stores the data 
- * accordingly. It also updates the indices for the first and last valid buffer positions.
+ * A fraction of the round trip measured from our ACKs to the new data they release, 
+ * clamped to ACK_DELAY_MIN_MS..ACK_DELAY_MAX_MS, or ACK_DELAY_MAX_MS before there is a measurement.
  *
- * @param receive_buffer Pointer to the received protocol packet.
+ * @return Returns the ACK delay in milliseconds.
  */
-void add_data_to_buffer(struct protocol_Packet *receive_buffer) {
-    uint32_t buffer_index;
-    uint32_t local_seq_num = receive_buffer->header.seq_ack_num;
-    uint16_t bytes_data_in_packet = receive_buffer->header.bytes_of_data;
-    buffer_index = local_seq_num - next_needed_seq_num;
-    if (buffer_index == 0) {
-        first_valid_buffer_index = 0;
+double ack_delay_ms(void) {
+    double delay_ms = (receiver_rtt_ms > 0) ? receiver_rtt_ms / ACK_DELAY_RTT_FRACTION : ACK_DELAY_MAX_MS;
+    delay_ms = (delay_ms < ACK_DELAY_MIN_MS) ? ACK_DELAY_MIN_MS : delay_ms;
+    return (delay_ms > ACK_DELAY_MAX_MS) ? ACK_DELAY_MAX_MS : delay_ms;
+}
+
+/**
+ * @brief Adds received data to the buffer.
+ * 
+ * Works out where in the window the data goes from its sequence number and stores it 
+ * there. Bytes past the end of the window are dropped.
+ *
+ * @param seq_num The sequence number of the first byte, inside the window.
+ * @param bytes The data.
+ * @param length The number of bytes.
+ */
+void add_data_to_buffer(uint32_t seq_num, const char *bytes, uint32_t length) {
+    uint32_t buffer_index = seq_num - next_needed_seq_num;
+    if (buffer_index + length > receive_window_size) {
+        length = receive_window_size - buffer_index;
     }
+    window_store(buffer_index, bytes, length);
+}
 
-    for (int i = 0; i < bytes_data_in_packet; i++) {
-        buffer_index = local_seq_num - next_needed_seq_num;
-        buffered_bytes[buffer_index] = receive_buffer->data[i];
-        local_seq_num++;
+/**
+ * @brief Stores bytes of the window and marks them as received.
+ * 
+ * Normally the bytes wait in the reassembly buffer until everything before them has arrived.
+ * With sparse writes they go straight to their final offset in the file (or the sink) and
+ * only the extent is remembered; bytes that continue the stream digest are hashed on the way.
+ *
+ * @param index Where the bytes start, relative to next_needed_seq_num.
+ * @param bytes The bytes.
+ * @param length The number of bytes.
+ */
+void window_store(uint32_t index, const char *bytes, uint32_t length) {
+    if (!sparse_writes) {
+        memcpy(&buffered_bytes[index], bytes, length);
+        memset(&buffered_valid[index], 1, length);
+        return;
     }
-    if (buffer_index >= last_valid_buffer_index) 
-    {
-        last_valid_buffer_index = buffer_index;       
+
+    uint64_t offset = committed_offset + index;
+    if (sink_enabled) {
+        sink_store(bytes, length, offset);
+    } else if (direct_active) {
+        direct_store(&direct_writer, bytes, length, offset);
+    } else if (writer_running) {
+        for (uint32_t queued = 0; queued < length; queued += PACKET_SIZE) {
+            queue_write(bytes + queued, ((length - queued) < PACKET_SIZE) ? (length - queued) : PACKET_SIZE, offset + queued);
+        }
+    } else if (pwrite(fileno(receiver_file), bytes, length, offset) != (ssize_t)length) {
+        perror("Error writing to file.");
+        transfer_failed = 1;
+        receiver_current_state = Finished;
+        return;
+    }
+    if ((offset <= digest_offset) && (digest_offset < offset + length)) {
+        uint32_t already_hashed = digest_offset - offset;
+        stream_digest = crc32c_extend(stream_digest, bytes + already_hashed, length - already_hashed);
+        digest_offset = offset + length;
     }
+    add_extent(offset, offset + length);
 }
 
+/**
+ * @brief Checks whether every byte of a range of the window has been received.
+ *
+ * @param index Where the range starts, relative to next_needed_seq_num.
+ * @param length The number of bytes.
+ * @return Returns 1 if all of them are in, 0 otherwise.
+ */
+int window_has(uint32_t index, uint32_t length) {
+    if (!sparse_writes) {
+        return memchr(&buffered_valid[index], 0, length) == NULL;
+    }
+
+    uint64_t start = committed_offset + index;
+    for (size_t i = 0; (i < extent_count) && (received_extents[i].start <= start); i++) {
+        if (start + length <= received_extents[i].end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads back received bytes of the window.
+ *
+ * @param index Where the bytes start, relative to next_needed_seq_num.
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes.
+ */
+void window_read(uint32_t index, char *buffer, uint32_t length) {
+    if (!sparse_writes) {
+        memcpy(buffer, &buffered_bytes[index], length);
+        return;
+    }
+    if (sink_enabled) {
+        sink_load(buffer, length, committed_offset + index);
+        return;
+    }
+    if (direct_active) {
+        direct_load(&direct_writer, buffer, length, committed_offset + index);
+        return;
+    }
+    drain_writes();
+    if (pread(fileno(receiver_file), buffer, length, committed_offset + index) != (ssize_t)length) {
+        perror("Error reading back file.");
+        memset(buffer, 0, length);
+    }
+}
+
+/**
+ * @brief Records that a range of the stream is in the file.
+ *
+ * The extents are kept sorted, and ranges that overlap or touch are merged, so there is
+ * one extent per run of received bytes; with no holes there is just one.
+ *
+ * @param start The stream offset of the first byte.
+ * @param end The stream offset just past the last byte.
+ */
+void add_extent(uint64_t start, uint64_t end) {
+    size_t first = 0;
+    while ((first < extent_count) && (received_extents[first].end < start)) {
+        first++;
+    }
+    size_t last = first;
+    while ((last < extent_count) && (received_extents[last].start <= end)) {
+        start = (received_extents[last].start < start) ? received_extents[last].start : start;
+        end = (received_extents[last].end > end) ? received_extents[last].end : end;
+        last++;
+    }
+
+    if (first == last) {
+        if (extent_count == extent_capacity) {
+            size_t capacity = (extent_capacity == 0) ? 16 : extent_capacity * 2;
+            struct received_extent *extents = realloc(received_extents, capacity * sizeof(struct received_extent));
+            if (extents == NULL) {
+                perror("Failed to realloc for received extents.");
+                return;
+            }
+            received_extents = extents;
+            extent_capacity = capacity;
+        }
+        memmove(&received_extents[first + 1], &received_extents[first], (extent_count - first) * sizeof(struct received_extent));
+        extent_count++;
+    } else {
+        memmove(&received_extents[first + 1], &received_extents[last], (extent_count - last) * sizeof(struct received_extent));
+        extent_count -= last - first - 1;
+    }
+    received_extents[first].start = start;
+    received_extents[first].end = end;
+}
+
+/**
+ * @brief Extends the stream digest over bytes that are already in the file.
+ * 
+ * Used for sparse writes, when a hole is filled and the bytes that arrived out of order
+ * after it become part of the in-order stream. With direct I/O they are still in the block pool.
+ *
+ * @param end The stream offset to hash up to.
+ */
+void hash_from_file(uint64_t end) {
+    char chunk[16 * PROTOCOL_DATA_SIZE];
+    while (digest_offset < end) {
+        uint32_t length = ((end - digest_offset) < sizeof(chunk)) ? (end - digest_offset) : sizeof(chunk);
+        window_read(digest_offset - committed_offset, chunk, length);
+        stream_digest = crc32c_extend(stream_digest, chunk, length);
+        digest_offset += length;
+    }
+}
+
+/**
+ * @brief Extends the run of in-order bytes at the front of the window.
+ * 
+ * In the reassembly buffer only the bytes past the run already known are scanned, up to
+ * the first hole. With sparse writes the run is the extent starting at the committed offset.
+ *
+ * @return Returns the number of bytes at the front of the window received in order.
+ */
+uint32_t advance_contiguous(void) {
+    if (sparse_writes) {
+        uint8_t in_order = (extent_count > 0) && (received_extents[0].start <= committed_offset);
+        contiguous_length = in_order ? (uint32_t)(received_extents[0].end - committed_offset) : 0;
+        return contiguous_length;
+    }
+    uint8_t *first_hole = memchr(buffered_valid + contiguous_length, 0, MAX_WINDOW_SIZE - contiguous_length);
+    contiguous_length = (first_hole == NULL) ? MAX_WINDOW_SIZE : (uint32_t)(first_hole - buffered_valid);
+    return contiguous_length;
+}
+
+/**
+ * @brief Holds a parity packet until its block can be checked for losses.
+ * 
+ * Parity for blocks that start before the window (already written) is ignored. A slot
+ * already holding the same block is refreshed, otherwise a free slot is used, and if none
+ * is free the parity replaces the slot its block maps onto.
+ *
+ * @param receive_buffer Pointer to the received parity packet.
+ */
+void add_parity_to_buffer(struct protocol_Packet *receive_buffer) {
+    uint32_t base_seq_num = receive_buffer->header.seq_ack_num;
+    uint16_t block_length = receive_buffer->header.bytes_of_data;
+
+    if (block_length == 0 || block_length > FEC_MAX_BLOCK_SEGMENTS * PROTOCOL_DATA_SIZE) {
+        return;
+    }
+    if (is_duplicate(base_seq_num)) {
+        return;
+    }
+
+    struct parity_slot *slot = NULL;
+    for (unsigned int i = 0; i < parity_slot_count; i++) {
+        if (parity_slots[i].valid && parity_slots[i].base_seq_num == base_seq_num) {
+            slot = &parity_slots[i];
+            break;
+        }
+        if (!parity_slots[i].valid && slot == NULL) {
+            slot = &parity_slots[i];
+        }
+    }
+    if (slot == NULL) {
+        slot = &parity_slots[(base_seq_num / PROTOCOL_DATA_SIZE) % parity_slot_count];
+    }
+
+    slot->valid = 1;
+    slot->base_seq_num = base_seq_num;
+    slot->block_length = block_length;
+    memcpy(slot->data, receive_buffer->data, PROTOCOL_DATA_SIZE);
+}
+
+/**
+ * @brief Rebuilds lost segments from the parity packets being held.
+ * 
+ * A block with exactly one incomplete segment is repaired by XORing its parity with
+ * the other segments of the block. Parity for blocks that have already been written
+ * or that turned out complete is released; blocks missing more than one segment keep
+ * their parity in case retransmissions leave only one hole.
+ */
+void recover_from_parity(void) {
+    for (unsigned int i = 0; i < parity_slot_count; i++) {
+        struct parity_slot *slot = &parity_slots[i];
+        if (!slot->valid) {
+            continue;
+        }
+
+        uint32_t block_index = slot->base_seq_num - next_needed_seq_num;
+        if (block_index >= receive_window_size) {
+            slot->valid = 0; // Block was already written out.
+            continue;
+        }
+        if (block_index + slot->block_length > receive_window_size) {
+            continue;
+        }
+
+        unsigned int segments = fec_segment_count(slot->block_length);
+        unsigned int missing = 0;
+        unsigned int missing_segment = 0;
+        for (unsigned int s = 0; s < segments; s++) {
+            uint32_t segment_index = block_index + s * PROTOCOL_DATA_SIZE;
+            if (!window_has(segment_index, fec_segment_length(slot->block_length, s))) {
+                missing++;
+                missing_segment = s;
+            }
+        }
+        if (missing != 1) {
+            if (missing == 0) {
+                slot->valid = 0;
+            }
+            continue;
+        }
+
+        char rebuilt[PROTOCOL_DATA_SIZE];
+        char segment[PROTOCOL_DATA_SIZE];
+        memcpy(rebuilt, slot->data, PROTOCOL_DATA_SIZE);
+        for (unsigned int s = 0; s < segments; s++) {
+            if (s != missing_segment) {
+                uint16_t segment_length = fec_segment_length(slot->block_length, s);
+                window_read(block_index + s * PROTOCOL_DATA_SIZE, segment, segment_length);
+                fec_xor_into(rebuilt, segment, segment_length);
+            }
+        }
+
+        uint32_t missing_index = block_index + missing_segment * PROTOCOL_DATA_SIZE;
+        uint16_t missing_length = fec_segment_length(slot->block_length, missing_segment);
+        window_store(missing_index, rebuilt, missing_length);
+        trace_event(Trace_Repair, next_needed_seq_num + missing_index, missing_length, 0);
+        repaired_segments++;
+        slot->valid = 0;
+    }
+}
+
+/**
+ * @brief Writes the in-order bytes at the front of the buffer to the file.
+ * 
+ * Only the contiguous run of received bytes starting at next_needed_seq_num is written;
+ * anything after a hole is shifted to the front of the buffer to wait for the hole to fill.
+ * With sparse writes the bytes are already in the file, so the run is only committed: 
+ * hashed into the digest where it arrived out of order, and dropped from the extents.
+ */
+void flush_buffer_to_file(void) {
+    uint32_t contiguous = advance_contiguous();
+
+    if (contiguous == 0) {
+        return;
+    }
+
+    if (sparse_writes) {
+        hash_from_file(committed_offset + contiguous);
+        extent_count--;
+        memmove(&received_extents[0], &received_extents[1], extent_count * sizeof(struct received_extent));
+    } else {
+        write_to_file(buffered_bytes, contiguous);
+        memmove(buffered_bytes, buffered_bytes + contiguous, MAX_WINDOW_SIZE - contiguous);
+        memmove(buffered_valid, buffered_valid + contiguous, MAX_WINDOW_SIZE - contiguous);
+        memset(buffered_valid + MAX_WINDOW_SIZE - contiguous, 0, contiguous);
+    }
+    next_needed_seq_num += contiguous;
+    committed_offset += contiguous;
+    bytes_since_checkpoint += contiguous;
+    contiguous_length = 0;
+
+    if ((direct_active && (direct_commit(&direct_writer, committed_offset) < 0)) ||
+        atomic_load_explicit(&writer_failed, memory_order_relaxed)) {
+        transfer_failed = 1;
+        receiver_current_state = Finished;
+        return;
+    }
+    if (resume_enabled && bytes_since_checkpoint >= CHECKPOINT_INTERVAL_BYTES) {
+        save_checkpoint();
+    }
+}
+
+
+/**
+ * @brief Writes in-order bytes of the data stream to the file.
+ *
+ * Each byte passes through here exactly once, so this is also where the stream digest
+ * is extended, while the bytes are still in cache.
+ *
+ * @param bytes The next bytes of the stream.
+ * @param length The number of bytes.
+ */
+void write_to_file(const char *bytes, uint32_t length) {
+    stream_digest = crc32c_extend(stream_digest, bytes, length);
+    if (manifest_enabled) {
+        manifest_write(&manifest_writer, bytes, length);
+        return;
+    }
+    if (delta_active) {
+        write_delta(bytes, length);
+        return;
+    }
+    fwrite(bytes, 1, length, receiver_file);
+}
+
+/**
+ * @brief Keeps received bytes in the sink, in place of writing them to a file.
+ *
+ * The sink holds the window in a ring of MAX_SPARSE_WINDOW_SIZE bytes, indexed by stream
+ * offset, so out-of-order bytes can still be hashed and parity can still repair losses.
+ * With -v every arrival is also compared with the generator the sender used.
+ *
+ * @param bytes The bytes.
+ * @param length The number of bytes.
+ * @param offset Their offset in the stream.
+ */
+void sink_store(const char *bytes, uint32_t length, uint64_t offset) {
+    uint32_t start = offset % MAX_SPARSE_WINDOW_SIZE;
+    uint32_t first = ((MAX_SPARSE_WINDOW_SIZE - start) < length) ? (MAX_SPARSE_WINDOW_SIZE - start) : length;
+    memcpy(sink_bytes + start, bytes, first);
+    memcpy(sink_bytes, bytes + first, length - first);
+    if (verify_enabled) {
+        uint32_t differing = synthetic_check(generated_kind, bytes, length, offset);
+        if ((differing > 0) && (mismatched_bytes == 0)) {
+            first_mismatch = offset;
+        }
+        mismatched_bytes += differing;
+    }
+}
+
+/**
+ * @brief Reads back bytes of the window from the sink.
+ *
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes.
+ * @param offset Their offset in the stream.
+ */
+void sink_load(char *buffer, uint32_t length, uint64_t offset) {
+    uint32_t start = offset % MAX_SPARSE_WINDOW_SIZE;
+    uint32_t first = ((MAX_SPARSE_WINDOW_SIZE - start) < length) ? (MAX_SPARSE_WINDOW_SIZE - start) : length;
+    memcpy(buffer, sink_bytes + start, first);
+    memcpy(buffer + first, sink_bytes, length - first);
+}
+
+/**
+ * @brief Reports what the sink received, and with -v whether it matched the generator.
+ */
+void report_sink(void) {
+    if (!verify_enabled) {
+        printf("Discarded %llu bytes.\n", (unsigned long long int)transfer_total_bytes);
+    } else if (mismatched_bytes > 0) {
+        fprintf(stderr, "Generated data check failed: %llu bytes differ, the first at byte %llu.\n",
+                mismatched_bytes, (unsigned long long int)first_mismatch);
+        transfer_failed = 1;
+    } else {
+        printf("Verified %llu bytes of generated %s data.\n", (unsigned long long int)transfer_total_bytes,
+                synthetic_name(generated_kind));
+    }
+}
+
+/**
+ * @brief Applies in-order bytes of a delta sync stream to the file.
+ *
+ * The stream starts with the changed-block bitmap; once it is complete the list of 
+ * changed blocks is built and the block contents that follow are written in place 
+ * with pwrite.
+ *
+ * @param bytes The next bytes of the stream.
+ * @param length The number of bytes.
+ */
+void write_delta(const char *bytes, uint32_t length) {
+    while (length > 0) {
+        uint32_t written;
+        if (delta_stream_offset < delta_bitmap_length) {
+            written = ((delta_bitmap_length - delta_stream_offset) < length) ? (delta_bitmap_length - delta_stream_offset) : length;
+            memcpy(delta_changed_bitmap + delta_stream_offset, bytes, written);
+
+            if (delta_stream_offset + written == delta_bitmap_length) {
+                uint64_t blocks = delta_block_count(transfer_total_bytes);
+                delta_changed_count = 0;
+                for (uint64_t block = 0; block < blocks; block++) {
+                    if (delta_changed_bitmap[block / 8] & (1 << (block % 8))) {
+                        delta_changed_blocks[delta_changed_count++] = block;
+                    }
+                }
+                printf("Delta sync: receiving %llu of %llu blocks\n", (unsigned long long int)delta_changed_count,
+                        (unsigned long long int)blocks);
+            }
+        } else {
+            uint64_t data_offset = delta_stream_offset - delta_bitmap_length;
+            uint64_t changed = data_offset / DELTA_BLOCK_SIZE;
+            uint32_t within_block = data_offset % DELTA_BLOCK_SIZE;
+            if (changed >= delta_changed_count) {
+                return; // More data than the bitmap describes.
+            }
+            written = ((DELTA_BLOCK_SIZE - within_block) < length) ? (DELTA_BLOCK_SIZE - within_block) : length;
+            if (pwrite(fileno(receiver_file), bytes, written, delta_changed_blocks[changed] * DELTA_BLOCK_SIZE + within_block) < 0) {
+                perror("Error writing file.");
+            }
+        }
+        bytes += written;
+        length -= written;
+        delta_stream_offset += written;
+    }
+}
 
 /**
  * @brief Sends a FIN_ACK packet to the sender.
  * 
- * This function constructs a FIN_ACK packet and sends it to the sender. It is called
- * when a FIN packet is received, indicating the end of data transmission. The function
- * also starts a long timer and sets the receiver's state to Wait_inCase.
+ * This function constructs a FIN_ACK packet, carrying the digest of the stream that was
+ * written, and sends it to the sender. It is called when a FIN packet is received, or
+ * the stream that ended with a FIN riding on its last segment is complete, indicating the
+ * end of data transmission, so the digests are compared and any checkpoint is no longer
+ * needed. The function also starts the linger timer and sets the receiver's state to Wait_inCase.
  */
 void receiver_action_Send_Fin_Ack(void) {
+    if (!transfer_complete) {
+        transfer_complete = 1;
+        if (direct_active && (direct_writer_finish(&direct_writer, transfer_total_bytes) < 0)) {
+            transfer_failed = 1;
+        }
+        drain_writes();
+        transfer_failed |= atomic_load(&writer_failed);
+        check_stream_digest();
+        if (sink_enabled) {
+            report_sink();
+        }
+        if (resume_enabled) {
+            remove_checkpoint();
+        }
+        if (manifest_enabled) {
+            printf("Wrote %llu entries under %s.\n", (unsigned long long int)manifest_writer.files_written, 
+                    manifest_writer.root);
+            transfer_failed |= manifest_writer.failed || (manifest_writer.fd >= 0);
+        }
+        // The sender's file may be shorter than the one we patched.
+        if (delta_active && ftruncate(fileno(receiver_file), transfer_total_bytes) < 0) {
+            perror("Error truncating file.");
+        }
+    }
+
     // Construct FIN_ACK packet.
-    struct protocol_Header FIN_ACK_packet;
-    memset(&FIN_ACK_packet, 0, sizeof(FIN_ACK_packet));
-    FIN_ACK_packet.management_byte = 0x1; // FIN_ACK bit
+    struct protocol_Packet FIN_ACK_packet;
+    struct protocol_Fin fin_info;
+    memset(&FIN_ACK_packet.header, 0, sizeof(FIN_ACK_packet.header));
+    FIN_ACK_packet.header.management_byte = 0x1; // FIN_ACK bit
+    fin_info.stream_digest = stream_digest;
+    fin_info.rto_ms = 0;
+    memcpy(FIN_ACK_packet.data, &fin_info, sizeof(fin_info));
     // Everything else should already be zero'd...
 
-    if (send(receiver_socket, &FIN_ACK_packet, sizeof(FIN_ACK_packet), 0) < 0) {
+    if (send_packet(&FIN_ACK_packet, sizeof(struct protocol_Header) + sizeof(fin_info)) < 0) {
         perror("Error with sending FIN_ACK.");
         receiver_current_state = Finished;
     }
     
-    // Start the long timer and goto wait in-case...
-    timer_start = clock();
+    // Start the linger timer and goto wait in-case...
+    linger_start_ms = monotonic_ms();
     receiver_current_state = Wait_inCase;
 }
 
 /**
- * @brief Waits for a long duration in case another FIN packet is received.
+ * @brief Lingers in case the FIN_ACK was lost and the sender sends its FIN again.
  * 
- * This function waits for a specified long duration to handle any additional FIN packets 
- * that may arrive. It ensures that the receiver properly finalizes the connection.
+ * The sender confirms the close once it has the FIN_ACK, which ends the linger right 
+ * away. Otherwise the receiver waits FIN_LINGER_RTOS of the sender's retransmission 
+ * timeouts (LONG_TIMER_MS if it is not known), answering any repeated FIN, and then exits.
  */
 void receiver_action_Wait_inCase(void) {
-    // Check for any incoming FINs (just in-case)...
-    char buffer[BUFFER_SIZE];
-    clock_t time_elapsed_ms = (clock() - timer_start) * 1000 / CLOCKS_PER_SEC;
+    double linger_ms = LONG_TIMER_MS;
+    if (sender_rto_ms > 0) {
+        linger_ms = (double)FIN_LINGER_RTOS * sender_rto_ms;
+        linger_ms = (linger_ms < FIN_LINGER_MIN_MS) ? FIN_LINGER_MIN_MS : linger_ms;
+        linger_ms = (linger_ms > LONG_TIMER_MS) ? LONG_TIMER_MS : linger_ms;
+    }
+    double time_remaining_ms = linger_ms - (monotonic_ms() - linger_start_ms);
+    if (time_remaining_ms <= 0) {
+        receiver_current_state = Finished;
+        return;
+    }
+
+    // Nothing else to do, so block until a packet arrives or the linger is over.
+    if (socket_readable(time_remaining_ms) <= 0) {
+        return;
+    }
 
-    ssize_t packet_size = recv(receiver_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+    // Check for any incoming FINs (just in-case)...
+    struct protocol_Packet buffer;
+    ssize_t packet_size = receive_packet(&buffer);
 
-    if (packet_size > 0 && is_FIN((struct protocol_Packet *)buffer))
+    if (packet_size > 0 && is_FIN(&buffer))
     {
         receiver_current_state = Send_Fin_Ack;
     } 
-    else if (time_elapsed_ms > LONG_TIMER_MS) 
+    else if (packet_size > 0 && buffer.header.management_byte == 0x1)
     {
+        // The sender's close confirmation.
         receiver_current_state = Finished;
     } 
     else if ((packet_size == -1) && (errno != EAGAIN && errno != EWOULDBLOCK))
@@ -589,10 +2323,201 @@ void receiver_action_Wait_inCase(void) {
     }
 }
 
+/**
+ * @brief Keeps what the sender's FIN says about the end of the stream.
+ *
+ * The FIN trailer follows the packet's data: the digest of the stream and the sender's
+ * retransmission timeout. The stream ends where the FIN packet's data ends.
+ *
+ * @param fin_packet The FIN packet.
+ * @param length The number of bytes received.
+ */
+void record_fin(struct protocol_Packet *fin_packet, ssize_t length) {
+    struct protocol_Fin fin_info;
+    uint16_t bytes_of_data = fin_packet->header.bytes_of_data;
+    if ((bytes_of_data > PROTOCOL_DATA_SIZE - sizeof(fin_info)) || 
+        ((size_t)length < sizeof(struct protocol_Header) + bytes_of_data + sizeof(fin_info))) {
+        return;
+    }
+    memcpy(&fin_info, fin_packet->data + bytes_of_data, sizeof(fin_info));
+    sender_stream_digest = fin_info.stream_digest;
+    sender_digest_received = 1;
+    sender_rto_ms = fin_info.rto_ms;
+    fin_seq_num = fin_packet->header.seq_ack_num + bytes_of_data;
+    fin_received = 1;
+}
+
+/**
+ * @brief Checks whether every byte up to the sender's FIN has been received in order.
+ *
+ * @return Returns 1 if the stream is complete, 0 otherwise.
+ */
+int stream_complete(void) {
+    return fin_received && (next_needed_seq_num + contiguous_length == fin_seq_num);
+}
+
+/**
+ * @brief Compares the digest of the stream written to the file with the sender's.
+ */
+void check_stream_digest(void) {
+    if (!sender_digest_received) {
+        fprintf(stderr, "Sender did not report a stream digest.\n");
+        transfer_failed = 1;
+    } else if (sender_stream_digest != stream_digest) {
+        fprintf(stderr, "Integrity check failed: sender sent crc32c %08x, wrote %08x.\n", 
+                sender_stream_digest, stream_digest);
+        transfer_failed = 1;
+    } else {
+        printf("Integrity verified (crc32c %08x, %s).\n", stream_digest, crc32c_implementation());
+    }
+    if (corrupted_packets > 0) {
+        printf("Dropped %llu corrupted packets.\n", corrupted_packets);
+    }
+    printf("Sent %llu ACKs, one every %u segments at most.\n", acks_sent, ack_frequency);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double elapsed_in_seconds = (monotonic_ms() - transfer_start_ms) / 1000;
+    double user_in_seconds = (usage.ru_utime.tv_sec - transfer_start_usage.ru_utime.tv_sec) 
+                             + (usage.ru_utime.tv_usec - transfer_start_usage.ru_utime.tv_usec) / 1e6;
+    double cpu_in_seconds = user_in_seconds + (usage.ru_stime.tv_sec - transfer_start_usage.ru_stime.tv_sec) 
+                            + (usage.ru_stime.tv_usec - transfer_start_usage.ru_stime.tv_usec) / 1e6;
+    uint64_t bytes_received = transfer_total_bytes - transfer_start_offset;
+    printf("Received %llu packets, %.0f packets/s; CPU %.3f s (%.3f s user), %.3f s per GB, peak RSS %ld KiB.\n", packets_received,
+            packets_received / elapsed_in_seconds, cpu_in_seconds, user_in_seconds,
+            (bytes_received > 0) ? cpu_in_seconds * 1e9 / bytes_received : 0.0, usage.ru_maxrss);
+    if (uring_active) {
+        printf("io_uring: %llu packets received with %llu system calls.\n", uring_packets, uring.enter_calls);
+    }
+    if (batch_active && (batch.calls > 0)) {
+        printf("Batched receive: %llu datagrams in %llu recvmmsg calls, %.1f per call (%s).\n", batch.datagrams,
+               batch.calls, (double)batch.datagrams / batch.calls, batch_implementation());
+    }
+    if (ecn_echoed) {
+        printf("ECN: %llu packets marked Congestion Experienced, echoed on %llu ACKs.\n", ce_marked, ecn_echoes);
+    }
+}
+
+/**
+ * @brief Receives transfer_count transfers one after another (-c), or until killed if it is 0.
+ *
+ * Each transfer goes through receiver_init() and receiver_finish() again, on a new socket,
+ * so a long run shows whether anything they set up is leaked.
+ *
+ * @param udpPort The UDP port to receive on.
+ * @param filename The destination file, rewritten by every transfer, or NULL for a sink.
+ * @param writeRate The rate at which data will be written to the file.
+ * @return Returns 1 if every transfer succeeded, 0 otherwise.
+ */
+int receive_transfers(unsigned short int udpPort, char *filename, unsigned long long int writeRate) {
+    for (unsigned int done = 0; (transfer_count == 0) || (done < transfer_count); done++) {
+        rrecv(udpPort, filename, writeRate);
+        fflush(stdout);
+    }
+    return !transfer_failed;
+}
+
+/**
+ * @brief Runs the receiver as several worker processes sharing the UDP port.
+ *
+ * Each worker is a receiver of its own, with its own SO_REUSEPORT socket, pinned to one of
+ * the CPUs we may run on, and handles one transfer (or -c of them). Its buffers are allocated after it is
+ * pinned, so they come from its CPU's NUMA node. The receiver's state is per process, which
+ * is why workers are processes rather than threads. In multi-file mode every worker writes 
+ * under the same directory, with a sink there is no file; otherwise worker i writes filename.i.
+ *
+ * @param udpPort The UDP port the workers share.
+ * @param filename The destination file or directory, NULL for a sink.
+ * @param writeRate The rate at which data will be written to the file.
+ * @return Returns 1 if every worker's transfer succeeded, 0 otherwise.
+ */
+int run_workers(unsigned short int udpPort, char *filename, unsigned long long int writeRate) {
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int cpu_count = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus[cpu_count++] = cpu;
+            }
+        }
+    }
+
+    pid_t workers[worker_count];
+    unsigned int started = 0;
+    fflush(stdout);
+    for (; started < worker_count; started++) {
+        workers[started] = fork();
+        if (workers[started] < 0) {
+            perror("Error starting worker.");
+            break;
+        }
+        if (workers[started] > 0) {
+            continue;
+        }
+
+        if (cpu_count > 0) {
+            cpu_set_t pinned;
+            CPU_ZERO(&pinned);
+            CPU_SET(cpus[started % cpu_count], &pinned);
+            if (sched_setaffinity(0, sizeof(pinned), &pinned) < 0) {
+                perror("Error pinning worker.");
+            }
+        }
+        char worker_file[((filename != NULL) ? strlen(filename) : 0) + 16];
+        if (filename == NULL) {
+            sprintf(worker_file, verify_enabled ? "the verify sink" : "the null sink");
+        } else {
+            sprintf(worker_file, manifest_enabled ? "%s" : "%s.%u", filename, started);
+        }
+        if (trace_path != NULL) {
+            char *worker_trace = malloc(strlen(trace_path) + 16);
+            sprintf(worker_trace, "%s.%u", trace_path, started);
+            trace_path = worker_trace;
+        }
+        printf("Worker %u on CPU %d receiving into %s\n", started, (cpu_count > 0) ? cpus[started % cpu_count] : -1, worker_file);
+        exit(receive_transfers(udpPort, (filename != NULL) ? worker_file : NULL, writeRate) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int all_succeeded = (started == worker_count);
+    for (unsigned int i = 0; i < started; i++) {
+        int status;
+        if ((waitpid(workers[i], &status, 0) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+            all_succeeded = 0;
+        }
+    }
+    return all_succeeded;
+}
+
 /**
  * @brief Main function for the receiver application.
  * 
- * This function parses command line arguments to set up the UDP port and destination file.
+ * This function parses command line arguments to set up the UDP port and destination file,
+ * along with the options:
+ *   -r  Resume an interrupted transfer from its last checkpoint (destination_file.ckpt).
+ *   -d  Delta sync: patch the existing file in place with only the blocks that changed.
+ *   -D  Direct I/O: write the file with O_DIRECT in aligned blocks, bypassing the page cache.
+ *   -U  Receive through io_uring: a multishot recv fills provided buffers, so packets are
+ *       picked up without system calls. Falls back to recv() where io_uring is unavailable.
+ *   -k  Kernel timestamps: time packets by when the kernel received them (SO_TIMESTAMPING,
+ *       hardware where the NIC has it), and echo them to an rsend -k (see timestamp.h). Not with
+ *       -U, whose multishot recv does not return them.
+ *   -T  Write the file from a separate thread, fed through a lock-free ring (see start_writer()).
+ *   -t trace_file  Record a packet-level event trace for rtrace (see trace.h); worker i writes trace_file.i.
+ *   -p  Count cycles, instructions, cache misses, context switches and system calls per phase
+ *       of each transfer with perf_event_open, and report them per packet and per GB (see perf.h).
+ *   -m  Multi-file: filename_to_write is a directory to recreate the sender's files under.
+ *   -n  Null sink: receive the stream but keep none of it, and there is no filename_to_write,
+ *       so a run with rsend -g measures the transfer without the disk (see synthetic.h).
+ *   -v  Verify sink: as -n, but check every byte against the generator rsend -g used.
+ *   -c transfers  Receive this many transfers one after another, each set up and torn down
+ *               afresh, or keep going until killed with 0 (see receive_transfers()).
+ *   -w workers  Receive this many transfers in parallel, each in a worker process pinned to
+ *               its own CPU with its own SO_REUSEPORT socket (see run_workers()).
+ *   -b datagrams  Receive up to this many datagrams per recvmmsg() (default 32, at most 256),
+ *               and store in-order runs of them with one copy each (see batch.h); 1 receives
+ *               one packet per recv(). Not used with -U or -k.
+ *   -B bytes    Size of the socket receive buffer (the window is capped to a quarter of it).
+ *   -S bytes    Size of the socket send buffer.
  * It then calls the rrecv function to start the receiver process.
  *
  * @param argc Number of command-line arguments.
@@ -603,13 +2528,87 @@ int main(int argc, char** argv) {
     unsigned short int udpPort;
     char* filename = NULL;
     unsigned long long int writeRate = 0;
-    if (argc != 3) {
-        fprintf(stderr, "usage: %s UDP_port filename_to_write\n\n", argv[0]);
+    int option;
+    int bad_option = 0;
+    direct_writer.fd = -1;
+
+    while ((option = getopt(argc, argv, "rdDUTkmnvpt:w:c:b:B:S:")) != -1) {
+        switch (option) {
+            case 'r':
+                resume_enabled = 1;
+                break;
+            case 'd':
+                delta_enabled = 1;
+                break;
+            case 'D':
+                direct_enabled = 1;
+                break;
+            case 'U':
+                uring_requested = 1;
+                break;
+            case 'T':
+                writer_requested = 1;
+                break;
+            case 'k':
+                timestamps_requested = 1;
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'p':
+                perf_requested = 1;
+                break;
+            case 'm':
+                manifest_enabled = 1;
+                break;
+            case 'n':
+                sink_enabled = 1;
+                break;
+            case 'v':
+                sink_enabled = 1;
+                verify_enabled = 1;
+                break;
+            case 'w':
+                worker_count = (unsigned int)atoi(optarg);
+                bad_option |= (worker_count == 0);
+                break;
+            case 'c':
+                transfer_count = (unsigned int)atoi(optarg);
+                break;
+            case 'b':
+                batch_size = (unsigned int)atoi(optarg);
+                bad_option |= (batch_size == 0) || (batch_size > BATCH_MAX_DATAGRAMS);
+                break;
+            case 'B':
+                socket_receive_buffer = atoi(optarg);
+                break;
+            case 'S':
+                socket_send_buffer = atoi(optarg);
+                break;
+            default:
+                bad_option = 1;
+        }
+    }
+
+    if (bad_option || (manifest_enabled && (resume_enabled || delta_enabled || direct_enabled || writer_requested)) ||
+        (sink_enabled && (manifest_enabled || resume_enabled || delta_enabled || direct_enabled || writer_requested)) ||
+        ((transfer_count != 1) && (manifest_enabled || resume_enabled || delta_enabled || direct_enabled)) ||
+        (delta_enabled && (direct_enabled || writer_requested)) || (direct_enabled && writer_requested) || (uring_requested && timestamps_requested) || ((worker_count > 1) && (resume_enabled || delta_enabled)) ||
+        (argc - optind != (sink_enabled ? 1 : 2))) {
+        fprintf(stderr, "usage: %s [-r] [-d | -D | -T] [-U | -k] [-t trace_file] [-p] [-b datagrams] [-B rcvbuf_bytes] [-S sndbuf_bytes] UDP_port filename_to_write\n"
+                        "       %s [-D | -T] [-U | -k] [-t trace_file] [-p] [-b datagrams] [-B rcvbuf_bytes] [-S sndbuf_bytes] -w workers UDP_port filename_prefix\n"
+                        "       %s [-T] [-U | -k] [-t trace_file] [-p] [-b datagrams] [-B rcvbuf_bytes] [-S sndbuf_bytes] [-w workers] -c transfers UDP_port filename_to_write\n"
+                        "       %s -m [-U | -k] [-t trace_file] [-p] [-b datagrams] [-B rcvbuf_bytes] [-S sndbuf_bytes] [-w workers] UDP_port destination_directory\n"
+                        "       %s -n | -v [-U | -k] [-t trace_file] [-p] [-b datagrams] [-B rcvbuf_bytes] [-S sndbuf_bytes] [-w workers] [-c transfers] UDP_port\n\n", 
+                argv[0], argv[0], argv[0], argv[0], argv[0]);
         exit(1);
     }
 
-    udpPort = (unsigned short int) atoi(argv[1]);
-    filename = argv[2];
+    udpPort = (unsigned short int) atoi(argv[optind]);
+    filename = sink_enabled ? NULL : argv[optind + 1];
 
-    rrecv(udpPort, filename, writeRate);
+    if (worker_count > 1) {
+        return run_workers(udpPort, filename, writeRate) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    return receive_transfers(udpPort, filename, writeRate) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "ring.h"
+
+static uint64_t ring_capacity(uint32_t capacity);
+
+/**
+ * @brief Sets up a single-producer, single-consumer ring.
+ *
+ * @param ring The ring.
+ * @param capacity The number of descriptors it must hold, rounded up to a power of two.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int ring_spsc_init(struct ring_Spsc *ring, uint32_t capacity)
+{
+    uint64_t slots = ring_capacity(capacity);
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = aligned_alloc(RING_CACHE_LINE, slots * sizeof(struct ring_Descriptor));
+    if (ring->slots == NULL)
+    {
+        fprintf(stderr, "Error allocating ring\n");
+        return -1;
+    }
+    ring->mask = slots - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+/**
+ * @brief Frees a single-producer, single-consumer ring.
+ *
+ * @param ring The ring.
+ */
+void ring_spsc_destroy(struct ring_Spsc *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+/**
+ * @brief Adds a descriptor to the ring; producer only.
+ *
+ * @param ring The ring.
+ * @param descriptor The descriptor, copied into the ring.
+ * @return Returns 1 if it was added, 0 if the ring is full.
+ */
+int ring_spsc_push(struct ring_Spsc *ring, const struct ring_Descriptor *descriptor)
+{
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->head_cache > ring->mask)
+    {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->head_cache > ring->mask)
+        {
+            return 0;
+        }
+    }
+    ring->slots[tail & ring->mask] = *descriptor;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Takes the oldest descriptor from the ring; consumer only.
+ *
+ * @param ring The ring.
+ * @param descriptor Where to store the descriptor.
+ * @return Returns 1 if one was taken, 0 if the ring is empty.
+ */
+int ring_spsc_pop(struct ring_Spsc *ring, struct ring_Descriptor *descriptor)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == ring->tail_cache)
+    {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == ring->tail_cache)
+        {
+            return 0;
+        }
+    }
+    *descriptor = ring->slots[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Sets up a multi-producer, single-consumer ring.
+ *
+ * @param ring The ring.
+ * @param capacity The number of descriptors it must hold, rounded up to a power of two.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int ring_mpsc_init(struct ring_Mpsc *ring, uint32_t capacity)
+{
+    uint64_t slots = ring_capacity(capacity);
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = aligned_alloc(RING_CACHE_LINE, slots * sizeof(struct ring_Slot));
+    if (ring->slots == NULL)
+    {
+        fprintf(stderr, "Error allocating ring\n");
+        return -1;
+    }
+    for (uint64_t i = 0; i < slots; i++)
+    {
+        atomic_init(&ring->slots[i].sequence, i);
+    }
+    ring->mask = slots - 1;
+    ring->head = 0;
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+/**
+ * @brief Frees a multi-producer, single-consumer ring.
+ *
+ * @param ring The ring.
+ */
+void ring_mpsc_destroy(struct ring_Mpsc *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+/**
+ * @brief Adds a descriptor to the ring; any thread.
+ *
+ * A slot whose sequence equals the tail position is free for that position. The producer
+ * that moves the tail past it owns the slot, fills it, then publishes it by advancing
+ * its sequence.
+ *
+ * @param ring The ring.
+ * @param descriptor The descriptor, copied into the ring.
+ * @return Returns 1 if it was added, 0 if the ring is full.
+ */
+int ring_mpsc_push(struct ring_Mpsc *ring, const struct ring_Descriptor *descriptor)
+{
+    uint64_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    struct ring_Slot *slot;
+    while (1)
+    {
+        slot = &ring->slots[position & ring->mask];
+        uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        int64_t difference = (int64_t)(sequence - position);
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            return 0;
+        }
+        else
+        {
+            position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+    slot->descriptor = *descriptor;
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Takes the oldest descriptor from the ring; consumer only.
+ *
+ * @param ring The ring.
+ * @param descriptor Where to store the descriptor.
+ * @return Returns 1 if one was taken, 0 if the ring is empty (or the oldest is still being filled).
+ */
+int ring_mpsc_pop(struct ring_Mpsc *ring, struct ring_Descriptor *descriptor)
+{
+    struct ring_Slot *slot = &ring->slots[ring->head & ring->mask];
+    uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (sequence != ring->head + 1)
+    {
+        return 0;
+    }
+    *descriptor = slot->descriptor;
+    atomic_store_explicit(&slot->sequence, ring->head + ring->mask + 1, memory_order_release);
+    ring->head++;
+    return 1;
+}
+
+/**
+ * @brief Waits a little for the other end of a ring.
+ *
+ * The first RING_BACKOFF_YIELDS rounds only yield the CPU, which is enough when the other
+ * thread is busy; after that the thread sleeps between tries, so an idle thread does not
+ * keep a core spinning. The caller resets idle_rounds to 0 once it makes progress.
+ *
+ * @param idle_rounds The rounds waited so far, updated.
+ */
+void ring_backoff(unsigned int *idle_rounds)
+{
+    if (*idle_rounds < RING_BACKOFF_YIELDS)
+    {
+        (*idle_rounds)++;
+        sched_yield();
+        return;
+    }
+    struct timespec pause = {0, RING_BACKOFF_SLEEP_US * 1000};
+    nanosleep(&pause, NULL);
+}
+
+/**
+ * @brief Rounds a capacity up to a power of two, at least 2.
+ */
+static uint64_t ring_capacity(uint32_t capacity)
+{
+    uint64_t slots = 2;
+    while (slots < capacity)
+    {
+        slots *= 2;
+    }
+    return slots;
+}
@@ -0,0 +1,85 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * Lock-free rings of packet descriptors for handing packets from one thread to another.
+ *
+ * ring_Spsc has one producer and one consumer. Each side owns its index on a cache line
+ * of its own and keeps a cached copy of the other side's index, so in the steady state
+ * a push or pop touches no cache line the other thread is writing.
+ *
+ * ring_Mpsc takes any number of producers and one consumer. Producers claim a slot with a
+ * compare-and-swap on the tail, and every slot carries a sequence number that says whether
+ * it is free or filled (Vyukov's bounded queue). Slots are a cache line each, so producers
+ * filling neighbouring slots do not share a line.
+ *
+ * Both hold a power-of-two number of descriptors, and neither blocks: a push to a full ring
+ * or a pop from an empty one returns 0 and the caller decides how to wait.
+ */
+
+#define RING_CACHE_LINE 64
+#define RING_BACKOFF_YIELDS 64 // Rounds that yield the CPU before an idle thread starts to sleep
+#define RING_BACKOFF_SLEEP_US 50
+
+struct ring_Descriptor
+{
+    /* The bytes, usually a buffer of a pool_Pool */
+    char *data;
+
+    /* Where the bytes belong in the data stream or file */
+    uint64_t stream_offset;
+    uint32_t length;
+    uint32_t flags;
+};
+
+struct ring_Spsc
+{
+    /* Producer's line */
+    _Alignas(RING_CACHE_LINE) _Atomic uint64_t tail;
+    uint64_t head_cache;
+
+    /* Consumer's line */
+    _Alignas(RING_CACHE_LINE) _Atomic uint64_t head;
+    uint64_t tail_cache;
+
+    /* Read-only after ring_spsc_init() */
+    _Alignas(RING_CACHE_LINE) struct ring_Descriptor *slots;
+    uint64_t mask;
+};
+
+struct ring_Slot
+{
+    _Alignas(RING_CACHE_LINE) _Atomic uint64_t sequence;
+    struct ring_Descriptor descriptor;
+};
+
+struct ring_Mpsc
+{
+    /* Shared by the producers */
+    _Alignas(RING_CACHE_LINE) _Atomic uint64_t tail;
+
+    /* Consumer's line */
+    _Alignas(RING_CACHE_LINE) uint64_t head;
+
+    /* Read-only after ring_mpsc_init() */
+    _Alignas(RING_CACHE_LINE) struct ring_Slot *slots;
+    uint64_t mask;
+};
+
+int ring_spsc_init(struct ring_Spsc *ring, uint32_t capacity);
+void ring_spsc_destroy(struct ring_Spsc *ring);
+int ring_spsc_push(struct ring_Spsc *ring, const struct ring_Descriptor *descriptor);
+int ring_spsc_pop(struct ring_Spsc *ring, struct ring_Descriptor *descriptor);
+
+int ring_mpsc_init(struct ring_Mpsc *ring, uint32_t capacity);
+void ring_mpsc_destroy(struct ring_Mpsc *ring);
+int ring_mpsc_push(struct ring_Mpsc *ring, const struct ring_Descriptor *descriptor);
+int ring_mpsc_pop(struct ring_Mpsc *ring, struct ring_Descriptor *descriptor);
+
+void ring_backoff(unsigned int *idle_rounds);
+
+#endif
@@ -0,0 +1,620 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "trace.h"
+
+/*
+ * rtrace: reads a trace written by rsend -t or rrecv -t.
+ *
+ *   rtrace trace_file              Summary: event counts, data, RTT and window statistics,
+ *                                  and one line per loss episode.
+ *   rtrace -s trace_file           Sequence/time CSV (sends, retransmits, ACKs, receptions).
+ *   rtrace -c trace_file           Congestion window / RTT / RTO / queueing delay time series CSV.
+ *   rtrace -p prefix trace_file    Writes prefix-seq.csv, prefix-series.csv and a gnuplot
+ *                                  script prefix.gp that plots them to prefix-seq.png and
+ *                                  prefix-cwnd.png.
+ *
+ * Times are in milliseconds since the trace was opened. Sequence numbers are widened to
+ * 64 bits, so transfers past 4 GiB plot as one line.
+ */
+
+#define MS_PER_NS 1e-6
+
+/* A loss episode: from the first retransmission or timeout until an ACK covers everything
+ * that was in flight when it started */
+struct loss_episode
+{
+    double start_ms;
+    double end_ms;
+    uint64_t recovery_point;
+    uint8_t timeout_first;
+    unsigned int retransmits;
+    unsigned int timeouts;
+    uint32_t cwnd_before;
+    uint32_t cwnd_min;
+};
+
+static const char *event_names[Trace_Event_Count] = {
+    "none", "send", "retransmit", "parity", "drop", "ack", "dup_ack", "timeout",
+    "cwnd", "rto", "receive", "ack_sent", "repair", "corrupt", "delay"
+};
+
+static struct trace_Header header;
+static struct trace_Record *records;
+static size_t record_count;
+
+int load_trace(const char *path);
+int compare_records(const void *a, const void *b);
+uint64_t widen_seq(uint64_t *last, uint32_t seq);
+double record_ms(const struct trace_Record *record);
+void print_summary(void);
+void print_sender_summary(void);
+struct loss_episode *start_episode(struct loss_episode **episodes, size_t *count, size_t *capacity, double now_ms);
+void print_receiver_summary(void);
+void write_sequence(FILE *out);
+void write_series(FILE *out);
+int write_plots(const char *prefix);
+
+/**
+ * @brief Reads a trace file into memory, sorted by time.
+ *
+ * @param path The trace file.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int load_trace(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror("Error opening trace");
+        return -1;
+    }
+    if ((fread(&header, sizeof(header), 1, file) != 1) || (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) ||
+        (header.version != TRACE_VERSION) || (header.record_size != sizeof(struct trace_Record)))
+    {
+        fprintf(stderr, "%s is not a trace this rtrace can read\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, sizeof(header), SEEK_SET);
+    record_count = (size - sizeof(header)) / sizeof(struct trace_Record);
+    records = malloc((record_count + 1) * sizeof(struct trace_Record));
+    if ((records == NULL) || (fread(records, sizeof(struct trace_Record), record_count, file) != record_count))
+    {
+        fprintf(stderr, "Error reading trace\n");
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    // Chunks of different threads reach the file in the order they filled up.
+    qsort(records, record_count, sizeof(struct trace_Record), compare_records);
+    return 0;
+}
+
+/**
+ * @brief Orders records by time, for qsort().
+ */
+int compare_records(const void *a, const void *b)
+{
+    const struct trace_Record *first = a;
+    const struct trace_Record *second = b;
+    return (first->time_ns > second->time_ns) - (first->time_ns < second->time_ns);
+}
+
+/**
+ * @brief Widens a 32-bit sequence number to 64 bits, next to the last one seen.
+ *
+ * @param last The last widened sequence number of this kind, updated.
+ * @param seq The sequence number from the trace.
+ * @return Returns the widened sequence number.
+ */
+uint64_t widen_seq(uint64_t *last, uint32_t seq)
+{
+    *last += (int32_t)(seq - (uint32_t)*last);
+    return *last;
+}
+
+/**
+ * @brief Returns the time of a record in milliseconds since the trace was opened.
+ */
+double record_ms(const struct trace_Record *record)
+{
+    return (double)(int64_t)(record->time_ns - header.start_ns) * MS_PER_NS;
+}
+
+/**
+ * @brief Prints the event counts and the side-specific summary.
+ */
+void print_summary(void)
+{
+    unsigned long long int counts[Trace_Event_Count] = {0};
+    for (size_t i = 0; i < record_count; i++)
+    {
+        if (records[i].event < Trace_Event_Count)
+        {
+            counts[records[i].event]++;
+        }
+    }
+
+    time_t wall_start = header.wall_start_ns / 1000000000ULL;
+    char started[64];
+    strftime(started, sizeof(started), "%Y-%m-%d %H:%M:%S", localtime(&wall_start));
+    double duration_ms = (record_count > 0) ? record_ms(&records[record_count - 1]) : 0;
+    printf("%s trace started %s: %zu events over %.3f ms\n", header.role, started, record_count, duration_ms);
+    printf("Events:");
+    for (int event = 1; event < Trace_Event_Count; event++)
+    {
+        if (counts[event] > 0)
+        {
+            printf(" %s %llu", event_names[event], counts[event]);
+        }
+    }
+    printf("\n");
+
+    if (strcmp(header.role, "rrecv") == 0)
+    {
+        print_receiver_summary();
+    }
+    else
+    {
+        print_sender_summary();
+    }
+}
+
+/**
+ * @brief Prints data, RTT and window statistics and the loss episodes of a sender trace.
+ */
+void print_sender_summary(void)
+{
+    unsigned long long int bytes_sent = 0, bytes_retransmitted = 0, bytes_acked = 0;
+    uint64_t send_seq = 0, ack_seq = 0, highest_sent = 0;
+    uint8_t seq_started = 0;
+    double rtt_min = 0, rtt_max = 0, rtt_sum = 0, last_rto = 0;
+    unsigned long long int rtt_samples = 0;
+    double delay_sum = 0, delay_max = 0;
+    unsigned long long int delay_samples = 0;
+    uint32_t cwnd = 0, cwnd_min = UINT32_MAX, cwnd_max = 0, cwnd_before_drop = 0;
+    double cwnd_time_weighted = 0, cwnd_since_ms = -1, cwnd_first_ms = 0;
+    double first_ms = -1, last_ack_ms = 0;
+
+    struct loss_episode *episodes = NULL;
+    size_t episode_count = 0, episode_capacity = 0;
+    struct loss_episode *open_episode = NULL;
+
+    for (size_t i = 0; i < record_count; i++)
+    {
+        struct trace_Record *record = &records[i];
+        double now_ms = record_ms(record);
+        if (!seq_started && ((record->event == Trace_Send) || (record->event == Trace_Ack)))
+        {
+            send_seq = ack_seq = highest_sent = record->seq;
+            seq_started = 1;
+        }
+
+        switch (record->event)
+        {
+            case Trace_Send:
+            case Trace_Retransmit:
+            {
+                uint64_t seq = widen_seq(&send_seq, record->seq);
+                first_ms = (first_ms < 0) ? now_ms : first_ms;
+                bytes_sent += record->length;
+                if (seq + record->length > highest_sent)
+                {
+                    highest_sent = seq + record->length;
+                }
+                if (record->event == Trace_Send)
+                {
+                    break;
+                }
+                bytes_retransmitted += record->length;
+                if (open_episode == NULL)
+                {
+                    open_episode = start_episode(&episodes, &episode_count, &episode_capacity, now_ms);
+                    open_episode->recovery_point = highest_sent;
+                    open_episode->cwnd_before = cwnd_before_drop ? cwnd_before_drop : cwnd;
+                    open_episode->cwnd_min = cwnd;
+                }
+                open_episode->retransmits++;
+                break;
+            }
+            case Trace_Timeout:
+                // A timeout resends the whole window, so it opens an episode of its own if none is open.
+                if (open_episode == NULL)
+                {
+                    open_episode = start_episode(&episodes, &episode_count, &episode_capacity, now_ms);
+                    open_episode->recovery_point = highest_sent;
+                    open_episode->timeout_first = 1;
+                    open_episode->cwnd_before = cwnd_before_drop ? cwnd_before_drop : cwnd;
+                    open_episode->cwnd_min = cwnd;
+                }
+                open_episode->timeouts++;
+                last_rto = record->value / 1000.0;
+                break;
+            case Trace_Ack:
+            {
+                uint64_t ack = widen_seq(&ack_seq, record->seq);
+                bytes_acked += record->length;
+                last_ack_ms = now_ms;
+                cwnd_before_drop = 0;
+                if ((open_episode != NULL) && (ack >= open_episode->recovery_point))
+                {
+                    open_episode->end_ms = now_ms;
+                    open_episode = NULL;
+                }
+                break;
+            }
+            case Trace_Cwnd:
+                if (cwnd_since_ms < 0)
+                {
+                    cwnd_first_ms = now_ms;
+                }
+                else
+                {
+                    cwnd_time_weighted += (double)cwnd * (now_ms - cwnd_since_ms);
+                }
+                if (record->value < record->length)
+                {
+                    cwnd_before_drop = record->length;
+                }
+                cwnd = record->value;
+                cwnd_since_ms = now_ms;
+                cwnd_min = (cwnd < cwnd_min) ? cwnd : cwnd_min;
+                cwnd_max = (cwnd > cwnd_max) ? cwnd : cwnd_max;
+                if ((open_episode != NULL) && (cwnd < open_episode->cwnd_min))
+                {
+                    open_episode->cwnd_min = cwnd;
+                }
+                break;
+            case Trace_Rto:
+            {
+                double rtt = record->length / 1000.0;
+                rtt_min = (rtt_samples == 0 || rtt < rtt_min) ? rtt : rtt_min;
+                rtt_max = (rtt > rtt_max) ? rtt : rtt_max;
+                rtt_sum += rtt;
+                rtt_samples++;
+                last_rto = record->value / 1000.0;
+                break;
+            }
+            case Trace_Delay:
+            {
+                double delay = record->length / 1000.0;
+                delay_max = (delay > delay_max) ? delay : delay_max;
+                delay_sum += delay;
+                delay_samples++;
+                break;
+            }
+        }
+    }
+
+    double data_ms = (first_ms >= 0) ? last_ack_ms - first_ms : 0;
+    printf("Data: %llu bytes sent, %llu retransmitted (%.2f%%), %llu acknowledged",
+           bytes_sent, bytes_retransmitted, bytes_sent ? 100.0 * bytes_retransmitted / bytes_sent : 0, bytes_acked);
+    if (data_ms > 0)
+    {
+        printf(", goodput %.3f Mbit/s", bytes_acked * 8 / data_ms / 1e3);
+    }
+    printf("\n");
+    if (rtt_samples > 0)
+    {
+        printf("RTT: %llu samples, min %.3f ms, mean %.3f ms, max %.3f ms; last RTO %.3f ms\n",
+               rtt_samples, rtt_min, rtt_sum / rtt_samples, rtt_max, last_rto);
+    }
+    if (delay_samples > 0)
+    {
+        printf("Queueing delay: %llu samples, mean %.3f ms, max %.3f ms\n", delay_samples, delay_sum / delay_samples, delay_max);
+    }
+    if (cwnd_max > 0)
+    {
+        double span_ms = last_ack_ms - cwnd_since_ms;
+        cwnd_time_weighted += (span_ms > 0) ? (double)cwnd * span_ms : 0;
+        double window_ms = last_ack_ms - cwnd_first_ms;
+        printf("Window: min %u, max %u, time-weighted mean %.0f bytes\n", cwnd_min, cwnd_max,
+               (window_ms > 0) ? cwnd_time_weighted / window_ms : (double)cwnd);
+    }
+
+    printf("Loss episodes: %zu\n", episode_count);
+    if (episode_count > 0)
+    {
+        printf("  %-4s %12s %12s %-8s %11s %9s %12s %12s\n", "#", "start_ms", "duration_ms", "trigger",
+               "retransmits", "timeouts", "cwnd_before", "cwnd_min");
+    }
+    for (size_t i = 0; i < episode_count; i++)
+    {
+        struct loss_episode *episode = &episodes[i];
+        double end_ms = (episode->end_ms > 0) ? episode->end_ms : record_ms(&records[record_count - 1]);
+        printf("  %-4zu %12.3f %12.3f %-8s %11u %9u %12u %12u%s\n", i + 1, episode->start_ms, end_ms - episode->start_ms,
+               episode->timeout_first ? "timeout" : "dup_ack", episode->retransmits, episode->timeouts,
+               episode->cwnd_before, episode->cwnd_min, (episode->end_ms > 0) ? "" : " (not recovered)");
+    }
+    free(episodes);
+}
+
+/**
+ * @brief Adds a loss episode starting now to the list.
+ *
+ * @param episodes The list, grown as needed.
+ * @param count Episodes in the list, updated.
+ * @param capacity Room in the list, updated.
+ * @param now_ms When the episode starts.
+ * @return Returns the new episode, zeroed but for its start.
+ */
+struct loss_episode *start_episode(struct loss_episode **episodes, size_t *count, size_t *capacity, double now_ms)
+{
+    if (*count == *capacity)
+    {
+        *capacity = *capacity ? 2 * *capacity : 16;
+        *episodes = realloc(*episodes, *capacity * sizeof(struct loss_episode));
+        if (*episodes == NULL)
+        {
+            fprintf(stderr, "Error allocating loss episodes\n");
+            exit(1);
+        }
+    }
+    struct loss_episode *episode = &(*episodes)[(*count)++];
+    memset(episode, 0, sizeof(*episode));
+    episode->start_ms = now_ms;
+    return episode;
+}
+
+/**
+ * @brief Prints what a receiver trace shows of the data that arrived.
+ */
+void print_receiver_summary(void)
+{
+    unsigned long long int bytes_received = 0, duplicate_bytes = 0, repaired_bytes = 0, gaps = 0, gap_bytes = 0;
+    uint64_t receive_seq = 0, highest_received = 0;
+    uint8_t seq_started = 0;
+    double first_ms = -1, last_ms = 0;
+
+    for (size_t i = 0; i < record_count; i++)
+    {
+        struct trace_Record *record = &records[i];
+        if (record->event == Trace_Repair)
+        {
+            repaired_bytes += record->length;
+        }
+        if (record->event != Trace_Receive)
+        {
+            continue;
+        }
+        if (!seq_started)
+        {
+            receive_seq = highest_received = record->seq;
+            seq_started = 1;
+        }
+        uint64_t seq = widen_seq(&receive_seq, record->seq);
+        first_ms = (first_ms < 0) ? record_ms(record) : first_ms;
+        last_ms = record_ms(record);
+        if (record->value)
+        {
+            duplicate_bytes += record->length;
+            continue;
+        }
+        bytes_received += record->length;
+        if (seq > highest_received)
+        {
+            gaps++;
+            gap_bytes += seq - highest_received;
+        }
+        if (seq + record->length > highest_received)
+        {
+            highest_received = seq + record->length;
+        }
+    }
+
+    printf("Data: %llu bytes received, %llu duplicate, %llu rebuilt from parity", bytes_received, duplicate_bytes, repaired_bytes);
+    if (last_ms > first_ms)
+    {
+        printf(", %.3f Mbit/s", bytes_received * 8 / (last_ms - first_ms) / 1e3);
+    }
+    printf("\n");
+    printf("Gaps: %llu segments arrived past a hole, %llu bytes missing at the time\n", gaps, gap_bytes);
+}
+
+/**
+ * @brief Writes the sequence/time CSV: time_ms,event,seq,length.
+ *
+ * @param out Where to write it.
+ */
+void write_sequence(FILE *out)
+{
+    uint64_t last_seq = 0;
+    uint8_t seq_started = 0;
+    fprintf(out, "time_ms,event,seq,length\n");
+    for (size_t i = 0; i < record_count; i++)
+    {
+        struct trace_Record *record = &records[i];
+        switch (record->event)
+        {
+            case Trace_Send:
+            case Trace_Retransmit:
+            case Trace_Parity:
+            case Trace_Drop:
+            case Trace_Ack:
+            case Trace_Dup_Ack:
+            case Trace_Receive:
+            case Trace_Ack_Sent:
+            case Trace_Repair:
+                if (!seq_started)
+                {
+                    last_seq = record->seq;
+                    seq_started = 1;
+                }
+                fprintf(out, "%.6f,%s,%llu,%u\n", record_ms(record), event_names[record->event],
+                        (unsigned long long int)widen_seq(&last_seq, record->seq),
+                        (record->event == Trace_Dup_Ack || record->event == Trace_Ack_Sent) ? 0 : record->length);
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Writes the window time series CSV: time_ms,cwnd_bytes,rtt_ms,rto_ms,queue_delay_ms.
+ *
+ * A row is written whenever one of them changes; the others carry over.
+ *
+ * @param out Where to write it.
+ */
+void write_series(FILE *out)
+{
+    uint32_t cwnd = 0;
+    double rtt_ms = 0, rto_ms = 0, queue_delay_ms = 0;
+    fprintf(out, "time_ms,cwnd_bytes,rtt_ms,rto_ms,queue_delay_ms\n");
+    for (size_t i = 0; i < record_count; i++)
+    {
+        struct trace_Record *record = &records[i];
+        switch (record->event)
+        {
+            case Trace_Cwnd:
+                cwnd = record->value;
+                break;
+            case Trace_Rto:
+                rtt_ms = record->length / 1000.0;
+                rto_ms = record->value / 1000.0;
+                break;
+            case Trace_Timeout:
+                rto_ms = record->value / 1000.0;
+                break;
+            case Trace_Delay:
+                queue_delay_ms = record->value / 1000.0;
+                break;
+            case Trace_Ack_Sent:
+                // The receiver's advertised window stands in for cwnd in a receiver trace.
+                if (record->value == cwnd)
+                {
+                    continue;
+                }
+                cwnd = record->value;
+                break;
+            default:
+                continue;
+        }
+        fprintf(out, "%.6f,%u,%.3f,%.3f,%.3f\n", record_ms(record), cwnd, rtt_ms, rto_ms, queue_delay_ms);
+    }
+}
+
+/**
+ * @brief Writes both CSVs and a gnuplot script that plots them.
+ *
+ * @param prefix Path prefix of the files written.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int write_plots(const char *prefix)
+{
+    size_t length = strlen(prefix) + sizeof("-series.csv");
+    char sequence_path[length], series_path[length], script_path[length];
+    snprintf(sequence_path, length, "%s-seq.csv", prefix);
+    snprintf(series_path, length, "%s-series.csv", prefix);
+    snprintf(script_path, length, "%s.gp", prefix);
+
+    FILE *sequence = fopen(sequence_path, "w");
+    FILE *series = fopen(series_path, "w");
+    FILE *script = fopen(script_path, "w");
+    if ((sequence == NULL) || (series == NULL) || (script == NULL))
+    {
+        perror("Error writing plots");
+        return -1;
+    }
+    write_sequence(sequence);
+    write_series(series);
+
+    fprintf(script,
+            "# gnuplot %s\n"
+            "set datafile separator ','\n"
+            "set terminal pngcairo size 1400,700\n"
+            "set key top left\n"
+            "set xlabel 'time (ms)'\n"
+            "set output '%s-seq.png'\n"
+            "set title '%s sequence/time'\n"
+            "set ylabel 'sequence (bytes)'\n"
+            "plot '%s' using 1:(strcol(2) eq 'send' || strcol(2) eq 'receive' ? $3 : 1/0) with dots lc rgb '#1f77b4' title 'send/receive', \\\n"
+            "     '' using 1:(strcol(2) eq 'retransmit' ? $3 : 1/0) with points pt 7 ps 0.5 lc rgb '#d62728' title 'retransmit', \\\n"
+            "     '' using 1:(strcol(2) eq 'drop' ? $3 : 1/0) with points pt 2 ps 0.5 lc rgb '#ff7f0e' title 'drop', \\\n"
+            "     '' using 1:(strcol(2) eq 'ack' || strcol(2) eq 'ack_sent' ? $3 : 1/0) with steps lc rgb '#2ca02c' title 'ack', \\\n"
+            "     '' using 1:(strcol(2) eq 'dup_ack' ? $3 : 1/0) with points pt 6 ps 0.5 lc rgb '#9467bd' title 'dup ack'\n"
+            "set output '%s-cwnd.png'\n"
+            "set title '%s window and RTT'\n"
+            "set ylabel 'window (bytes)'\n"
+            "set y2label 'ms'\n"
+            "set y2tics\n"
+            "set ytics nomirror\n"
+            "plot '%s' using 1:2 with steps lw 2 title 'window', \\\n"
+            "     '' using 1:3 axes x1y2 with lines title 'RTT', \\\n"
+            "     '' using 1:4 axes x1y2 with lines title 'RTO'\n",
+            script_path, prefix, header.role, sequence_path, prefix, header.role, series_path);
+
+    fclose(sequence);
+    fclose(series);
+    fclose(script);
+    printf("Wrote %s, %s and %s; run gnuplot %s\n", sequence_path, series_path, script_path, script_path);
+    return 0;
+}
+
+/**
+ * @brief Main function of rtrace, see the top of this file for the usage.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Array of command-line arguments.
+ * @return Returns the exit status.
+ */
+int main(int argc, char **argv)
+{
+    int option;
+    char mode = 0;
+    char *prefix = NULL;
+    int bad_option = 0;
+
+    while ((option = getopt(argc, argv, "scp:")) != -1)
+    {
+        switch (option)
+        {
+            case 's':
+            case 'c':
+                mode = option;
+                break;
+            case 'p':
+                mode = option;
+                prefix = optarg;
+                break;
+            default:
+                bad_option = 1;
+        }
+    }
+    if (bad_option || (argc - optind != 1))
+    {
+        fprintf(stderr, "usage: %s [-s | -c | -p output_prefix] trace_file\n\n", argv[0]);
+        exit(1);
+    }
+    if (load_trace(argv[optind]) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    switch (mode)
+    {
+        case 's':
+            write_sequence(stdout);
+            break;
+        case 'c':
+            write_series(stdout);
+            break;
+        case 'p':
+            if (write_plots(prefix) < 0)
+            {
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            print_summary();
+    }
+    free(records);
+    return EXIT_SUCCESS;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,15 +8,71 @@
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
 #include <time.h>
 #include <math.h>
+#include <poll.h>
 #include "our_protocol.h"
+#include "fec.h"
+#include "delta.h"
+#include "checksum.h"
+#include "manifest.h"
+#include "monotonic.h"
+#include "direct_io.h"
+#include "uring.h"
+#include "ring.h"
+#include "pool.h"
+#include "trace.h"
+#include "timestamp.h"
+#include "synthetic.h"
+#include "perf.h"
+#include "zerocopy.h"
+#include "ecn.h"
+#include <stdatomic.h>
 
 #define ALPHA 0.125
 #define BETA 0.25
+#define FEC_INITIAL_LOSS_ESTIMATE 0.01
+#define DELTA_FETCH_WINDOW 128
+#define DELTA_FETCH_MIN_TIMEOUT_MS 10
+#define SYNC_INITIAL_TIMEOUT_MS 1000
+#define SYNC_MAX_TIMEOUT_MS 8000
+#define SYNC_MAX_ATTEMPTS 6
+#define INITIAL_WINDOW_SEGMENTS 10
+#define FIN_MAX_ATTEMPTS 8
+#define FIN_MIN_TIMEOUT_MS 10
+#define FIN_MAX_TIMEOUT_MS 2000
+#define ACK_FREQUENCY_DEFAULT 4
+#define DUPLICATE_ACK_THRESHOLD 3
+#define URING_ENTRIES 1024
+#define URING_SLAB_PACKETS 1024 // Packets queued to send; a few windows of the largest size
+#define URING_CHUNK_SIZE (128 * 1024)
+#define URING_CHUNKS 16
+#define URING_READAHEAD_CHUNKS 4
+#define URING_SOCKET_INDEX 0
+#define URING_FILE_INDEX 1
+#define URING_READ_TAG (1ULL << 32) // In user_data, with the chunk; sends carry the slab slot
+#define SEND_ROOM_WAIT_MS 100 // Longest wait for room in a full send buffer before trying again
+#define QUEUE_DELAY_MIN_TARGET_MS 0.5 // Queueing delay the window may always build before it stops growing
+#define READER_BUFFERS (4 * MAX_SPARSE_WINDOW_SIZE / PACKET_SIZE) // Read ahead by up to four windows of the largest size
+
+/* A URING_CHUNK_SIZE piece of the file, read ahead into the registered cache */
+struct cache_chunk
+{
+    uint64_t index;
+    uint32_t length;
+    uint8_t state;
+};
+
+enum cache_chunk_state
+{
+    Chunk_Empty,
+    Chunk_Reading,
+    Chunk_Ready
+};
 
 static unsigned int sender_current_state;
 static unsigned long long int bytes_left_to_send;
@@ -29,17 +86,122 @@ static double RTT_in_ms;
 static double timeoutInterval_in_ms;
 static double devRTT;
 static uint8_t timer_valid;
+static double rtt_sample_start;
+static uint32_t rtt_sample_seq;
+static uint32_t rtt_sample_first;
+static double min_rtt_ms;
 
-static clock_t start, end;
-static double cpu_time_used_in_seconds;
-static double cpu_time_used_in_ms;
+static double start, end;
+static double time_elapsed_in_ms;
 static long long int file_offset_for_sending;
+static unsigned long long int bytes_acknowledged;
 static uint8_t duplicate_ack_count;
+static uint32_t next_to_send;
+static uint32_t highest_sent;
+static uint8_t in_recovery;
+static uint32_t recovery_seq;
+static unsigned int lost_segments;
+static uint16_t ack_frequency;
+static unsigned long long int acks_received;
+static uint32_t max_window_size;
+static unsigned int sync_attempts;
+static unsigned int fin_attempts;
+
+static uint8_t fec_enabled;
+static double loss_rate_estimate;
+static double simulated_loss_percent;
+
+static uint8_t delta_requested;
+static uint8_t delta_active;
+static unsigned long long int file_bytes_to_send;
+static struct delta_Signature *local_signatures;
+static uint64_t local_block_count;
+static uint32_t remote_signature_count;
+static uint8_t *signature_chunk_received;
+static uint8_t *weak_hash_matched;
+static uint32_t next_signature_chunk;
+static uint8_t *delta_changed_bitmap;
+static uint64_t delta_bitmap_length;
+static uint64_t *delta_changed_blocks;
+static uint64_t delta_changed_count;
+
+static uint32_t stream_digest;
+static unsigned long long int digest_offset;
+static unsigned long long int corrupted_packets;
+static uint8_t transfer_failed;
+
+static uint8_t manifest_requested;
+static struct manifest_List manifest_list;
+
+static int generated_kind;
+static unsigned long long int packets_sent;
+
+static uint8_t direct_requested;
+static struct direct_Reader direct_reader;
+
+static uint8_t uring_requested;
+static uint8_t uring_active;
+static struct uring_Ring uring;
+static struct protocol_Packet *slab_packets;
+static uint8_t *slab_busy;
+static unsigned long long int slab_next;
+static uint8_t burst_open;
+static int send_error;
+static char *cache_memory;
+static struct cache_chunk cache_chunks[URING_CHUNKS];
+static unsigned long long int uring_packets;
+
+static uint8_t zerocopy_requested;
+static uint8_t zerocopy_active;
+static struct zerocopy_Sender zerocopy;
+
+static uint8_t timestamps_requested;
+static uint8_t timestamps_active;
+static uint8_t timestamps_echoed;
+static uint8_t stamp_next_send;
+static uint32_t stamps_requested;
+static uint8_t rtt_sample_stamped;
+static uint32_t rtt_sample_id;
+static struct timestamp_Stamp arrival_stamp;
+static unsigned long long int kernel_rtt_samples;
+static unsigned long long int rtt_samples;
+static uint8_t delay_signal;
+static int64_t min_one_way_ns;
+static double queue_delay_ms;
+static unsigned long long int growth_held;
+
+static uint8_t ecn_requested;
+static uint8_t ecn_active;
+static uint8_t ecn_echo_seen;
+static uint8_t ecn_reduced;
+static uint32_t ecn_reduction_seq;
+static unsigned long long int ecn_echoes;
+static unsigned long long int ecn_reductions;
+
+static char *trace_path;
+
+static uint8_t reader_requested;
+static uint8_t reader_running;
+static pthread_t reader_thread;
+static unsigned long long int reader_start_offset;
+static struct ring_Spsc read_queue;
+static struct pool_Pool read_pool;
+static struct pool_Cache send_cache;
+static struct ring_Descriptor read_current;
+static uint8_t read_current_valid;
+static _Atomic uint8_t reader_stopping;
+static _Atomic uint8_t reader_done;
+static unsigned long long int read_ahead_hits;
+static unsigned long long int read_ahead_misses;
+
+static uint8_t perf_requested;
+static struct perf_Counters perf_counters;
      
 enum sender_state
 {
     /* Connection Setup */
     Start_Connection,
+    Fetch_Signatures,
 
     /* Send Data*/
     Send_N_Packets,
@@ -56,9 +218,18 @@ enum sender_state
 int sender_init(char* filename, unsigned long long int bytesToTransfer,
                         char* hostname, unsigned short int hostUDPport);
 int open_file(char* filename, unsigned long long int bytesToTransfer); 
+int read_file(char *buffer, uint32_t length, unsigned long long int offset);
+int open_manifest(char* manifest_path);
+int open_generated(unsigned long long int bytesToTransfer);
 int setup_socket(char* hostname, unsigned short int hostUDPport);
+int setup_uring(void);
 void setup_cwindow(void);
+void setup_fec(void);
 void updateRTT(double sampleRTT);
+double sample_rtt(struct protocol_Packet *ack_packet, ssize_t length);
+int find_send_stamp(struct timestamp_Stamp *stamp);
+void update_queue_delay(const struct timestamp_Stamp *sent, const struct protocol_Ack_Timestamp *echo);
+int queue_building(void);
 void handle_timeout(void);
 
 /* Closing file, socket, etc. */
@@ -67,10 +238,34 @@ void sender_finish(void);
 /* Connection Setup */
 void sender_action_Start_Connection(void);
 int is_Sync_Ack(struct protocol_Header* receive_buffer);
-void init_rtt(void);
+void accept_window(uint32_t advertised_window);
+void resume_from(unsigned long long int offset);
+void sender_action_Fetch_Signatures(void);
+void compare_signatures(uint32_t chunk, struct protocol_Packet *signature_packet);
+int plan_delta(void);
+void init_rtt(double handshake_ms);
 
 /* Send Data*/
 void sender_action_Send_N_Packets(void);
+ssize_t send_segment(struct protocol_Packet *packet, uint32_t sending_index, uint8_t last_in_burst);
+uint32_t segment_length(uint32_t sending_index);
+struct protocol_Packet *slab_packet(void);
+ssize_t queue_send(struct protocol_Packet *packet, size_t length);
+int flush_sends(void);
+void reap_completions(void);
+int uring_read_file(char *buffer, uint32_t length, unsigned long long int offset);
+void read_ahead(uint64_t chunk_index);
+void retransmit_first_segment(void);
+void read_stream(unsigned long long int stream_offset, char *buffer, uint32_t length);
+int start_reader(unsigned long long int offset);
+void stop_reader(void);
+void *reader_main(void *argument);
+int take_read_ahead(char *buffer, uint32_t length, unsigned long long int offset);
+void update_stream_digest(unsigned long long int stream_offset, const char *data, uint32_t length);
+ssize_t send_packet(struct protocol_Packet *packet, size_t length);
+ssize_t send_stamped(struct protocol_Packet *packet, size_t length);
+int wait_for_send_room(void);
+ssize_t receive_packet(struct protocol_Packet *packet);
 int valid_ack_num(uint32_t ack_num);
 int sending_index_in_range(uint32_t sending_index);
 
@@ -78,10 +273,19 @@ void sender_action_Wait_for_Ack(void);
 void increment_cwindow(void);
 void half_cwindow(void);
 void quarter_cwindow(void);
+void respond_to_ecn(uint32_t ack_num);
+void update_loss_rate(double sample);
 
 /* Connection Teardown */
 void sender_action_Send_Fin(void);
 void sender_action_Wait_Fin_Ack(void);
+void check_stream_digest(struct protocol_Packet *fin_ack_packet, ssize_t length);
+size_t add_fin(struct protocol_Packet *packet);
+void fin_ack_received(struct protocol_Packet *fin_ack_packet, ssize_t length);
+int socket_readable(double timeout_in_ms);
+
+/* Performance counters */
+int sender_phase(void);
 /* ================ Function Declarations END ================ */
 
 /**
@@ -101,8 +305,18 @@ int sender_init(char* filename, unsigned long long int bytesToTransfer,
                         char* hostname, unsigned short int hostUDPport)
 {
     sockfd = -1;
+    if (perf_requested)
+    {
+        perf_open(&perf_counters);
+    }
+    if ((trace_path != NULL) && (trace_open(trace_path, "rsend") < 0))
+    {
+        return -1;
+    }
+
     /* File related initialization */
-    if (open_file(filename, bytesToTransfer))
+    if ((generated_kind != Synthetic_None) ? open_generated(bytesToTransfer) :
+        manifest_requested ? open_manifest(filename) : open_file(filename, bytesToTransfer))
     {   
         printf("Could not open file\n");
         return -1;
@@ -115,8 +329,22 @@ int sender_init(char* filename, unsigned long long int bytesToTransfer,
         printf("Could not setup_socket\n");
         return -1;
     }
+    if (uring_requested && setup_uring())
+    {
+        printf("io_uring unavailable, using plain system calls\n");
+    }
+    if (zerocopy_requested)
+    {
+        zerocopy_active = (zerocopy_init(&zerocopy, sockfd) == 0);
+        if (!zerocopy_active)
+        {
+            printf("Zero-copy transmit unavailable, copying every packet\n");
+        }
+    }
 
+    max_window_size = MAX_WINDOW_SIZE;
     setup_cwindow();
+    setup_fec();
     /* Set up State machine */
     sender_current_state = Start_Connection;
     return 0;
@@ -126,7 +354,8 @@ int sender_init(char* filename, unsigned long long int bytesToTransfer,
  * @brief Opens the file to be sent and calculates the bytes to transfer.
  *
  * This function opens the specified file for reading and sets the bytes_left_to_send
- * based on the file size and the requested bytes to transfer.
+ * based on the file size and the requested bytes to transfer. For delta sync it also
+ * computes the weak hash of every block.
  *
  * @param filename The path to the file to be sent.
  * @param bytesToTransfer The number of bytes to transfer from the file.
@@ -164,6 +393,71 @@ int open_file(char* filename, unsigned long long int bytesToTransfer)
     {
         return -1;
     }
+    file_bytes_to_send = bytes_left_to_send;
+
+    /* Large files bypass the page cache, see direct_io.h */
+    if (direct_requested && (direct_reader_open(&direct_reader, filename) < 0))
+    {
+        return -1;
+    }
+
+    /* Weak hashes of our blocks, to compare against the receiver's signatures */
+    if (delta_requested)
+    {
+        local_block_count = delta_block_count(file_bytes_to_send);
+        local_signatures = calloc(local_block_count, sizeof(struct delta_Signature));
+        if ((local_signatures == NULL) || 
+            delta_compute_signatures(fileno(file_pointer), file_bytes_to_send, local_signatures, 0))
+        {
+            fprintf(stderr, "Error: Could not hash file for delta sync.\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Lists the files named by a manifest and sizes the multi-file stream.
+ *
+ * Every file is sent in full, so the bytes to send are the length of the stream
+ * of frames and contents.
+ *
+ * @param manifest_path The manifest, one path per line.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int open_manifest(char* manifest_path)
+{
+    if (manifest_load(&manifest_list, manifest_path))
+    {
+        return -1;
+    }
+    file_offset_for_sending = 0;
+    bytes_left_to_send = manifest_list.stream_length;
+    file_bytes_to_send = bytes_left_to_send;
+    printf("Sending %zu entries, %llu bytes in one stream\n", manifest_list.count, bytes_left_to_send);
+    return 0;
+}
+
+/**
+ * @brief Sizes a transfer of generated data (-g), which has no file behind it.
+ *
+ * The bytes are made as they are sent, see synthetic.h, so the transfer can be any length
+ * and never waits on the disk.
+ *
+ * @param bytesToTransfer The number of bytes to send.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int open_generated(unsigned long long int bytesToTransfer)
+{
+    if (bytesToTransfer == 0)
+    {
+        printf("Nothing to send\n");
+        return -1;
+    }
+    file_offset_for_sending = 0;
+    bytes_left_to_send = bytesToTransfer;
+    file_bytes_to_send = bytes_left_to_send;
+    printf("Sending %llu bytes of generated %s data\n", bytes_left_to_send, synthetic_name(generated_kind));
     return 0;
 }
 
@@ -221,6 +515,45 @@ int setup_socket(char* hostname, unsigned short int hostUDPport) {
         perror("Error setting socket to non-blocking mode");
         return -1;
     }
+
+    /* Kernel send and arrival times for the RTT and the one-way delay, see timestamp.h */
+    if (timestamps_requested) {
+        timestamps_active = (timestamp_enable(sockfd) == 0);
+        if (!timestamps_active) {
+            printf("Kernel timestamps unavailable, timing in user space\n");
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets up the io_uring backend.
+ *
+ * The socket and the file are registered with the ring, and so is the cache the file is
+ * read ahead into. Packets are built in a slab where they stay until their send completes.
+ *
+ * @return Returns 0 on success, -1 if io_uring is not available (plain system calls are used).
+ */
+int setup_uring(void)
+{
+    slab_packets = malloc(URING_SLAB_PACKETS * sizeof(struct protocol_Packet));
+    slab_busy = calloc(URING_SLAB_PACKETS, sizeof(uint8_t));
+    if ((slab_packets == NULL) || (slab_busy == NULL) ||
+        (posix_memalign((void **)&cache_memory, 4096, URING_CHUNKS * URING_CHUNK_SIZE) != 0))
+    {
+        cache_memory = NULL;
+        return -1;
+    }
+
+    int files[2] = { sockfd, (file_pointer != NULL) ? fileno(file_pointer) : -1 };
+    struct iovec cache = { .iov_base = cache_memory, .iov_len = URING_CHUNKS * URING_CHUNK_SIZE };
+    if ((uring_init(&uring, URING_ENTRIES) < 0) || (uring_register_files(&uring, files, 2) < 0) ||
+        (uring_register_buffers(&uring, &cache, 1) < 0))
+    {
+        uring_close(&uring);
+        return -1;
+    }
+    uring_active = 1;
     return 0;
 }
 
@@ -228,23 +561,43 @@ int setup_socket(char* hostname, unsigned short int hostUDPport) {
  * @brief Sets up the congestion window for the sender.
  *
  * Initializes the congestion window size and the tracking arrays for in-flight and
- * acknowledged packets. The window size is set to either the protocol data size or the
- * remaining bytes to send, whichever is smaller.
+ * acknowledged packets, starting at the current file offset. The window size is set to 
+ * either INITIAL_WINDOW_SEGMENTS packets or the remaining bytes to send, whichever is smaller,
+ * so a short transfer fits in the data sent along with the SYNC.
  */
 void setup_cwindow(void)
 {
-    /* Initialize to 1 packet. */
-    current_window_size = PROTOCOL_DATA_SIZE;
+    current_window_size = INITIAL_WINDOW_SEGMENTS * PROTOCOL_DATA_SIZE;
+    if (current_window_size > max_window_size)
+    {
+        current_window_size = max_window_size;
+    }
     if (bytes_left_to_send < current_window_size)
     {
         current_window_size = bytes_left_to_send;
     }
 
-    in_Flight[0] = 0;
+    in_Flight[0] = (uint32_t)file_offset_for_sending;
     in_Flight[1] = in_Flight[0] + (current_window_size - 1);
     acknowledged[0] = in_Flight[1] + 1;
     acknowledged[1] = in_Flight[0] - 1;
+    next_to_send = in_Flight[0];
+    highest_sent = in_Flight[0];
     duplicate_ack_count = 0;
+    in_recovery = 0;
+    trace_event(Trace_Cwnd, in_Flight[0], 0, current_window_size);
+}
+
+/**
+ * @brief Sets up the loss estimate used to size FEC blocks.
+ *
+ * Starts from a small assumed loss rate so the first windows are already protected,
+ * and seeds the generator used for simulated loss.
+ */
+void setup_fec(void)
+{
+    loss_rate_estimate = FEC_INITIAL_LOSS_ESTIMATE;
+    srand48(time(NULL));
 }
 
 /**
@@ -264,10 +617,124 @@ void updateRTT(double sampleRTT) {
 
     // Update timeout interval using this newly estimated RTT and safety margin.
     timeoutInterval_in_ms = RTT_in_ms + 4 * devRTT;
+    trace_event(Trace_Rto, rtt_sample_seq, (uint32_t)(sampleRTT * 1000), (uint32_t)(timeoutInterval_in_ms * 1000));
     
     timer_valid = 0;
 }
 
+/**
+ * @brief Measures the round trip of the timed segment, whose ACK just arrived.
+ *
+ * With kernel timestamps, from when the segment left to when the ACK arrived, both as the
+ * kernel saw them, so the time it took us to get to either is left out. Otherwise, or when
+ * either time is missing, from the times read here. An ACK that echoes when the segment
+ * reached the receiver also gives a one-way delay.
+ *
+ * @param ack_packet The ACK.
+ * @param length The number of bytes received.
+ * @return Returns the RTT sample in milliseconds.
+ */
+double sample_rtt(struct protocol_Packet *ack_packet, ssize_t length)
+{
+    double sample = end - rtt_sample_start;
+    struct timestamp_Stamp sent;
+    int64_t interval_ns;
+    rtt_samples++;
+    if (rtt_sample_stamped && find_send_stamp(&sent))
+    {
+        if (timestamp_interval(&sent, &arrival_stamp, &interval_ns) && (interval_ns > 0))
+        {
+            sample = interval_ns / 1e6;
+            kernel_rtt_samples++;
+        }
+
+        struct protocol_Ack_Timestamp echo;
+        if (timestamps_echoed && ((size_t)length >= sizeof(struct protocol_Header) + sizeof(echo)))
+        {
+            memcpy(&echo, ack_packet->data, sizeof(echo));
+            if (echo.seq == rtt_sample_first)
+            {
+                update_queue_delay(&sent, &echo);
+            }
+        }
+    }
+    rtt_sample_stamped = 0;
+    if ((min_rtt_ms == 0) || (sample < min_rtt_ms))
+    {
+        min_rtt_ms = sample;
+    }
+    return sample;
+}
+
+/**
+ * @brief Finds when the timed segment left, among the send times the kernel reported.
+ *
+ * Times of earlier segments, whose samples were given up, are passed over. The software
+ * and hardware times come separately.
+ *
+ * @param stamp Where to store the time.
+ * @return Returns 1 if it was found, 0 otherwise.
+ */
+int find_send_stamp(struct timestamp_Stamp *stamp)
+{
+    struct timestamp_Stamp reported;
+    uint32_t id;
+    int found = 0;
+    memset(stamp, 0, sizeof(*stamp));
+    while (timestamp_read_tx(sockfd, &id, &reported))
+    {
+        if (id == rtt_sample_id)
+        {
+            stamp->software_ns = reported.software_ns ? reported.software_ns : stamp->software_ns;
+            stamp->hardware_ns = reported.hardware_ns ? reported.hardware_ns : stamp->hardware_ns;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Updates the queueing delay from the one-way delay of the timed segment.
+ *
+ * The two ends' clocks are not in step, so a one-way delay on its own means nothing, but
+ * how far it rises above the smallest one seen is how long the segment waited in queues
+ * along the path.
+ *
+ * @param sent When the segment left, on our clock.
+ * @param echo When it arrived, on the receiver's clock.
+ */
+void update_queue_delay(const struct timestamp_Stamp *sent, const struct protocol_Ack_Timestamp *echo)
+{
+    uint64_t sent_ns = echo->hardware ? sent->hardware_ns : sent->software_ns;
+    if (sent_ns == 0)
+    {
+        return;
+    }
+    int64_t one_way_ns = (int64_t)(echo->arrival_ns - sent_ns);
+    if (!delay_signal || (one_way_ns < min_one_way_ns))
+    {
+        min_one_way_ns = one_way_ns;
+    }
+    double sample_ms = (one_way_ns - min_one_way_ns) / 1e6;
+    queue_delay_ms = delay_signal ? (1 - ALPHA) * queue_delay_ms + ALPHA * sample_ms : sample_ms;
+    delay_signal = 1;
+    trace_event(Trace_Delay, echo->seq, (uint32_t)(sample_ms * 1000), (uint32_t)(queue_delay_ms * 1000));
+}
+
+/**
+ * @brief Tells whether the window is building a queue on the path.
+ *
+ * That is when the queueing delay is more than the path's own round trip (and more than
+ * QUEUE_DELAY_MIN_TARGET_MS); a bigger window would then only add delay.
+ *
+ * @return Returns 1 if the queue is building, 0 if not or if there is no one-way delay.
+ */
+int queue_building(void)
+{
+    double target_ms = (min_rtt_ms > QUEUE_DELAY_MIN_TARGET_MS) ? min_rtt_ms : QUEUE_DELAY_MIN_TARGET_MS;
+    return delay_signal && (queue_delay_ms > target_ms);
+}
+
 /**
  * @brief Handles the timeout event.
  *
@@ -277,6 +744,7 @@ void updateRTT(double sampleRTT) {
 void handle_timeout(void) {
     // Exponential backoff, double the timeout interval
      timeoutInterval_in_ms *= 2;
+     trace_event(Trace_Timeout, in_Flight[0], 0, (uint32_t)(timeoutInterval_in_ms * 1000));
      // We could also double the deviation, but this might be more than we need for now
      // devRTT *= 2;
 }
@@ -284,46 +752,143 @@ void handle_timeout(void) {
 /**
  * @brief Initiates the connection setup process by sending a SYNC packet.
  *
- * Sends a SYNC packet to the receiver to start the connection setup. After sending,
- * it waits for a SYNC_ACK response from the receiver and transitions the sender's state
- * machine based on the response.
+ * Sends a SYNC packet carrying the transfer size, segment size, window and options to the
+ * receiver to start the connection setup. Unless the data stream depends on the receiver
+ * (delta sync), the first window of data follows right behind it so a short transfer is
+ * delivered within one round trip. It then waits for a SYNC_ACK response from the receiver,
+ * which says where the transfer starts and how large a window it accepts, and transitions
+ * the sender's state machine based on the response. Each unanswered SYNC doubles the wait,
+ * and the sender gives up after SYNC_MAX_ATTEMPTS.
  */
 void sender_action_Start_Connection(void)
 {
+    if (sync_attempts == SYNC_MAX_ATTEMPTS)
+    {
+        fprintf(stderr, "No response from receiver after %u attempts\n", sync_attempts);
+        transfer_failed = 1;
+        sender_current_state = sender_Done;
+        return;
+    }
+    double timeout_in_ms = SYNC_INITIAL_TIMEOUT_MS * (double)(1u << sync_attempts);
+    if (timeout_in_ms > SYNC_MAX_TIMEOUT_MS)
+    {
+        timeout_in_ms = SYNC_MAX_TIMEOUT_MS;
+    }
+    sync_attempts++;
+
     /* send SYNC = 1 to receiver */ 
     struct protocol_Packet sync_packet;
+    struct protocol_Sync sync_info;
 
     /* Sync bit:7, Sync Ack bit:6, 0:5, 0:4, 0:3, 0:2, Fin bit:1, Fin ack bit:0 */
     memset(&sync_packet, 0, sizeof(sync_packet));
     sync_packet.header.management_byte = sync_packet.header.management_byte | 0x80;
 
-    ssize_t bytes_sent = send(sockfd, &sync_packet, sizeof(struct protocol_Packet), 0);
+    memset(&sync_info, 0, sizeof(sync_info));
+    sync_info.total_bytes = bytes_left_to_send;
+    sync_info.start_offset = 0;
+    sync_info.options = delta_requested ? SYNC_OPTION_DELTA : 0;
+    sync_info.options |= manifest_requested ? SYNC_OPTION_MANIFEST : 0;
+    sync_info.options |= timestamps_active ? SYNC_OPTION_TIMESTAMPS : 0;
+    sync_info.options |= (generated_kind == Synthetic_Pattern) ? SYNC_OPTION_GENERATED_PATTERN : 0;
+    sync_info.options |= (generated_kind == Synthetic_Random) ? SYNC_OPTION_GENERATED_RANDOM : 0;
+    sync_info.options |= ecn_requested ? SYNC_OPTION_ECN : 0;
+    sync_info.window_size = MAX_SPARSE_WINDOW_SIZE;
+    sync_info.segment_size = PROTOCOL_DATA_SIZE;
+    sync_info.ack_frequency = ack_frequency;
+    memcpy(sync_packet.data, &sync_info, sizeof(sync_info));
+
+    ssize_t bytes_sent = send_packet(&sync_packet, sizeof(struct protocol_Header) + sizeof(sync_info));
 
     if (bytes_sent < 0) {
         perror("Error sending data");
         sender_current_state = sender_Done;
         return;
     }
+    double sync_sent_at = monotonic_ms();
+
+    /* Send the first window without waiting for the SYNC_ACK */
+    uint8_t early_data_sent = !delta_requested;
+    if (early_data_sent)
+    {
+        /* A retried SYNC resends the same first window */
+        next_to_send = in_Flight[0];
+        sender_action_Send_N_Packets();
+        if (sender_current_state == sender_Done)
+        {
+            return;
+        }
+        sender_current_state = Start_Connection;
+    }
     
-    /* Start 2 second timer */
-    start = clock();
     while(1)
     {
-        end = clock();
-        cpu_time_used_in_ms = ((double) (end - start)) / (CLOCKS_PER_SEC / 1000);
+        double remaining_in_ms = timeout_in_ms - (monotonic_ms() - sync_sent_at);
+        if (remaining_in_ms <= 0)
+        {
+            break;
+        }
+
+        /* Nothing else to do until the SYNC_ACK arrives, so block rather than spin */
+        int readable = socket_readable(remaining_in_ms);
+        if (readable < 0)
+        {
+            sender_current_state = sender_Done;
+            break;
+        }
+        if (readable == 0)
+        {
+            continue;
+        }
 
         /* Check Socket for response */
-        struct protocol_Header receive_buffer;
-        ssize_t bytes_received = recv(sockfd, &receive_buffer, 512, MSG_DONTWAIT);
+        struct protocol_Packet receive_buffer;
+        ssize_t bytes_received = receive_packet(&receive_buffer);
         if (bytes_received > 0) 
         {
             /* If its a Sync Ack*/            
-            if (is_Sync_Ack(&receive_buffer)) 
+            if (is_Sync_Ack(&receive_buffer.header)) 
             {
-                //TODO: set up sliding window, current packet size, RTT?
-                init_rtt();
+                init_rtt(monotonic_ms() - sync_sent_at);
 
-                sender_current_state = Send_N_Packets;
+                /* The first window is already in flight */
+                sender_current_state = early_data_sent ? Wait_for_Ack : Send_N_Packets;
+
+                if ((size_t)bytes_received >= sizeof(struct protocol_Header) + sizeof(sync_info))
+                {
+                    memcpy(&sync_info, receive_buffer.data, sizeof(sync_info));
+                    accept_window(sync_info.window_size);
+                    ack_frequency = sync_info.ack_frequency;
+                    timestamps_echoed = (sync_info.options & SYNC_OPTION_TIMESTAMPS) != 0;
+                    if (ecn_requested)
+                    {
+                        /* Marking packets ECN-capable only pays if the marks come back */
+                        ecn_active = (sync_info.options & SYNC_OPTION_ECN) && (ecn_mark_outgoing(sockfd) == 0);
+                        if (!ecn_active)
+                        {
+                            printf("Receiver does not echo ECN marks, sending without ECN\n");
+                        }
+                    }
+
+                    if (((sync_info.options & SYNC_OPTION_MANIFEST) != 0) != manifest_requested)
+                    {
+                        fprintf(stderr, manifest_requested ? "Receiver refused a multi-file transfer (needs rrecv -m)\n"
+                                                           : "Receiver expects multiple files (needs rsend -m)\n");
+                        transfer_failed = 1;
+                        sender_current_state = sender_Done;
+                    }
+                    /* Fetch the receiver's block signatures before deciding what to send */
+                    else if (delta_requested && (sync_info.options & SYNC_OPTION_DELTA))
+                    {
+                        remote_signature_count = sync_info.signature_count;
+                        sender_current_state = Fetch_Signatures;
+                    }
+                    /* Skip what the receiver already has from an interrupted transfer */
+                    else if ((sync_info.start_offset > 0) && (sync_info.start_offset <= bytes_left_to_send))
+                    {
+                        resume_from(sync_info.start_offset);
+                    }
+                }
                 break;
             }
         } 
@@ -340,16 +905,37 @@ void sender_action_Start_Connection(void)
             sender_current_state = sender_Done;
             break;
         }
-
-        /* Check Timer for timeout */
-        else if (cpu_time_used_in_ms >= 2000)
-        {
-            break;
-        }
     }
     return;    
 }
 
+/**
+ * @brief Limits the congestion window to the window the receiver advertised.
+ *
+ * Until the receiver says otherwise the window stays within MAX_WINDOW_SIZE. The window is
+ * kept a whole number of packets, and anything in flight beyond it is dropped from the window.
+ *
+ * @param advertised_window The receiver's window in bytes, 0 if it did not say.
+ */
+void accept_window(uint32_t advertised_window)
+{
+    if (advertised_window < PROTOCOL_DATA_SIZE)
+    {
+        return;
+    }
+    if (advertised_window > MAX_SPARSE_WINDOW_SIZE)
+    {
+        advertised_window = MAX_SPARSE_WINDOW_SIZE;
+    }
+    max_window_size = advertised_window - (advertised_window % PROTOCOL_DATA_SIZE);
+    if (current_window_size > max_window_size)
+    {
+        current_window_size = max_window_size;
+        in_Flight[1] = in_Flight[0] + (current_window_size - 1);
+        acknowledged[0] = in_Flight[1] + 1;
+    }
+}
+
 /**
  * @brief Checks if the received packet is a valid SYNC_ACK packet.
  *
@@ -364,122 +950,1062 @@ int is_Sync_Ack(struct protocol_Header* receive_buffer)
 }
 
 /**
- * @brief Initializes Round-Trip Time (RTT) values based on the initial measurement.
+ * @brief Moves the start of the transfer to the offset the receiver resumes from.
  *
- * Sets the initial RTT, deviation, and timeout interval values based on the first
- * measured RTT.
+ * Seeks the file straight to the offset and rebuilds the congestion window there, since
+ * sequence numbers follow file offsets. Goes straight to teardown if nothing is left.
+ *
+ * @param offset The byte offset the receiver already has everything before.
  */
-void init_rtt(void) 
+void resume_from(unsigned long long int offset)
 {
-    RTT_in_ms = cpu_time_used_in_ms * 6;
-    devRTT = RTT_in_ms /2;
-    timeoutInterval_in_ms = RTT_in_ms + (4 * devRTT);
-    timer_valid = 0;
+    printf("Resuming transfer at byte %llu\n", offset);
+    stop_reader();
+    bytes_left_to_send -= offset;
+    file_offset_for_sending = offset;
+
+    /* The digest covers this session only, so forget the early data hashed from offset 0 */
+    stream_digest = 0;
+    digest_offset = offset;
+
+    if (bytes_left_to_send == 0)
+    {
+        sender_current_state = Send_Fin;
+        return;
+    }
+    setup_cwindow();
 }
 
 /**
- * @brief Handles the process of sending a number of data packets.
+ * @brief Fetches the receiver's block signatures for delta sync.
  *
- * Reads data from the file and sends packets sequentially according to the current
- * congestion window. Updates the sender's state machine to wait for acknowledgments.
+ * Requests up to DELTA_FETCH_WINDOW missing chunks of the signature list at once and
+ * compares each chunk against our blocks as it arrives. Chunks that do not arrive within
+ * the timeout are requested again on the next call. Once every chunk is in, plans the
+ * data stream and moves on to sending it.
  */
-void sender_action_Send_N_Packets(void) 
+void sender_action_Fetch_Signatures(void)
 {
-    uint32_t sending_index;
-    struct protocol_Packet packet_being_sent;
-    sending_index = in_Flight[0];
-    
-    while (sending_index_in_range(sending_index))
+    uint32_t chunk_count = (remote_signature_count + DELTA_SIGNATURES_PER_PACKET - 1) / DELTA_SIGNATURES_PER_PACKET;
+
+    if (signature_chunk_received == NULL)
+    {
+        signature_chunk_received = calloc(chunk_count + 1, sizeof(uint8_t));
+        weak_hash_matched = calloc(local_block_count + 1, sizeof(uint8_t));
+        delta_bitmap_length = (local_block_count + 7) / 8;
+        delta_changed_bitmap = calloc(delta_bitmap_length, sizeof(uint8_t));
+        if ((signature_chunk_received == NULL) || (weak_hash_matched == NULL) || (delta_changed_bitmap == NULL))
+        {
+            perror("Error allocating for delta sync");
+            sender_current_state = sender_Done;
+            return;
+        }
+        /* Every block is changed until a matching signature says otherwise */
+        for (uint64_t block = 0; block < local_block_count; block++)
+        {
+            delta_changed_bitmap[block / 8] |= (1 << (block % 8));
+        }
+        next_signature_chunk = 0;
+    }
+
+    while ((next_signature_chunk < chunk_count) && signature_chunk_received[next_signature_chunk])
+    {
+        next_signature_chunk++;
+    }
+    if (next_signature_chunk == chunk_count)
     {
-        unsigned int i;
-        memset(&packet_being_sent, 0, sizeof(packet_being_sent));
-        packet_being_sent.header.seq_ack_num = sending_index;
+        sender_current_state = plan_delta() ? sender_Done : Send_N_Packets;
+        return;
+    }
 
-        for (i = 0; (i < PROTOCOL_DATA_SIZE) && (sending_index_in_range(sending_index)); i++, sending_index++)
+    /* Request a window of missing chunks */
+    uint32_t requested = 0;
+    for (uint32_t chunk = next_signature_chunk; (chunk < chunk_count) && (requested < DELTA_FETCH_WINDOW); chunk++)
+    {
+        if (signature_chunk_received[chunk])
         {
-            packet_being_sent.data[i] = fgetc(file_pointer);
+            continue;
         }
-        
-        if (i < PROTOCOL_DATA_SIZE) {
-            for (unsigned int j = i; j < PROTOCOL_DATA_SIZE; j++){
-                packet_being_sent.data[j] = EOF;
+        struct protocol_Packet request;
+        memset(&request.header, 0, sizeof(request.header));
+        request.header.management_byte = SIGNATURE_BIT;
+        request.header.seq_ack_num = chunk;
+        if (send_packet(&request, sizeof(request.header)) < 0)
+        {
+            perror("Error sending signature request");
+            sender_current_state = sender_Done;
+            return;
+        }
+        requested++;
+    }
+
+    double timeout_in_ms = (timeoutInterval_in_ms > DELTA_FETCH_MIN_TIMEOUT_MS) ? timeoutInterval_in_ms : DELTA_FETCH_MIN_TIMEOUT_MS;
+    start = monotonic_ms();
+    while (requested > 0)
+    {
+        end = monotonic_ms();
+        time_elapsed_in_ms = end - start;
+
+        struct protocol_Packet receive_buffer;
+        ssize_t bytes_received = receive_packet(&receive_buffer);
+        if (bytes_received > 0) 
+        {
+            uint32_t chunk = receive_buffer.header.seq_ack_num;
+            if ((receive_buffer.header.management_byte == SIGNATURE_BIT) && (chunk < chunk_count) 
+                && !signature_chunk_received[chunk])
+            {
+                compare_signatures(chunk, &receive_buffer);
+                signature_chunk_received[chunk] = 1;
+                requested--;
             }
         }
-        packet_being_sent.header.bytes_of_data = i;
-        ssize_t bytes_sent = send(sockfd, &packet_being_sent, sizeof(struct protocol_Packet), 0);
-        
-        if (bytes_sent == -1){
+        else if ((bytes_received == -1) && (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            perror("Error receiving data");
             sender_current_state = sender_Done;
-            break;
+            return;
         }
-        if (!timer_valid)
+        else if (time_elapsed_in_ms > timeout_in_ms)
         {
-            start = clock();
-            timer_valid = 1;
+            break;
         }
     }
-    sender_current_state = Wait_for_Ack;
-    return;
 }
 
 /**
- * @brief Checks if a given acknowledgment number is valid.
+ * @brief Finds the blocks covered by a chunk of receiver signatures whose weak hash matches.
  *
- * Validates the acknowledgment number against the range of sequence numbers in the
- * current congestion window.
+ * The receiver's strong hash of each such block is kept so plan_delta() can confirm
+ * them all at once; blocks whose weak hash differs are changed without further work.
  *
- * @param ack_num The acknowledgment number to validate.
- * @return Returns 1 if the acknowledgment number is valid, 0 otherwise.
+ * @param chunk The index of the chunk of the signature list.
+ * @param signature_packet The SIGNATURE packet carrying the chunk.
  */
-int valid_ack_num(uint32_t ack_num) 
+void compare_signatures(uint32_t chunk, struct protocol_Packet *signature_packet)
 {
-
-    if (in_Flight[0] < in_Flight[1]){
-        if ((ack_num > in_Flight[0]) && (ack_num <= (in_Flight[1] + 1))){
-            return 1;
-        }
-        return 0;
+    uint32_t entries = signature_packet->header.bytes_of_data / sizeof(struct delta_Signature);
+    if (entries > DELTA_SIGNATURES_PER_PACKET)
+    {
+        entries = DELTA_SIGNATURES_PER_PACKET;
     }
 
-    else if (in_Flight[0] > in_Flight[1])
-    {   
-        if ((ack_num > in_Flight[0]) || (ack_num <= (in_Flight[1] + 1)))
+    for (uint32_t i = 0; i < entries; i++)
+    {
+        uint64_t block = (uint64_t)chunk * DELTA_SIGNATURES_PER_PACKET + i;
+        if (block >= local_block_count)
         {
-            return 1;
+            break;
         }
-        return 0;
-    }
-    else if (in_Flight[0] == in_Flight[1]) 
-    {
-        if (ack_num == (in_Flight[1] + 1))
+        struct delta_Signature remote;
+        memcpy(&remote, signature_packet->data + i * sizeof(remote), sizeof(remote));
+
+        if (remote.weak_hash == local_signatures[block].weak_hash)
         {
-            return 1;
+            local_signatures[block] = remote;
+            weak_hash_matched[block] = 1;
         }
-        return 0;
     }
-    return 0;
 }
 
 /**
- * @brief Checks if the sending index is within the current congestion window range.
+ * @brief Lays out the delta sync data stream.
  *
- * Determines if a given index for sending data is within the bounds of the current
- * congestion window.
+ * Confirms the weak hash matches with the strong hash (in parallel), then lays out the
+ * stream as the changed-block bitmap followed by every changed block in order.
+ * Rebuilds the congestion window over the new stream length.
  *
- * @param sending_index The index to be checked.
- * @return Returns 1 if the index is within range, 0 otherwise.
+ * @return Returns 0 on success, -1 on failure.
  */
-int sending_index_in_range(uint32_t sending_index)
+int plan_delta(void)
 {
-
-    if (in_Flight[1] > in_Flight[0]) {
-        return ((sending_index <= in_Flight[1]) && (sending_index >= in_Flight[0]));
-    }
-    else if (in_Flight[0] > in_Flight[1])
+    uint64_t candidate_count = 0;
+    delta_changed_blocks = malloc((local_block_count + 1) * sizeof(uint64_t));
+    struct delta_Signature *candidate_signatures = malloc((local_block_count + 1) * sizeof(struct delta_Signature));
+    uint8_t *unchanged = malloc(local_block_count + 1);
+    if ((delta_changed_blocks == NULL) || (candidate_signatures == NULL) || (unchanged == NULL))
     {
-        return ((sending_index <= in_Flight[1]) || (sending_index >= in_Flight[0]));
+        perror("Error allocating for delta sync");
+        free(candidate_signatures);
+        free(unchanged);
+        return -1;
     }
-    else if (in_Flight[0] == in_Flight[1])
+
+    /* Candidates are listed in delta_changed_blocks until the real list is built */
+    for (uint64_t block = 0; block < local_block_count; block++)
+    {
+        if (weak_hash_matched[block])
+        {
+            delta_changed_blocks[candidate_count] = block;
+            candidate_signatures[candidate_count] = local_signatures[block];
+            candidate_count++;
+        }
+    }
+    if (delta_confirm_blocks(fileno(file_pointer), file_bytes_to_send, delta_changed_blocks, 
+                             candidate_signatures, unchanged, candidate_count) < 0)
+    {
+        /* Anything left unconfirmed is simply sent */
+        perror("Error confirming blocks for delta sync");
+    }
+    for (uint64_t i = 0; i < candidate_count; i++)
+    {
+        if (unchanged[i])
+        {
+            uint64_t block = delta_changed_blocks[i];
+            delta_changed_bitmap[block / 8] &= ~(1 << (block % 8));
+        }
+    }
+    free(candidate_signatures);
+    free(unchanged);
+
+    unsigned long long int stream_length = delta_bitmap_length;
+    delta_changed_count = 0;
+    for (uint64_t block = 0; block < local_block_count; block++)
+    {
+        if (delta_changed_bitmap[block / 8] & (1 << (block % 8)))
+        {
+            delta_changed_blocks[delta_changed_count++] = block;
+            stream_length += delta_block_length(file_bytes_to_send, block);
+        }
+    }
+    printf("Delta sync: sending %llu of %llu blocks\n", (unsigned long long int)delta_changed_count, 
+            (unsigned long long int)local_block_count);
+
+    delta_active = 1;
+    bytes_left_to_send = stream_length;
+    file_offset_for_sending = 0;
+    setup_cwindow();
+    return 0;
+}
+
+/**
+ * @brief Initializes Round-Trip Time (RTT) values based on the initial measurement.
+ *
+ * Sets the initial RTT, deviation, and timeout interval values based on the first
+ * measured RTT.
+ */
+void init_rtt(double handshake_ms) 
+{
+    RTT_in_ms = handshake_ms * 6;
+    devRTT = RTT_in_ms /2;
+    timeoutInterval_in_ms = RTT_in_ms + (4 * devRTT);
+    timer_valid = 0;
+    trace_event(Trace_Rto, in_Flight[0], (uint32_t)(handshake_ms * 1000), (uint32_t)(timeoutInterval_in_ms * 1000));
+}
+
+/**
+ * @brief Handles the process of sending a number of data packets.
+ *
+ * Sends the segments of the current congestion window that have not been sent yet, so an
+ * ACK that moves the window only releases new segments. With FEC enabled, every block of
+ * segments is followed by a parity packet, with the block size chosen from the measured loss
+ * rate. The last segment sent asks the receiver to ACK right away, since nothing more follows
+ * until an ACK arrives. With io_uring the packets of the burst are queued and sent with one
+ * submission, which also carries the read-ahead of the file. With -z they are built one after
+ * another in the zero-copy slab and sent in runs (see zerocopy.h). Updates the sender's state
+ * machine to wait for acknowledgments.
+ */
+void sender_action_Send_N_Packets(void) 
+{
+    uint32_t sending_index;
+    struct protocol_Packet segment_packet;
+    struct protocol_Packet parity_block_packet;
+    struct protocol_Packet *packet_being_sent = &segment_packet;
+    struct protocol_Packet *parity_packet = &parity_block_packet;
+    unsigned int block_segments = fec_enabled ? fec_block_segments(loss_rate_estimate) : 0;
+    unsigned int segments_in_block = 0;
+    sending_index = next_to_send;
+    burst_open = uring_active || zerocopy_active;
+    
+    while (sending_index_in_range(sending_index))
+    {
+        /* Up to a full packet, without running past the end of the window */
+        uint32_t i = segment_length(sending_index);
+        if (uring_active)
+        {
+            packet_being_sent = slab_packet();
+        }
+        else if (zerocopy_active)
+        {
+            packet_being_sent = zerocopy_packet(&zerocopy);
+        }
+        ssize_t bytes_sent = send_segment(packet_being_sent, sending_index, !sending_index_in_range(sending_index + i));
+        
+        if (bytes_sent == -1){
+            sender_current_state = sender_Done;
+            break;
+        }
+        sending_index += i;
+        next_to_send = sending_index;
+
+        if (block_segments == 0)
+        {
+            continue;
+        }
+        if (segments_in_block == 0)
+        {
+            if (uring_active)
+            {
+                parity_packet = slab_packet();
+            }
+            memset(parity_packet, 0, sizeof(*parity_packet));
+            parity_packet->header.management_byte = PARITY_BIT;
+            parity_packet->header.seq_ack_num = packet_being_sent->header.seq_ack_num;
+        }
+        fec_xor_into(parity_packet->data, packet_being_sent->data, i);
+        parity_packet->header.bytes_of_data += i;
+        segments_in_block++;
+
+        /* Close the block once full, or at the end of the window */
+        if ((segments_in_block == block_segments) || !sending_index_in_range(sending_index))
+        {
+            /* Built on the side, so it is copied in after the block to keep the run going */
+            struct protocol_Packet *parity_to_send = parity_packet;
+            if (zerocopy_active)
+            {
+                parity_to_send = zerocopy_packet(&zerocopy);
+                memcpy(parity_to_send, parity_packet, sizeof(*parity_to_send));
+            }
+            if (send_packet(parity_to_send, sizeof(struct protocol_Packet)) == -1){
+                sender_current_state = sender_Done;
+                break;
+            }
+            trace_event(Trace_Parity, parity_packet->header.seq_ack_num, parity_packet->header.bytes_of_data, segments_in_block);
+            segments_in_block = 0;
+        }
+    }
+    if (uring_active)
+    {
+        burst_open = 0;
+        if (flush_sends() < 0)
+        {
+            sender_current_state = sender_Done;
+        }
+    }
+    if (zerocopy_active)
+    {
+        burst_open = 0;
+        if (zerocopy_flush(&zerocopy) < 0)
+        {
+            perror("Error sending a zero-copy run");
+            sender_current_state = sender_Done;
+        }
+        zerocopy_reap(&zerocopy);
+    }
+    if (sender_current_state != sender_Done)
+    {
+        sender_current_state = Wait_for_Ack;
+    }
+    return;
+}
+
+/**
+ * @brief Returns the length of the data segment starting at a sequence number.
+ *
+ * @param sending_index The sequence number of the first byte of the segment.
+ * @return Returns PROTOCOL_DATA_SIZE, or less when the window ends sooner.
+ */
+uint32_t segment_length(uint32_t sending_index)
+{
+    uint32_t i = in_Flight[1] - sending_index + 1;
+    if ((i == 0) || (i > PROTOCOL_DATA_SIZE))
+    {
+        i = PROTOCOL_DATA_SIZE;
+    }
+    return i;
+}
+
+/**
+ * @brief Reads and sends the data segment starting at a sequence number.
+ *
+ * The segment runs to the end of the window or PROTOCOL_DATA_SIZE bytes, whichever is
+ * first. The last segment of the stream also carries the FIN. Sending the segment at the
+ * front of the window restarts the retransmission timer, and the first new segment sent
+ * while no RTT sample is running starts one.
+ *
+ * @param packet Where to build the segment; holds the sent segment afterwards.
+ * @param sending_index The sequence number of the first byte of the segment.
+ * @param last_in_burst Whether no more segments follow until an ACK arrives.
+ * @return Returns the result of send_packet().
+ */
+ssize_t send_segment(struct protocol_Packet *packet, uint32_t sending_index, uint8_t last_in_burst)
+{
+    uint32_t i = segment_length(sending_index);
+    memset(&packet->header, 0, sizeof(packet->header));
+    packet->header.seq_ack_num = sending_index;
+    packet->header.bytes_of_data = i;
+    if (last_in_burst)
+    {
+        packet->header.management_byte = ACK_NOW_BIT;
+    }
+
+    unsigned long long int stream_offset = file_offset_for_sending + (uint32_t)(sending_index - in_Flight[0]);
+    read_stream(stream_offset, packet->data, i);
+    update_stream_digest(stream_offset, packet->data, i);
+    size_t packet_length = sizeof(struct protocol_Header) + i;
+
+    /* The FIN rides on the last segment of the stream when there is room for it */
+    if ((stream_offset + i == file_offset_for_sending + bytes_left_to_send) 
+        && (i + sizeof(struct protocol_Fin) <= PROTOCOL_DATA_SIZE))
+    {
+        packet_length = add_fin(packet);
+    }
+
+    /* With kernel timestamps the ack-now segment is timed, since the receiver ACKs it at once */
+    uint8_t start_sample = !timer_valid && (sending_index == highest_sent) && (!timestamps_active || last_in_burst);
+    if (start_sample)
+    {
+        rtt_sample_stamped = 0;
+        stamp_next_send = timestamps_active;
+    }
+    ssize_t bytes_sent = send_packet(packet, packet_length);
+    if (bytes_sent == -1)
+    {
+        return -1;
+    }
+    trace_event(((int32_t)(sending_index - highest_sent) < 0) ? Trace_Retransmit : Trace_Send, sending_index, i, current_window_size);
+
+    double now = monotonic_ms();
+    if (sending_index == in_Flight[0])
+    {
+        start = now;
+    }
+    if (start_sample)
+    {
+        rtt_sample_start = now;
+        rtt_sample_seq = sending_index + i;
+        rtt_sample_first = sending_index;
+        timer_valid = 1;
+    }
+    if ((int32_t)(sending_index + i - highest_sent) > 0)
+    {
+        highest_sent = sending_index + i;
+    }
+    return bytes_sent;
+}
+
+/**
+ * @brief Resends the segment at the front of the window.
+ *
+ * Used for fast retransmit, when duplicate ACKs show the receiver is missing it, and for
+ * each further hole the receiver reports while recovering. Any RTT sample running is
+ * dropped, since its ACK may now be for the retransmission.
+ */
+void retransmit_first_segment(void)
+{
+    struct protocol_Packet packet;
+    timer_valid = 0;
+    lost_segments++;
+    if (send_segment(&packet, in_Flight[0], 1) == -1)
+    {
+        sender_current_state = sender_Done;
+    }
+}
+
+/**
+ * @brief Takes the next packet of the slab to build a packet of the burst in.
+ *
+ * The slab is used round robin. A packet whose send has not completed yet is waited for.
+ *
+ * @return Returns the packet.
+ */
+struct protocol_Packet *slab_packet(void)
+{
+    unsigned int slot = slab_next++ % URING_SLAB_PACKETS;
+    while (slab_busy[slot] && (uring_submit(&uring, 1) >= 0))
+    {
+        reap_completions();
+    }
+    return &slab_packets[slot];
+}
+
+/**
+ * @brief Queues a packet of the burst to be sent with the next submission.
+ *
+ * @param packet The checksummed packet, in the slab.
+ * @param length The number of bytes of the packet to send, header included.
+ * @return Returns the length, or -1 if sending failed.
+ */
+ssize_t queue_send(struct protocol_Packet *packet, size_t length)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&uring);
+    if (sqe == NULL)
+    {
+        if (flush_sends() < 0)
+        {
+            return -1;
+        }
+        sqe = uring_get_sqe(&uring);
+    }
+    unsigned int slot = packet - slab_packets;
+    uring_prep_send(sqe, URING_SOCKET_INDEX, packet, length, slot);
+    slab_busy[slot] = 1;
+    uring_packets++;
+    return length;
+}
+
+/**
+ * @brief Submits everything queued, the sends of a burst and any read-ahead, with one system call.
+ *
+ * The sends are not waited for; their completions, and the errors they report, are picked
+ * up from the completion ring later on.
+ *
+ * @return Returns 0 on success, -1 if a send has failed.
+ */
+int flush_sends(void)
+{
+    if (uring_submit(&uring, 0) < 0)
+    {
+        return -1;
+    }
+    reap_completions();
+    if (send_error != 0)
+    {
+        errno = send_error;
+        perror("Error sending burst");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Handles every completion waiting in the completion ring.
+ *
+ * A send completion frees its slab packet; a read completion makes its chunk of the
+ * cache ready (or empty again if the read failed).
+ */
+void reap_completions(void)
+{
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&uring)) != NULL)
+    {
+        if (cqe->user_data & URING_READ_TAG)
+        {
+            struct cache_chunk *chunk = &cache_chunks[(uint32_t)cqe->user_data];
+            chunk->state = (cqe->res >= 0) ? Chunk_Ready : Chunk_Empty;
+            chunk->length = (cqe->res >= 0) ? cqe->res : 0;
+        }
+        else
+        {
+            slab_busy[cqe->user_data] = 0;
+            send_error = (cqe->res < 0) ? -cqe->res : send_error;
+        }
+        uring_cqe_seen(&uring);
+    }
+}
+
+/**
+ * @brief Reads bytes of the file from the read-ahead cache.
+ *
+ * Chunks that are not in the cache are read with fixed-buffer reads and waited for. The
+ * next few chunks are read ahead; those reads go to the kernel with the next burst, so a
+ * sequential transfer finds its data already in the cache without a system call.
+ *
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes to read.
+ * @param offset The file offset to read from.
+ * @return Returns 0 on success, -1 on failure or when reading past the end of the file.
+ */
+int uring_read_file(char *buffer, uint32_t length, unsigned long long int offset)
+{
+    while (length > 0)
+    {
+        uint64_t chunk_index = offset / URING_CHUNK_SIZE;
+        struct cache_chunk *chunk = &cache_chunks[chunk_index % URING_CHUNKS];
+        if ((chunk->index != chunk_index) || (chunk->state == Chunk_Empty))
+        {
+            read_ahead(chunk_index);
+        }
+        while (chunk->state == Chunk_Reading)
+        {
+            if (uring_submit(&uring, 1) < 0)
+            {
+                return -1;
+            }
+            reap_completions();
+        }
+
+        uint32_t within_chunk = offset % URING_CHUNK_SIZE;
+        if ((chunk->state != Chunk_Ready) || (within_chunk >= chunk->length))
+        {
+            return -1;
+        }
+        uint32_t bytes_read = ((chunk->length - within_chunk) < length) ? (chunk->length - within_chunk) : length;
+        memcpy(buffer, cache_memory + (chunk_index % URING_CHUNKS) * URING_CHUNK_SIZE + within_chunk, bytes_read);
+        buffer += bytes_read;
+        offset += bytes_read;
+        length -= bytes_read;
+        read_ahead(chunk_index + 1);
+    }
+    return 0;
+}
+
+/**
+ * @brief Queues reads of a chunk of the file and the few after it, unless already cached.
+ *
+ * The reads are only submitted with the next submission. A chunk replaces the one
+ * URING_CHUNKS chunks before it, well behind the window.
+ *
+ * @param chunk_index The first chunk to read.
+ */
+void read_ahead(uint64_t chunk_index)
+{
+    for (uint64_t index = chunk_index; index < chunk_index + URING_READAHEAD_CHUNKS; index++)
+    {
+        struct cache_chunk *chunk = &cache_chunks[index % URING_CHUNKS];
+        if ((index * URING_CHUNK_SIZE >= file_bytes_to_send) || 
+            ((chunk->index == index) && (chunk->state != Chunk_Empty)))
+        {
+            continue;
+        }
+        while (chunk->state == Chunk_Reading)
+        {
+            if (uring_submit(&uring, 1) < 0)
+            {
+                return;
+            }
+            reap_completions();
+        }
+        struct io_uring_sqe *sqe = uring_get_sqe(&uring);
+        if (sqe == NULL)
+        {
+            return;
+        }
+        chunk->index = index;
+        chunk->state = Chunk_Reading;
+        uring_prep_read_fixed(sqe, URING_FILE_INDEX, cache_memory + (index % URING_CHUNKS) * URING_CHUNK_SIZE,
+                              URING_CHUNK_SIZE, index * URING_CHUNK_SIZE, 0, URING_READ_TAG | (index % URING_CHUNKS));
+    }
+}
+
+/**
+ * @brief Reads bytes of the data stream being sent.
+ *
+ * The stream is normally the file itself. For delta sync it is the changed-block bitmap
+ * followed by the contents of each changed block, which are read from their place in the file.
+ * For a multi-file transfer it is the frames and contents of every file in the manifest.
+ *
+ * @param stream_offset The offset in the stream to read from.
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes to read.
+ */
+void read_stream(unsigned long long int stream_offset, char *buffer, uint32_t length)
+{
+    if (manifest_requested)
+    {
+        if (manifest_read(&manifest_list, stream_offset, buffer, length) < 0)
+        {
+            fprintf(stderr, "Error reading multi-file stream\n");
+        }
+        return;
+    }
+
+    if (!delta_active)
+    {
+        if (reader_requested && take_read_ahead(buffer, length, stream_offset))
+        {
+            read_ahead_hits++;
+            return;
+        }
+        read_ahead_misses += reader_requested;
+        if (read_file(buffer, length, stream_offset) < 0)
+        {
+            perror("Error reading file");
+        }
+        return;
+    }
+
+    while (length > 0)
+    {
+        uint32_t bytes_read;
+        if (stream_offset < delta_bitmap_length)
+        {
+            bytes_read = ((delta_bitmap_length - stream_offset) < length) ? (delta_bitmap_length - stream_offset) : length;
+            memcpy(buffer, delta_changed_bitmap + stream_offset, bytes_read);
+        }
+        else
+        {
+            uint64_t data_offset = stream_offset - delta_bitmap_length;
+            uint64_t changed = data_offset / DELTA_BLOCK_SIZE;
+            uint32_t within_block = data_offset % DELTA_BLOCK_SIZE;
+            bytes_read = ((DELTA_BLOCK_SIZE - within_block) < length) ? (DELTA_BLOCK_SIZE - within_block) : length;
+            if ((changed >= delta_changed_count) ||
+                (read_file(buffer, bytes_read, delta_changed_blocks[changed] * DELTA_BLOCK_SIZE + within_block) < 0))
+            {
+                perror("Error reading file");
+                return;
+            }
+        }
+        buffer += bytes_read;
+        stream_offset += bytes_read;
+        length -= bytes_read;
+    }
+}
+
+/**
+ * @brief Starts the thread that reads the file ahead of the sender.
+ *
+ * The reader thread reads the file in order from the given offset, one segment at a time,
+ * into buffers of read_pool, and passes their descriptors down read_queue. It stays at most
+ * READER_BUFFERS segments ahead, since it waits for buffers once they are all queued.
+ *
+ * @param offset The file offset to start reading at.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int start_reader(unsigned long long int offset)
+{
+    if (pool_init(&read_pool, PACKET_SIZE, READER_BUFFERS) < 0)
+    {
+        return -1;
+    }
+    if (ring_spsc_init(&read_queue, READER_BUFFERS) < 0)
+    {
+        pool_destroy(&read_pool);
+        return -1;
+    }
+    pool_cache_init(&send_cache, &read_pool);
+    reader_start_offset = offset;
+    atomic_store(&reader_stopping, 0);
+    atomic_store(&reader_done, 0);
+    if (pthread_create(&reader_thread, NULL, reader_main, NULL) != 0)
+    {
+        fprintf(stderr, "Error starting reader thread\n");
+        ring_spsc_destroy(&read_queue);
+        pool_destroy(&read_pool);
+        return -1;
+    }
+    reader_running = 1;
+    return 0;
+}
+
+/**
+ * @brief Stops the reader thread and drops whatever it read ahead.
+ *
+ * The next read of the file starts a new reader at that offset.
+ */
+void stop_reader(void)
+{
+    if (!reader_running)
+    {
+        return;
+    }
+    atomic_store_explicit(&reader_stopping, 1, memory_order_release);
+    pthread_join(reader_thread, NULL);
+    reader_running = 0;
+    read_current_valid = 0;
+    ring_spsc_destroy(&read_queue);
+    pool_destroy(&read_pool);
+}
+
+/**
+ * @brief The reader thread: reads the file in order into pool buffers and queues them.
+ *
+ * With -D it is the only user of the direct I/O reader.
+ *
+ * @param argument Unused.
+ * @return Returns NULL.
+ */
+void *reader_main(void *argument)
+{
+    (void)argument;
+    struct pool_Cache reader_cache;
+    pool_cache_init(&reader_cache, &read_pool);
+    unsigned long long int offset = reader_start_offset;
+    unsigned int idle_rounds = 0;
+
+    while ((offset < file_bytes_to_send) && !atomic_load_explicit(&reader_stopping, memory_order_acquire))
+    {
+        char *buffer = pool_alloc(&reader_cache);
+        if (buffer == NULL)
+        {
+            ring_backoff(&idle_rounds);
+            continue;
+        }
+        idle_rounds = 0;
+        uint32_t length = ((file_bytes_to_send - offset) < PROTOCOL_DATA_SIZE) ? (file_bytes_to_send - offset) : PROTOCOL_DATA_SIZE;
+        int result = direct_requested ? direct_read(&direct_reader, buffer, length, offset)
+                                      : ((pread(fileno(file_pointer), buffer, length, offset) == (ssize_t)length) ? 0 : -1);
+        if (result < 0)
+        {
+            perror("Error reading file ahead");
+            pool_free(&reader_cache, buffer);
+            break;
+        }
+
+        // The queue holds every buffer of the pool, so it has room for any buffer we got.
+        struct ring_Descriptor segment = {buffer, offset, length, 0};
+        ring_spsc_push(&read_queue, &segment);
+        offset += length;
+    }
+    pool_cache_flush(&reader_cache);
+    atomic_store_explicit(&reader_done, 1, memory_order_release);
+    return NULL;
+}
+
+/**
+ * @brief Copies file bytes from what the reader thread read ahead.
+ *
+ * New data is sent in file order, so it is always at or after the segment in hand; segments
+ * the sender has moved past go back to the pool. A retransmission of bytes before the segment
+ * in hand is not served, and the caller reads the file instead.
+ *
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes.
+ * @param offset The file offset of the first byte.
+ * @return Returns 1 if the bytes were copied, 0 if the caller has to read them itself.
+ */
+int take_read_ahead(char *buffer, uint32_t length, unsigned long long int offset)
+{
+    if (!reader_running && start_reader(offset) < 0)
+    {
+        reader_requested = 0;
+        return 0;
+    }
+
+    unsigned int idle_rounds = 0;
+    while (length > 0)
+    {
+        if (!read_current_valid)
+        {
+            // Checked before the pop, so a finished reader with an empty queue has nothing left.
+            uint8_t done = atomic_load_explicit(&reader_done, memory_order_acquire);
+            if (!ring_spsc_pop(&read_queue, &read_current))
+            {
+                if (done)
+                {
+                    return 0;
+                }
+                ring_backoff(&idle_rounds);
+                continue;
+            }
+            read_current_valid = 1;
+        }
+        if (offset < read_current.stream_offset)
+        {
+            return 0;
+        }
+        unsigned long long int end = read_current.stream_offset + read_current.length;
+        if (offset >= end)
+        {
+            pool_free(&send_cache, read_current.data);
+            read_current_valid = 0;
+            continue;
+        }
+        uint32_t copied = ((end - offset) < length) ? (end - offset) : length;
+        memcpy(buffer, read_current.data + (offset - read_current.stream_offset), copied);
+        buffer += copied;
+        offset += copied;
+        length -= copied;
+    }
+    return 1;
+}
+
+/**
+ * @brief Reads bytes of the file being sent, through the direct I/O block pool with -D or
+ * the io_uring read-ahead cache with -U, or generates them with -g.
+ *
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes to read.
+ * @param offset The file offset to read from.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int read_file(char *buffer, uint32_t length, unsigned long long int offset)
+{
+    if (generated_kind != Synthetic_None)
+    {
+        synthetic_fill(generated_kind, buffer, length, offset);
+        return 0;
+    }
+    /* With -T the reader thread owns the direct I/O reader, and this only reads retransmissions */
+    if (direct_requested && !reader_requested)
+    {
+        return direct_read(&direct_reader, buffer, length, offset);
+    }
+    if (uring_active && !reader_requested)
+    {
+        return uring_read_file(buffer, length, offset);
+    }
+    return (pread(fileno(file_pointer), buffer, length, offset) < 0) ? -1 : 0;
+}
+
+/**
+ * @brief Folds newly sent stream bytes into the stream digest.
+ *
+ * Only bytes past digest_offset are new; retransmissions of earlier bytes are skipped,
+ * so every byte is hashed exactly once, while it is still in cache from the read.
+ *
+ * @param stream_offset The offset in the stream of the first byte.
+ * @param data The bytes being sent.
+ * @param length The number of bytes.
+ */
+void update_stream_digest(unsigned long long int stream_offset, const char *data, uint32_t length)
+{
+    if ((digest_offset < stream_offset) || (digest_offset >= stream_offset + length))
+    {
+        return;
+    }
+    uint32_t already_hashed = digest_offset - stream_offset;
+    stream_digest = crc32c_extend(stream_digest, data + already_hashed, length - already_hashed);
+    digest_offset += length - already_hashed;
+}
+
+/**
+ * @brief Checksums and sends a packet to the receiver.
+ *
+ * When simulated loss is configured, drops data, parity and FIN packets with that probability
+ * instead, so FEC and recovery can be exercised on a clean link. A packet being timed with
+ * kernel timestamps goes out on its own, asking for the time it leaves. A packet of the
+ * zero-copy slab joins the run being gathered, padded to a whole packet if it is a full one.
+ *
+ * @param packet The packet to send.
+ * @param length The number of bytes of the packet to send, header included.
+ * @return Returns the result of send(), or the length if it was dropped on purpose.
+ */
+ssize_t send_packet(struct protocol_Packet *packet, size_t length)
+{
+    uint8_t stamped = stamp_next_send;
+    stamp_next_send = 0;
+    if (burst_open && zerocopy_holds(&zerocopy, packet))
+    {
+        length = zerocopy_pad(packet, length);
+    }
+    packet_set_checksum(packet, length);
+    if (((packet->header.management_byte & ~(PARITY_BIT | ACK_NOW_BIT | 0x02)) == 0) 
+        && (simulated_loss_percent > 0) && (drand48() * 100 < simulated_loss_percent))
+    {
+        trace_event(Trace_Drop, packet->header.seq_ack_num, packet->header.bytes_of_data, 0);
+        return length;
+    }
+    packets_sent++;
+    if (stamped)
+    {
+        return send_stamped(packet, length);
+    }
+    if (burst_open && uring_active)
+    {
+        return queue_send(packet, length);
+    }
+    if (burst_open && zerocopy_holds(&zerocopy, packet))
+    {
+        return zerocopy_queue(&zerocopy, packet, length);
+    }
+    if (burst_open && zerocopy_active && (zerocopy_flush(&zerocopy) < 0))
+    {
+        return -1;
+    }
+    ssize_t bytes_sent;
+    while (((bytes_sent = send(sockfd, packet, length, 0)) < 0) && wait_for_send_room())
+    {
+    }
+    return bytes_sent;
+}
+
+/**
+ * @brief Waits for room in the socket's send buffer after a send found none.
+ *
+ * The socket does not block, so once the send buffer is full of packets that have not left
+ * yet (held in a queue on this host, such as a shaping qdisc) a send fails with EAGAIN.
+ * They leave at the link's pace, so it is enough to wait.
+ *
+ * @return Returns 1 if the send should be tried again, 0 if it failed for another reason.
+ */
+int wait_for_send_room(void)
+{
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS))
+    {
+        return 0;
+    }
+    struct pollfd socket_poll = { .fd = sockfd, .events = POLLOUT };
+    if ((poll(&socket_poll, 1, SEND_ROOM_WAIT_MS) < 0) && (errno != EINTR))
+    {
+        perror("Error waiting to send");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Sends the segment an RTT sample is taken on, asking the kernel for the time it leaves.
+ *
+ * Anything queued on the io_uring goes first, so the segment is not sent ahead of them.
+ *
+ * @param packet The packet, checksummed.
+ * @param length The number of bytes of the packet to send, header included.
+ * @return Returns the result of sendmsg(), or -1 if the queued sends failed.
+ */
+ssize_t send_stamped(struct protocol_Packet *packet, size_t length)
+{
+    if (burst_open && (flush_sends() < 0))
+    {
+        return -1;
+    }
+    ssize_t bytes_sent;
+    while (((bytes_sent = timestamp_send(sockfd, packet, length)) < 0) && wait_for_send_room())
+    {
+    }
+    if (bytes_sent >= 0)
+    {
+        rtt_sample_id = stamps_requested++;
+        rtt_sample_stamped = 1;
+    }
+    return bytes_sent;
+}
+
+/**
+ * @brief Polls the socket for a packet from the receiver.
+ *
+ * Packets whose checksum does not match are counted and dropped, as if lost.
+ *
+ * @param packet Where to store the packet.
+ * @return Returns the result of recv(), or -1 with errno set to EAGAIN for a corrupted packet.
+ */
+ssize_t receive_packet(struct protocol_Packet *packet)
+{
+    ssize_t bytes_received = timestamps_active ? timestamp_recv(sockfd, packet, sizeof(struct protocol_Packet), &arrival_stamp)
+                                               : recv(sockfd, packet, sizeof(struct protocol_Packet), MSG_DONTWAIT);
+    if ((bytes_received > 0) && !packet_checksum_valid(packet, bytes_received))
+    {
+        corrupted_packets++;
+        errno = EAGAIN;
+        return -1;
+    }
+    return bytes_received;
+}
+
+/**
+ * @brief Checks if a given acknowledgment number is valid.
+ *
+ * Validates the acknowledgment number against the sequence numbers sent so far: it must
+ * acknowledge something past the front of the window, and nothing that was never sent.
+ *
+ * @param ack_num The acknowledgment number to validate.
+ * @return Returns 1 if the acknowledgment number is valid, 0 otherwise.
+ */
+int valid_ack_num(uint32_t ack_num) 
+{
+    uint32_t advanced = ack_num - in_Flight[0];
+    return (advanced > 0) && (advanced <= (uint32_t)(highest_sent - in_Flight[0]));
+}
+
+/**
+ * @brief Checks if the sending index is within the current congestion window range.
+ *
+ * Determines if a given index for sending data is within the bounds of the current
+ * congestion window.
+ *
+ * @param sending_index The index to be checked.
+ * @return Returns 1 if the index is within range, 0 otherwise.
+ */
+int sending_index_in_range(uint32_t sending_index)
+{
+
+    if (in_Flight[1] > in_Flight[0]) {
+        return ((sending_index <= in_Flight[1]) && (sending_index >= in_Flight[0]));
+    }
+    else if (in_Flight[0] > in_Flight[1])
+    {
+        return ((sending_index <= in_Flight[1]) || (sending_index >= in_Flight[0]));
+    }
+    else if (in_Flight[0] == in_Flight[1])
     {
         return (in_Flight[0] == sending_index); 
     }
@@ -490,8 +2016,13 @@ int sending_index_in_range(uint32_t sending_index)
  * @brief Handles the state of waiting for packet acknowledgments.
  *
  * Monitors for incoming acknowledgments, updates the congestion window, and handles
- * timeout events. Transitions the sender's state machine based on received
- * acknowledgments or timeouts.
+ * timeout events. The receiver ACKs every few segments, so each ACK slides the window and
+ * releases new segments. An ACK that echoes an ECN mark halves the window instead of growing
+ * it, once per round trip, with nothing retransmitted. Duplicate ACKs mean the receiver is missing the segment at the front
+ * of the window, which is retransmitted on its own (after the parity of its block had a chance
+ * to repair it, with FEC); until the recovery is over, every ACK that still leaves a hole
+ * retransmits the next one. A timeout resends the whole window. Transitions the sender's
+ * state machine based on received acknowledgments or timeouts.
  */
 void sender_action_Wait_for_Ack(void)
 {
@@ -502,25 +2033,50 @@ void sender_action_Wait_for_Ack(void)
 
     while(1)
     {
-        end = clock();
-        cpu_time_used_in_ms = ((double) (end - start)) / (CLOCKS_PER_SEC / 1000 );
+        end = monotonic_ms();
+        time_elapsed_in_ms = end - start;
         
         /* Check Socket for response */
-        struct protocol_Header receive_buffer;
-        ssize_t bytes_received = recv(sockfd, &receive_buffer, sizeof(struct protocol_Header), MSG_DONTWAIT);
-        if (bytes_received > 0) 
+        struct protocol_Packet receive_buffer;
+        ssize_t bytes_received = receive_packet(&receive_buffer);
+        if ((bytes_received > 0) && ((receive_buffer.header.management_byte & 0x1) == 0x1))
+        {
+            /* The receiver got the FIN riding on the last segment, and with it everything */
+            fin_ack_received(&receive_buffer, bytes_received);
+            break;
+        }
+        else if (bytes_received > 0) 
         {
+            acks_received++;
+            if (ecn_active && (receive_buffer.header.management_byte & ECN_ECHO_BIT))
+            {
+                ecn_echoes++;
+                ecn_echo_seen = 1;
+            }
+
             /* If its a Valid Seq number */
-            uint32_t ack_num = receive_buffer.seq_ack_num;
+            uint32_t ack_num = receive_buffer.header.seq_ack_num;
             if (valid_ack_num(ack_num)) 
             {
-                updateRTT(cpu_time_used_in_ms);
+                if (timer_valid && ((int32_t)(ack_num - rtt_sample_seq) >= 0))
+                {
+                    updateRTT(sample_rtt(&receive_buffer, bytes_received));
+                }
+                start = end;
+
                 uint32_t old_acked = acknowledged[1];
                 acknowledged[1] = ack_num - 1;
                 
                 // update bytes left, if bytes left to send == 0, goto Send_FIN
                 uint32_t gained = (acknowledged[1] - old_acked);
+
+                /* Loss seen by the receiver = segments retransmitted + segments it repaired */
+                uint32_t acked_segments = (gained + PROTOCOL_DATA_SIZE - 1) / PROTOCOL_DATA_SIZE;
+                update_loss_rate((double)(lost_segments + receive_buffer.header.bytes_of_data) / acked_segments);
+                lost_segments = 0;
+
 		        bytes_left_to_send = bytes_left_to_send - (gained);
+                bytes_acknowledged += gained;
                 in_Flight[0] = ack_num;
                 if (bytes_left_to_send == 0){
                     sender_current_state = Send_Fin;
@@ -528,22 +2084,47 @@ void sender_action_Wait_for_Ack(void)
                 }
 
                 file_offset_for_sending = file_offset_for_sending + (gained);
-                fseek(file_pointer, file_offset_for_sending, SEEK_SET);
+                /* After a timeout the receiver may already hold more than was resent */
+                if ((int32_t)(ack_num - next_to_send) > 0)
+                {
+                    next_to_send = ack_num;
+                }
                                 
                 //update current window size based on bytes left, AMID, theoretical max
                 increment_cwindow();
+                if (ecn_echo_seen)
+                {
+                    respond_to_ecn(ack_num);
+                }
+                trace_event(Trace_Ack, ack_num, gained, current_window_size);
+
+                /* An ACK short of what was in flight when the loss was seen points at the next hole */
+                if (in_recovery && ((int32_t)(ack_num - recovery_seq) < 0))
+                {
+                    retransmit_first_segment();
+                }
+                else
+                {
+                    in_recovery = 0;
+                }
 
                 sender_current_state = Send_N_Packets;
                 break;
             }
             
             /* If its a Duplicate Ack */
-            else 
+            else if ((ack_num == in_Flight[0]) && !in_recovery)
             {
                 duplicate_ack_count++;
-                if (duplicate_ack_count >= 3)
+                trace_event(Trace_Dup_Ack, ack_num, duplicate_ack_count, current_window_size);
+                unsigned int threshold = DUPLICATE_ACK_THRESHOLD + (fec_enabled ? fec_block_segments(loss_rate_estimate) : 0);
+                if (duplicate_ack_count >= threshold)
                 {
                     half_cwindow();
+                    in_recovery = 1;
+                    recovery_seq = highest_sent;
+                    retransmit_first_segment();
+                    break;
                 }
             }
         } 
@@ -561,12 +2142,17 @@ void sender_action_Wait_for_Ack(void)
             break;
         }
 
-        if(cpu_time_used_in_ms > timeoutInterval_in_ms) //TODO: figure out time to use
+        if(time_elapsed_in_ms > timeoutInterval_in_ms) //TODO: figure out time to use
         {
+            update_loss_rate(1);
             quarter_cwindow();
             handle_timeout();
+
+            /* Go back to the front of the window; its ACK would not be a clean RTT sample */
+            next_to_send = in_Flight[0];
+            timer_valid = 0;
+            in_recovery = 0;
             
-            fseek(file_pointer, file_offset_for_sending, SEEK_SET);
             sender_current_state = Send_N_Packets;
             break;
         }
@@ -578,17 +2164,22 @@ void sender_action_Wait_for_Ack(void)
  * @brief Increases the current congestion window size.
  *
  * Expands the size of the congestion window incrementally based on successful
- * packet transmissions, up to a maximum window size.
+ * packet transmissions, up to a maximum window size. While kernel timestamps show the
+ * window is building a queue on the path, it is held where it is instead.
  */
 void increment_cwindow(void){
-    
-    if (current_window_size < MAX_WINDOW_SIZE) 
+    uint32_t previous_window_size = current_window_size;
+    if ((current_window_size < max_window_size) && queue_building())
+    {
+        growth_held++;
+    }
+    else if (current_window_size < max_window_size) 
     {
         current_window_size = current_window_size + PROTOCOL_DATA_SIZE - (current_window_size % PROTOCOL_DATA_SIZE);
     }
-    else if (current_window_size >= MAX_WINDOW_SIZE)
+    else if (current_window_size >= max_window_size)
     {
-        current_window_size = MAX_WINDOW_SIZE;
+        current_window_size = max_window_size;
     }
     if (bytes_left_to_send < current_window_size){
         current_window_size = bytes_left_to_send;
@@ -596,6 +2187,10 @@ void increment_cwindow(void){
     duplicate_ack_count = 0;
     in_Flight[1] = in_Flight[0] + (current_window_size - 1);
     acknowledged[0] = in_Flight[1] + 1;
+    if (current_window_size != previous_window_size)
+    {
+        trace_event(Trace_Cwnd, in_Flight[0], previous_window_size, current_window_size);
+    }
 }
 
 /**
@@ -606,6 +2201,7 @@ void increment_cwindow(void){
  */
 void half_cwindow(void)
 {
+    uint32_t previous_window_size = current_window_size;
     current_window_size = current_window_size/2;
     if ((current_window_size % PROTOCOL_DATA_SIZE) != 0)
     {
@@ -618,6 +2214,7 @@ void half_cwindow(void)
     in_Flight[1] = in_Flight[0] + (current_window_size - 1);
     acknowledged[0] = in_Flight[1] + 1;
     duplicate_ack_count = 0;
+    trace_event(Trace_Cwnd, in_Flight[0], previous_window_size, current_window_size);
 }
 
 /**
@@ -628,6 +2225,7 @@ void half_cwindow(void)
  */
 void quarter_cwindow(void)
 {
+    uint32_t previous_window_size = current_window_size;
     current_window_size = current_window_size/4;
     if ((current_window_size % PROTOCOL_DATA_SIZE) != 0)
     {
@@ -640,25 +2238,79 @@ void quarter_cwindow(void)
     in_Flight[1] = in_Flight[0] + (current_window_size - 1);
     acknowledged[0] = in_Flight[1] + 1;
     duplicate_ack_count = 0;
+    trace_event(Trace_Cwnd, in_Flight[0], previous_window_size, current_window_size);
+}
+
+/**
+ * @brief Halves the window in response to an echoed Congestion Experienced mark.
+ *
+ * A queue on the path is building but nothing was lost, so nothing is retransmitted. Once the
+ * window is halved, echoes are ignored until everything sent before then is acknowledged, since
+ * they may be for data sent before the smaller window took effect: the window is halved at
+ * most once per round trip. Loss recovery has halved it already, so echoes during it are
+ * ignored too. An echo that came on a duplicate ACK is acted on at the next ACK that moves the
+ * window, so the duplicate count is left alone.
+ *
+ * @param ack_num The acknowledgment number of the ACK being handled.
+ */
+void respond_to_ecn(uint32_t ack_num)
+{
+    ecn_echo_seen = 0;
+    if (in_recovery || (ecn_reduced && ((int32_t)(ack_num - ecn_reduction_seq) <= 0)))
+    {
+        return;
+    }
+    half_cwindow();
+    ecn_reduced = 1;
+    ecn_reduction_seq = highest_sent;
+    ecn_reductions++;
+}
+
+/**
+ * @brief Updates the estimated loss rate used to size FEC blocks.
+ *
+ * Keeps a rolling average of the fraction of each window that was lost, in the same
+ * way the RTT estimate is smoothed.
+ *
+ * @param sample The fraction of the last window that was lost (0 to 1).
+ */
+void update_loss_rate(double sample)
+{
+    if (sample > 1) 
+    {
+        sample = 1;
+    }
+    loss_rate_estimate = (1 - ALPHA) * loss_rate_estimate + ALPHA * sample;
 }
 
 /**
  * @brief Initiates the connection teardown process by sending a FIN packet.
  *
- * Constructs and sends a FIN packet to the receiver to signal the end of data transmission.
+ * The FIN normally rides on the last data segment, and the receiver answers it with a 
+ * FIN_ACK instead of a final ACK. Reaching this state means the receiver acknowledged all
+ * the data without seeing that FIN, so a separate FIN packet, carrying the digest of the 
+ * stream that was sent, signals the end of data transmission. Gives up after FIN_MAX_ATTEMPTS.
  * Transitions the sender's state to waiting for a FIN_ACK response.
  */
 void sender_action_Send_Fin(void)
 {
+    if (fin_attempts == FIN_MAX_ATTEMPTS)
+    {
+        fprintf(stderr, "Receiver did not acknowledge the FIN after %u attempts\n", fin_attempts);
+        transfer_failed = 1;
+        sender_current_state = sender_Done;
+        return;
+    }
+    fin_attempts++;
+
     /* send FIN = 1 to receiver */ 
     struct protocol_Packet fin_packet;
 
     /* Sync bit:7, Sync Ack bit:6, 0:5, 0:4, 0:3, 0:2, Fin bit:1, Fin ack bit:0 */
-    fin_packet.header.management_byte = 0;
-    fin_packet.header.seq_ack_num = 0;
-    fin_packet.header.management_byte = fin_packet.header.management_byte | 0x02;
+    memset(&fin_packet.header, 0, sizeof(fin_packet.header));
+    fin_packet.header.seq_ack_num = (uint32_t)(file_offset_for_sending + bytes_left_to_send);
 
-    ssize_t bytes_sent = send(sockfd, &fin_packet, sizeof(struct protocol_Packet), 0);
+    ssize_t bytes_sent = send_packet(&fin_packet, add_fin(&fin_packet));
     printf("Sending Fin Packet\n");
 
     if (bytes_sent < 0) {
@@ -666,16 +2318,37 @@ void sender_action_Send_Fin(void)
         sender_current_state = sender_Done;
         return;
     }
-    start = clock();
+    start = monotonic_ms();
 
     sender_current_state = Wait_Fin_Ack;
     return;
 }
 
+/**
+ * @brief Marks a packet as the FIN and appends the FIN trailer after its data.
+ *
+ * The trailer carries the digest of the stream and our retransmission timeout, which
+ * the receiver uses to decide how long to linger.
+ *
+ * @param packet The packet, with bytes_of_data already set.
+ * @return Returns the length of the packet to send, header included.
+ */
+size_t add_fin(struct protocol_Packet *packet)
+{
+    struct protocol_Fin fin_info;
+    fin_info.stream_digest = stream_digest;
+    fin_info.rto_ms = (uint32_t)timeoutInterval_in_ms + 1;
+
+    packet->header.management_byte |= 0x02;
+    memcpy(packet->data + packet->header.bytes_of_data, &fin_info, sizeof(fin_info));
+    return sizeof(struct protocol_Header) + packet->header.bytes_of_data + sizeof(fin_info);
+}
+
 /**
  * @brief Waits for a FIN_ACK packet from the receiver.
  *
  * In this state, the sender waits for a FIN_ACK packet indicating that the receiver has acknowledged the end of transmission.
+ * The wait starts at the retransmission timeout and doubles with every FIN sent.
  * If a FIN_ACK is received or a timeout occurs, it transitions to the appropriate next state.
  */
 void sender_action_Wait_Fin_Ack(void)
@@ -683,20 +2356,46 @@ void sender_action_Wait_Fin_Ack(void)
     // Wait_FIN_Ack: do nothing/wait
     //         if (timeout), goto: Send_FIN
     //         else if (FIN_ACK = 1 received), done 
+    double timeout_in_ms = timeoutInterval_in_ms * (double)(1u << (fin_attempts - 1));
+    if (timeout_in_ms < FIN_MIN_TIMEOUT_MS)
+    {
+        timeout_in_ms = FIN_MIN_TIMEOUT_MS;
+    }
+    else if (timeout_in_ms > FIN_MAX_TIMEOUT_MS)
+    {
+        timeout_in_ms = FIN_MAX_TIMEOUT_MS;
+    }
     
     while(1)
     {
-        end = clock();
-        cpu_time_used_in_seconds = ((double) (end - start)) / CLOCKS_PER_SEC;
+        end = monotonic_ms();
+        time_elapsed_in_ms = end - start;
+
+        /* Check Timer for timeout */ 
+        if (time_elapsed_in_ms >= timeout_in_ms)
+        {   
+            sender_current_state = Send_Fin;
+            break;
+        }
+        int readable = socket_readable(timeout_in_ms - time_elapsed_in_ms);
+        if (readable < 0)
+        {
+            sender_current_state = sender_Done;
+            break;
+        }
+        if (readable == 0)
+        {
+            continue;
+        }
 
         /* Check Socket for response */
-        struct protocol_Header receive_buffer;
-        ssize_t bytes_received = recv(sockfd, &receive_buffer, sizeof(struct protocol_Header), MSG_DONTWAIT);
+        struct protocol_Packet receive_buffer;
+        ssize_t bytes_received = receive_packet(&receive_buffer);
         if (bytes_received > 0) 
         {
             /* If its a Fin Ack*/
-            if ((receive_buffer.management_byte & 0x1) == 0x1) {
-                sender_current_state = sender_Done;
+            if ((receive_buffer.header.management_byte & 0x1) == 0x1) {
+                fin_ack_received(&receive_buffer, bytes_received);
                 break;
             }
         } 
@@ -713,24 +2412,116 @@ void sender_action_Wait_Fin_Ack(void)
             sender_current_state = sender_Done;
             break;
         }
+    }
+    return;    
+}
 
-        /* Check Timer for timeout */ 
-        else if (cpu_time_used_in_seconds >= 2)
-        {   
-            sender_current_state = Send_Fin;
-            break;
+/**
+ * @brief Completes the transfer once the receiver has acknowledged the FIN.
+ *
+ * A FIN_ACK means the receiver has every byte of the stream, so whatever was still
+ * unacknowledged counts as delivered. The digests are compared and the close is 
+ * confirmed, which lets the receiver exit without lingering.
+ *
+ * @param fin_ack_packet The FIN_ACK packet.
+ * @param length The number of bytes received.
+ */
+void fin_ack_received(struct protocol_Packet *fin_ack_packet, ssize_t length)
+{
+    bytes_acknowledged += bytes_left_to_send;
+    file_offset_for_sending += bytes_left_to_send;
+    bytes_left_to_send = 0;
+    check_stream_digest(fin_ack_packet, length);
+
+    /* Close confirmation: a FIN_ACK from the sender's side */
+    struct protocol_Packet close_packet;
+    memset(&close_packet.header, 0, sizeof(close_packet.header));
+    close_packet.header.management_byte = 0x1;
+    if (send_packet(&close_packet, sizeof(close_packet.header)) < 0)
+    {
+        perror("Error sending close confirmation");
+    }
+    sender_current_state = sender_Done;
+}
+
+/**
+ * @brief Blocks until a packet can be read or the timeout expires.
+ *
+ * @param timeout_in_ms How long to wait at most.
+ * @return Returns 1 if a packet is waiting, 0 on timeout or interruption, -1 on error.
+ */
+int socket_readable(double timeout_in_ms)
+{
+    struct pollfd socket_poll = { .fd = sockfd, .events = POLLIN };
+    int ready = poll(&socket_poll, 1, (int)timeout_in_ms + 1);
+    if (ready < 0)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
         }
+        perror("Error waiting for data");
+        return -1;
     }
-    return;    
+
+    /* A send time nobody waits for any more would keep waking us up */
+    struct timestamp_Stamp unused;
+    if (timestamps_active && (socket_poll.revents & POLLERR) && !(socket_poll.revents & POLLIN))
+    {
+        find_send_stamp(&unused);
+        return 0;
+    }
+    if (zerocopy_active && (socket_poll.revents & POLLERR) && !(socket_poll.revents & POLLIN))
+    {
+        zerocopy_reap(&zerocopy);
+        return 0;
+    }
+    return ready > 0;
+}
+
+/**
+ * @brief Compares the digest of the stream the receiver wrote with the one that was sent.
+ *
+ * @param fin_ack_packet The FIN_ACK packet, carrying the receiver's digest.
+ * @param length The number of bytes received.
+ */
+void check_stream_digest(struct protocol_Packet *fin_ack_packet, ssize_t length)
+{
+    struct protocol_Fin fin_info;
+    if ((size_t)length < sizeof(struct protocol_Header) + sizeof(fin_info))
+    {
+        fprintf(stderr, "Receiver did not report a stream digest\n");
+        transfer_failed = 1;
+        return;
+    }
+    memcpy(&fin_info, fin_ack_packet->data, sizeof(fin_info));
+    if (fin_info.stream_digest != stream_digest)
+    {
+        fprintf(stderr, "Integrity check failed: sent crc32c %08x, receiver wrote %08x\n", 
+                stream_digest, fin_info.stream_digest);
+        transfer_failed = 1;
+        return;
+    }
+    printf("Integrity verified (crc32c %08x, %s)\n", stream_digest, crc32c_implementation());
 }
 
 /**
  * @brief Cleans up resources used by the sender.
  *
- * This function closes the socket and the file associated with the sender. It is used
- * to clean up resources before the sender shuts down.
+ * This function closes the socket and the file associated with the sender and frees any
+ * delta sync state. It is used to clean up resources before the sender shuts down.
  */
 void sender_finish(void){
+    stop_reader();
+    trace_close();
+    if (perf_requested)
+    {
+        perf_close(&perf_counters);
+    }
+    if (zerocopy_active)
+    {
+        zerocopy_close(&zerocopy);
+    }
     if (sockfd != -1) {
         close(sockfd);
     }
@@ -738,6 +2529,26 @@ void sender_finish(void){
     {
         fclose(file_pointer);
     }
+    if (manifest_requested)
+    {
+        manifest_free(&manifest_list);
+    }
+    if (direct_requested)
+    {
+        direct_reader_close(&direct_reader);
+    }
+    if (uring_active)
+    {
+        uring_close(&uring);
+    }
+    free(slab_packets);
+    free(slab_busy);
+    free(cache_memory);
+    free(local_signatures);
+    free(signature_chunk_received);
+    free(weak_hash_matched);
+    free(delta_changed_bitmap);
+    free(delta_changed_blocks);
 }
 
 /**
@@ -763,8 +2574,16 @@ void rsend(char* hostname,
         return;
     }
 
+    /* Wall clock, not clock(), so the reported goodput includes time spent waiting */
+    struct timespec transfer_start, transfer_end;
+    clock_gettime(CLOCK_MONOTONIC, &transfer_start);
+
     while (sender_current_state != sender_Done) 
     {
+        if (perf_requested)
+        {
+            perf_enter(&perf_counters, sender_phase(), packets_sent);
+        }
         //TODO: figure out how to break from while(1) loop at the end
         switch (sender_current_state) 
         {
@@ -773,6 +2592,10 @@ void rsend(char* hostname,
                 sender_action_Start_Connection();
                 break;
 
+            case Fetch_Signatures:
+                sender_action_Fetch_Signatures();
+                break;
+
 
             /* Send Data*/
             case Send_N_Packets:
@@ -796,15 +2619,113 @@ void rsend(char* hostname,
             default: 
         }    
     }
+    clock_gettime(CLOCK_MONOTONIC, &transfer_end);
+    double elapsed_in_seconds = (transfer_end.tv_sec - transfer_start.tv_sec) 
+                                + (transfer_end.tv_nsec - transfer_start.tv_nsec) / 1e9;
+    printf("Transferred %llu bytes in %.3f s, goodput %.3f Mbit/s\n", bytes_acknowledged,
+            elapsed_in_seconds, bytes_acknowledged * 8 / elapsed_in_seconds / 1e6);
+    printf("Received %llu ACKs, receiver ACKs every %u segments\n", acks_received, ack_frequency);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu_in_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+                            + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    printf("Sent %llu packets, %.0f packets/s; CPU %.3f s (%.3f s user), %.3f s per GB, peak RSS %ld KiB\n", packets_sent,
+            packets_sent / elapsed_in_seconds, cpu_in_seconds, usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+            (bytes_acknowledged > 0) ? cpu_in_seconds * 1e9 / bytes_acknowledged : 0.0, usage.ru_maxrss);
+    if (corrupted_packets > 0)
+    {
+        printf("Dropped %llu corrupted packets\n", corrupted_packets);
+    }
+    if (uring_active)
+    {
+        printf("io_uring: %llu packets sent with %llu system calls\n", uring_packets, uring.enter_calls);
+    }
+    if (zerocopy_active)
+    {
+        printf("Zero-copy: %llu datagrams in %llu sendmsg calls, %.1f per call; %llu zero-copy, %llu of them copied by the kernel\n",
+                zerocopy.datagrams, zerocopy.runs, (zerocopy.runs > 0) ? (double)zerocopy.datagrams / zerocopy.runs : 0.0,
+                zerocopy.zerocopy_runs, zerocopy.copied_runs);
+    }
+    if (reader_requested)
+    {
+        printf("Reader thread: %llu segment reads served ahead, %llu read directly\n", read_ahead_hits, read_ahead_misses);
+    }
+    if (timestamps_active)
+    {
+        printf("Kernel timestamps: %llu of %llu RTT samples, minimum RTT %.3f ms", kernel_rtt_samples, rtt_samples, min_rtt_ms);
+        if (delay_signal)
+        {
+            printf(", queueing delay %.3f ms, window growth held %llu times", queue_delay_ms, growth_held);
+        }
+        printf("\n");
+    }
+    if (ecn_active)
+    {
+        printf("ECN: %llu ACKs echoed Congestion Experienced, window halved %llu times\n", ecn_echoes, ecn_reductions);
+    }
+    if (perf_requested)
+    {
+        perf_report(&perf_counters, packets_sent, bytes_acknowledged);
+    }
+
     sender_finish();
     return;
 }
 
+/**
+ * @brief Returns the phase of the transfer the current state belongs to, for the
+ * performance counters.
+ *
+ * @return Returns Perf_Handshake, Perf_Data or Perf_Teardown.
+ */
+int sender_phase(void)
+{
+    switch (sender_current_state)
+    {
+        case Start_Connection:
+        case Fetch_Signatures:
+            return Perf_Handshake;
+        case Send_N_Packets:
+        case Wait_for_Ack:
+            return Perf_Data;
+        default:
+            return Perf_Teardown;
+    }
+}
+
 /**
  * @brief Main function for the sender application.
  *
  * Parses command-line arguments to set up the receiver's hostname, UDP port, file to send,
- * and the number of bytes to transfer. Then calls the rsend function to start the sending process.
+ * and the number of bytes to transfer, along with the options:
+ *   -f          Send adaptive XOR parity (FEC) so single losses per block need no retransmit.
+ *   -L percent  Drop this percentage of outgoing data and parity packets to simulate loss.
+ *   -a segments Ask the receiver to ACK every this many data segments (default 4).
+ *   -d          Delta sync: only send the blocks that differ from the receiver's copy (needs rrecv -d).
+ *   -D          Direct I/O: read the file with O_DIRECT through a small block pool, so a
+ *               very large file does not flood the page cache.
+ *   -U          Send each burst, and read the file ahead, through io_uring with one system
+ *               call per burst, falling back to plain system calls where io_uring is unavailable.
+ *   -z          Zero-copy transmit: send each burst in runs of up to 32 datagrams per sendmsg()
+ *               with UDP segmentation offload, and runs of 16 KB or more with MSG_ZEROCOPY so
+ *               the kernel sends from the packets themselves (see zerocopy.h; not with -U or -k).
+ *   -T          Read the file ahead in a separate thread, handed over through a lock-free ring
+ *               (see start_reader()).
+ *   -k          Kernel timestamps: time RTT samples by when the kernel sent the segment and
+ *               received its ACK (SO_TIMESTAMPING, hardware where the NIC has it), and with
+ *               rrecv -k hold the window while the one-way delay shows a queue building.
+ *   -e          ECN: send data ECN-capable and halve the window, once per round trip and without
+ *               retransmitting, when the receiver echoes a Congestion Experienced mark (see ecn.h).
+ *   -t file     Record a packet-level event trace in this file, for rtrace (see trace.h).
+ *   -p          Count cycles, instructions, cache misses, context switches and system calls
+ *               per phase of the transfer with perf_event_open, and report them at the end
+ *               per packet and per GB (see perf.h).
+ *   -m          Multi-file: the file argument is a manifest of files and directories to send in
+ *               one session, and there is no bytes_to_xfer argument (needs rrecv -m).
+ *   -g kind     Generated data: send bytes_to_xfer bytes of a "pattern" or "random" stream
+ *               made in memory, and there is no filename argument (see synthetic.h; with
+ *               rrecv -n or -v neither end touches the disk).
+ * Then calls the rsend function to start the sending process.
  *
  * @param argc Number of command-line arguments.
  * @param argv Array of command-line arguments.
@@ -816,17 +2737,78 @@ int main(int argc, char** argv) {
     unsigned long long int bytesToTransfer;
     char* hostname = NULL;
     char* filename = NULL;
+    int option;
+    int bad_option = 0;
+    ack_frequency = ACK_FREQUENCY_DEFAULT;
+    direct_reader.fd = -1;
+
+    while ((option = getopt(argc, argv, "fL:a:dDUTkmt:g:pze")) != -1) {
+        switch (option) {
+            case 'f':
+                fec_enabled = 1;
+                break;
+            case 'L':
+                simulated_loss_percent = atof(optarg);
+                break;
+            case 'a':
+                ack_frequency = (uint16_t)atoi(optarg);
+                bad_option |= (ack_frequency == 0);
+                break;
+            case 'd':
+                delta_requested = 1;
+                break;
+            case 'D':
+                direct_requested = 1;
+                break;
+            case 'U':
+                uring_requested = 1;
+                break;
+            case 'T':
+                reader_requested = 1;
+                break;
+            case 'k':
+                timestamps_requested = 1;
+                break;
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'm':
+                manifest_requested = 1;
+                break;
+            case 'g':
+                generated_kind = synthetic_kind_from_name(optarg);
+                bad_option |= (generated_kind < 0);
+                break;
+            case 'p':
+                perf_requested = 1;
+                break;
+            case 'z':
+                zerocopy_requested = 1;
+                break;
+            case 'e':
+                ecn_requested = 1;
+                break;
+            default:
+                bad_option = 1;
+        }
+    }
 
-    if (argc != 5) {
-        fprintf(stderr, "usage: %s receiver_hostname receiver_port filename_to_xfer bytes_to_xfer\n\n", argv[0]);
+    int generated = (generated_kind > Synthetic_None);
+    if (bad_option || (manifest_requested && (delta_requested || direct_requested || reader_requested)) ||
+        (generated && (manifest_requested || delta_requested || direct_requested || reader_requested)) ||
+        (delta_requested && reader_requested) || (zerocopy_requested && (uring_requested || timestamps_requested)) || (argc - optind != ((manifest_requested || generated) ? 3 : 4))) {
+        fprintf(stderr, "usage: %s [-f] [-L loss_percent] [-a ack_frequency] [-d | -T] [-D] [-U] [-k] [-z] [-e] [-t trace_file] [-p] receiver_hostname receiver_port filename_to_xfer bytes_to_xfer\n"
+                        "       %s -m [-f] [-L loss_percent] [-a ack_frequency] [-U] [-k] [-z] [-e] [-t trace_file] [-p] receiver_hostname receiver_port manifest_file\n"
+                        "       %s -g pattern|random [-f] [-L loss_percent] [-a ack_frequency] [-U] [-k] [-z] [-e] [-t trace_file] [-p] receiver_hostname receiver_port bytes_to_xfer\n\n",
+                        argv[0], argv[0], argv[0]);
         exit(1);
     }
-    hostUDPport = (unsigned short int) atoi(argv[2]);
-    hostname = argv[1];
-    filename = argv[3];
-    bytesToTransfer = atoll(argv[4]);
+    hostUDPport = (unsigned short int) atoi(argv[optind + 1]);
+    hostname = argv[optind];
+    filename = generated ? NULL : argv[optind + 2];
+    bytesToTransfer = manifest_requested ? 0 : atoll(argv[optind + (generated ? 2 : 3)]);
 
     rsend(hostname, hostUDPport, filename, bytesToTransfer);
 
-    return (EXIT_SUCCESS);
+    return transfer_failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
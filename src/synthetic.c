@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include "synthetic.h"
+
+#define SYNTHETIC_CHECK_CHUNK 2048 // Bytes generated at a time to compare against
+
+/**
+ * @brief Works out one word of the stream.
+ *
+ * @param kind Synthetic_Pattern or Synthetic_Random.
+ * @param index The word's index in the stream.
+ * @return Returns the word.
+ */
+static uint64_t synthetic_word(int kind, uint64_t index)
+{
+    if (kind == Synthetic_Pattern)
+    {
+        return index;
+    }
+    uint64_t z = index + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Parses the name of a generator, as given to rsend -g.
+ *
+ * @param name "pattern" or "random".
+ * @return Returns the synthetic_kind, or -1 if the name is not known.
+ */
+int synthetic_kind_from_name(const char *name)
+{
+    if (strcmp(name, "pattern") == 0)
+    {
+        return Synthetic_Pattern;
+    }
+    if (strcmp(name, "random") == 0)
+    {
+        return Synthetic_Random;
+    }
+    return -1;
+}
+
+/**
+ * @brief Names a generator.
+ *
+ * @param kind One of enum synthetic_kind.
+ * @return Returns its name.
+ */
+const char *synthetic_name(int kind)
+{
+    return (kind == Synthetic_Pattern) ? "pattern" : (kind == Synthetic_Random) ? "random" : "none";
+}
+
+/**
+ * @brief Generates bytes of the stream.
+ *
+ * @param kind Synthetic_Pattern or Synthetic_Random.
+ * @param buffer Where to store the bytes.
+ * @param length The number of bytes.
+ * @param offset The stream offset of the first byte.
+ */
+void synthetic_fill(int kind, char *buffer, uint32_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        uint64_t word = synthetic_word(kind, offset / SYNTHETIC_WORD_SIZE);
+        uint32_t within_word = offset % SYNTHETIC_WORD_SIZE;
+        uint32_t bytes = SYNTHETIC_WORD_SIZE - within_word;
+        bytes = (bytes < length) ? bytes : length;
+        for (uint32_t i = 0; i < bytes; i++)
+        {
+            buffer[i] = (char)(word >> (8 * (within_word + i)));
+        }
+        buffer += bytes;
+        offset += bytes;
+        length -= bytes;
+    }
+}
+
+/**
+ * @brief Compares received bytes with what the generator makes for their place in the stream.
+ *
+ * @param kind Synthetic_Pattern or Synthetic_Random.
+ * @param buffer The bytes received.
+ * @param length The number of bytes.
+ * @param offset The stream offset of the first byte.
+ * @return Returns the number of bytes that differ.
+ */
+uint32_t synthetic_check(int kind, const char *buffer, uint32_t length, uint64_t offset)
+{
+    char expected[SYNTHETIC_CHECK_CHUNK];
+    uint32_t differing = 0;
+    while (length > 0)
+    {
+        uint32_t bytes = (length < SYNTHETIC_CHECK_CHUNK) ? length : SYNTHETIC_CHECK_CHUNK;
+        synthetic_fill(kind, expected, bytes, offset);
+        if (memcmp(expected, buffer, bytes) != 0)
+        {
+            for (uint32_t i = 0; i < bytes; i++)
+            {
+                differing += (expected[i] != buffer[i]);
+            }
+        }
+        buffer += bytes;
+        offset += bytes;
+        length -= bytes;
+    }
+    return differing;
+}
@@ -0,0 +1,35 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <stdint.h>
+
+/*
+ * Generated data for memory-to-memory runs (rsend -g, rrecv -n and -v).
+ *
+ * The sender can send a stream it makes up instead of reading a file, and the receiver can
+ * throw the stream away, or check it against the same generator, instead of writing a file.
+ * Neither end then touches the disk, so a run measures the protocol and the sockets alone.
+ *
+ * Every byte is a function of its offset in the stream, so retransmissions, parity repairs
+ * and resumed transfers all see the same bytes. The stream is made of 8-byte little-endian
+ * words:
+ *   Synthetic_Pattern  each word holds its own index, so a misplaced segment shows where it
+ *                      came from; the cheapest to make.
+ *   Synthetic_Random   each word is splitmix64 of its index; incompressible.
+ */
+
+#define SYNTHETIC_WORD_SIZE 8
+
+enum synthetic_kind
+{
+    Synthetic_None,
+    Synthetic_Pattern,
+    Synthetic_Random
+};
+
+int synthetic_kind_from_name(const char *name);
+const char *synthetic_name(int kind);
+void synthetic_fill(int kind, char *buffer, uint32_t length, uint64_t offset);
+uint32_t synthetic_check(int kind, const char *buffer, uint32_t length, uint64_t offset);
+
+#endif
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include "timestamp.h"
+
+#define TIMESTAMP_CONTROL_SIZE 256
+
+static void read_stamp(struct msghdr *message, struct timestamp_Stamp *stamp);
+
+/**
+ * @brief Turns on kernel timestamps for a socket.
+ *
+ * Every datagram received is timestamped. Sent datagrams are only timestamped when asked
+ * for with timestamp_send(), and their times come back numbered, without the datagram.
+ *
+ * @param fd The socket.
+ * @return Returns 0 on success, -1 if the kernel does not support it.
+ */
+int timestamp_enable(int fd)
+{
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+                SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+    {
+        perror("Error enabling kernel timestamps");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Receives a datagram, without waiting, along with the time it arrived.
+ *
+ * @param fd The socket, with timestamps enabled.
+ * @param buffer Where to store the datagram.
+ * @param length The size of the buffer.
+ * @param stamp Where to store its arrival times, zeroed where the kernel gave none.
+ * @return Returns the result of recvmsg().
+ */
+ssize_t timestamp_recv(int fd, void *buffer, size_t length, struct timestamp_Stamp *stamp)
+{
+    char control[TIMESTAMP_CONTROL_SIZE];
+    struct iovec data = {buffer, length};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t bytes_received = recvmsg(fd, &message, MSG_DONTWAIT);
+    memset(stamp, 0, sizeof(*stamp));
+    if (bytes_received >= 0)
+    {
+        read_stamp(&message, stamp);
+    }
+    return bytes_received;
+}
+
+/**
+ * @brief Sends a datagram and asks for the time it leaves.
+ *
+ * The software time is taken as the datagram enters the device's queue, so time spent
+ * queued on this host counts as part of the path, and the hardware time as it leaves the
+ * NIC. They are reported separately. The kernel numbers the datagrams it timestamps from 0,
+ * in the order they are sent; see timestamp_read_tx().
+ *
+ * @param fd The connected socket, with timestamps enabled.
+ * @param buffer The datagram.
+ * @param length Its length.
+ * @return Returns the result of sendmsg().
+ */
+ssize_t timestamp_send(int fd, const void *buffer, size_t length)
+{
+    union
+    {
+        char bytes[CMSG_SPACE(sizeof(uint32_t))];
+        struct cmsghdr align;
+    } control;
+    struct iovec data = {(void *)buffer, length};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    memset(&control, 0, sizeof(control));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control.bytes;
+    message.msg_controllen = sizeof(control.bytes);
+
+    struct cmsghdr *request = CMSG_FIRSTHDR(&message);
+    request->cmsg_level = SOL_SOCKET;
+    request->cmsg_type = SO_TIMESTAMPING;
+    request->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+    uint32_t flags = SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_TX_HARDWARE;
+    memcpy(CMSG_DATA(request), &flags, sizeof(flags));
+    return sendmsg(fd, &message, 0);
+}
+
+/**
+ * @brief Takes the next send time off the socket's error queue, without waiting.
+ *
+ * A datagram timestamped both ways has its software and hardware times reported one at a
+ * time, each with the other one zero.
+ *
+ * @param fd The socket, with timestamps enabled.
+ * @param id Where to store which timestamped datagram it is, counting from 0.
+ * @param stamp Where to store the time it left.
+ * @return Returns 1 if there was one, 0 if the queue is empty.
+ */
+int timestamp_read_tx(int fd, uint32_t *id, struct timestamp_Stamp *stamp)
+{
+    char control[TIMESTAMP_CONTROL_SIZE];
+    while (1)
+    {
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            return 0;
+        }
+
+        int found = 0;
+        for (struct cmsghdr *entry = CMSG_FIRSTHDR(&message); entry != NULL; entry = CMSG_NXTHDR(&message, entry))
+        {
+            if ((entry->cmsg_level == SOL_IP) && (entry->cmsg_type == IP_RECVERR))
+            {
+                struct sock_extended_err error;
+                memcpy(&error, CMSG_DATA(entry), sizeof(error));
+                if (error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING)
+                {
+                    *id = error.ee_data;
+                    found = 1;
+                }
+            }
+        }
+        // Anything else on the queue (an ICMP error) is of no use here.
+        if (found)
+        {
+            read_stamp(&message, stamp);
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Works out the time between two stamps, on a clock both of them have.
+ *
+ * @param from The earlier packet's times.
+ * @param to The later packet's times.
+ * @param interval_ns Where to store to - from, in nanoseconds.
+ * @return Returns 1 on success, 0 if they have no clock in common.
+ */
+int timestamp_interval(const struct timestamp_Stamp *from, const struct timestamp_Stamp *to, int64_t *interval_ns)
+{
+    if ((from->hardware_ns != 0) && (to->hardware_ns != 0))
+    {
+        *interval_ns = (int64_t)(to->hardware_ns - from->hardware_ns);
+        return 1;
+    }
+    if ((from->software_ns != 0) && (to->software_ns != 0))
+    {
+        *interval_ns = (int64_t)(to->software_ns - from->software_ns);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Picks the kernel's times out of a message's control data.
+ *
+ * The kernel reports the software time first and the raw hardware time third.
+ */
+static void read_stamp(struct msghdr *message, struct timestamp_Stamp *stamp)
+{
+    memset(stamp, 0, sizeof(*stamp));
+    for (struct cmsghdr *entry = CMSG_FIRSTHDR(message); entry != NULL; entry = CMSG_NXTHDR(message, entry))
+    {
+        if ((entry->cmsg_level == SOL_SOCKET) && (entry->cmsg_type == SCM_TIMESTAMPING))
+        {
+            struct scm_timestamping times;
+            memcpy(&times, CMSG_DATA(entry), sizeof(times));
+            stamp->software_ns = (uint64_t)times.ts[0].tv_sec * 1000000000ULL + times.ts[0].tv_nsec;
+            stamp->hardware_ns = (uint64_t)times.ts[2].tv_sec * 1000000000ULL + times.ts[2].tv_nsec;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Kernel packet timestamps (rsend -k, rrecv -k), through SO_TIMESTAMPING.
+ *
+ * Every datagram received carries the time the kernel took it off the wire, and a datagram
+ * sent with timestamp_send() has the time it left reported back on the socket's error queue.
+ * The kernel takes these in the network stack (software; for sends, as the datagram is
+ * queued to the device) and, where the NIC timestamps packets and has been told to, at the
+ * NIC (hardware). Times measured between them leave out how long the process took to get
+ * to the packet, which a time read in user space includes.
+ *
+ * Software times are on CLOCK_REALTIME and hardware times on the NIC's clock, so only times
+ * from the same source are compared; hardware is used when both ends have it. Hardware
+ * timestamps are only there once the interface has been switched on for them (for instance
+ * by hwstamp_ctl or ptp4l), which needs privileges, so this does not try to.
+ */
+
+/* A packet's times, 0 where there is none; nanoseconds */
+struct timestamp_Stamp
+{
+    uint64_t software_ns;
+    uint64_t hardware_ns;
+};
+
+int timestamp_enable(int fd);
+ssize_t timestamp_recv(int fd, void *buffer, size_t length, struct timestamp_Stamp *stamp);
+ssize_t timestamp_send(int fd, const void *buffer, size_t length);
+int timestamp_read_tx(int fd, uint32_t *id, struct timestamp_Stamp *stamp);
+int timestamp_interval(const struct timestamp_Stamp *from, const struct timestamp_Stamp *to, int64_t *interval_ns);
+
+#endif
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.h"
+
+#define TRACE_FLUSH_INTERVAL_US 1000 // How long the flusher sleeps when there is nothing to write
+
+_Thread_local struct trace_Thread *trace_current;
+
+static int trace_fd = -1;
+static pthread_t flusher_thread;
+static struct ring_Mpsc full_chunks;
+static struct trace_Thread *trace_threads[TRACE_MAX_THREADS];
+static _Atomic unsigned int trace_thread_count;
+static _Atomic uint8_t flusher_stopping;
+static uint8_t write_failed;
+
+static void *flusher_main(void *argument);
+
+/**
+ * @brief Creates the trace file, starts the flusher thread and starts tracing the calling thread.
+ *
+ * @param path The trace file, replaced if it exists.
+ * @param role Which side is tracing, stored in the header.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int trace_open(const char *path, const char *role)
+{
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (trace_fd < 0)
+    {
+        perror("Error opening trace file");
+        return -1;
+    }
+
+    struct trace_Header header;
+    struct timespec now, wall;
+    memset(&header, 0, sizeof(header));
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(struct trace_Record);
+    header.start_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    header.wall_start_ns = (uint64_t)wall.tv_sec * 1000000000ULL + wall.tv_nsec;
+    strncpy(header.role, role, sizeof(header.role) - 1);
+    if ((write(trace_fd, &header, sizeof(header)) != sizeof(header)) ||
+        (ring_mpsc_init(&full_chunks, TRACE_MAX_THREADS * TRACE_CHUNKS) < 0))
+    {
+        perror("Error writing trace file");
+        close(trace_fd);
+        trace_fd = -1;
+        return -1;
+    }
+
+    atomic_store(&flusher_stopping, 0);
+    if (pthread_create(&flusher_thread, NULL, flusher_main, NULL) != 0)
+    {
+        fprintf(stderr, "Error starting trace flusher\n");
+        ring_mpsc_destroy(&full_chunks);
+        close(trace_fd);
+        trace_fd = -1;
+        return -1;
+    }
+    return trace_thread_start();
+}
+
+/**
+ * @brief Stops tracing, writes out everything recorded and closes the trace file.
+ *
+ * Every other thread that was tracing must have called trace_thread_stop() already.
+ */
+void trace_close(void)
+{
+    if (trace_fd < 0)
+    {
+        return;
+    }
+    trace_thread_stop();
+    atomic_store_explicit(&flusher_stopping, 1, memory_order_release);
+    pthread_join(flusher_thread, NULL);
+
+    unsigned long long int dropped = 0;
+    unsigned int threads = atomic_load(&trace_thread_count);
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        dropped += trace_threads[i]->dropped;
+        pool_destroy(&trace_threads[i]->chunks);
+        free(trace_threads[i]);
+        trace_threads[i] = NULL;
+    }
+    atomic_store(&trace_thread_count, 0);
+    if (dropped > 0)
+    {
+        fprintf(stderr, "Trace dropped %llu events, the file could not keep up\n", dropped);
+    }
+    if (write_failed || (close(trace_fd) < 0))
+    {
+        perror("Error writing trace file");
+    }
+    trace_fd = -1;
+    ring_mpsc_destroy(&full_chunks);
+}
+
+/**
+ * @brief Starts tracing the calling thread, with a pool of chunks of its own.
+ *
+ * @return Returns 0 on success, -1 if there is no trace open or no room for another thread.
+ */
+int trace_thread_start(void)
+{
+    if ((trace_fd < 0) || (trace_current != NULL))
+    {
+        return (trace_fd < 0) ? -1 : 0;
+    }
+    unsigned int index = atomic_fetch_add(&trace_thread_count, 1);
+    if (index >= TRACE_MAX_THREADS)
+    {
+        atomic_fetch_sub(&trace_thread_count, 1);
+        fprintf(stderr, "Too many threads to trace\n");
+        return -1;
+    }
+
+    struct trace_Thread *thread = calloc(1, sizeof(*thread));
+    if ((thread == NULL) || (pool_init(&thread->chunks, TRACE_CHUNK_RECORDS * sizeof(struct trace_Record), TRACE_CHUNKS) < 0))
+    {
+        free(thread);
+        atomic_fetch_sub(&trace_thread_count, 1);
+        return -1;
+    }
+    // Touch the chunks now, so the first events recorded do not take page faults.
+    memset(thread->chunks.memory, 0, (size_t)thread->chunks.buffer_size * thread->chunks.count);
+    pool_cache_init(&thread->cache, &thread->chunks);
+    thread->index = index;
+    trace_threads[index] = thread;
+    trace_current = thread;
+    return 0;
+}
+
+/**
+ * @brief Stops tracing the calling thread and hands its last, partly filled chunk to the flusher.
+ */
+void trace_thread_stop(void)
+{
+    struct trace_Thread *thread = trace_current;
+    if (thread == NULL)
+    {
+        return;
+    }
+    if (thread->chunk != NULL)
+    {
+        trace_submit_chunk(thread);
+    }
+    pool_cache_flush(&thread->cache);
+    trace_current = NULL;
+}
+
+/**
+ * @brief Takes a free chunk for a thread to record in.
+ *
+ * @param thread The calling thread's trace buffer.
+ * @return Returns 1 if there was one, 0 if the flusher still holds them all.
+ */
+int trace_next_chunk(struct trace_Thread *thread)
+{
+    thread->chunk = (struct trace_Record *)pool_alloc(&thread->cache);
+    thread->used = 0;
+    return thread->chunk != NULL;
+}
+
+/**
+ * @brief Hands a thread's chunk to the flusher.
+ *
+ * The ring holds every chunk of every thread, so the push cannot fail.
+ *
+ * @param thread The calling thread's trace buffer.
+ */
+void trace_submit_chunk(struct trace_Thread *thread)
+{
+    struct ring_Descriptor chunk = {(char *)thread->chunk, 0, thread->used * sizeof(struct trace_Record), thread->index};
+    ring_mpsc_push(&full_chunks, &chunk);
+    thread->chunk = NULL;
+    thread->used = 0;
+}
+
+/**
+ * @brief The flusher thread: writes full chunks to the trace file and gives them back.
+ *
+ * Checks for chunks every TRACE_FLUSH_INTERVAL_US; TRACE_CHUNKS chunks per thread are
+ * enough to cover that at any packet rate the transfer can reach.
+ *
+ * @param argument Unused.
+ * @return Returns NULL.
+ */
+static void *flusher_main(void *argument)
+{
+    (void)argument;
+    struct ring_Descriptor chunk;
+    while (1)
+    {
+        // Checked before the pop, so a stop with an empty ring means everything was written.
+        uint8_t stopping = atomic_load_explicit(&flusher_stopping, memory_order_acquire);
+        if (!ring_mpsc_pop(&full_chunks, &chunk))
+        {
+            if (stopping)
+            {
+                break;
+            }
+            struct timespec pause = {0, TRACE_FLUSH_INTERVAL_US * 1000};
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        if (write(trace_fd, chunk.data, chunk.length) != (ssize_t)chunk.length)
+        {
+            write_failed = 1;
+        }
+
+        struct pool_Cache returned;
+        pool_cache_init(&returned, &trace_threads[chunk.flags]->chunks);
+        pool_free(&returned, chunk.data);
+        pool_cache_flush(&returned);
+    }
+    return NULL;
+}
@@ -0,0 +1,125 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+#include "pool.h"
+
+/*
+ * Packet-level event trace (rsend -t, rrecv -t), read back with rtrace.
+ *
+ * Each recording thread fills chunks of fixed-size binary records, taken from a small pool
+ * of its own. A full chunk goes down a ring to a flusher thread, which writes it to the trace
+ * file and gives it back. Recording an event costs a clock read and a few stores. When the
+ * flusher falls behind and a thread has no free chunk, events are dropped and counted
+ * instead of stalling the transfer.
+ *
+ * A trace file is a trace_Header followed by records. The flusher writes whole chunks, so
+ * records of different threads may be out of order; rtrace sorts them by time.
+ */
+
+#define TRACE_MAGIC "RTRC"
+#define TRACE_VERSION 1
+#define TRACE_CHUNK_RECORDS 2048 // 48 KiB
+#define TRACE_CHUNKS 8 // Per thread
+#define TRACE_MAX_THREADS 8
+
+/* What each event records in seq, length and value */
+enum trace_event
+{
+    Trace_Send = 1,     // seq, length, congestion window
+    Trace_Retransmit,   // seq, length, congestion window
+    Trace_Parity,       // first seq of the block, block length, segments in the block
+    Trace_Drop,         // seq, length, 0: dropped on purpose by rsend -L
+    Trace_Ack,          // ack, bytes newly acknowledged, congestion window
+    Trace_Dup_Ack,      // ack, duplicates so far, congestion window
+    Trace_Timeout,      // front of the window, 0, RTO after the backoff in microseconds
+    Trace_Cwnd,         // front of the window, previous congestion window, new congestion window
+    Trace_Rto,          // seq the RTT was sampled on, RTT sample in microseconds, RTO in microseconds
+    Trace_Receive,      // seq, length, 1 if it was a duplicate
+    Trace_Ack_Sent,     // ack, 0, advertised window
+    Trace_Repair,       // seq rebuilt from parity, length, 0
+    Trace_Corrupt,      // seq as received, length, 0
+    Trace_Delay,        // seq of the timed segment, queueing delay sample in microseconds, smoothed queueing delay in microseconds
+    Trace_Event_Count
+};
+
+struct trace_Header
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+    uint64_t start_ns; // Monotonic clock when the trace was opened
+    uint64_t wall_start_ns; // Wall clock at the same moment
+    char role[16]; // "rsend" or "rrecv"
+};
+
+struct trace_Record
+{
+    uint64_t time_ns; // Monotonic clock
+    uint32_t seq;
+    uint32_t length;
+    uint32_t value;
+    uint8_t event;
+    uint8_t thread;
+    uint16_t reserved;
+};
+
+struct trace_Thread
+{
+    struct pool_Pool chunks;
+    struct pool_Cache cache;
+    struct trace_Record *chunk;
+    uint32_t used;
+    uint8_t index;
+    unsigned long long int dropped;
+};
+
+/* The calling thread's trace buffer, NULL when it is not tracing */
+extern _Thread_local struct trace_Thread *trace_current;
+
+int trace_open(const char *path, const char *role);
+void trace_close(void);
+int trace_thread_start(void);
+void trace_thread_stop(void);
+int trace_next_chunk(struct trace_Thread *thread);
+void trace_submit_chunk(struct trace_Thread *thread);
+
+/**
+ * @brief Records an event in the calling thread's trace buffer, if it is tracing.
+ *
+ * @param event One of enum trace_event.
+ * @param seq The sequence or ACK number.
+ * @param length A length or count, see enum trace_event.
+ * @param value A window or time, see enum trace_event.
+ */
+static inline void trace_event(uint8_t event, uint32_t seq, uint32_t length, uint32_t value)
+{
+    struct trace_Thread *thread = trace_current;
+    if (thread == NULL)
+    {
+        return;
+    }
+    if ((thread->chunk == NULL) && !trace_next_chunk(thread))
+    {
+        thread->dropped++;
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct trace_Record *record = &thread->chunk[thread->used++];
+    record->time_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record->seq = seq;
+    record->length = length;
+    record->value = value;
+    record->event = event;
+    record->thread = thread->index;
+    record->reserved = 0;
+    if (thread->used == TRACE_CHUNK_RECORDS)
+    {
+        trace_submit_chunk(thread);
+    }
+}
+
+#endif
@@ -0,0 +1,439 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static unsigned uring_flush_sq(struct uring_Ring *ring);
+static void uring_flush_overflow(struct uring_Ring *ring);
+
+/**
+ * @brief Sets up an io_uring instance and maps its rings.
+ *
+ * @param ring The ring to set up.
+ * @param entries The size of the submission ring, a power of two.
+ * @return Returns 0 on success, -1 if io_uring is not available.
+ */
+int uring_init(struct uring_Ring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+    {
+        perror("Error setting up io_uring");
+        return -1;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->sq_ring_size = (ring->cq_ring_size > ring->sq_ring_size) ? ring->cq_ring_size : ring->sq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        ring->sq_ring = NULL;
+        perror("Error mapping io_uring");
+        return -1;
+    }
+    ring->cq_ring = ring->sq_ring;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+        {
+            ring->cq_ring = NULL;
+            perror("Error mapping io_uring");
+            return -1;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        perror("Error mapping io_uring");
+        return -1;
+    }
+
+    char *sq = ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->sq_flags = (unsigned *)(sq + params.sq_off.flags);
+
+    char *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * @brief Tears down the ring, which also cancels any request still armed.
+ *
+ * @param ring The ring.
+ */
+void uring_close(struct uring_Ring *ring)
+{
+    if (ring->fd > 0)
+    {
+        close(ring->fd);
+    }
+    if (ring->sqes != NULL)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if ((ring->cq_ring != NULL) && (ring->cq_ring != ring->sq_ring))
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->buf_ring != NULL)
+    {
+        munmap(ring->buf_ring, ring->buf_ring_size);
+    }
+    free(ring->buf_memory);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/**
+ * @brief Registers files, so requests can refer to them by index without a lookup each time.
+ *
+ * @param ring The ring.
+ * @param fds The file descriptors; request file index i refers to fds[i].
+ * @param count The number of file descriptors.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int uring_register_files(struct uring_Ring *ring, const int *fds, unsigned count)
+{
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds, count) < 0)
+    {
+        perror("Error registering files with io_uring");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Registers buffers, so fixed-buffer requests skip pinning their pages each time.
+ *
+ * @param ring The ring.
+ * @param buffers The buffers; request buffer index i refers to buffers[i].
+ * @param count The number of buffers.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int uring_register_buffers(struct uring_Ring *ring, const struct iovec *buffers, unsigned count)
+{
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, buffers, count) < 0)
+    {
+        perror("Error registering buffers with io_uring");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sets up a provided buffer ring that receives pick their buffers from.
+ *
+ * A receive takes the next buffer in the ring and reports its id in the completion;
+ * the buffer goes back with uring_recycle_buffer() once its contents are consumed.
+ *
+ * @param ring The ring.
+ * @param group The buffer group id that receives select from.
+ * @param count The number of buffers, a power of two.
+ * @param size The size of each buffer.
+ * @return Returns 0 on success, -1 on failure.
+ */
+int uring_setup_buffers(struct uring_Ring *ring, uint16_t group, unsigned count, unsigned size)
+{
+    ring->buf_ring_size = count * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED)
+    {
+        ring->buf_ring = NULL;
+        perror("Error allocating io_uring buffer ring");
+        return -1;
+    }
+    if (posix_memalign((void **)&ring->buf_memory, 4096, (size_t)count * size) != 0)
+    {
+        ring->buf_memory = NULL;
+        fprintf(stderr, "Error allocating io_uring buffers\n");
+        return -1;
+    }
+
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = (uintptr_t)ring->buf_ring;
+    registration.ring_entries = count;
+    registration.bgid = group;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+    {
+        perror("Error registering io_uring buffer ring");
+        return -1;
+    }
+
+    ring->buf_count = count;
+    ring->buf_size = size;
+    ring->buf_group = group;
+    ring->buf_tail = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        uring_recycle_buffer(ring, i);
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the memory of a provided buffer.
+ *
+ * @param ring The ring.
+ * @param buffer_id The buffer id from a completion.
+ * @return Returns the start of the buffer.
+ */
+char *uring_buffer(struct uring_Ring *ring, unsigned buffer_id)
+{
+    return ring->buf_memory + (size_t)buffer_id * ring->buf_size;
+}
+
+/**
+ * @brief Hands a provided buffer back to the kernel for another receive.
+ *
+ * @param ring The ring.
+ * @param buffer_id The buffer id.
+ */
+void uring_recycle_buffer(struct uring_Ring *ring, unsigned buffer_id)
+{
+    struct io_uring_buf *buffer = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_count - 1)];
+    buffer->addr = (uintptr_t)uring_buffer(ring, buffer_id);
+    buffer->len = ring->buf_size;
+    buffer->bid = buffer_id;
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Takes the next free submission entry, cleared.
+ *
+ * @param ring The ring.
+ * @return Returns the entry, or NULL if the submission ring is full.
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring_Ring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries)
+    {
+        return NULL;
+    }
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * @brief Submits the queued requests, and waits for completions if asked to.
+ *
+ * @param ring The ring.
+ * @param wait_count The number of completions to wait for; 0 does not wait.
+ * @return Returns the number of requests submitted, or -1 on failure.
+ */
+int uring_submit(struct uring_Ring *ring, unsigned wait_count)
+{
+    unsigned to_submit = uring_flush_sq(ring);
+    if ((to_submit == 0) && (wait_count == 0))
+    {
+        return 0;
+    }
+
+    unsigned flags = (wait_count > 0) ? IORING_ENTER_GETEVENTS : 0;
+    int submitted;
+    do
+    {
+        ring->enter_calls++;
+        submitted = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_count, flags, NULL, 0);
+    } while ((submitted < 0) && (errno == EINTR));
+
+    if (submitted < 0)
+    {
+        perror("Error submitting to io_uring");
+    }
+    return submitted;
+}
+
+/**
+ * @brief Waits for a completion, like poll() on the ring.
+ *
+ * Queued requests are submitted on the way.
+ *
+ * @param ring The ring.
+ * @param timeout_in_ms How long to wait at most.
+ * @return Returns 1 if a completion is waiting, 0 on timeout or interruption, -1 on error.
+ */
+int uring_wait(struct uring_Ring *ring, double timeout_in_ms)
+{
+    unsigned to_submit = uring_flush_sq(ring);
+    if ((to_submit == 0) && (uring_peek_cqe(ring) != NULL))
+    {
+        return 1;
+    }
+
+    struct __kernel_timespec timeout;
+    timeout.tv_sec = (long long)(timeout_in_ms / 1000);
+    timeout.tv_nsec = (long long)((timeout_in_ms - timeout.tv_sec * 1000.0) * 1e6);
+    struct io_uring_getevents_arg arguments;
+    memset(&arguments, 0, sizeof(arguments));
+    arguments.ts = (uintptr_t)&timeout;
+
+    ring->enter_calls++;
+    if ((syscall(__NR_io_uring_enter, ring->fd, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                 &arguments, sizeof(arguments)) < 0) && (errno != ETIME) && (errno != EINTR))
+    {
+        perror("Error waiting on io_uring");
+        return -1;
+    }
+    return uring_peek_cqe(ring) != NULL;
+}
+
+/**
+ * @brief Looks at the oldest completion, without a system call.
+ *
+ * @param ring The ring.
+ * @return Returns the completion, or NULL if there is none yet.
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring_Ring *ring)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        uring_flush_overflow(ring);
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            return NULL;
+        }
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+/**
+ * @brief Releases the completion returned by uring_peek_cqe().
+ *
+ * @param ring The ring.
+ */
+void uring_cqe_seen(struct uring_Ring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Prepares a multishot receive that stays armed and posts one completion per datagram.
+ *
+ * Each datagram lands in a buffer from the provided buffer ring of the group. The completion
+ * has IORING_CQE_F_MORE set while the receive remains armed.
+ *
+ * @param sqe The submission entry.
+ * @param file_index The registered socket.
+ * @param group The provided buffer group.
+ * @param user_data Passed back in the completions.
+ */
+void uring_prep_multishot_recv(struct io_uring_sqe *sqe, int file_index, uint16_t group, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = file_index;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = group;
+    sqe->user_data = user_data;
+}
+
+/**
+ * @brief Prepares a read into part of a registered buffer.
+ *
+ * @param sqe The submission entry.
+ * @param file_index The registered file.
+ * @param buffer Where to read to, inside the registered buffer.
+ * @param length The number of bytes.
+ * @param offset The file offset.
+ * @param buffer_index The registered buffer.
+ * @param user_data Passed back in the completion.
+ */
+void uring_prep_read_fixed(struct io_uring_sqe *sqe, int file_index, char *buffer, uint32_t length,
+                           uint64_t offset, uint16_t buffer_index, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = file_index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uintptr_t)buffer;
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->buf_index = buffer_index;
+    sqe->user_data = user_data;
+}
+
+/**
+ * @brief Prepares a send on a registered, connected socket.
+ *
+ * @param sqe The submission entry.
+ * @param file_index The registered socket.
+ * @param buffer The bytes to send; they must stay put until the completion.
+ * @param length The number of bytes.
+ * @param user_data Passed back in the completion.
+ */
+void uring_prep_send(struct io_uring_sqe *sqe, int file_index, const void *buffer, uint32_t length, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = file_index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uintptr_t)buffer;
+    sqe->len = length;
+    sqe->user_data = user_data;
+}
+
+/**
+ * @brief Publishes the entries taken since the last submission to the kernel.
+ *
+ * @return Returns the number of entries to submit.
+ */
+static unsigned uring_flush_sq(struct uring_Ring *ring)
+{
+    unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    return to_submit;
+}
+
+/**
+ * @brief Has the kernel move completions that did not fit in the ring back into it.
+ */
+static void uring_flush_overflow(struct uring_Ring *ring)
+{
+    if (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)
+    {
+        ring->enter_calls++;
+        syscall(__NR_io_uring_enter, ring->fd, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+}
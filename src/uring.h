@@ -0,0 +1,87 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+ * io_uring backend (rsend -U, rrecv -U), on the raw system calls so there is no library
+ * to depend on.
+ *
+ * Requests are queued in the submission ring and handed to the kernel together with one
+ * io_uring_enter() call; completions are read straight from the shared completion ring,
+ * without a system call. The receiver keeps one multishot recv armed on its socket, which
+ * fills buffers from a provided buffer ring as datagrams arrive. The sender reads each burst
+ * into a registered buffer with fixed-buffer reads, then sends the whole burst in one
+ * submission. Where io_uring is not available (old kernel, disabled by sysctl, seccomp),
+ * uring_init() fails and the caller keeps to poll() and plain system calls.
+ */
+
+#define URING_CQ_ENTRIES 4096
+
+struct uring_Ring
+{
+    int fd;
+
+    /* Submission ring, shared with the kernel */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+
+    /* IORING_SQ_CQ_OVERFLOW here says completions are waiting in the kernel's overflow list */
+    unsigned *sq_flags;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+
+    /* Entries handed out by uring_get_sqe() and not yet submitted end at this */
+    unsigned sqe_tail;
+
+    /* Completion ring, shared with the kernel */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    /* Provided buffer ring, see uring_setup_buffers() */
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *buf_memory;
+    unsigned buf_count;
+    unsigned buf_size;
+    uint16_t buf_tail;
+    uint16_t buf_group;
+
+    /* io_uring_enter() calls made, to report how many system calls the transfer needed */
+    unsigned long long int enter_calls;
+};
+
+int uring_init(struct uring_Ring *ring, unsigned entries);
+void uring_close(struct uring_Ring *ring);
+
+int uring_register_files(struct uring_Ring *ring, const int *fds, unsigned count);
+int uring_register_buffers(struct uring_Ring *ring, const struct iovec *buffers, unsigned count);
+int uring_setup_buffers(struct uring_Ring *ring, uint16_t group, unsigned count, unsigned size);
+char *uring_buffer(struct uring_Ring *ring, unsigned buffer_id);
+void uring_recycle_buffer(struct uring_Ring *ring, unsigned buffer_id);
+
+struct io_uring_sqe *uring_get_sqe(struct uring_Ring *ring);
+int uring_submit(struct uring_Ring *ring, unsigned wait_count);
+int uring_wait(struct uring_Ring *ring, double timeout_in_ms);
+struct io_uring_cqe *uring_peek_cqe(struct uring_Ring *ring);
+void uring_cqe_seen(struct uring_Ring *ring);
+
+void uring_prep_multishot_recv(struct io_uring_sqe *sqe, int file_index, uint16_t group, uint64_t user_data);
+void uring_prep_read_fixed(struct io_uring_sqe *sqe, int file_index, char *buffer, uint32_t length,
+                           uint64_t offset, uint16_t buffer_index, uint64_t user_data);
+void uring_prep_send(struct io_uring_sqe *sqe, int file_index, const void *buffer, uint32_t length, uint64_t user_data);
+
+#endif
@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include "zerocopy.h"
+
+/* Older C libraries do not have these yet */
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+#define ZEROCOPY_WAIT_MS 10       // Longest wait for the kernel before looking again
+#define ZEROCOPY_DRAIN_ROUNDS 100 // Waits for the last completions when closing
+
+/**
+ * @brief Turns on zero-copy sends and segmentation offload for a socket, and allocates the slab.
+ *
+ * @param zerocopy The sender.
+ * @param fd The connected UDP socket.
+ * @return Returns 0 on success, -1 if the kernel cannot do either (nothing is left allocated).
+ */
+int zerocopy_init(struct zerocopy_Sender *zerocopy, int fd)
+{
+    memset(zerocopy, 0, sizeof(*zerocopy));
+    zerocopy->fd = fd;
+    int on = 1;
+    int segment_size = 0; // Set per send; this only checks that UDP_SEGMENT is there
+    if ((setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) ||
+        (setsockopt(fd, IPPROTO_UDP, UDP_SEGMENT, &segment_size, sizeof(segment_size)) < 0))
+    {
+        return -1;
+    }
+
+    zerocopy->packets = malloc(ZEROCOPY_SLAB_PACKETS * sizeof(struct protocol_Packet));
+    zerocopy->busy = calloc(ZEROCOPY_SLAB_PACKETS, sizeof(uint8_t));
+    zerocopy->send_ids = calloc(ZEROCOPY_SLAB_PACKETS, sizeof(uint32_t));
+    if ((zerocopy->packets == NULL) || (zerocopy->busy == NULL) || (zerocopy->send_ids == NULL))
+    {
+        perror("Failed to malloc for the zero-copy slab");
+        zerocopy_close(zerocopy);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Takes the next packet of the slab to build a packet of the burst in.
+ *
+ * The slab is used round robin. A packet the kernel is still sending from is waited for.
+ *
+ * @param zerocopy The sender.
+ * @return Returns the packet.
+ */
+struct protocol_Packet *zerocopy_packet(struct zerocopy_Sender *zerocopy)
+{
+    unsigned int slot = zerocopy->next++ % ZEROCOPY_SLAB_PACKETS;
+    while (zerocopy->busy[slot])
+    {
+        struct pollfd socket_poll = { .fd = zerocopy->fd, .events = 0 }; // POLLERR is always reported
+        if ((zerocopy_reap(zerocopy) == 0) && (poll(&socket_poll, 1, ZEROCOPY_WAIT_MS) < 0) && (errno != EINTR))
+        {
+            perror("Error waiting for zero-copy completions");
+            break;
+        }
+    }
+    return &zerocopy->packets[slot];
+}
+
+/**
+ * @brief Pads a full segment to a whole protocol_Packet, the size the kernel cuts runs into.
+ *
+ * Done before the packet is checksummed, so the checksum covers the (zeroed) padding.
+ *
+ * @param packet The packet.
+ * @param length The number of bytes of the packet to send, header included.
+ * @return Returns the number of bytes to send now.
+ */
+size_t zerocopy_pad(struct protocol_Packet *packet, size_t length)
+{
+    if (length != sizeof(struct protocol_Header) + PROTOCOL_DATA_SIZE)
+    {
+        return length;
+    }
+    memset((char *)packet + length, 0, sizeof(*packet) - length);
+    return sizeof(*packet);
+}
+
+/**
+ * @brief Adds a packet of the slab to the run being gathered, sending the run first if the
+ * packet cannot join it.
+ *
+ * A packet joins the run if it follows the run's last packet in the slab, that packet was a
+ * whole one (only the last datagram of a segmented send may be shorter), and the run is not full.
+ *
+ * @param zerocopy The sender.
+ * @param packet The checksummed packet, from zerocopy_packet().
+ * @param length The number of bytes of the packet to send, header included.
+ * @return Returns the length, or -1 if sending the run before it failed.
+ */
+ssize_t zerocopy_queue(struct zerocopy_Sender *zerocopy, struct protocol_Packet *packet, size_t length)
+{
+    unsigned int slot = packet - zerocopy->packets;
+    if ((zerocopy->run_packets > 0) &&
+        ((slot != zerocopy->run_first + zerocopy->run_packets) || (zerocopy->run_last_length != sizeof(struct protocol_Packet)) ||
+         (zerocopy->run_packets == ZEROCOPY_RUN_PACKETS)) &&
+        (zerocopy_flush(zerocopy) < 0))
+    {
+        return -1;
+    }
+    if (zerocopy->run_packets == 0)
+    {
+        zerocopy->run_first = slot;
+    }
+    zerocopy->run_packets++;
+    zerocopy->run_bytes += length;
+    zerocopy->run_last_length = length;
+    return length;
+}
+
+/**
+ * @brief Sends the run gathered so far with one sendmsg().
+ *
+ * The kernel cuts it into datagrams of one full packet each. A run of ZEROCOPY_MIN_BYTES or
+ * more goes with MSG_ZEROCOPY, and its packets stay busy until the kernel is done with them.
+ * A full send buffer, or running out of the socket memory zero-copy sends are accounted to,
+ * is waited out.
+ *
+ * @param zerocopy The sender.
+ * @return Returns 0 on success, -1 with errno set if sending failed.
+ */
+int zerocopy_flush(struct zerocopy_Sender *zerocopy)
+{
+    if (zerocopy->run_packets == 0)
+    {
+        return 0;
+    }
+    struct iovec run = { .iov_base = &zerocopy->packets[zerocopy->run_first], .iov_len = zerocopy->run_bytes };
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &run;
+    message.msg_iovlen = 1;
+    if (zerocopy->run_packets > 1)
+    {
+        uint16_t segment_size = sizeof(struct protocol_Packet);
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr *entry = CMSG_FIRSTHDR(&message);
+        entry->cmsg_level = IPPROTO_UDP;
+        entry->cmsg_type = UDP_SEGMENT;
+        entry->cmsg_len = CMSG_LEN(sizeof(segment_size));
+        memcpy(CMSG_DATA(entry), &segment_size, sizeof(segment_size));
+    }
+
+    uint8_t zero_copy = (zerocopy->run_bytes >= ZEROCOPY_MIN_BYTES);
+    while (sendmsg(zerocopy->fd, &message, zero_copy ? MSG_ZEROCOPY : 0) < 0)
+    {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS) && (errno != EINTR))
+        {
+            return -1;
+        }
+        struct pollfd socket_poll = { .fd = zerocopy->fd, .events = POLLOUT };
+        if ((zerocopy_reap(zerocopy) == 0) && (poll(&socket_poll, 1, ZEROCOPY_WAIT_MS) < 0) && (errno != EINTR))
+        {
+            return -1;
+        }
+    }
+
+    if (zero_copy)
+    {
+        for (unsigned int i = 0; i < zerocopy->run_packets; i++)
+        {
+            zerocopy->busy[zerocopy->run_first + i] = 1;
+            zerocopy->send_ids[zerocopy->run_first + i] = zerocopy->next_send_id;
+        }
+        zerocopy->next_send_id++;
+        zerocopy->zerocopy_runs++;
+    }
+    zerocopy->runs++;
+    zerocopy->datagrams += zerocopy->run_packets;
+    zerocopy->run_packets = 0;
+    zerocopy->run_bytes = 0;
+    return 0;
+}
+
+/**
+ * @brief Frees the packets of the zero-copy sends the kernel reports done on the error queue.
+ *
+ * Each report covers a range of sends, numbered in the order they were made.
+ *
+ * @param zerocopy The sender.
+ * @return Returns the number of reports read.
+ */
+int zerocopy_reap(struct zerocopy_Sender *zerocopy)
+{
+    int reports = 0;
+    while (1)
+    {
+        union
+        {
+            char buffer[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        if (recvmsg(zerocopy->fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            return reports;
+        }
+
+        for (struct cmsghdr *entry = CMSG_FIRSTHDR(&message); entry != NULL; entry = CMSG_NXTHDR(&message, entry))
+        {
+            struct sock_extended_err error;
+            if (!(((entry->cmsg_level == SOL_IP) && (entry->cmsg_type == IP_RECVERR)) ||
+                  ((entry->cmsg_level == SOL_IPV6) && (entry->cmsg_type == IPV6_RECVERR))))
+            {
+                continue;
+            }
+            memcpy(&error, CMSG_DATA(entry), sizeof(error));
+            if ((error.ee_errno != 0) || (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+            {
+                continue; // Anything else on the queue (an ICMP error) is of no use here
+            }
+            uint32_t first = error.ee_info;
+            uint32_t sends = error.ee_data - first + 1;
+            for (unsigned int slot = 0; slot < ZEROCOPY_SLAB_PACKETS; slot++)
+            {
+                if (zerocopy->busy[slot] && ((uint32_t)(zerocopy->send_ids[slot] - first) < sends))
+                {
+                    zerocopy->busy[slot] = 0;
+                }
+            }
+            if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                zerocopy->copied_runs += sends;
+            }
+            reports++;
+        }
+    }
+}
+
+/**
+ * @brief Waits a little for the kernel to finish with the slab, then frees it.
+ *
+ * Called before the socket is closed, since the completions arrive on it.
+ */
+void zerocopy_close(struct zerocopy_Sender *zerocopy)
+{
+    for (unsigned int round = 0; (zerocopy->busy != NULL) && (round < ZEROCOPY_DRAIN_ROUNDS); round++)
+    {
+        zerocopy_reap(zerocopy);
+        if (memchr(zerocopy->busy, 1, ZEROCOPY_SLAB_PACKETS) == NULL)
+        {
+            break;
+        }
+        struct pollfd socket_poll = { .fd = zerocopy->fd, .events = 0 };
+        poll(&socket_poll, 1, ZEROCOPY_WAIT_MS);
+    }
+    free(zerocopy->packets);
+    free(zerocopy->busy);
+    free(zerocopy->send_ids);
+    zerocopy->packets = NULL;
+    zerocopy->busy = NULL;
+    zerocopy->send_ids = NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "our_protocol.h"
+
+/*
+ * Zero-copy transmit (rsend -z), through MSG_ZEROCOPY and UDP segmentation offload.
+ *
+ * A single datagram is too small for MSG_ZEROCOPY to pay: pinning its pages and sending back
+ * a completion cost about as much as copying 1.5 KB. So the packets of a burst are built one
+ * after another in a slab, and each run of consecutive packets goes out with one sendmsg()
+ * that asks the kernel (UDP_SEGMENT) to cut it into datagrams of one whole protocol_Packet
+ * each; the last may be shorter. A full segment is padded to a whole packet (zerocopy_pad())
+ * so the run is one contiguous stretch of memory, which the kernel pins as a few pages rather
+ * than a piece per packet. A run of at least ZEROCOPY_MIN_BYTES is sent with MSG_ZEROCOPY, so
+ * the kernel sends from the slab itself instead of copying it; a shorter one is copied as usual.
+ *
+ * The kernel owns a zero-copy run's packets until it reports on the socket's error queue that
+ * it is done with them, so they stay busy until then and zerocopy_packet() hands out only
+ * free ones, waiting for the kernel if it must. The report also says whether the kernel had
+ * to copy after all (loopback, a device that cannot gather the pages), which is counted.
+ */
+
+#define ZEROCOPY_SLAB_PACKETS 1024 // Packets queued or in flight; a few windows of the largest size
+#define ZEROCOPY_RUN_PACKETS 32    // Datagrams per sendmsg(), below the kernel's limit of 64
+#define ZEROCOPY_MIN_BYTES (16 * 1024) // Shorter runs are copied: pinning costs more than it saves
+
+struct zerocopy_Sender
+{
+    int fd;
+    struct protocol_Packet *packets;   // The slab
+    uint8_t *busy;                     // Packets the kernel has not finished with
+    uint32_t *send_ids;                // The zero-copy send each busy packet belongs to
+    unsigned long long int next;       // Next packet of the slab to hand out, round robin
+    unsigned int run_first;            // The run being gathered
+    unsigned int run_packets;
+    size_t run_bytes;
+    size_t run_last_length;
+    uint32_t next_send_id;             // The kernel numbers zero-copy sends from 0
+    unsigned long long int runs;       // Statistics
+    unsigned long long int zerocopy_runs;
+    unsigned long long int copied_runs; // Zero-copy sends the kernel copied anyway
+    unsigned long long int datagrams;
+};
+
+int zerocopy_init(struct zerocopy_Sender *zerocopy, int fd);
+struct protocol_Packet *zerocopy_packet(struct zerocopy_Sender *zerocopy);
+ssize_t zerocopy_queue(struct zerocopy_Sender *zerocopy, struct protocol_Packet *packet, size_t length);
+int zerocopy_flush(struct zerocopy_Sender *zerocopy);
+int zerocopy_reap(struct zerocopy_Sender *zerocopy);
+void zerocopy_close(struct zerocopy_Sender *zerocopy);
+size_t zerocopy_pad(struct protocol_Packet *packet, size_t length);
+
+/**
+ * @brief Returns whether a packet is one of the slab's, so it can join a run.
+ */
+static inline int zerocopy_holds(const struct zerocopy_Sender *zerocopy, const struct protocol_Packet *packet)
+{
+    return (zerocopy->packets != NULL) && (packet >= zerocopy->packets) && (packet < zerocopy->packets + ZEROCOPY_SLAB_PACKETS);
+}
+
+#endif